@@ -2,11 +2,15 @@
 #include "bplustree.h"
 
 #include <assert.h>
+#include <errno.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
+#include "../includes/log.h"
+#include "../includes/metrics.h"
+
 // #include "bplustree_utils.h"
 
 // #define Test_BinarySearch
@@ -206,7 +210,7 @@ static inline uint64_t BinarySearchNode(BPlusTreeNode *curNode, uint64_t key) {
 /* Search a leaf node which contains the specified key */
 static BPlusTreeNode *LeafNodeSearch(uint64_t key) {
     if (Root == NULL) {
-        printf("Root of B+tree is null.\n");
+        LOG_ERROR("Root of B+tree is null.");
         exit(EXIT_FAILURE);
     }
     BPlusTreeNode *curNode = Root;
@@ -269,6 +273,7 @@ static void _BPlusTree_Insert(BPlusTreeNode *node, uint64_t key, uint64_t value)
         if (rNode == NULL) {
             return;
         }
+        Metrics_Add(Metrics_NodeSplits, 1);
 
         mid  = node->keyNum >> 1;  // node->keyNum = MAX_RECORDS_PER_NODE + 1 right now
         temp = node->keys[mid];
@@ -292,7 +297,7 @@ static void _BPlusTree_Insert(BPlusTreeNode *node, uint64_t key, uint64_t value)
         if (node->isRoot) {  // node is root
             Root = New_BPlusTreeNode(RootNode);
             if (Root == NULL) {
-                perror("Failed to allocate memory for Root.\n");
+                LOG_ERROR("Failed to allocate memory for Root: %s", strerror(errno));
                 exit(EXIT_FAILURE);
             }
             Root->childs[0] = node;
@@ -301,6 +306,7 @@ static void _BPlusTree_Insert(BPlusTreeNode *node, uint64_t key, uint64_t value)
             node->isRoot    = false;
             parent          = Root;
             TreeHeight++;
+            Metrics_SetGauge(Metrics_BPlusTreeHeight, TreeHeight);
         }
         // step2.3: update the right keys and childs of parent
         for (i = parent->keyNum; i > 0 && parent->keys[i - 1] > temp; i--) {
@@ -328,25 +334,29 @@ extern void BPlusTree_Insert(uint64_t key, uint64_t value) {
     // #ifdef DEBUG_TEST
     //     printf("enter BPlusTree_Insert()\n");
     // #endif
+    uint64_t start = Metrics_Now();
     if (Root == NULL) {
         BPlusTree_Init();
     }
     BPlusTreeNode *node = LeafNodeSearch(key);
     _BPlusTree_Insert(node, key, value);
+    Metrics_Record(Metrics_BPlusTreeInsert, Metrics_Now() - start);
 }
 
 /*=======================================================================*/
 
 extern uint64_t BPlusTree_Select(uint64_t key) {
-    uint64_t i          = -1;
+    uint64_t start      = Metrics_Now();
+    uint64_t i          = -1, value = -1;
     BPlusTreeNode *leaf = LeafNodeSearch(key);
     i                   = BinarySearchKey(leaf, key);
     if (leaf->keys[i] == key)
-        return leaf->values[i];
+        value = leaf->values[i];
     else {
-        printf("Key = %ld doesn't exist in the B+Tree.\n", key);
-        return -1;
+        LOG_DEBUG("Key = %ld doesn't exist in the B+Tree.", key);
     }
+    Metrics_Record(Metrics_BPlusTreeSelect, Metrics_Now() - start);
+    return value;
 }
 
 extern uint64_t *BPlusTree_Select_Range(uint64_t key, uint64_t range, uint64_t *length) {
@@ -354,7 +364,7 @@ extern uint64_t *BPlusTree_Select_Range(uint64_t key, uint64_t range, uint64_t *
     BPlusTreeNode *leaf = LeafNodeSearch(key);
     i                   = BinarySearchKey(leaf, key);
     if (leaf->keys[i] != key) {
-        printf("Key = %ld doesn't exist in the B+Tree.\n", key);
+        LOG_DEBUG("Key = %ld doesn't exist in the B+Tree.", key);
     }
     uint64_t *array = calloc(range, sizeof(uint64_t));
     if (array == NULL) {
@@ -377,6 +387,7 @@ extern uint64_t *BPlusTree_Select_Range(uint64_t key, uint64_t range, uint64_t *
 }
 
 extern uint64_t BPlusTree_Update(uint64_t key, uint64_t newValue) {
+    uint64_t start = Metrics_Now();
     uint64_t oldValue, index = -1;
     BPlusTreeNode *leaf = LeafNodeSearch(key);
     index               = BinarySearchKey(leaf, key);
@@ -384,6 +395,7 @@ extern uint64_t BPlusTree_Update(uint64_t key, uint64_t newValue) {
         oldValue            = leaf->values[index];
         leaf->values[index] = newValue;
     }
+    Metrics_Record(Metrics_BPlusTreeUpdate, Metrics_Now() - start);
     return oldValue;
 }
 
@@ -394,9 +406,7 @@ extern uint64_t BPlusTree_Update(uint64_t key, uint64_t newValue) {
  * 
  */
 static void Node_Right_Roate(BPlusTreeNode *node, uint64_t index) {
-#ifdef DEBUG_TEST
-    printf("Enter [Node_Left_Roate]\n");
-#endif
+    LOG_DEBUG("Enter [Node_Left_Roate]");
     BPlusTreeNode *lSibling = node->prev, *parent = node->parent;
     uint64_t temp;
     temp = node->keys[0];
@@ -421,9 +431,7 @@ static void Node_Right_Roate(BPlusTreeNode *node, uint64_t index) {
  * borrow the first key-value from the right sibling of node
  */
 static void Node_Left_Roate(BPlusTreeNode *node) {
-#ifdef DEBUG_TEST
-    printf("Enter [Node_Right_Roate]\n");
-#endif
+    LOG_DEBUG("Enter [Node_Right_Roate]");
     BPlusTreeNode *rSibling = node->next, *parent = node->parent;
     node->keys[node->keyNum] = rSibling->keys[0];
     node->keys[node->keyNum] = rSibling->values[0];
@@ -442,9 +450,7 @@ static void Node_Left_Roate(BPlusTreeNode *node) {
  * 
  */
 static void Merge_Left_Silbing(BPlusTreeNode *node, uint64_t key) {
-#ifdef DEBUG_TEST
-    printf("Enter [Merge_Left_Silbing]\n");
-#endif
+    LOG_DEBUG("Enter [Merge_Left_Silbing]");
     BPlusTreeNode *lSilbing = node->prev, *nNext = node->next;
     uint64_t temp = node->keys[0];
     // 将node的key-value全部复制到lSilbing
@@ -468,9 +474,7 @@ static void Merge_Left_Silbing(BPlusTreeNode *node, uint64_t key) {
 }
 
 static void Merge_Right_Silbing(BPlusTreeNode *node, uint64_t key) {
-#ifdef DEBUG_TEST
-    printf("Enter [Merge_Right_Silbing]\n");
-#endif
+    LOG_DEBUG("Enter [Merge_Right_Silbing]");
     BPlusTreeNode *rSilbing = node->next, *parent = node->parent;
     uint64_t temp = rSilbing->keys[0];
     // 为了减少复制次数，将rSilbing的key-value全部复制到node中
@@ -498,9 +502,7 @@ static void Merge_Right_Silbing(BPlusTreeNode *node, uint64_t key) {
 // _leaf_node_left_rotate
 // args: parent , 0
 static void _Leaf_Node_Left_Rotate(BPlusTreeNode *parent, uint64_t index) {
-#ifdef DEBUG_TEST
-    printf("Enter _Leaf_Node_Left_Rotate()\n");
-#endif
+    LOG_DEBUG("Enter _Leaf_Node_Left_Rotate()");
     BPlusTreeNode *node = parent->childs[index], *rSilbling = parent->childs[index + 1];
     node->keys[node->keyNum]   = rSilbling->keys[0];
     node->values[node->keyNum] = rSilbling->values[0];
@@ -514,9 +516,7 @@ static void _Leaf_Node_Left_Rotate(BPlusTreeNode *parent, uint64_t index) {
 // _internal_node_left_rotate
 // args: parent , 0
 static void _Internal_Node_Left_Rotate(BPlusTreeNode *parent, uint64_t index) {
-#ifdef DEBUG_TEST
-    printf("Enter _Internal_Node_Left_Rotate()\n");
-#endif
+    LOG_DEBUG("Enter _Internal_Node_Left_Rotate()");
     BPlusTreeNode *node = parent->childs[index], *rSilbling = parent->childs[index + 1];
     node->keys[node->keyNum]       = parent->keys[index];
     node->childs[node->keyNum + 1] = rSilbling->childs[0];
@@ -530,9 +530,7 @@ static void _Internal_Node_Left_Rotate(BPlusTreeNode *parent, uint64_t index) {
 // _leaf_node_right_rotate
 // args: parent , index - 1
 static void _Leaf_Node_Right_Rotate(BPlusTreeNode *parent, uint64_t index) {
-#ifdef DEBUG_TEST
-    printf("Enter _Leaf_Node_Right_Rotate()\n");
-#endif
+    LOG_DEBUG("Enter _Leaf_Node_Right_Rotate()");
     // BUG:这里必须是parent->childs[index+1]，理由暂不明确
     // 初步判定是链表链接出错
     BPlusTreeNode *node = parent->childs[index], *rSilbling = parent->childs[index + 1];
@@ -548,9 +546,7 @@ static void _Leaf_Node_Right_Rotate(BPlusTreeNode *parent, uint64_t index) {
 // _internal_node_right_rotate
 // args: parent , index - 1
 static void _Internal_Node_Right_Rotate(BPlusTreeNode *parent, uint64_t index) {
-#ifdef DEBUG_TEST
-    printf("Enter _Internal_Node_Right_Rotate()\n");
-#endif
+    LOG_DEBUG("Enter _Internal_Node_Right_Rotate()");
     BPlusTreeNode *node = parent->childs[index], *rSilbling = parent->childs[index + 1];
     memmove(rSilbling->keys + 1, rSilbling->keys, sizeof(uint64_t) * rSilbling->keyNum);
     memmove(rSilbling->childs + 1, rSilbling->childs, sizeof(BPlusTreeNode *) * (rSilbling->keyNum + 1));
@@ -566,9 +562,8 @@ static void _Internal_Node_Right_Rotate(BPlusTreeNode *parent, uint64_t index) {
 // args: parent , 0
 // args: parent , index - 1
 static void _Node_Merge_Silbing(BPlusTreeNode *parent, uint64_t index) {
-#ifdef DEBUG_TEST
-    printf("Enter _Node_Merge_Silbing()\n");
-#endif
+    LOG_DEBUG("Enter _Node_Merge_Silbing()");
+    Metrics_Add(Metrics_NodeMerges, 1);
     BPlusTreeNode *node = parent->childs[index], *rSilbling = parent->childs[index + 1];
 
     if (node->isLeaf) {
@@ -617,7 +612,7 @@ static void _BPlusTree_Delete(BPlusTreeNode *node, uint64_t key, uint64_t index)
         for (idxAtParent = 0; idxAtParent <= parent->keyNum && curNode != parent->childs[idxAtParent]; idxAtParent++)
             ;
         if (idxAtParent > parent->keyNum) {
-            printf("Error: Don't find node(%p) in parent(%p)\n", curNode, parent);
+            LOG_ERROR("Don't find node(%p) in parent(%p)", curNode, parent);
             return;
         }
 
@@ -663,11 +658,13 @@ static void _BPlusTree_Delete(BPlusTreeNode *node, uint64_t key, uint64_t index)
                 FreeNode(&curNode);
             }
             TreeHeight--;
+            Metrics_SetGauge(Metrics_BPlusTreeHeight, TreeHeight);
         }
     }
 }
 
 extern uint64_t BPlusTree_Delete(uint64_t key) {
+    uint64_t start = Metrics_Now();
     uint64_t value, index = -1;
     BPlusTreeNode *leaf = LeafNodeSearch(key);
     index               = BinarySearchKey(leaf, key);
@@ -675,6 +672,7 @@ extern uint64_t BPlusTree_Delete(uint64_t key) {
         value = leaf->values[index];
     }
     _BPlusTree_Delete(leaf, key, index);
+    Metrics_Record(Metrics_BPlusTreeDelete, Metrics_Now() - start);
 
     return value;
 }
@@ -686,14 +684,15 @@ extern void BPlusTree_Init() {
         Root->isLeaf = true;
         Root->values = calloc(ORDER, sizeof(uint64_t));
         TreeHeight   = 1;
+        Metrics_SetGauge(Metrics_BPlusTreeHeight, TreeHeight);
         if (Root->values == NULL) {
             FreeNode(&Root);
-            printf("Fail to init the B+Tree.\n");
+            LOG_ERROR("Fail to init the B+Tree.");
         } else {
-            printf("B+Tree has been initialized success.\n");
+            LOG_INFO("B+Tree has been initialized success.");
         }
     } else {
-        printf("Fail to init the B+Tree.\n");
+        LOG_ERROR("Fail to init the B+Tree.");
     }
 }
 
@@ -701,7 +700,7 @@ extern void BPlusTree_Destroy() {
     if (Root != NULL) {
         Destroy_Tree(Root);
     }
-    printf("\nB+Tree has been destroyed.\n");
+    LOG_INFO("B+Tree has been destroyed.");
 }
 
 extern void BPlusTree_PrintTree() {
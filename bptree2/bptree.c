@@ -2,6 +2,7 @@
 
 #include <alloca.h>
 #include <assert.h>
+#include <errno.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
@@ -11,11 +12,15 @@
 
 #include "../includes/file.h"
 #include "../includes/global.h"
+#include "../includes/log.h"
+#include "../includes/metrics.h"
+
+#define BULK_LOAD_BATCH 64  // 批量加载时一次分配和写入的最多页面数
 
 /*========================================*/
 const uint64_t DEFAULT_PAGE_SIZE       = 4096;
-const uint64_t BPTREE_NODE_HEADER_SIZE = TYPE_SIZE + PARENT_SIZE + NEXT_SIZE + PREV_SIZE + NUM_SIZE;
-const uint64_t DEFAULT_ORDER           = DEFAULT_PAGE_SIZE / BPTREE_NODE_HEADER_SIZE;
+const uint64_t BPTREE_NODE_HEADER_SIZE = OFFSET_OF_ATTRIBUTE(BpTreeNode, childs);
+const uint64_t DEFAULT_ORDER           = (DEFAULT_PAGE_SIZE - BPTREE_NODE_HEADER_SIZE) / sizeof(Index);
 const char *DEFAULT_INDEX_FILE         = "tinydb_index";
 const char *DEFAULT_DATA_FILE          = "tinydb_data";
 const char *DEFAULT_CONFIG_FILE        = "tinydb_config";
@@ -26,11 +31,21 @@ static void Destroy_BpTreeNode(BpTreeNode *node);
 static void DeserializeNode(BpTreeNode *node, void *buffer);
 static void SerializeNode(BpTreeNode *node, void *buffer);
 
-static uint64_t BpTreeNodeSearch(BpTreeNode *node, key_t key);
+static int64_t BpTreeNodeSearch(BpTreeNode *node, key_t key);
+static void BpTreeReadNode(BpTree *tree, off_t offset, void *buffer);
+static void BpTreeWriteNode(BpTree *tree, off_t offset, BpTreeNode *node, void *buffer);
+static off_t BpTreeAllocNodes(BpTree *tree, uint64_t n);
+static BpTreeNode *BpTreeGetNode(BpTree *tree, off_t offset);
+static void BpTreeCachePut(BpTree *tree, off_t offset, BpTreeNode *node);
+static NodeCacheEntry *BpTreeCacheLookup(BpTree *tree, off_t offset);
+static void BpTreeCacheTrim(BpTree *tree);
+static bool BpTreeReadSuperblock(BpTree *tree, Superblock *super);
+static void BpTreeWriteSuperblock(BpTree *tree);
 
+/* 结点在内存中可以多容纳一项，插入后超过order时再分裂 */
 static BpTreeNode *New_BpTreeNode(BpTreeConfig *config) {
     uint64_t order   = config->order;
-    BpTreeNode *node = (BpTreeNode *)calloc(1, sizeof(BpTreeNode) + order * sizeof(Index));
+    BpTreeNode *node = (BpTreeNode *)calloc(1, sizeof(BpTreeNode) + (order + 1) * sizeof(Index));
     assert(node != NULL);
     return node;
 }
@@ -41,29 +56,48 @@ static void Destroy_BpTreeNode(BpTreeNode *node) {
 /* 将buffer反序列化为node */
 static inline void DeserializeNode(BpTreeNode *node, void *buffer) {
     memcpy(node, buffer, BPTREE_NODE_HEADER_SIZE);
-    memcpy(node->childs, buffer + BPTREE_NODE_HEADER_SIZE, node->num * sizeof(Index));
+    memcpy(node->childs, (char *)buffer + BPTREE_NODE_HEADER_SIZE, node->num * sizeof(Index));
 }
 
 /* 将node序列化为buffer */
 static inline void SerializeNode(BpTreeNode *node, void *buffer) {
     memcpy(buffer, node, BPTREE_NODE_HEADER_SIZE);
-    memcpy(buffer + BPTREE_NODE_HEADER_SIZE, node->childs, node->num * sizeof(Index));
+    memcpy((char *)buffer + BPTREE_NODE_HEADER_SIZE, node->childs, node->num * sizeof(Index));
 }
 
-static inline uint64_t BpTreeNodeSearch(BpTreeNode *node, key_t key) {
-    uint64_t i;
-    for (i = node->num - 1; i >= 0 && node->childs[i]->key > key; i--)
-        ;
-    return i;
+/* 最后一个键不大于key的项，所有键都大于key时返回-1 */
+static inline int64_t BpTreeNodeSearch(BpTreeNode *node, key_t key) {
+    int64_t low = 0, high = (int64_t)node->num - 1;
+    while (low <= high) {
+        int64_t mid = (low + high) / 2;
+        if (node->childs[mid].key <= key) {
+            low = mid + 1;
+        } else {
+            high = mid - 1;
+        }
+    }
+    return high;
+}
+
+/* 在pos处插入一项，pos之后的项后移 */
+static inline void BpTreeNodeInsertAt(BpTreeNode *node, uint64_t pos, key_t key, val_t value) {
+    memmove(&node->childs[pos + 1], &node->childs[pos], (node->num - pos) * sizeof(Index));
+    node->childs[pos].key   = key;
+    node->childs[pos].value = value;
+    node->num++;
 }
 
 /*========================================*/
 
+/**
+ * pageSize要能放下两份超级块，并且是8的倍数，空闲页面的位图按uint64_t读写整页。
+ * 不合法的参数使用默认值。
+ */
 BpTreeConfig *New_BpTreeConfig(uint64_t pageSize,
                                const char *indexFile,
                                const char *configFile,
                                const char *dataFile) {
-    if (pageSize < 0 || pageSize % 2 != 0) {
+    if (pageSize < 2 * SUPERBLOCK_SLOT_SIZE || pageSize % sizeof(uint64_t) != 0) {
         pageSize = DEFAULT_PAGE_SIZE;
     }
     if (indexFile == NULL || strlen(indexFile) <= 0) {
@@ -78,9 +112,12 @@ BpTreeConfig *New_BpTreeConfig(uint64_t pageSize,
     BpTreeConfig *config = (BpTreeConfig *)calloc(1, sizeof(BpTreeConfig));
     assert(config != NULL);
     config->pageSize      = pageSize;
-    config->order         = pageSize / BPTREE_NODE_HEADER_SIZE;
+    config->order         = (pageSize - BPTREE_NODE_HEADER_SIZE) / sizeof(Index);
     config->indexFileSize = DEFAULT_INDEX_FILE_INIT_SIZE;
     config->dataFileSize  = DEFUALT_DATA_FILE_INIT_SIZE;
+    config->ioDepth       = 0;
+    config->cacheLeaves   = DEFAULT_CACHE_LEAVES;
+    config->fillFactor    = DEFAULT_FILL_FACTOR;
     memcpy(config->configFile, configFile, strlen(configFile) + 1);
     memcpy(config->indexFile, indexFile, strlen(indexFile) + 1);
     memcpy(config->dataFile, dataFile, strlen(dataFile) + 1);
@@ -105,113 +142,584 @@ BpTree *New_BpTree(BpTreeConfig *config) {
     CreateFileIfNotExists(cfg->indexFile, cfg->indexFileSize);
     CreateFileIfNotExists(cfg->dataFile, cfg->dataFileSize);
 
-    // step2: TODO: 将默认参数写入configFile
-
-    // step3: 打开indexFile和dataFile
+    // step2: 打开indexFile和dataFile
     tree->idxFd = OpenFile(cfg->indexFile);
     tree->datFd = OpenFile(cfg->dataFile);
 
-    tree->height                = 0;
-    tree->indexNum              = 0;
-    tree->leafNum               = 0;
-    tree->root                  = -1;
-    tree->slot                  = 1;
-    tree->config                = cfg;
+    // step3: 读取超级块，新建的索引文件没有有效的超级块，树为空
+    tree->height   = 0;
+    tree->indexNum = 0;
+    tree->leafNum  = 0;
+    tree->root     = -1;
+    tree->config   = cfg;
+    uint64_t hint  = 0;
+    Superblock super;
+    if (BpTreeReadSuperblock(tree, &super)) {
+        if (super.pageSize != cfg->pageSize) {
+            LOG_WARN("%s was created with page size %llu, ignoring %llu", cfg->indexFile,
+                     (unsigned long long)super.pageSize, (unsigned long long)cfg->pageSize);
+            cfg->pageSize = super.pageSize;
+        }
+        cfg->order     = super.order;
+        tree->height   = super.height;
+        tree->indexNum = super.indexNum;
+        tree->leafNum  = super.leafNum;
+        tree->root     = super.root;
+        tree->superSeq = super.seq;
+        hint           = super.freeHint;
+    }
+
     tree->config->dataFileSize  = FileLength(tree->datFd);
     tree->config->indexFileSize = FileLength(tree->idxFd);
+    tree->aio                   = cfg->ioDepth > 0 ? New_Aio(cfg->ioDepth) : NULL;
+
+    NodeCache *cache = (NodeCache *)calloc(1, sizeof(NodeCache));
+    assert(cache != NULL);
+    cache->capacity  = cfg->cacheLeaves;
+    cache->bucketNum = 64;
+    cache->buckets   = (NodeCacheEntry **)calloc(cache->bucketNum, sizeof(NodeCacheEntry *));
+    assert(cache->buckets != NULL);
+    tree->cache = cache;
+
+    // step4: 空闲页面位图保存在索引文件中，打开时不读入
+    tree->freeMap       = New_FreeMap(tree->idxFd, cfg->pageSize, cfg->indexFileSize / cfg->pageSize);
+    tree->freeMap->hint = hint;
+    Metrics_SetGauge(Metrics_BpTreeHeight, tree->height);
+
+    return tree;
+}
 
-    // step4.1: 初始化freeList
-    FreeBlock *fblock = (FreeBlock *)calloc(1, sizeof(FreeBlock));
-    assert(fblock != NULL);
-    fblock->max_num    = cfg->indexFileSize / cfg->pageSize;
-    fblock->num        = fblock->max_num;  // current num
-    fblock->head       = New_FreeBlockNode();
-    fblock->tail       = New_FreeBlockNode();
-    fblock->head->next = fblock->tail;
-    // flist->tail->next = NULL;
-
-    // step4.2: 将indexFile文件内所有页面都加入到freeList中
-    // uint64_t pageNum  = cfg->indexFileSize / cfg->pageSize;
-    FreeBlockNode *ptr = fblock->head;
+/**
+ * 关闭索引文件和数据文件，释放树和它的config
+ */
+void Destroy_BpTree(BpTree *tree) {
+    assert(tree != NULL);
+    Destroy_FreeMap(tree->freeMap);
+    CloseFile(tree->idxFd);
+    CloseFile(tree->datFd);
+    Destroy_Aio(tree->aio);
     uint64_t i;
-    for (i = 0; i < fblock->max_num;) {
-        ptr->curOffset  = i++;
-        ptr->nextOffset = i;
-        if (ptr->next == NULL) {
-            ptr->next = New_FreeBlockNode();
+    for (i = 0; i < tree->cache->bucketNum; i++) {
+        NodeCacheEntry *entry = tree->cache->buckets[i], *hnext;
+        for (; entry != NULL; entry = hnext) {
+            hnext = entry->hnext;
+            Destroy_BpTreeNode(entry->node);
+            free(entry);
         }
-        ptr = ptr->next;
     }
-    tree->freeBlock = fblock;
-
-    return tree;
+    free(tree->cache->buckets);
+    free(tree->cache);
+    free(tree->config);
+    free(tree);
 }
 
 /**
- * 查找返回key在db文件中的偏移量
+ * 查找返回key在db文件中的偏移量，key不存在时返回-1
  * 
  * 从root开始，将结点从磁盘中读取到内存中，反序列化为内存结构，再查找键值对
  */
 val_t BpTree_Select(BpTree *tree, key_t key) {
-    val_t ret;
-    BpTreeNode *root  = New_BpTreeNode(tree->config);
+    uint64_t start = Metrics_Now();
+    val_t ret      = -1;
+    off_t offset   = tree->root;
+    while (offset != -1) {
+        BpTreeNode *node = BpTreeGetNode(tree, offset);
+        // 如果是叶子结点，则代表记录的偏移量；如果是内部结点，代表子结点的偏移量
+        int64_t idx = BpTreeNodeSearch(node, key);
+        if (node->type == Leaf) {
+            if (idx >= 0 && node->childs[idx].key == key) {
+                ret = node->childs[idx].value;
+            }
+            break;
+        }
+        offset = node->childs[idx < 0 ? 0 : idx].value;
+    }
+    BpTreeCacheTrim(tree);
+    Metrics_Record(Metrics_BpTreeSelect, Metrics_Now() - start);
+    return ret;
+}
+
+/**
+ * 把node的后一半移到新分配的结点right中，同时写回node和right，right加入结点缓存，
+ * 原来的后继结点只改写prev字段。
+ * @return offset of right
+ */
+static off_t BpTreeSplitNode(BpTree *tree, off_t offset, BpTreeNode *node, BpTreeNode *right) {
+    uint64_t pageSize = tree->config->pageSize;
+    off_t rightOffset = BpTreeAllocNodes(tree, 1);
+    uint64_t mid      = node->num / 2;
+    right->type       = node->type;
+    right->parent     = -1;
+    right->prev       = offset;
+    right->next       = node->next;
+    right->num        = node->num - mid;
+    memcpy(right->childs, &node->childs[mid], right->num * sizeof(Index));
+    node->num  = mid;
+    node->next = rightOffset;
+    if (right->next != -1) {
+        NodeCacheEntry *entry = BpTreeCacheLookup(tree, right->next);
+        if (entry != NULL) {
+            entry->node->prev = rightOffset;
+        }
+        S_PWRITE(tree->idxFd, &rightOffset, sizeof(off_t), right->next + OFFSET_OF_ATTRIBUTE(BpTreeNode, prev));
+        Metrics_Add(Metrics_NodesWritten, 1);
+        Metrics_Add(Metrics_BytesWritten, sizeof(off_t));
+    }
+
+    off_t offsets[2] = {offset, rightOffset};
+    void *buffers[2] = {alloca(pageSize), alloca(pageSize)};
+    memset(buffers[0], 0, pageSize);
+    memset(buffers[1], 0, pageSize);
+    SerializeNode(node, buffers[0]);
+    SerializeNode(right, buffers[1]);
+    if (BpTree_WriteNodes(tree, offsets, buffers, 2) != 0) {
+        EXIT_ERROR("Failed to write split nodes.\n");
+    }
+    BpTreeCachePut(tree, rightOffset, right);
+    if (node->type == Leaf) {
+        tree->leafNum++;
+    } else {
+        tree->indexNum++;
+    }
+    Metrics_Add(Metrics_NodeSplits, 1);
+    return rightOffset;
+}
+
+/**
+ * 将key插入到B+树中，value是记录在db文件中的偏移量。
+ * 
+ * 从root向下查找叶子结点，记录经过的结点和子结点的下标，
+ * 叶子结点放不下时分裂，分隔键插入父结点，父结点放不下时继续向上分裂，根结点分裂时树高加一。
+ * 只写回修改过的结点，发生分裂时再更新超级块。
+ * @return value, or -1 if key already exists
+ */
+val_t BpTree_Insert(BpTree *tree, key_t key, val_t value) {
+    uint64_t start    = Metrics_Now();
     uint64_t pageSize = tree->config->pageSize;
+    uint64_t order    = tree->config->order;
     void *buffer      = alloca(pageSize);
-    int idxFd         = tree->idxFd;
-    // if (lseek(idxFd, 0L, SEEK_SET) == -1) {
-    //     perror("Seek Error.\n");
-    // }
-    // if (read(idxFd, buffer, pageSize) != pageSize) {
-    //     perror("Fail to read a page.\n");
-    // }
-    S_SEEK(idxFd, 0L, SEEK_SET);
-    S_READ(idxFd, buffer, pageSize);
-    DeserializeNode(root, buffer);
+    val_t ret         = value;
+    BpTreeNode *node;
+
+    if (tree->root == -1) {
+        node         = New_BpTreeNode(tree->config);
+        node->type   = Leaf;
+        node->parent = node->next = node->prev = -1;
+        BpTreeNodeInsertAt(node, 0, key, value);
+        tree->root = BpTreeAllocNodes(tree, 1);
+        tree->leafNum++;
+        BpTreeWriteNode(tree, tree->root, node, buffer);
+        BpTreeCachePut(tree, tree->root, node);
+        BpTreeCacheTrim(tree);
+        BpTreeWriteSuperblock(tree);
+        Metrics_Record(Metrics_BpTreeInsert, Metrics_Now() - start);
+        return ret;
+    }
+
+    // search node to insert
+    off_t *path    = (off_t *)alloca((tree->height + 1) * sizeof(off_t));  // 从根到叶子经过的结点
+    int64_t *slots = (int64_t *)alloca((tree->height + 1) * sizeof(int64_t));  // 在每个结点中选择的下标
+    int64_t level  = 0;
+    off_t offset   = tree->root;
     while (true) {
-        // 如果是叶子结点，则代表记录的偏移量；如果是内部结点，代表子结点的偏移量
-        uint64_t idx = BpTreeNodeSearch(root, key);
-        if (root->type == Leaf) {
-            ret = idx;
+        node         = BpTreeGetNode(tree, offset);
+        path[level]  = offset;
+        slots[level] = BpTreeNodeSearch(node, key);
+        if (node->type == Leaf) {
             break;
-        } else {
-            lseek(idxFd, idx, SEEK_SET);
-            read(idxFd, buffer, pageSize);
-            DeserializeNode(root, buffer);
         }
+        slots[level] = slots[level] < 0 ? 0 : slots[level];
+        offset       = node->childs[slots[level]].value;
+        level++;
+    }
+    if (slots[level] >= 0 && node->childs[slots[level]].key == key) {
+        BpTreeCacheTrim(tree);
+        Metrics_Record(Metrics_BpTreeInsert, Metrics_Now() - start);
+        return -1;
+    }
+
+    // insert，缓存中的结点直接修改，再写回索引文件
+    BpTreeNodeInsertAt(node, slots[level] + 1, key, value);
+    bool split = node->num > order;
+    while (node->num > order) {
+        BpTreeNode *right = New_BpTreeNode(tree->config);
+        off_t rightOffset = BpTreeSplitNode(tree, path[level], node, right);
+        key_t separator   = right->childs[0].key;
+        if (level == 0) {
+            // 根结点分裂，新的根结点指向分裂出的两个结点
+            BpTreeNode *root = New_BpTreeNode(tree->config);
+            root->type       = Internal;
+            root->parent     = root->next = root->prev = -1;
+            BpTreeNodeInsertAt(root, 0, node->childs[0].key, path[0]);
+            BpTreeNodeInsertAt(root, 1, separator, rightOffset);
+            tree->root = BpTreeAllocNodes(tree, 1);
+            tree->height++;
+            tree->indexNum++;
+            BpTreeWriteNode(tree, tree->root, root, buffer);
+            BpTreeCachePut(tree, tree->root, root);
+            Metrics_SetGauge(Metrics_BpTreeHeight, tree->height);
+            node = NULL;
+            break;
+        }
+        level--;
+        node = BpTreeGetNode(tree, path[level]);
+        BpTreeNodeInsertAt(node, slots[level] + 1, separator, rightOffset);
+    }
+    if (node != NULL) {
+        BpTreeWriteNode(tree, path[level], node, buffer);
     }
-    Destroy_BpTreeNode(root);
+    BpTreeCacheTrim(tree);
+    if (split) {
+        BpTreeWriteSuperblock(tree);
+    }
+    Metrics_Record(Metrics_BpTreeInsert, Metrics_Now() - start);
     return ret;
 }
 
 /**
- * 将key插入到B+树中，返回在db文件中待插入的位置
+ * 构建一层结点，第j个结点包含第from(j)到第from(j + 1) - 1项，项数在结点之间平均分配。
+ * 叶子层的项来自keys和values，内部层的项来自下一层的entries。
+ * 先为这一层分配所有页面，这样每个结点写入时已经知道兄弟结点的偏移量；
+ * 页面连续时合并成一次写入。
+ * @param parents: out, the smallest key and the offset of each node, for the level above
  */
-val_t BpTree_Insert(BpTree *tree, key_t key) {
-    BpTreeNode *root  = New_BpTreeNode(tree->config);
+static void BpTreeBulkLevel(BpTree *tree, const key_t *keys, const val_t *values, const Index *entries,
+                            uint64_t n, uint64_t count, Index *parents) {
     uint64_t pageSize = tree->config->pageSize;
-    void *buffer      = alloca(pageSize);
-    int idxFd         = tree->idxFd;
-   // if (lseek(idxFd, 0L, SEEK_SET) == -1) {
-   //     perror("Seek Error.\n");
-   // }
-   // if (read(idxFd, buffer, pageSize) != pageSize) {
-   //     perror("Fail to read a page.\n");
-   // }
-   // search node to insert
-    S_SEEK(idxFd, 0L, SEEK_SET);
-    S_READ(idxFd, buffer, pageSize);
-    uint64_t idx;
-    while(true){
-	idx = BpTreeNodeSearch(root, key); // idx of leaf node
-	if(root->type == Leaf) {
-	    break;	
-	} else {
-	    S_SEEK(idxFd, idx, SEEK_SET);
-	    S_READ(idxFd, buffer, pageSize);
-	    DeserializeNode(root, buffer);
-	}	    
-   }
-   // insert
-   
+    char *batch       = (char *)malloc(BULK_LOAD_BATCH * pageSize);
+    assert(batch != NULL);
+    uint64_t j, k, pending = 0, run;
+    for (j = 0; j < count; j += run) {
+        run         = count - j < BULK_LOAD_BATCH ? count - j : BULK_LOAD_BATCH;
+        off_t first = BpTreeAllocNodes(tree, run);
+        for (k = 0; k < run; k++) {
+            parents[j + k].key   = entries != NULL ? entries[n * (j + k) / count].key : keys[n * (j + k) / count];
+            parents[j + k].value = first + (off_t)(k * pageSize);
+        }
+    }
+    for (j = 0; j < count; j++) {
+        uint64_t from = n * j / count, to = n * (j + 1) / count;
+        if (pending > 0 && (pending == BULK_LOAD_BATCH || parents[j].value != parents[j - 1].value + (off_t)pageSize)) {
+            size_t size = pending * pageSize;
+            S_PWRITE(tree->idxFd, batch, size, parents[j - pending].value);
+            pending = 0;
+        }
+        BpTreeNode *node = (BpTreeNode *)(batch + pending * pageSize);
+        memset(node, 0, pageSize);
+        node->type   = entries != NULL ? Internal : Leaf;
+        node->parent = -1;
+        node->prev   = j > 0 ? parents[j - 1].value : -1;
+        node->next   = j + 1 < count ? parents[j + 1].value : -1;
+        node->num    = to - from;
+        for (k = from; k < to; k++) {
+            node->childs[k - from].key   = entries != NULL ? entries[k].key : keys[k];
+            node->childs[k - from].value = entries != NULL ? entries[k].value : values[k];
+        }
+        pending++;
+    }
+    size_t size = pending * pageSize;
+    S_PWRITE(tree->idxFd, batch, size, parents[count - pending].value);
+    free(batch);
+    Metrics_Add(Metrics_NodesWritten, count);
+    Metrics_Add(Metrics_BytesWritten, count * pageSize);
+}
+
+/**
+ * 用按key严格递增的键值对自底向上构建B+树，只能在空树上使用。
+ * 
+ * 叶子结点从左到右按config->fillFactor填充，再由下一层结点的最小键逐层构建内部结点，
+ * 直到一层只有一个结点，即根结点。每次从空闲页面位图分配连续的 BULK_LOAD_BATCH 个页面，
+ * 空树中除位图页以外的页面都是空闲的，所以结点按层顺序写入索引文件。
+ * @return false if the tree is not empty or keys are not strictly increasing
+ */
+bool BpTree_BulkLoad(BpTree *tree, const key_t *keys, const val_t *values, size_t n) {
+    if (tree->root != -1) {
+        return false;
+    }
+    size_t i;
+    for (i = 1; i < n; i++) {
+        if (keys[i - 1] >= keys[i]) {
+            return false;
+        }
+    }
+    if (n == 0) {
+        return true;
+    }
+    uint64_t order = tree->config->order;
+    uint64_t fill  = (uint64_t)(order * tree->config->fillFactor);
+    fill           = fill < 2 ? 2 : (fill > order ? order : fill);
+
+    uint64_t count = (n + fill - 1) / fill;
+    Index *level   = (Index *)malloc(count * sizeof(Index));
+    assert(level != NULL);
+    BpTreeBulkLevel(tree, keys, values, NULL, n, count, level);
+    tree->leafNum += count;
+    while (count > 1) {
+        uint64_t children = count;
+        count             = (children + fill - 1) / fill;
+        Index *parents    = (Index *)malloc(count * sizeof(Index));
+        assert(parents != NULL);
+        BpTreeBulkLevel(tree, NULL, NULL, level, children, count, parents);
+        free(level);
+        level = parents;
+        tree->indexNum += count;
+        tree->height++;
+    }
+    tree->root = level[0].value;
+    free(level);
+    BpTreeWriteSuperblock(tree);
+    Metrics_SetGauge(Metrics_BpTreeHeight, tree->height);
+    return true;
+}
+
+/*========================================*/
+
+/* 从索引文件读取一个结点 */
+static void BpTreeReadNode(BpTree *tree, off_t offset, void *buffer) {
+    uint64_t pageSize = tree->config->pageSize;
+    S_PREAD(tree->idxFd, buffer, pageSize, offset);
+    Metrics_Add(Metrics_NodesRead, 1);
+    Metrics_Add(Metrics_BytesRead, pageSize);
+}
+
+/* 序列化node并写入索引文件，buffer的大小为pageSize */
+static void BpTreeWriteNode(BpTree *tree, off_t offset, BpTreeNode *node, void *buffer) {
+    uint64_t pageSize = tree->config->pageSize;
+    memset(buffer, 0, pageSize);  // num项之后的部分也写入文件，不能留下栈上的旧数据
+    SerializeNode(node, buffer);
+    S_PWRITE(tree->idxFd, buffer, pageSize, offset);
+    Metrics_Add(Metrics_NodesWritten, 1);
+    Metrics_Add(Metrics_BytesWritten, pageSize);
+}
+
+/*========================================*/
+// 结点缓存
+
+static inline uint64_t BpTreeCacheBucket(BpTree *tree, off_t offset) {
+    return (uint64_t)offset / tree->config->pageSize & (tree->cache->bucketNum - 1);
+}
+
+/* 缓存中的结点，不存在时返回NULL，不读索引文件 */
+static NodeCacheEntry *BpTreeCacheLookup(BpTree *tree, off_t offset) {
+    NodeCacheEntry *entry = tree->cache->buckets[BpTreeCacheBucket(tree, offset)];
+    while (entry != NULL && entry->offset != offset) {
+        entry = entry->hnext;
+    }
+    return entry;
+}
+
+static void BpTreeLruRemove(NodeCache *cache, NodeCacheEntry *entry) {
+    if (entry->prev != NULL) {
+        entry->prev->next = entry->next;
+    } else {
+        cache->head = entry->next;
+    }
+    if (entry->next != NULL) {
+        entry->next->prev = entry->prev;
+    } else {
+        cache->tail = entry->prev;
+    }
+    entry->prev = entry->next = NULL;
+}
+
+static void BpTreeLruPushFront(NodeCache *cache, NodeCacheEntry *entry) {
+    entry->prev = NULL;
+    entry->next = cache->head;
+    if (cache->head != NULL) {
+        cache->head->prev = entry;
+    } else {
+        cache->tail = entry;
+    }
+    cache->head = entry;
+}
+
+/* 散列桶的个数翻倍，重新分配所有项 */
+static void BpTreeCacheRehash(BpTree *tree) {
+    NodeCache *cache         = tree->cache;
+    uint64_t bucketNum       = cache->bucketNum;
+    NodeCacheEntry **buckets = cache->buckets;
+    cache->bucketNum         = bucketNum * 2;
+    cache->buckets           = (NodeCacheEntry **)calloc(cache->bucketNum, sizeof(NodeCacheEntry *));
+    assert(cache->buckets != NULL);
+    uint64_t i;
+    for (i = 0; i < bucketNum; i++) {
+        NodeCacheEntry *entry = buckets[i], *hnext;
+        for (; entry != NULL; entry = hnext) {
+            hnext             = entry->hnext;
+            uint64_t k        = BpTreeCacheBucket(tree, entry->offset);
+            entry->hnext      = cache->buckets[k];
+            cache->buckets[k] = entry;
+        }
+    }
+    free(buckets);
+}
+
+/* 把node加入缓存，之后由缓存负责释放。内部结点常驻，叶子结点放在LRU链表头部 */
+static void BpTreeCachePut(BpTree *tree, off_t offset, BpTreeNode *node) {
+    NodeCache *cache = tree->cache;
+    if (cache->count >= cache->bucketNum) {
+        BpTreeCacheRehash(tree);
+    }
+    NodeCacheEntry *entry = (NodeCacheEntry *)calloc(1, sizeof(NodeCacheEntry));
+    assert(entry != NULL);
+    uint64_t k        = BpTreeCacheBucket(tree, offset);
+    entry->offset     = offset;
+    entry->node       = node;
+    entry->pinned     = node->type != Leaf;
+    entry->hnext      = cache->buckets[k];
+    cache->buckets[k] = entry;
+    cache->count++;
+    if (!entry->pinned) {
+        BpTreeLruPushFront(cache, entry);
+        cache->leaves++;
+    }
+}
+
+/**
+ * 从缓存中取得结点，不在缓存中时从索引文件读入并反序列化。
+ * 返回的结点由所有调用者共享，修改后需要调用 BpTreeWriteNode 写回。
+ */
+static BpTreeNode *BpTreeGetNode(BpTree *tree, off_t offset) {
+    NodeCacheEntry *entry = BpTreeCacheLookup(tree, offset);
+    if (entry != NULL) {
+        Metrics_Add(Metrics_CacheHits, 1);
+        if (!entry->pinned && entry != tree->cache->head) {
+            BpTreeLruRemove(tree->cache, entry);
+            BpTreeLruPushFront(tree->cache, entry);
+        }
+        return entry->node;
+    }
+    Metrics_Add(Metrics_CacheMisses, 1);
+    void *buffer     = alloca(tree->config->pageSize);
+    BpTreeNode *node = New_BpTreeNode(tree->config);
+    BpTreeReadNode(tree, offset, buffer);
+    DeserializeNode(node, buffer);
+    BpTreeCachePut(tree, offset, node);
+    return node;
+}
+
+/* 淘汰最久未使用的叶子结点，直到不超过capacity。缓存中没有脏结点，直接释放 */
+static void BpTreeCacheTrim(BpTree *tree) {
+    NodeCache *cache = tree->cache;
+    while (cache->leaves > cache->capacity) {
+        NodeCacheEntry *victim = cache->tail;
+        BpTreeLruRemove(cache, victim);
+        NodeCacheEntry **link = &cache->buckets[BpTreeCacheBucket(tree, victim->offset)];
+        while (*link != victim) {
+            link = &(*link)->hnext;
+        }
+        *link = victim->hnext;
+        cache->leaves--;
+        cache->count--;
+        Destroy_BpTreeNode(victim->node);
+        free(victim);
+    }
+}
+
+/*========================================*/
+
+/*========================================*/
+// 超级块
+
+static uint32_t BpTreeSuperblockChecksum(const Superblock *super) {
+    uint32_t hash          = 2166136261u;
+    const unsigned char *p = (const unsigned char *)super;
+    size_t i;
+    for (i = 0; i < OFFSET_OF_ATTRIBUTE(Superblock, checksum); i++) {
+        hash = (hash ^ p[i]) * 16777619u;
+    }
+    return hash;
+}
+
+/**
+ * 一次读入超级块的两份，选择校验通过且seq较大的一份
+ * @return false if neither copy is valid, e.g. the index file is new
+ */
+static bool BpTreeReadSuperblock(BpTree *tree, Superblock *super) {
+    char buffer[2 * SUPERBLOCK_SLOT_SIZE];
+    if (pread(tree->idxFd, buffer, sizeof(buffer), 0) != (ssize_t)sizeof(buffer)) {
+        return false;
+    }
+    bool found = false;
+    int32_t i;
+    for (i = 0; i < 2; i++) {
+        Superblock slot;
+        memcpy(&slot, buffer + i * SUPERBLOCK_SLOT_SIZE, sizeof(Superblock));
+        if (slot.magic != SUPERBLOCK_MAGIC || slot.version != SUPERBLOCK_VERSION ||
+            slot.checksum != BpTreeSuperblockChecksum(&slot) || slot.seq % 2 != (uint64_t)i) {
+            continue;
+        }
+        if (!found || slot.seq > super->seq) {
+            *super = slot;
+            found  = true;
+        }
+    }
+    return found;
+}
+
+/**
+ * 先写回空闲页面位图，等结点和位图落盘后再写超级块，
+ * 超级块指向的结点总是完整的。写入seq较旧的那一份。
+ */
+static void BpTreeWriteSuperblock(BpTree *tree) {
+    FreeMap_Flush(tree->freeMap);
+    if (fdatasync(tree->idxFd) == -1) {
+        LOG_ERROR("Failed to sync index file: %s", strerror(errno));
+    }
+    char buffer[SUPERBLOCK_SLOT_SIZE];
+    assert(sizeof(Superblock) <= SUPERBLOCK_SLOT_SIZE);
+    memset(buffer, 0, sizeof(buffer));
+    Superblock *super = (Superblock *)buffer;
+    super->magic      = SUPERBLOCK_MAGIC;
+    super->version    = SUPERBLOCK_VERSION;
+    super->seq        = ++tree->superSeq;
+    super->pageSize   = tree->config->pageSize;
+    super->order      = tree->config->order;
+    super->root       = tree->root;
+    super->height     = tree->height;
+    super->indexNum   = tree->indexNum;
+    super->leafNum    = tree->leafNum;
+    super->freeHint   = tree->freeMap->hint;
+    super->checksum   = BpTreeSuperblockChecksum(super);
+    S_PWRITE(tree->idxFd, buffer, sizeof(buffer), (off_t)(super->seq % 2) * SUPERBLOCK_SLOT_SIZE);
+}
+
+/* 从空闲页面位图分配n个连续的页面，@return offset of the first page */
+static off_t BpTreeAllocNodes(BpTree *tree, uint64_t n) {
+    int64_t page                = FreeMap_Alloc(tree->freeMap, n);
+    tree->config->indexFileSize = tree->freeMap->pageCount * tree->config->pageSize;
+    return (off_t)(page * tree->config->pageSize);
+}
+
+/* 对索引文件执行一批大小为pageSize的读写请求 */
+static int32_t BpTreeExecuteNodes(BpTree *tree, bool write, const off_t *offsets, void **buffers, int32_t n) {
+    AioRequest *requests = (AioRequest *)calloc(n, sizeof(AioRequest));
+    assert(requests != NULL);
+    int32_t i;
+    for (i = 0; i < n; i++) {
+        requests[i].fd     = tree->idxFd;
+        requests[i].write  = write;
+        requests[i].buffer = buffers[i];
+        requests[i].size   = tree->config->pageSize;
+        requests[i].offset = offsets[i];
+    }
+    int32_t failed = Aio_Execute(tree->aio, requests, n);
+    free(requests);
+    Metrics_Add(write ? Metrics_NodesWritten : Metrics_NodesRead, n - failed);
+    Metrics_Add(write ? Metrics_BytesWritten : Metrics_BytesRead, (uint64_t)(n - failed) * tree->config->pageSize);
+    return failed;
+}
+
+/**
+ * 一次读入多个结点，例如同一层中多个key需要访问的结点。
+ * 开启io_uring时这些读请求同时在设备的队列中。
+ * @return number of failed reads
+ */
+int32_t BpTree_ReadNodes(BpTree *tree, const off_t *offsets, void **buffers, int32_t n) {
+    return BpTreeExecuteNodes(tree, false, offsets, buffers, n);
+}
 
+/* 一次写回多个结点，@return number of failed writes */
+int32_t BpTree_WriteNodes(BpTree *tree, const off_t *offsets, void **buffers, int32_t n) {
+    return BpTreeExecuteNodes(tree, true, offsets, buffers, n);
 }
@@ -11,25 +11,35 @@
 #ifndef BPTREE_BPTREE_H
 #define BPTREE_BPTREE_H
 #include <assert.h>
+#include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <sys/types.h>
 
+#include "../includes/aio.h"
 #include "../includes/global.h"
+#include "./freemap.h"
 
 #define key_t uint64_t  // TODO: 暂时将 key_t 类型硬编码
 #define val_t off_t     // TODO: 暂时将 val_t 类型硬编码
 #define MAX_FILE_NAME_LENGTH 31
 #define DEFUALT_DATA_FILE_INIT_SIZE (512 * 1024)
 #define DEFAULT_INDEX_FILE_INIT_SIZE (512 * 1024)
+#define DEFAULT_CACHE_LEAVES 1024
+#define DEFAULT_FILL_FACTOR 0.9
+#define SUPERBLOCK_MAGIC 0x54425054
+#define SUPERBLOCK_VERSION 1
+#define SUPERBLOCK_SLOT_SIZE 128  // 超级块的两份分别在第0页的偏移量0和128处，所以pageSize至少为256
 
 typedef struct bptree_config_t BpTreeConfig;
 typedef struct bptree_t BpTree;
 typedef struct record_t Record;
 typedef struct index_t Index;
 typedef struct bptree_node_t BpTreeNode;
-typedef struct free_block_t FreeBlock;
+typedef struct node_cache_entry_t NodeCacheEntry;
+typedef struct node_cache_t NodeCache;
+typedef struct superblock_t Superblock;
 
 // struct record_t {
 // };
@@ -40,55 +50,33 @@ struct index_t {
     val_t value;
 };
 
-typedef struct free_block_node_t FreeBlockNode;
-struct free_block_node_t {
-    uint64_t i;        // 初次分配时给予的编号
-    off_t curOffset;   // 该空闲块在indexFile中的偏移量
-    off_t nextOffset;  // 下一个空闲块在indexFile中的偏移量
-    struct free_block_node_t *next;
-};
-
-static inline FreeBlockNode *New_FreeBlockNode() {
-    FreeBlockNode *node = (FreeBlockNode *)calloc(1, sizeof(FreeBlockNode));
-    assert(node != NULL);
-    node->curOffset  = 0;
-    node->nextOffset = 0;
-    node->next       = NULL;
-    node->i          = -1;
-    return node;
-}
-
-struct free_block_t {
-    uint64_t max_num;
-    uint64_t num;
-    struct free_block_node_t *head;
-    struct free_block_node_t *tail;
-};
-static inline void FreeList_InsertAfter(FreeBlockNode *pos, FreeBlockNode *node) {
-    node->next = pos->next;
-    pos->next  = node;
-}
-
 typedef enum {
     Leaf     = 0,
     Root     = 1,
     Internal = 2
 } BpTreeNodeType;
 
+/**
+ * 结点在索引文件中的格式就是这个结构体本身：头部之后紧跟num个Index。
+ * 叶子结点中Index的value是记录在db文件中的偏移量，内部结点中是子结点在索引文件中的偏移量，
+ * 内部结点的childs[i].key是第i个子树中最小的键，childs[0].key视为负无穷。
+ * next/prev是同一层的兄弟结点，没有时为-1。
+ * parent不维护（总是-1），插入时沿查找路径记录父结点，避免内部结点分裂时改写一半子结点。
+ */
 struct bptree_node_t {
     char type;
     off_t parent;
     off_t next;
     off_t prev;
     uint64_t num;
-    struct index_t *childs[];
+    Index childs[];
 };
 const size_t TYPE_SIZE   = SIZE_OF_ATTRIBUTE(BpTreeNode, type);
 const size_t PARENT_SIZE = SIZE_OF_ATTRIBUTE(BpTreeNode, parent);
 const size_t NEXT_SIZE   = SIZE_OF_ATTRIBUTE(BpTreeNode, next);
 const size_t PREV_SIZE   = SIZE_OF_ATTRIBUTE(BpTreeNode, prev);
 const size_t NUM_SIZE    = SIZE_OF_ATTRIBUTE(BpTreeNode, num);
-extern const uint64_t BPTREE_NODE_HEADER_SIZE;
+extern const uint64_t BPTREE_NODE_HEADER_SIZE;  // 包含对齐填充，即childs的偏移量
 
 extern const uint64_t DEFAULT_PAGE_SIZE;
 extern const uint64_t DEFAULT_ORDER;
@@ -96,11 +84,63 @@ extern const char *DEFAULT_INDEX_FILE;
 extern const char *DEFAULT_DATA_FILE;
 extern const char *DEFAULT_CONFIG_FILE;
 
+/**
+ * 结点缓存中的一项，node是反序列化后的结点，所有查找共享同一份。
+ * 内部结点常驻（pinned），叶子结点在LRU链表中，最近使用的在头部。
+ */
+struct node_cache_entry_t {
+    off_t offset;
+    bool pinned;
+    BpTreeNode *node;
+    struct node_cache_entry_t *hnext;  // 同一个散列桶中的下一项
+    struct node_cache_entry_t *prev;
+    struct node_cache_entry_t *next;
+};
+
+/**
+ * 按结点在索引文件中的偏移量缓存结点。写结点时同时写回索引文件，缓存中没有脏结点，
+ * 淘汰只是释放内存。淘汰只在每次操作结束时进行，操作过程中拿到的结点不会被释放。
+ */
+struct node_cache_t {
+    uint64_t capacity;   // 最多缓存的叶子结点数，0表示不缓存叶子结点
+    uint64_t leaves;     // 当前缓存的叶子结点数
+    uint64_t count;      // 当前缓存的结点数
+    uint64_t bucketNum;  // 散列桶的个数，2的幂
+    NodeCacheEntry **buckets;
+    NodeCacheEntry *head;  // LRU链表，只包含叶子结点
+    NodeCacheEntry *tail;
+};
+
+/**
+ * 索引文件第0页的超级块，保存打开树需要的全部元数据，打开时只需要读这一页。
+ * 超级块有两份，每次更新写seq较旧的那一份，写到一半崩溃时另一份仍然完整，
+ * 打开时选择校验通过且seq较大的一份。
+ * 空闲页面位图的根固定在第1页，freeHint是 FreeMap.hint，打开后分配不必从头查找。
+ * seq: increases on every update, slot seq % 2 holds it
+ * checksum: FNV-1a of the fields before it
+ */
+struct superblock_t {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t seq;
+    uint64_t pageSize;
+    uint64_t order;
+    off_t root;
+    uint64_t height;
+    uint64_t indexNum;
+    uint64_t leafNum;
+    uint64_t freeHint;
+    uint32_t checksum;
+};
+
 struct bptree_config_t {
-    uint64_t pageSize;  // 页面大小
-    uint64_t order;     // B+树的阶
+    uint64_t pageSize;  // 页面大小，打开已有的索引文件时使用文件创建时的页面大小
+    uint64_t order;     // B+树的阶，即一个结点最多容纳的Index数
     uint64_t indexFileSize;
     uint64_t dataFileSize;
+    uint32_t ioDepth;   // io_uring的队列深度，0表示同步读写
+    uint64_t cacheLeaves;  // 结点缓存中最多缓存的叶子结点数，内部结点总是缓存
+    double fillFactor;     // 批量加载时结点的填充率，(0, 1]
     char indexFile[MAX_FILE_NAME_LENGTH + 1];
     char configFile[MAX_FILE_NAME_LENGTH + 1];
     char dataFile[MAX_FILE_NAME_LENGTH + 1];
@@ -112,10 +152,12 @@ struct bptree_t {
     uint64_t height;    // 当前树高（除去叶子层）
     uint64_t indexNum;  // 内部结点数量
     uint64_t leafNum;   // 叶子结点数量
-    off_t root;         // 根结点在索引文件中的偏移量
-    off_t slot;         // 下一个页面插入的位置
+    off_t root;         // 根结点在索引文件中的偏移量，空树为-1
     BpTreeConfig *config;
-    FreeBlock *freeBlock;
+    FreeMap *freeMap;   // 索引文件的空闲页面
+    uint64_t superSeq;  // 最近一次写入的超级块的seq
+    Aio *aio;           // 批量读写结点，config->ioDepth为0时为NULL
+    NodeCache *cache;
 };
 
 BpTreeConfig *New_BpTreeConfig(uint64_t pageSize,
@@ -123,9 +165,15 @@ BpTreeConfig *New_BpTreeConfig(uint64_t pageSize,
                                const char *configFile,
                                const char *dataFile);
 BpTree *New_BpTree(BpTreeConfig *config);
+void Destroy_BpTree(BpTree *tree);
 
-val_t BpTree_Insert(BpTree *tree, key_t key);
+val_t BpTree_Insert(BpTree *tree, key_t key, val_t value);
 val_t BpTree_Select(BpTree *tree, key_t key);
+bool BpTree_BulkLoad(BpTree *tree, const key_t *keys, const val_t *values, size_t n);
+
+/* 直接读写索引文件，不经过结点缓存 */
+int32_t BpTree_ReadNodes(BpTree *tree, const off_t *offsets, void **buffers, int32_t n);
+int32_t BpTree_WriteNodes(BpTree *tree, const off_t *offsets, void **buffers, int32_t n);
 
 // void Init_BpTreeConfig(const char *cfgFile, BpTreeConfig *config);
 // void Flush_BpTreeConfig(BpTreeConfig *config, int fd);
@@ -0,0 +1,156 @@
+#include "./freemap.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../includes/file.h"
+
+/* 第group组的位图所在的页 */
+static inline uint64_t FreeMapBitmapPage(FreeMap *map, uint64_t group) {
+    return group == 0 ? 1 : group * map->groupPages;
+}
+
+static inline void FreeMapSetBit(FreeMap *map, uint64_t page, bool used) {
+    uint64_t group = page / map->groupPages, i = page % map->groupPages;
+    if (used) {
+        map->chunks[group][i / 64] |= 1ull << (i % 64);
+    } else {
+        map->chunks[group][i / 64] &= ~(1ull << (i % 64));
+    }
+    if (!map->dirty[group]) {
+        map->dirty[group] = true;
+        map->dirtyGroups++;
+    }
+}
+
+/* 第group组的位图，第一次访问时读入，并标记第0页和位图页自身已分配 */
+static uint64_t *FreeMapChunk(FreeMap *map, uint64_t group) {
+    if (map->chunks[group] == NULL) {
+        uint64_t *chunk = (uint64_t *)malloc(map->pageSize);
+        assert(chunk != NULL);
+        S_PREAD(map->fd, chunk, map->pageSize, FreeMapBitmapPage(map, group) * map->pageSize);
+        uint64_t i = FreeMapBitmapPage(map, group) % map->groupPages;
+        chunk[i / 64] |= 1ull << (i % 64);
+        if (group == 0) {
+            chunk[0] |= 1;
+        }
+        map->chunks[group] = chunk;
+    }
+    return map->chunks[group];
+}
+
+/* 文件扩大到pageCount页，新的组的位图在访问时读入 */
+static void FreeMapResize(FreeMap *map, uint64_t pageCount) {
+    if (ftruncate(map->fd, pageCount * map->pageSize) == -1) {
+        EXIT_ERROR("Failed to grow index file.\n");
+    }
+    uint64_t groupNum = (pageCount + map->groupPages - 1) / map->groupPages;
+    map->chunks       = (uint64_t **)realloc(map->chunks, groupNum * sizeof(uint64_t *));
+    map->dirty        = (bool *)realloc(map->dirty, groupNum * sizeof(bool));
+    assert(map->chunks != NULL && map->dirty != NULL);
+    memset(map->chunks + map->groupNum, 0, (groupNum - map->groupNum) * sizeof(uint64_t *));
+    memset(map->dirty + map->groupNum, 0, (groupNum - map->groupNum) * sizeof(bool));
+    map->groupNum  = groupNum;
+    map->pageCount = pageCount;
+}
+
+/**
+ * 打开时不读位图，文件不足两页时扩大到两页
+ * @param pageCount: number of pages in the file
+ */
+TINYDB_API FreeMap *New_FreeMap(int fd, uint64_t pageSize, uint64_t pageCount) {
+    FreeMap *map = (FreeMap *)calloc(1, sizeof(FreeMap));
+    assert(map != NULL && pageSize % sizeof(uint64_t) == 0);
+    map->fd         = fd;
+    map->pageSize   = pageSize;
+    map->groupPages = pageSize * 8;
+    FreeMapResize(map, pageCount < 2 ? 2 : pageCount);
+    return map;
+}
+
+/* 写回修改过的位图后释放 */
+TINYDB_API void Destroy_FreeMap(FreeMap *map) {
+    if (map == NULL) {
+        return;
+    }
+    FreeMap_Flush(map);
+    uint64_t i;
+    for (i = 0; i < map->groupNum; i++) {
+        free(map->chunks[i]);
+    }
+    free(map->chunks);
+    free(map->dirty);
+    free(map);
+}
+
+/**
+ * 分配n个连续的页面，没有足够的空闲页面时把文件扩大一倍。
+ * 连续的页面不会跨过位图页，所以n必须小于一组的页数。
+ * @return first page of the extent
+ */
+TINYDB_API int64_t FreeMap_Alloc(FreeMap *map, uint64_t n) {
+    assert(n > 0 && n < map->groupPages);
+    uint64_t page = map->hint, run = 0, firstFree = UINT64_MAX;
+    while (true) {
+        if (page >= map->pageCount) {
+            FreeMapResize(map, map->pageCount * 2);
+        }
+        uint64_t *chunk = FreeMapChunk(map, page / map->groupPages);
+        uint64_t i      = page % map->groupPages;
+        if (run == 0 && i % 64 == 0 && chunk[i / 64] == UINT64_MAX) {
+            page += 64;
+            continue;
+        }
+        if ((chunk[i / 64] >> (i % 64)) & 1) {
+            run = 0;
+            page++;
+            continue;
+        }
+        firstFree = firstFree == UINT64_MAX ? page : firstFree;
+        if (++run == n) {
+            break;
+        }
+        page++;
+    }
+    uint64_t start = page + 1 - n, k;
+    for (k = start; k <= page; k++) {
+        FreeMapSetBit(map, k, true);
+    }
+    map->hint = firstFree == start ? page + 1 : firstFree;
+    return (int64_t)start;
+}
+
+/* 释放从page开始的n个页面，这些页面必须已经分配 */
+TINYDB_API void FreeMap_Free(FreeMap *map, uint64_t page, uint64_t n) {
+    uint64_t k;
+    for (k = page; k < page + n; k++) {
+        assert(!FreeMap_IsFree(map, k) && k != 0 && k != FreeMapBitmapPage(map, k / map->groupPages));
+        FreeMapSetBit(map, k, false);
+    }
+    map->hint = page < map->hint ? page : map->hint;
+}
+
+/* 文件之外的页面视为空闲 */
+TINYDB_API bool FreeMap_IsFree(FreeMap *map, uint64_t page) {
+    if (page >= map->pageCount) {
+        return true;
+    }
+    uint64_t *chunk = FreeMapChunk(map, page / map->groupPages);
+    uint64_t i      = page % map->groupPages;
+    return ((chunk[i / 64] >> (i % 64)) & 1) == 0;
+}
+
+/* 写回修改过的位图页 */
+TINYDB_API void FreeMap_Flush(FreeMap *map) {
+    uint64_t i;
+    for (i = 0; i < map->groupNum && map->dirtyGroups > 0; i++) {
+        if (map->dirty[i]) {
+            S_PWRITE(map->fd, map->chunks[i], map->pageSize, FreeMapBitmapPage(map, i) * map->pageSize);
+            map->dirty[i] = false;
+            map->dirtyGroups--;
+        }
+    }
+}
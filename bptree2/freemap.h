@@ -0,0 +1,48 @@
+#ifndef BPTREE_FREEMAP_H
+#define BPTREE_FREEMAP_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "../includes/global.h"
+
+/**
+ * 索引文件的空闲页面位图，保存在索引文件自身中。
+ *
+ * 文件按 pageSize * 8 页分组，每组的位图占一页，第i位为1表示组内第i页已分配。
+ * 第0组的位图在第1页（第0页留给树的元数据），其余各组的位图是组内的第一页。
+ * 位图页只在第一次访问这一组时读入，打开时不读任何位图，所以打开的时间和内存与文件大小无关。
+ * 文件扩大（ftruncate）后新的位图页全为0，读入时再标记位图页自身，不需要初始化。
+ *
+ * 分配从hint开始逐个64位字查找连续的空闲页面，hint之前没有空闲页面，释放时把hint前移，
+ * 单个页面的分配和释放均摊O(1)。
+ * fd: index file
+ * pageCount: number of pages in the file
+ * groupPages: pages covered by one bitmap page
+ * groupNum: number of groups, i.e. length of chunks and dirty
+ * chunks: bitmap of each group, NULL until loaded
+ * dirty: the bitmap of the group has changes not written by FreeMap_Flush
+ * dirtyGroups: number of dirty groups
+ * hint: no free page before this one
+ */
+typedef struct FreeMap {
+    int fd;
+    uint64_t pageSize;
+    uint64_t pageCount;
+    uint64_t groupPages;
+    uint64_t groupNum;
+    uint64_t **chunks;
+    bool *dirty;
+    uint64_t dirtyGroups;
+    uint64_t hint;
+} FreeMap;
+
+TINYDB_API FreeMap *New_FreeMap(int fd, uint64_t pageSize, uint64_t pageCount);
+TINYDB_API void Destroy_FreeMap(FreeMap *map);
+
+TINYDB_API int64_t FreeMap_Alloc(FreeMap *map, uint64_t n);
+TINYDB_API void FreeMap_Free(FreeMap *map, uint64_t page, uint64_t n);
+TINYDB_API bool FreeMap_IsFree(FreeMap *map, uint64_t page);
+TINYDB_API void FreeMap_Flush(FreeMap *map);
+
+#endif
@@ -2,20 +2,371 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
 
+#include "../includes/file.h"
+#include "../includes/metrics.h"
 #include "./bptree.h"
+#include "./freemap.h"
 
 void test_New_BpTree();
+void test_BpTree_NodeIO();
+void test_BpTree_Insert();
+void test_BpTree_NodeCache();
+void test_BpTree_BulkLoad();
+void test_FreeMap();
+void test_BpTree_Reopen();
 
 int main(int argc, char const *argv[]) {
     test_New_BpTree();
+    test_BpTree_NodeIO();
+    test_BpTree_Insert();
+    test_BpTree_NodeCache();
+    test_BpTree_BulkLoad();
+    test_FreeMap();
+    test_BpTree_Reopen();
     return 0;
 }
 
 void test_New_BpTree() {
     BpTree *tree = New_BpTree(NULL);
     printf("tree->datFd = %d\n", tree->datFd);
-    printf("tree->freeBlock->max_num = %ld\n", tree->freeBlock->max_num);
+    printf("tree->freeMap->pageCount = %ld\n", tree->freeMap->pageCount);
     printf("tree->config->dataFileSize = %ld\n", tree->config->dataFileSize);
     printf("tree->config->indexFileSize = %ld\n", tree->config->indexFileSize);
-}
\ No newline at end of file
+    Destroy_BpTree(tree);
+
+    // 空闲页面的位图按uint64_t读写整页，pageSize不是8的倍数时使用默认值
+    BpTreeConfig *config = New_BpTreeConfig(260, NULL, NULL, NULL);
+    assert(config->pageSize == DEFAULT_PAGE_SIZE);
+    free(config);
+    config = New_BpTreeConfig(264, NULL, NULL, NULL);
+    assert(config->pageSize == 264);
+    free(config);
+}
+
+void test_BpTree_NodeIO() {
+    BpTreeConfig *config = New_BpTreeConfig(DEFAULT_PAGE_SIZE, "test_aio_index", "test_aio_config", "test_aio_data");
+    config->ioDepth      = 8;
+    BpTree *tree         = New_BpTree(config);
+    uint64_t pageSize    = config->pageSize;
+    off_t offsets[16];
+    void *buffers[16];
+    int32_t i;
+    for (i = 0; i < 16; i++) {
+        offsets[i] = (off_t)(15 - i) * pageSize;
+        buffers[i] = malloc(pageSize);
+        memset(buffers[i], i, pageSize);
+    }
+    assert(BpTree_WriteNodes(tree, offsets, buffers, 16) == 0);
+    for (i = 0; i < 16; i++) {
+        memset(buffers[i], 0xFF, pageSize);
+    }
+    assert(BpTree_ReadNodes(tree, offsets, buffers, 16) == 0);
+    for (i = 0; i < 16; i++) {
+        assert(((char *)buffers[i])[pageSize - 1] == i);
+        free(buffers[i]);
+    }
+    Destroy_BpTree(tree);
+    unlink("test_aio_index");
+    unlink("test_aio_config");
+    unlink("test_aio_data");
+    printf("test_BpTree_NodeIO passed.\n");
+}
+
+#define INSERT_KEYS 20000
+
+/* 从最左边的叶子结点开始沿next遍历，检查键有序、prev正确、页面的剩余部分为0，返回键的数量 */
+uint64_t checkLeafChain(BpTree *tree) {
+    uint64_t pageSize = tree->config->pageSize;
+    BpTreeNode *node  = (BpTreeNode *)malloc(pageSize);
+    off_t offset      = tree->root, prev = -1;
+    while (true) {
+        assert(BpTree_ReadNodes(tree, &offset, (void **)&node, 1) == 0);
+        if (node->type == Leaf) {
+            break;
+        }
+        assert(node->num >= 2 && node->prev == -1);
+        offset = node->childs[0].value;
+    }
+    uint64_t keys = 0, leaves = 0;
+    key_t last = 0;
+    while (offset != -1) {
+        assert(BpTree_ReadNodes(tree, &offset, (void **)&node, 1) == 0);
+        assert(node->type == Leaf && node->prev == prev && node->num > 0 && node->num <= tree->config->order);
+        uint64_t i;
+        for (i = BPTREE_NODE_HEADER_SIZE + node->num * sizeof(Index); i < pageSize; i++) {
+            assert(((char *)node)[i] == 0);
+        }
+        for (i = 0; i < node->num; i++, keys++) {
+            assert(keys == 0 || node->childs[i].key > last);
+            last = node->childs[i].key;
+            assert(node->childs[i].value == (val_t)last * 10);
+        }
+        leaves++;
+        prev   = offset;
+        offset = node->next;
+    }
+    assert(leaves == tree->leafNum);
+    free(node);
+    return keys;
+}
+
+/* 位图中已分配的页面数，不包括第0页和位图页 */
+uint64_t allocatedNodes(FreeMap *map) {
+    uint64_t page, used = 0;
+    for (page = 0; page < map->pageCount; page++) {
+        used += !FreeMap_IsFree(map, page);
+    }
+    return used - 1 - map->groupNum;
+}
+
+void runBpTreeInsert(uint64_t pageSize, uint32_t ioDepth, uint64_t cacheLeaves) {
+    BpTreeConfig *config = New_BpTreeConfig(pageSize, "test_insert_index", "test_insert_config", "test_insert_data");
+    config->ioDepth      = ioDepth;
+    config->cacheLeaves  = cacheLeaves;
+    BpTree *tree         = New_BpTree(config);
+    assert(BpTree_Select(tree, 1) == -1);
+    uint64_t i;
+    for (i = 0; i < INSERT_KEYS; i++) {
+        key_t key = (i * 7919) % INSERT_KEYS;
+        assert(BpTree_Insert(tree, key, (val_t)key * 10) == (val_t)key * 10);
+    }
+    assert(BpTree_Insert(tree, 7919, 1) == -1);
+    for (i = 0; i < INSERT_KEYS; i++) {
+        assert(BpTree_Select(tree, i) == (val_t)i * 10);
+    }
+    assert(BpTree_Select(tree, INSERT_KEYS + 1) == -1);
+    assert(checkLeafChain(tree) == INSERT_KEYS);
+    // 索引文件增长过，每个结点都从空闲页面位图分配
+    assert(tree->config->indexFileSize > DEFAULT_INDEX_FILE_INIT_SIZE);
+    uint64_t nodes = tree->leafNum + tree->indexNum;
+    assert(allocatedNodes(tree->freeMap) == nodes);
+    assert(tree->height >= 1);
+    if (pageSize < DEFAULT_PAGE_SIZE) {
+        assert(tree->height >= 3);
+    }
+    Destroy_BpTree(tree);
+
+    // 位图已经写回索引文件
+    int fd       = OpenFile("test_insert_index");
+    FreeMap *map = New_FreeMap(fd, pageSize, FileLength(fd) / pageSize);
+    assert(allocatedNodes(map) == nodes);
+    Destroy_FreeMap(map);
+    CloseFile(fd);
+    unlink("test_insert_index");
+    unlink("test_insert_config");
+    unlink("test_insert_data");
+}
+
+void test_BpTree_Insert() {
+    runBpTreeInsert(DEFAULT_PAGE_SIZE, 0, DEFAULT_CACHE_LEAVES);
+    runBpTreeInsert(DEFAULT_PAGE_SIZE, 8, DEFAULT_CACHE_LEAVES);
+    runBpTreeInsert(256, 0, DEFAULT_CACHE_LEAVES);
+    runBpTreeInsert(256, 0, 0);
+    runBpTreeInsert(256, 0, 3);
+    printf("test_BpTree_Insert passed.\n");
+}
+
+uint64_t nodesRead() {
+    MetricsSnapshot snapshot;
+    Metrics_Snapshot(&snapshot);
+    return snapshot.counters[Metrics_NodesRead];
+}
+
+uint64_t nodesWritten() {
+    MetricsSnapshot snapshot;
+    Metrics_Snapshot(&snapshot);
+    return snapshot.counters[Metrics_NodesWritten];
+}
+
+void test_BpTree_NodeCache() {
+    BpTreeConfig *config = New_BpTreeConfig(256, "test_cache_index", "test_cache_config", "test_cache_data");
+    config->cacheLeaves  = 16;
+    BpTree *tree         = New_BpTree(config);
+    uint64_t i;
+    for (i = 0; i < INSERT_KEYS; i++) {
+        BpTree_Insert(tree, i * 3, (val_t)i * 30);
+    }
+    assert(tree->height >= 3);
+    assert(tree->cache->leaves <= 16 && tree->cache->count == tree->cache->leaves + tree->indexNum);
+
+    // 内部结点都在缓存中，每次查找最多读一个叶子结点
+    uint64_t before = nodesRead();
+    for (i = 0; i < INSERT_KEYS; i++) {
+        assert(BpTree_Select(tree, i * 3) == (val_t)i * 30);
+        assert(tree->cache->leaves <= 16);
+    }
+    assert(nodesRead() - before <= INSERT_KEYS);
+    before = nodesRead();
+    assert(BpTree_Select(tree, 30) == 300);
+    assert(nodesRead() - before <= 1);
+    before = nodesRead();
+    assert(BpTree_Select(tree, 30) == 300);
+    assert(BpTree_Select(tree, 31) == -1);
+    assert(BpTree_Select(tree, 33) == 330);
+    assert(nodesRead() == before);
+
+    // 缓存中的叶子结点和索引文件中的一致
+    assert(BpTree_Insert(tree, 31, 310) == 310);
+    assert(BpTree_Select(tree, 31) == 310);
+    assert(checkLeafChain(tree) == INSERT_KEYS + 1);
+    Destroy_BpTree(tree);
+    unlink("test_cache_index");
+    unlink("test_cache_config");
+    unlink("test_cache_data");
+    printf("test_BpTree_NodeCache passed.\n");
+}
+
+#define BULK_KEYS 100000
+
+void runBpTreeBulkLoad(uint64_t pageSize, double fillFactor) {
+    BpTreeConfig *config = New_BpTreeConfig(pageSize, "test_bulk_index", "test_bulk_config", "test_bulk_data");
+    config->fillFactor   = fillFactor;
+    BpTree *tree         = New_BpTree(config);
+    key_t *keys          = (key_t *)malloc(BULK_KEYS * sizeof(key_t));
+    val_t *values        = (val_t *)malloc(BULK_KEYS * sizeof(val_t));
+    uint64_t i;
+    for (i = 0; i < BULK_KEYS; i++) {
+        keys[i]   = i * 2;
+        values[i] = (val_t)keys[i] * 10;
+    }
+    keys[1] = 0;
+    assert(!BpTree_BulkLoad(tree, keys, values, BULK_KEYS));
+    keys[1] = 2;
+    assert(BpTree_BulkLoad(tree, keys, values, 0) && tree->root == -1);
+
+    uint64_t before = nodesWritten();
+    assert(BpTree_BulkLoad(tree, keys, values, BULK_KEYS));
+    uint64_t nodes = tree->leafNum + tree->indexNum;
+    assert(nodesWritten() - before == nodes);
+    // 结点从第2页开始连续写入，中间只有位图页，根结点最后写入
+    uint64_t page;
+    for (page = 0; page <= (uint64_t)tree->root / pageSize; page++) {
+        assert(!FreeMap_IsFree(tree->freeMap, page));
+    }
+    assert(allocatedNodes(tree->freeMap) == nodes);
+    uint64_t fill = (uint64_t)(tree->config->order * fillFactor);
+    assert(tree->leafNum == (BULK_KEYS + fill - 1) / fill);
+    assert(!BpTree_BulkLoad(tree, keys, values, BULK_KEYS));
+
+    for (i = 0; i < BULK_KEYS; i++) {
+        assert(BpTree_Select(tree, i * 2) == (val_t)i * 20);
+    }
+    assert(BpTree_Select(tree, 1) == -1);
+    assert(checkLeafChain(tree) == BULK_KEYS);
+
+    // 批量加载之后仍然可以逐个插入
+    for (i = 0; i < 2000; i++) {
+        key_t key = (i * 7919 % 2000) * 2 + 1;
+        assert(BpTree_Insert(tree, key, (val_t)key * 10) == (val_t)key * 10);
+    }
+    assert(BpTree_Select(tree, 3999) == 39990);
+    assert(checkLeafChain(tree) == BULK_KEYS + 2000);
+    free(keys);
+    free(values);
+    Destroy_BpTree(tree);
+    unlink("test_bulk_index");
+    unlink("test_bulk_config");
+    unlink("test_bulk_data");
+}
+
+void test_BpTree_BulkLoad() {
+    runBpTreeBulkLoad(DEFAULT_PAGE_SIZE, DEFAULT_FILL_FACTOR);
+    runBpTreeBulkLoad(DEFAULT_PAGE_SIZE, 1.0);
+    runBpTreeBulkLoad(256, 0.5);
+    printf("test_BpTree_BulkLoad passed.\n");
+}
+
+void test_FreeMap() {
+    uint64_t pageSize = 256, groupPages = pageSize * 8;
+    CreateFileIfNotExists("test_freemap", 4 * pageSize);
+    int fd       = OpenFile("test_freemap");
+    FreeMap *map = New_FreeMap(fd, pageSize, 4);
+    // 第0页和第1页（第0组的位图）保留
+    assert(FreeMap_Alloc(map, 1) == 2);
+    assert(FreeMap_Alloc(map, 5) == 3);
+    assert(map->pageCount == 8 && FileLength(fd) == (off_t)(8 * pageSize));
+    FreeMap_Free(map, 4, 2);
+    assert(FreeMap_IsFree(map, 4) && FreeMap_IsFree(map, 5) && !FreeMap_IsFree(map, 6));
+    assert(map->hint == 4);
+    assert(FreeMap_Alloc(map, 1) == 4);
+    assert(FreeMap_Alloc(map, 3) == 8);  // 第5页前后不够3个连续的页面
+    assert(map->hint == 5);
+    assert(FreeMap_Alloc(map, 1) == 5);
+    assert(map->hint == 6);
+
+    // 第1组的位图页不会被分配，连续的页面不跨过它
+    uint64_t page;
+    while ((page = FreeMap_Alloc(map, 1)) < groupPages - 3) {
+    }
+    assert(page == groupPages - 3 && map->groupNum == 1);
+    assert(FreeMap_Alloc(map, 4) == (int64_t)groupPages + 1);
+    assert(map->groupNum == 2 && !FreeMap_IsFree(map, groupPages));
+    assert(FreeMap_Alloc(map, 2) == (int64_t)groupPages - 2);
+    FreeMap_Flush(map);
+    assert(map->dirtyGroups == 0);
+    Destroy_FreeMap(map);
+
+    // 重新打开时不读位图，访问时才读入
+    map = New_FreeMap(fd, pageSize, FileLength(fd) / pageSize);
+    assert(map->chunks[0] == NULL && map->chunks[1] == NULL);
+    assert(!FreeMap_IsFree(map, 4) && !FreeMap_IsFree(map, groupPages + 4) && FreeMap_IsFree(map, groupPages + 5));
+    assert(map->chunks[0] != NULL && map->chunks[1] != NULL);
+    assert(FreeMap_Alloc(map, 1) == (int64_t)groupPages + 5);
+    Destroy_FreeMap(map);
+    CloseFile(fd);
+    unlink("test_freemap");
+    printf("test_FreeMap passed.\n");
+}
+
+void test_BpTree_Reopen() {
+    BpTreeConfig *config = New_BpTreeConfig(256, "test_reopen_index", "test_reopen_config", "test_reopen_data");
+    BpTree *tree         = New_BpTree(config);
+    assert(tree->root == -1 && tree->superSeq == 0);
+    uint64_t i;
+    for (i = 0; i < INSERT_KEYS; i++) {
+        key_t key = (i * 7919) % INSERT_KEYS;
+        BpTree_Insert(tree, key, (val_t)key * 10);
+    }
+    off_t root        = tree->root;
+    uint64_t height   = tree->height, leafNum = tree->leafNum, indexNum = tree->indexNum;
+    uint64_t superSeq = tree->superSeq;
+    assert(superSeq > 1 && superSeq <= leafNum + indexNum);  // 创建根结点和每次分裂时更新超级块
+    Destroy_BpTree(tree);
+
+    // 打开时使用索引文件创建时的页面大小
+    tree = New_BpTree(New_BpTreeConfig(DEFAULT_PAGE_SIZE, "test_reopen_index", "test_reopen_config", "test_reopen_data"));
+    assert(tree->config->pageSize == 256 && tree->config->order == (256 - BPTREE_NODE_HEADER_SIZE) / sizeof(Index));
+    assert(tree->root == root && tree->height == height && tree->leafNum == leafNum && tree->indexNum == indexNum);
+    assert(tree->superSeq == superSeq && tree->freeMap->hint > 0);
+    for (i = 0; i < INSERT_KEYS; i++) {
+        assert(BpTree_Select(tree, i) == (val_t)i * 10);
+    }
+    // 新分配的结点不会覆盖已有的结点
+    for (i = INSERT_KEYS; i < INSERT_KEYS + 2000; i++) {
+        assert(BpTree_Insert(tree, i, (val_t)i * 10) == (val_t)i * 10);
+    }
+    assert(checkLeafChain(tree) == INSERT_KEYS + 2000);
+    assert(allocatedNodes(tree->freeMap) == tree->leafNum + tree->indexNum);
+    superSeq = tree->superSeq;
+    root     = tree->root;
+    Destroy_BpTree(tree);
+
+    // 最新的一份超级块写坏了，使用另一份
+    int fd = OpenFile("test_reopen_index");
+    Superblock older;
+    S_PREAD(fd, &older, sizeof(Superblock), (off_t)((superSeq - 1) % 2) * SUPERBLOCK_SLOT_SIZE);
+    uint32_t garbage = 0xdeadbeef;
+    S_PWRITE(fd, &garbage, sizeof(garbage), (off_t)(superSeq % 2) * SUPERBLOCK_SLOT_SIZE + 16);
+    CloseFile(fd);
+    tree = New_BpTree(New_BpTreeConfig(256, "test_reopen_index", "test_reopen_config", "test_reopen_data"));
+    assert(tree->superSeq == superSeq - 1 && older.seq == superSeq - 1);
+    assert(tree->root == older.root && tree->leafNum == older.leafNum);
+    Destroy_BpTree(tree);
+    unlink("test_reopen_index");
+    unlink("test_reopen_config");
+    unlink("test_reopen_data");
+    printf("test_BpTree_Reopen passed.\n");
+}
@@ -0,0 +1,205 @@
+#include "./aio.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <linux/io_uring.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "./log.h"
+
+PRIVATE int AioSetup(uint32_t entries, struct io_uring_params *params) {
+    return (int)syscall(__NR_io_uring_setup, entries, params);
+}
+
+PRIVATE int AioEnter(int ringFd, uint32_t submit, uint32_t complete, uint32_t flags) {
+    return (int)syscall(__NR_io_uring_enter, ringFd, submit, complete, flags, NULL, 0);
+}
+
+/* 映射提交队列、完成队列和sqe数组，失败时返回false */
+PRIVATE bool AioMapRings(Aio *aio, struct io_uring_params *params) {
+    aio->sqRingSize = params->sq_off.array + params->sq_entries * sizeof(unsigned);
+    aio->cqRingSize = params->cq_off.cqes + params->cq_entries * sizeof(struct io_uring_cqe);
+    bool single     = (params->features & IORING_FEAT_SINGLE_MMAP) != 0;
+    if (single && aio->cqRingSize > aio->sqRingSize) {
+        aio->sqRingSize = aio->cqRingSize;
+    }
+    aio->sqRing = mmap(NULL, aio->sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                       aio->ringFd, IORING_OFF_SQ_RING);
+    if (aio->sqRing == MAP_FAILED) {
+        aio->sqRing = NULL;
+        return false;
+    }
+    if (single) {
+        aio->cqRing = aio->sqRing;
+    } else {
+        aio->cqRing = mmap(NULL, aio->cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                           aio->ringFd, IORING_OFF_CQ_RING);
+        if (aio->cqRing == MAP_FAILED) {
+            aio->cqRing = NULL;
+            return false;
+        }
+    }
+    aio->sqesSize = params->sq_entries * sizeof(struct io_uring_sqe);
+    aio->sqes     = mmap(NULL, aio->sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                     aio->ringFd, IORING_OFF_SQES);
+    if (aio->sqes == MAP_FAILED) {
+        aio->sqes = NULL;
+        return false;
+    }
+    char *sq     = (char *)aio->sqRing;
+    char *cq     = (char *)aio->cqRing;
+    aio->sqHead  = (unsigned *)(sq + params->sq_off.head);
+    aio->sqTail  = (unsigned *)(sq + params->sq_off.tail);
+    aio->sqMask  = (unsigned *)(sq + params->sq_off.ring_mask);
+    aio->sqArray = (unsigned *)(sq + params->sq_off.array);
+    aio->cqHead  = (unsigned *)(cq + params->cq_off.head);
+    aio->cqTail  = (unsigned *)(cq + params->cq_off.tail);
+    aio->cqMask  = (unsigned *)(cq + params->cq_off.ring_mask);
+    aio->cqes    = cq + params->cq_off.cqes;
+    aio->depth   = params->sq_entries;
+    return true;
+}
+
+PRIVATE void AioUnmapRings(Aio *aio) {
+    if (aio->sqes != NULL) {
+        munmap(aio->sqes, aio->sqesSize);
+    }
+    if (aio->cqRing != NULL && aio->cqRing != aio->sqRing) {
+        munmap(aio->cqRing, aio->cqRingSize);
+    }
+    if (aio->sqRing != NULL) {
+        munmap(aio->sqRing, aio->sqRingSize);
+    }
+}
+
+/**
+ * 创建一个队列深度为depth的 io_uring。内核不支持时返回的Aio退化为同步I/O，
+ * 调用者不需要区分这两种情况。
+ */
+TINYDB_API Aio *New_Aio(uint32_t depth) {
+    Aio *aio = (Aio *)calloc(1, sizeof(Aio));
+    assert(aio != NULL);
+    aio->depth  = depth == 0 ? 1 : depth;
+    aio->ringFd = -1;
+
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    int fd = AioSetup(aio->depth, &params);
+    if (fd < 0) {
+        LOG_WARN("io_uring is not available, use synchronous I/O.");
+        return aio;
+    }
+    aio->ringFd = fd;
+    if (!AioMapRings(aio, &params)) {
+        LOG_ERROR("Failed to map io_uring: %s", strerror(errno));
+        AioUnmapRings(aio);
+        close(fd);
+        aio->ringFd = -1;
+        aio->depth  = depth == 0 ? 1 : depth;
+    }
+    return aio;
+}
+
+TINYDB_API void Destroy_Aio(Aio *aio) {
+    if (aio == NULL) {
+        return;
+    }
+    if (aio->ringFd != -1) {
+        AioUnmapRings(aio);
+        close(aio->ringFd);
+    }
+    free(aio);
+}
+
+TINYDB_API bool Aio_IsAsync(Aio *aio) {
+    return aio != NULL && aio->ringFd != -1;
+}
+
+PRIVATE bool AioFailed(AioRequest *request) {
+    return request->result < 0 || (request->write && (size_t)request->result != request->size);
+}
+
+/* 同步执行所有请求 */
+PRIVATE int32_t AioExecuteSync(AioRequest *requests, int32_t n) {
+    int32_t i, failed = 0;
+    for (i = 0; i < n; i++) {
+        AioRequest *r = &requests[i];
+        r->result     = r->write ? pwrite(r->fd, r->buffer, r->size, r->offset)
+                                 : pread(r->fd, r->buffer, r->size, r->offset);
+        if (r->result < 0) {
+            r->result = -errno;
+        }
+        failed += AioFailed(r);
+    }
+    return failed;
+}
+
+/**
+ * 执行n个读写请求，等待它们全部完成之后返回。同时在途的请求最多depth个，
+ * 一个请求完成后立即提交下一个，让设备的队列始终保持满的。
+ * 请求之间没有顺序保证，调用者不能在同一批中读写同一块区域。
+ * 读到文件末尾时result小于size，不算失败。
+ *
+ * @param aio: NULL for synchronous I/O
+ * @return number of failed requests
+ */
+TINYDB_API int32_t Aio_Execute(Aio *aio, AioRequest *requests, int32_t n) {
+    if (!Aio_IsAsync(aio)) {
+        return AioExecuteSync(requests, n);
+    }
+    struct io_uring_sqe *sqes = (struct io_uring_sqe *)aio->sqes;
+    struct io_uring_cqe *cqes = (struct io_uring_cqe *)aio->cqes;
+    int32_t next = 0, done = 0, inflight = 0, failed = 0;
+    while (done < n) {
+        // 填满提交队列
+        unsigned tail    = *aio->sqTail;
+        uint32_t pending = 0;
+        while (next < n && inflight + (int32_t)pending < (int32_t)aio->depth) {
+            AioRequest *r            = &requests[next];
+            unsigned index           = tail & *aio->sqMask;
+            struct io_uring_sqe *sqe = &sqes[index];
+            memset(sqe, 0, sizeof(struct io_uring_sqe));
+            sqe->opcode         = r->write ? IORING_OP_WRITE : IORING_OP_READ;
+            sqe->fd             = r->fd;
+            sqe->addr           = (uint64_t)(uintptr_t)r->buffer;
+            sqe->len            = (uint32_t)r->size;
+            sqe->off            = (uint64_t)r->offset;
+            sqe->user_data      = (uint64_t)next;
+            aio->sqArray[index] = index;
+            tail++;
+            next++;
+            pending++;
+        }
+        __atomic_store_n(aio->sqTail, tail, __ATOMIC_RELEASE);
+
+        int ret;
+        do {
+            ret = AioEnter(aio->ringFd, pending, 1, IORING_ENTER_GETEVENTS);
+        } while (ret < 0 && errno == EINTR);
+        if (ret < 0) {
+            LOG_ERROR("io_uring_enter failed: %s", strerror(errno));
+            // 剩下没有提交的请求同步执行
+            return failed + AioExecuteSync(requests + next - pending, n - (next - pending)) + inflight;
+        }
+        inflight += pending;
+
+        // 收割完成的请求
+        unsigned head = *aio->cqHead;
+        while (head != __atomic_load_n(aio->cqTail, __ATOMIC_ACQUIRE)) {
+            struct io_uring_cqe *cqe = &cqes[head & *aio->cqMask];
+            AioRequest *r            = &requests[cqe->user_data];
+            r->result                = cqe->res;
+            failed += AioFailed(r);
+            head++;
+            done++;
+            inflight--;
+        }
+        __atomic_store_n(aio->cqHead, head, __ATOMIC_RELEASE);
+    }
+    return failed;
+}
@@ -0,0 +1,51 @@
+#ifndef TINYDB_AIO_H
+#define TINYDB_AIO_H
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "./global.h"
+
+/**
+ * 一次读或写请求，由 Aio_Execute 填写result。
+ * result: bytes transferred, or -errno
+ */
+typedef struct AioRequest {
+    int fd;
+    bool write;
+    void *buffer;
+    size_t size;
+    off_t offset;
+    ssize_t result;
+} AioRequest;
+
+/**
+ * io_uring 的提交队列和完成队列，直接通过系统调用使用，不依赖liburing。
+ * 内核不支持 io_uring 时（ringFd == -1），退化为逐个调用pread/pwrite。
+ * depth: max number of requests in flight
+ */
+typedef struct Aio {
+    int ringFd;
+    uint32_t depth;
+    void *sqRing;
+    size_t sqRingSize;
+    void *cqRing;
+    size_t cqRingSize;
+    void *sqes;
+    size_t sqesSize;
+    unsigned *sqHead;
+    unsigned *sqTail;
+    unsigned *sqMask;
+    unsigned *sqArray;
+    unsigned *cqHead;
+    unsigned *cqTail;
+    unsigned *cqMask;
+    void *cqes;
+} Aio;
+
+TINYDB_API Aio *New_Aio(uint32_t depth);
+TINYDB_API void Destroy_Aio(Aio *aio);
+TINYDB_API int32_t Aio_Execute(Aio *aio, AioRequest *requests, int32_t n);
+TINYDB_API bool Aio_IsAsync(Aio *aio);
+
+#endif
@@ -8,6 +8,8 @@
 #include <sys/stat.h>
 #include <unistd.h>
 
+#include "./log.h"
+
 /**
  * Size of file is always times of 4096 bytes. 
  */
@@ -16,16 +18,9 @@ void CreateFileIfNotExists(const char *file, off_t size) {
         EXIT_ERROR("file is not exists.\n");
     }
     if (access(file, F_OK) == 0) {
-        printf("%s is already exists.\n", file);
-        if (access(file, R_OK) == 0) {
-            printf("%s can read,", file);
-        }
-        if (access(file, W_OK) == 0) {
-            printf("write");
-        }
-        printf(".\n");
+        LOG_DEBUG("%s is already exists.", file);
     } else {
-        printf("%s is not exists, it will be create later.\n", file);
+        LOG_DEBUG("%s is not exists, it will be create later.", file);
         // 创建一个文件，大小为一个pagesize。
         FILE *fp = fopen(file, "wb+");
         if (fp == NULL) {
@@ -4,26 +4,41 @@
 
 #include "./global.h"
 
-#define S_SEEK(fd, off, seek) (        \
+#define S_SEEK(fd, off, seek)             \
     do {                                  \
         if (lseek(fd, off, seek) == -1) { \
             EXIT_ERROR("Error Seek.\n");  \
         }                                 \
-    } while (0))
-
-#define S_READ(fd, buffer, size) (         \
-    do {                                      \
-        if (read(fd, buffer, size) != size) { \
-            EXIT_ERROR("Error Read.\n");      \
-        }                                     \
-    } while (0))
-
-#define S_WRITE(fd, buffer, size) (         \
-    do {                                       \
-        if (write(fd, buffer, size) != size) { \
-            EXIT_ERROR("Error write.\n");      \
-        }                                      \
-    } while (0))
+    } while (0)
+
+#define S_READ(fd, buffer, size)                       \
+    do {                                               \
+        if (read(fd, buffer, size) != (ssize_t)size) { \
+            EXIT_ERROR("Error Read.\n");               \
+        }                                              \
+    } while (0)
+
+#define S_WRITE(fd, buffer, size)                       \
+    do {                                                \
+        if (write(fd, buffer, size) != (ssize_t)size) { \
+            EXIT_ERROR("Error write.\n");               \
+        }                                               \
+    } while (0)
+
+/* 带偏移量的读写，不移动文件偏移量，多个线程可以同时使用同一个fd */
+#define S_PREAD(fd, buffer, size, off)                       \
+    do {                                                     \
+        if (pread(fd, buffer, size, off) != (ssize_t)size) { \
+            EXIT_ERROR("Error Read.\n");                     \
+        }                                                    \
+    } while (0)
+
+#define S_PWRITE(fd, buffer, size, off)                       \
+    do {                                                      \
+        if (pwrite(fd, buffer, size, off) != (ssize_t)size) { \
+            EXIT_ERROR("Error write.\n");                     \
+        }                                                     \
+    } while (0)
 
 // #define 
 
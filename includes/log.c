@@ -0,0 +1,169 @@
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include "./log.h"
+
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define LOG_BATCH_SIZE (64 * LOG_ENTRY_SIZE)
+
+/**
+ * 环形缓冲区的一个槽位（Vyukov 有界队列）
+ * seq == position: 空闲，等待 position 处的生产者
+ * seq == position + 1: 已写入，等待消费者
+ * 消费者读完后置为 position + LOG_RING_SIZE，即下一圈的空闲状态
+ */
+typedef struct LogSlot {
+    uint64_t seq;
+    int32_t level;
+    int32_t length;
+    char text[LOG_ENTRY_SIZE];
+} LogSlot;
+
+int32_t LogLevel = LOG_LEVEL;
+
+PRIVATE LogSlot LogRing[LOG_RING_SIZE];
+PRIVATE uint64_t LogHead     = 0;  // next position to be reserved by a producer
+PRIVATE uint64_t LogTail     = 0;  // next position to be drained, advanced after the batch is written
+PRIVATE uint64_t LogDropped  = 0;
+PRIVATE int LogFd            = STDOUT_FILENO;
+PRIVATE pthread_once_t LogOnce = PTHREAD_ONCE_INIT;
+PRIVATE pthread_t LogThread;
+
+PRIVATE const char *LOG_LEVEL_NAMES[] = {"DEBUG", "INFO", "WARN", "ERROR"};
+
+PRIVATE void LogSleep(long us) {
+    struct timespec ts = {us / 1000000, (us % 1000000) * 1000};
+    nanosleep(&ts, NULL);
+}
+
+PRIVATE void LogWriteAll(const char *buf, size_t size) {
+    int fd = __atomic_load_n(&LogFd, __ATOMIC_ACQUIRE);
+    while (size > 0) {
+        ssize_t n = write(fd, buf, size);
+        if (n <= 0) {
+            return;  // 输出出错时丢弃，日志不能反过来影响调用者
+        }
+        buf += n;
+        size -= n;
+    }
+}
+
+/* 后台线程：把已写入的槽位按顺序拷进批量缓冲区，一次 write 出去 */
+PRIVATE void *LogDrain(void *arg) {
+    char batch[LOG_BATCH_SIZE];
+    uint64_t tail = __atomic_load_n(&LogTail, __ATOMIC_RELAXED);
+    while (true) {
+        size_t size = 0;
+        while (size + LOG_ENTRY_SIZE <= LOG_BATCH_SIZE) {
+            LogSlot *slot = &LogRing[tail & (LOG_RING_SIZE - 1)];
+            if (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) != tail + 1) {
+                break;
+            }
+            memcpy(batch + size, slot->text, slot->length);
+            size += slot->length;
+            __atomic_store_n(&slot->seq, tail + LOG_RING_SIZE, __ATOMIC_RELEASE);
+            tail++;
+        }
+        if (size == 0) {
+            LogSleep(LOG_DRAIN_US);
+            continue;
+        }
+        LogWriteAll(batch, size);
+        __atomic_store_n(&LogTail, tail, __ATOMIC_RELEASE);
+    }
+    return NULL;
+}
+
+PRIVATE void LogAtExit() {
+    Log_Flush();
+}
+
+PRIVATE void LogInit() {
+    uint64_t i;
+    for (i = 0; i < LOG_RING_SIZE; i++) {
+        LogRing[i].seq = i;
+    }
+    if (pthread_create(&LogThread, NULL, LogDrain, NULL) != 0) {
+        EXIT_ERROR("Failed to create log thread");
+    }
+    pthread_detach(LogThread);
+    atexit(LogAtExit);
+}
+
+TINYDB_API void Log_SetLevel(int32_t level) {
+    __atomic_store_n(&LogLevel, level, __ATOMIC_RELAXED);
+}
+
+/**
+ * 切换输出文件，之前的日志先写完再切换
+ * @param fd: the caller owns fd and keeps it open while logging to it
+ */
+TINYDB_API void Log_SetOutput(int fd) {
+    Log_Flush();
+    __atomic_store_n(&LogFd, fd, __ATOMIC_RELEASE);
+}
+
+/**
+ * 格式化一条日志放进环形缓冲区，末尾自动加换行。缓冲区满时丢弃这条日志。
+ */
+TINYDB_API void Log_Write(int32_t level, const char *format, ...) {
+    pthread_once(&LogOnce, LogInit);
+    LogSlot *slot;
+    uint64_t pos = __atomic_load_n(&LogHead, __ATOMIC_RELAXED);
+    while (true) {
+        slot         = &LogRing[pos & (LOG_RING_SIZE - 1)];
+        uint64_t seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+        int64_t diff = (int64_t)(seq - pos);
+        if (diff == 0) {
+            if (__atomic_compare_exchange_n(&LogHead, &pos, pos + 1, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                break;
+            }
+        } else if (diff < 0) {
+            __atomic_fetch_add(&LogDropped, 1, __ATOMIC_RELAXED);
+            return;
+        } else {
+            pos = __atomic_load_n(&LogHead, __ATOMIC_RELAXED);
+        }
+    }
+
+    if (level < LOG_LEVEL_DEBUG || level > LOG_LEVEL_ERROR) {
+        level = LOG_LEVEL_ERROR;
+    }
+    int32_t length = snprintf(slot->text, LOG_ENTRY_SIZE, "[%s] ", LOG_LEVEL_NAMES[level]);
+    va_list args;
+    va_start(args, format);
+    int32_t n = vsnprintf(slot->text + length, LOG_ENTRY_SIZE - length, format, args);
+    va_end(args);
+    length += n < 0 ? 0 : n;
+    if (length > LOG_ENTRY_SIZE - 1) {
+        length = LOG_ENTRY_SIZE - 1;
+    }
+    slot->text[length++] = '\n';
+    slot->level          = level;
+    slot->length         = length;
+    __atomic_store_n(&slot->seq, pos + 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * 等待调用之前放进缓冲区的日志全部写到输出文件
+ */
+TINYDB_API void Log_Flush() {
+    uint64_t head = __atomic_load_n(&LogHead, __ATOMIC_ACQUIRE);
+    while (__atomic_load_n(&LogTail, __ATOMIC_ACQUIRE) < head) {
+        LogSleep(LOG_DRAIN_US / 10);
+    }
+}
+
+/**
+ * @return number of messages dropped because the ring buffer was full
+ */
+TINYDB_API uint64_t Log_Dropped() {
+    return __atomic_load_n(&LogDropped, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,82 @@
+#ifndef TINYDB_LOG_H
+#define TINYDB_LOG_H
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "./global.h"
+
+#define LOG_LEVEL_DEBUG 0
+#define LOG_LEVEL_INFO 1
+#define LOG_LEVEL_WARN 2
+#define LOG_LEVEL_ERROR 3
+#define LOG_LEVEL_OFF 4
+
+/* 编译期级别：低于它的日志调用连同参数求值一起被预处理掉，-DLOG_LEVEL=LOG_LEVEL_OFF 关闭所有日志 */
+#ifndef LOG_LEVEL
+#define LOG_LEVEL LOG_LEVEL_INFO
+#endif
+
+#define LOG_RING_SIZE 1024  // entries in the ring buffer, must be a power of 2
+#define LOG_ENTRY_SIZE 256  // max bytes of one message, longer messages are truncated
+#define LOG_DRAIN_US 1000   // sleep of the drain thread when the ring is empty
+
+/**
+ * 分级日志。
+ *
+ * 调用者只把消息格式化进一个无锁的有界环形缓冲区（多生产者单消费者），
+ * 由后台线程批量 write 到输出文件，热路径上没有 stdio 和锁。缓冲区满时丢弃消息并计数，
+ * 不会阻塞调用者。后台线程在第一条日志时启动，进程退出前会把缓冲区写完。
+ *
+ * 运行期级别由 Log_SetLevel 设置，只能在编译期级别之上进一步过滤。
+ */
+
+extern int32_t LogLevel;
+
+#define LOG_ENABLED(level) (__atomic_load_n(&LogLevel, __ATOMIC_RELAXED) <= (level))
+
+#define LOG_AT(level, ...)                 \
+    do {                                   \
+        if (LOG_ENABLED(level)) {          \
+            Log_Write(level, __VA_ARGS__); \
+        }                                  \
+    } while (0)
+
+#if LOG_LEVEL <= LOG_LEVEL_DEBUG
+#define LOG_DEBUG(...) LOG_AT(LOG_LEVEL_DEBUG, __VA_ARGS__)
+#else
+#define LOG_DEBUG(...) \
+    do {               \
+    } while (0)
+#endif
+
+#if LOG_LEVEL <= LOG_LEVEL_INFO
+#define LOG_INFO(...) LOG_AT(LOG_LEVEL_INFO, __VA_ARGS__)
+#else
+#define LOG_INFO(...) \
+    do {              \
+    } while (0)
+#endif
+
+#if LOG_LEVEL <= LOG_LEVEL_WARN
+#define LOG_WARN(...) LOG_AT(LOG_LEVEL_WARN, __VA_ARGS__)
+#else
+#define LOG_WARN(...) \
+    do {              \
+    } while (0)
+#endif
+
+#if LOG_LEVEL <= LOG_LEVEL_ERROR
+#define LOG_ERROR(...) LOG_AT(LOG_LEVEL_ERROR, __VA_ARGS__)
+#else
+#define LOG_ERROR(...) \
+    do {               \
+    } while (0)
+#endif
+
+TINYDB_API void Log_SetLevel(int32_t level);
+TINYDB_API void Log_SetOutput(int fd);
+TINYDB_API void Log_Write(int32_t level, const char *format, ...) __attribute__((format(printf, 2, 3)));
+TINYDB_API void Log_Flush();
+TINYDB_API uint64_t Log_Dropped();
+
+#endif
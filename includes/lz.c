@@ -0,0 +1,155 @@
+#include "./lz.h"
+
+#include <stdbool.h>
+#include <string.h>
+
+#define LZ_HASH_BITS 12
+
+PRIVATE uint32_t LzHash(const char *p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(uint32_t));
+    return (v * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+/* 写入长度n超出token部分的扩展字节：若干个255，最后一个小于255 */
+PRIVATE bool LzPutLength(char *dst, int32_t capacity, int32_t *out, int32_t n) {
+    for (; n >= 255; n -= 255) {
+        if (*out >= capacity) {
+            return false;
+        }
+        dst[(*out)++] = (char)255;
+    }
+    if (*out >= capacity) {
+        return false;
+    }
+    dst[(*out)++] = (char)n;
+    return true;
+}
+
+/**
+ * 输出一个序列
+ * @param length: length of the match, 0 for the last sequence which has no match
+ */
+PRIVATE bool LzEmit(char *dst, int32_t capacity, int32_t *out, const char *literals, int32_t literalLength,
+                    int32_t offset, int32_t length) {
+    int32_t match = length == 0 ? 0 : length - LZ_MIN_MATCH;
+    if (*out >= capacity) {
+        return false;
+    }
+    dst[(*out)++] = (char)((literalLength < 15 ? literalLength : 15) << 4 | (match < 15 ? match : 15));
+    if (literalLength >= 15 && !LzPutLength(dst, capacity, out, literalLength - 15)) {
+        return false;
+    }
+    if (*out + literalLength > capacity) {
+        return false;
+    }
+    memcpy(dst + *out, literals, literalLength);
+    *out += literalLength;
+    if (length == 0) {
+        return true;
+    }
+    if (*out + 2 > capacity) {
+        return false;
+    }
+    dst[(*out)++] = (char)(offset & 0xFF);
+    dst[(*out)++] = (char)(offset >> 8);
+    return match < 15 || LzPutLength(dst, capacity, out, match - 15);
+}
+
+/**
+ * 贪心匹配：用哈希表记住每个4字节序列最后出现的位置，当前位置的4字节在表中出现过，
+ * 并且距离不超过 LZ_MAX_OFFSET 时，尽量向后延长匹配。
+ *
+ * @param src: src[0, dictSize) is the dictionary, src[dictSize, size) is compressed
+ * @return compressed size, -1 if it exceeds capacity
+ */
+TINYDB_API int32_t Lz_Compress(const char *src, int32_t dictSize, int32_t size, char *dst, int32_t capacity) {
+    int32_t table[1 << LZ_HASH_BITS];
+    int32_t i, out = 0;
+    memset(table, -1, sizeof(table));
+    for (i = 0; i + LZ_MIN_MATCH <= dictSize; i++) {
+        table[LzHash(src + i)] = i;
+    }
+    int32_t anchor = dictSize, pos = dictSize;
+    while (pos + LZ_MIN_MATCH <= size) {
+        uint32_t h  = LzHash(src + pos);
+        int32_t ref = table[h];
+        table[h]    = pos;
+        if (ref < 0 || pos - ref > LZ_MAX_OFFSET || memcmp(src + ref, src + pos, LZ_MIN_MATCH) != 0) {
+            pos++;
+            continue;
+        }
+        int32_t length = LZ_MIN_MATCH;
+        while (pos + length < size && src[ref + length] == src[pos + length]) {
+            length++;
+        }
+        if (!LzEmit(dst, capacity, &out, src + anchor, pos - anchor, pos - ref, length)) {
+            return -1;
+        }
+        // 匹配覆盖的位置也放进哈希表，后面的匹配常常引用它们
+        for (i = pos + 1; i < pos + length && i + LZ_MIN_MATCH <= size; i++) {
+            table[LzHash(src + i)] = i;
+        }
+        pos += length;
+        anchor = pos;
+    }
+    return LzEmit(dst, capacity, &out, src + anchor, size - anchor, 0, 0) ? out : -1;
+}
+
+/* 读取扩展长度字节 */
+PRIVATE bool LzGetLength(const unsigned char *src, int32_t size, int32_t *in, int32_t *n) {
+    unsigned char b;
+    do {
+        if (*in >= size) {
+            return false;
+        }
+        b = src[(*in)++];
+        *n += b;
+    } while (b == 255);
+    return true;
+}
+
+/**
+ * @param dst: dst[0, dictSize) must hold the dictionary used by Lz_Compress,
+ *             the data is decompressed into dst[dictSize, capacity)
+ * @return end of the decompressed data in dst, -1 if src is corrupted
+ */
+TINYDB_API int32_t Lz_Decompress(const char *src, int32_t size, char *dst, int32_t dictSize, int32_t capacity) {
+    const unsigned char *in8 = (const unsigned char *)src;
+    int32_t in = 0, out = dictSize;
+    while (in < size) {
+        unsigned char token   = in8[in++];
+        int32_t literalLength = token >> 4;
+        if (literalLength == 15 && !LzGetLength(in8, size, &in, &literalLength)) {
+            return -1;
+        }
+        if (in + literalLength > size || out + literalLength > capacity) {
+            return -1;
+        }
+        memcpy(dst + out, src + in, literalLength);
+        in += literalLength;
+        out += literalLength;
+        if (in == size) {
+            break;
+        }
+        if (in + 2 > size) {
+            return -1;
+        }
+        int32_t offset = in8[in] | in8[in + 1] << 8;
+        int32_t length = (token & 15) + LZ_MIN_MATCH;
+        in += 2;
+        if ((token & 15) == 15 && !LzGetLength(in8, size, &in, &length)) {
+            return -1;
+        }
+        if (offset == 0 || offset > out || out + length > capacity) {
+            return -1;
+        }
+        // 匹配可以与输出重叠，逐字节复制
+        int32_t i;
+        for (i = 0; i < length; i++) {
+            dst[out + i] = dst[out - offset + i];
+        }
+        out += length;
+    }
+    return out;
+}
@@ -0,0 +1,22 @@
+#ifndef TINYDB_LZ_H
+#define TINYDB_LZ_H
+#include <stdint.h>
+
+#include "./global.h"
+
+#define LZ_MIN_MATCH 4
+#define LZ_MAX_OFFSET 65535
+
+/**
+ * LZ77 压缩，不依赖任何外部库。输出是一串序列，每个序列依次是：
+ * token（高4位为字面量长度，低4位为匹配长度 - LZ_MIN_MATCH，等于15时后面跟着扩展长度字节）、
+ * 字面量、2字节小端的匹配距离。最后一个序列只有字面量。
+ *
+ * 压缩和解压都可以带一个预置字典：字典紧挨在数据之前，匹配可以引用字典中的字节，
+ * 字典本身不输出，解压时由调用者提供同样的字典。
+ */
+
+TINYDB_API int32_t Lz_Compress(const char *src, int32_t dictSize, int32_t size, char *dst, int32_t capacity);
+TINYDB_API int32_t Lz_Decompress(const char *src, int32_t size, char *dst, int32_t dictSize, int32_t capacity);
+
+#endif
@@ -0,0 +1,190 @@
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include "./metrics.h"
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+__thread MetricsShard *MetricsLocal = NULL;
+
+PRIVATE pthread_mutex_t MetricsLatch  = PTHREAD_MUTEX_INITIALIZER;  // protects the shard list and MetricsRetired
+PRIVATE pthread_once_t MetricsOnce    = PTHREAD_ONCE_INIT;
+PRIVATE pthread_key_t MetricsKey;
+PRIVATE MetricsShard *MetricsShards = NULL;
+PRIVATE MetricsShard MetricsRetired;  // 已经退出的线程的分片之和
+PRIVATE int64_t MetricsGauges[Metrics_GaugeCount];
+
+PRIVATE const char *METRICS_COUNTER_NAMES[Metrics_CounterCount] = {
+    "pages_read", "pages_written", "bytes_read", "bytes_written", "cache_hits", "cache_misses",
+    "page_splits", "page_merges", "partial_page_writes", "wal_bytes", "wal_syncs", "nodes_read", "nodes_written",
+    "node_splits", "node_merges",
+};
+
+PRIVATE const char *METRICS_GAUGE_NAMES[Metrics_GaugeCount] = {"bplustree_height", "bptree_height"};
+
+PRIVATE const char *METRICS_OP_NAMES[Metrics_OpCount] = {
+    "pager_insert",     "pager_insert_batch", "pager_select",     "pager_select_by",  "pager_update",
+    "pager_delete",     "pager_scan",         "pager_flush",      "pager_checkpoint", "pager_compact",
+    "bplustree_insert", "bplustree_select",   "bplustree_update", "bplustree_delete", "bptree_insert",
+    "bptree_select",
+};
+
+/* 把分片src加到dst上，src可能正在被所属线程写入，逐个字段relaxed读取 */
+PRIVATE void MetricsMerge(uint64_t *counters, MetricsHistogram *histograms, MetricsShard *src) {
+    int32_t i, k;
+    for (i = 0; i < Metrics_CounterCount; i++) {
+        counters[i] += __atomic_load_n(&src->counters[i], __ATOMIC_RELAXED);
+    }
+    for (i = 0; i < Metrics_OpCount; i++) {
+        MetricsHistogram *from = &src->histograms[i], *to = &histograms[i];
+        to->count += __atomic_load_n(&from->count, __ATOMIC_RELAXED);
+        to->sum += __atomic_load_n(&from->sum, __ATOMIC_RELAXED);
+        uint64_t max = __atomic_load_n(&from->max, __ATOMIC_RELAXED);
+        to->max      = max > to->max ? max : to->max;
+        for (k = 0; k < METRICS_BUCKETS; k++) {
+            to->buckets[k] += __atomic_load_n(&from->buckets[k], __ATOMIC_RELAXED);
+        }
+    }
+}
+
+/* 线程退出时把它的分片并入MetricsRetired */
+PRIVATE void MetricsRetire(void *arg) {
+    MetricsShard *shard = (MetricsShard *)arg;
+    pthread_mutex_lock(&MetricsLatch);
+    MetricsMerge(MetricsRetired.counters, MetricsRetired.histograms, shard);
+    if (shard->prev != NULL) {
+        shard->prev->next = shard->next;
+    } else {
+        MetricsShards = shard->next;
+    }
+    if (shard->next != NULL) {
+        shard->next->prev = shard->prev;
+    }
+    pthread_mutex_unlock(&MetricsLatch);
+    MetricsLocal = NULL;
+    free(shard);
+}
+
+PRIVATE void MetricsInit() {
+    if (pthread_key_create(&MetricsKey, MetricsRetire) != 0) {
+        EXIT_ERROR("Failed to create metrics key");
+    }
+}
+
+/**
+ * 为当前线程分配分片，由 Metrics_Local 在线程第一次记录时调用
+ */
+TINYDB_API MetricsShard *Metrics_Register() {
+    pthread_once(&MetricsOnce, MetricsInit);
+    MetricsShard *shard = (MetricsShard *)calloc(1, sizeof(MetricsShard));
+    assert(shard != NULL);
+    pthread_mutex_lock(&MetricsLatch);
+    shard->next = MetricsShards;
+    if (MetricsShards != NULL) {
+        MetricsShards->prev = shard;
+    }
+    MetricsShards = shard;
+    pthread_mutex_unlock(&MetricsLatch);
+    pthread_setspecific(MetricsKey, shard);
+    MetricsLocal = shard;
+    return shard;
+}
+
+/* 单调时钟，单位纳秒 */
+TINYDB_API uint64_t Metrics_Now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/**
+ * 记录一次操作的耗时
+ * @param ns: latency in nanoseconds, usually Metrics_Now() - start
+ */
+TINYDB_API void Metrics_Record(MetricsOp op, uint64_t ns) {
+    MetricsHistogram *histogram = &Metrics_Local()->histograms[op];
+    METRICS_BUMP(histogram->count, 1);
+    METRICS_BUMP(histogram->sum, ns);
+    METRICS_BUMP(histogram->buckets[Metrics_Bucket(ns)], 1);
+    if (ns > histogram->max) {
+        __atomic_store_n(&histogram->max, ns, __ATOMIC_RELAXED);
+    }
+}
+
+TINYDB_API void Metrics_SetGauge(MetricsGauge gauge, int64_t value) {
+    __atomic_store_n(&MetricsGauges[gauge], value, __ATOMIC_RELAXED);
+}
+
+/**
+ * 汇总所有线程的分片。分片在汇总的过程中仍然可能被写入，
+ * 所以不同字段之间不保证是同一时刻的值，但每个字段都是完整的。
+ */
+TINYDB_API void Metrics_Snapshot(MetricsSnapshot *snapshot) {
+    memset(snapshot, 0, sizeof(MetricsSnapshot));
+    pthread_mutex_lock(&MetricsLatch);
+    MetricsMerge(snapshot->counters, snapshot->histograms, &MetricsRetired);
+    MetricsShard *shard;
+    for (shard = MetricsShards; shard != NULL; shard = shard->next) {
+        MetricsMerge(snapshot->counters, snapshot->histograms, shard);
+    }
+    pthread_mutex_unlock(&MetricsLatch);
+    int32_t i;
+    for (i = 0; i < Metrics_GaugeCount; i++) {
+        snapshot->gauges[i] = __atomic_load_n(&MetricsGauges[i], __ATOMIC_RELAXED);
+    }
+}
+
+/**
+ * @param p: quantile in (0, 1], e.g. 0.99 for p99
+ * @return midpoint of the bucket that contains the quantile, never larger than max; 0 if there is no sample
+ */
+TINYDB_API uint64_t Metrics_Percentile(const MetricsHistogram *histogram, double p) {
+    if (histogram->count == 0) {
+        return 0;
+    }
+    uint64_t rank = (uint64_t)(p * histogram->count + 0.5), seen = 0;
+    rank          = rank == 0 ? 1 : rank;
+    int32_t i;
+    for (i = 0; i < METRICS_BUCKETS; i++) {
+        seen += histogram->buckets[i];
+        if (seen >= rank) {
+            break;
+        }
+    }
+    if (i < METRICS_SUB_BUCKETS) {
+        return i;
+    }
+    int32_t msb    = i / METRICS_SUB_BUCKETS;
+    uint64_t width = 1ull << (msb - METRICS_SUB_BITS);
+    uint64_t mid   = (uint64_t)(METRICS_SUB_BUCKETS + i % METRICS_SUB_BUCKETS) * width + width / 2;
+    return mid < histogram->max ? mid : histogram->max;
+}
+
+/* 文本格式输出，没有样本的操作不输出 */
+TINYDB_API void Metrics_Dump(const MetricsSnapshot *snapshot, FILE *fp) {
+    int32_t i;
+    fprintf(fp, "counters:\n");
+    for (i = 0; i < Metrics_CounterCount; i++) {
+        fprintf(fp, "  %-20s %llu\n", METRICS_COUNTER_NAMES[i], (unsigned long long)snapshot->counters[i]);
+    }
+    fprintf(fp, "gauges:\n");
+    for (i = 0; i < Metrics_GaugeCount; i++) {
+        fprintf(fp, "  %-20s %lld\n", METRICS_GAUGE_NAMES[i], (long long)snapshot->gauges[i]);
+    }
+    fprintf(fp, "latency (ns):\n  %-20s %10s %10s %10s %10s %10s %10s\n", "op", "count", "avg", "p50", "p99", "p999",
+            "max");
+    for (i = 0; i < Metrics_OpCount; i++) {
+        const MetricsHistogram *h = &snapshot->histograms[i];
+        if (h->count == 0) {
+            continue;
+        }
+        fprintf(fp, "  %-20s %10llu %10llu %10llu %10llu %10llu %10llu\n", METRICS_OP_NAMES[i],
+                (unsigned long long)h->count, (unsigned long long)(h->sum / h->count),
+                (unsigned long long)Metrics_Percentile(h, 0.5), (unsigned long long)Metrics_Percentile(h, 0.99),
+                (unsigned long long)Metrics_Percentile(h, 0.999), (unsigned long long)h->max);
+    }
+}
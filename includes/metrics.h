@@ -0,0 +1,129 @@
+#ifndef TINYDB_METRICS_H
+#define TINYDB_METRICS_H
+#include <stdint.h>
+#include <stdio.h>
+
+#include "./global.h"
+
+/**
+ * 引擎指标：计数器、仪表和每种操作的延迟直方图。
+ *
+ * 计数器和直方图按线程分片，每个线程第一次记录时分配自己的分片，
+ * 之后只有这个线程写它，写入是一次普通的加法，没有锁也没有原子读改写。
+ * Metrics_Snapshot 读取时把所有线程的分片加起来，线程退出时它的分片并入一个公共分片。
+ * 仪表（例如树高）是全局的当前值，不分片。
+ *
+ * 直方图的桶按对数划分：每个2的幂区间再等分成 METRICS_SUB_BUCKETS 份，
+ * 分位数的相对误差不超过 1 / METRICS_SUB_BUCKETS。
+ */
+
+#define METRICS_SUB_BITS 2
+#define METRICS_SUB_BUCKETS (1 << METRICS_SUB_BITS)
+#define METRICS_BUCKETS (64 * METRICS_SUB_BUCKETS)
+
+typedef enum MetricsCounter {
+    Metrics_PagesRead = 0,
+    Metrics_PagesWritten,
+    Metrics_BytesRead,
+    Metrics_BytesWritten,
+    Metrics_CacheHits,
+    Metrics_CacheMisses,
+    Metrics_PageSplits,
+    Metrics_PageMerges,
+    Metrics_PartialPageWrites,
+    Metrics_WalBytes,
+    Metrics_WalSyncs,
+    Metrics_NodesRead,
+    Metrics_NodesWritten,
+    Metrics_NodeSplits,
+    Metrics_NodeMerges,
+    Metrics_CounterCount
+} MetricsCounter;
+
+typedef enum MetricsGauge {
+    Metrics_BPlusTreeHeight = 0,
+    Metrics_BpTreeHeight,
+    Metrics_GaugeCount
+} MetricsGauge;
+
+/* 记录延迟的操作，操作次数就是对应直方图的count */
+typedef enum MetricsOp {
+    Metrics_PagerInsert = 0,
+    Metrics_PagerInsertBatch,
+    Metrics_PagerSelect,
+    Metrics_PagerSelectBy,
+    Metrics_PagerUpdate,
+    Metrics_PagerDelete,
+    Metrics_PagerScan,
+    Metrics_PagerFlush,
+    Metrics_PagerCheckpoint,
+    Metrics_PagerCompact,
+    Metrics_BPlusTreeInsert,
+    Metrics_BPlusTreeSelect,
+    Metrics_BPlusTreeUpdate,
+    Metrics_BPlusTreeDelete,
+    Metrics_BpTreeInsert,
+    Metrics_BpTreeSelect,
+    Metrics_OpCount
+} MetricsOp;
+
+/**
+ * count: number of samples
+ * sum: sum of samples in nanoseconds
+ * max: largest sample in nanoseconds
+ */
+typedef struct MetricsHistogram {
+    uint64_t count;
+    uint64_t sum;
+    uint64_t max;
+    uint64_t buckets[METRICS_BUCKETS];
+} MetricsHistogram;
+
+/* 一个线程的分片 */
+typedef struct MetricsShard {
+    uint64_t counters[Metrics_CounterCount];
+    MetricsHistogram histograms[Metrics_OpCount];
+    struct MetricsShard *prev;
+    struct MetricsShard *next;
+} MetricsShard;
+
+typedef struct MetricsSnapshot {
+    uint64_t counters[Metrics_CounterCount];
+    int64_t gauges[Metrics_GaugeCount];
+    MetricsHistogram histograms[Metrics_OpCount];
+} MetricsSnapshot;
+
+extern __thread MetricsShard *MetricsLocal;
+
+TINYDB_API MetricsShard *Metrics_Register();
+
+/* 只有所属线程写分片，用relaxed的load/store代替读改写，读取的线程也不会读到撕裂的值 */
+#define METRICS_BUMP(field, n) __atomic_store_n(&(field), (field) + (n), __ATOMIC_RELAXED)
+
+static inline MetricsShard *Metrics_Local() {
+    MetricsShard *shard = MetricsLocal;
+    return shard != NULL ? shard : Metrics_Register();
+}
+
+static inline void Metrics_Add(MetricsCounter counter, uint64_t n) {
+    MetricsShard *shard = Metrics_Local();
+    METRICS_BUMP(shard->counters[counter], n);
+}
+
+/* 值v所在的桶：小于 METRICS_SUB_BUCKETS 的值各占一个桶，其余按最高位和紧随其后的 METRICS_SUB_BITS 位分桶 */
+static inline int32_t Metrics_Bucket(uint64_t v) {
+    if (v < METRICS_SUB_BUCKETS) {
+        return (int32_t)v;
+    }
+    int32_t msb = 63 - __builtin_clzll(v);
+    return msb * METRICS_SUB_BUCKETS + (int32_t)((v >> (msb - METRICS_SUB_BITS)) & (METRICS_SUB_BUCKETS - 1));
+}
+
+TINYDB_API uint64_t Metrics_Now();
+TINYDB_API void Metrics_Record(MetricsOp op, uint64_t ns);
+TINYDB_API void Metrics_SetGauge(MetricsGauge gauge, int64_t value);
+TINYDB_API void Metrics_Snapshot(MetricsSnapshot *snapshot);
+TINYDB_API uint64_t Metrics_Percentile(const MetricsHistogram *histogram, double p);
+TINYDB_API void Metrics_Dump(const MetricsSnapshot *snapshot, FILE *fp);
+
+#endif
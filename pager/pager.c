@@ -1,18 +1,40 @@
 #include "pager.h"
 
 #include <assert.h>
-// #include <errno.h>
 #include <alloca.h>
+#include <errno.h>
 #include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>
 
+#include "../includes/log.h"
+#include "../includes/metrics.h"
+
 // #include "../includes/global.h"
 
+#define BATCH_WRITE_PAGES 64 /* pages appended by Pager_InsertBatch in one write */
+#define TXN_MAX_PAGES (BATCH_WRITE_PAGES + 4)
+#define PREFETCH_PAGES 32 /* pages read ahead at once when scanning the data file */
+#define COMPACT_MAX_FILL (FSM_FULL * 3 / 4) /* two neighbors are merged if the result is at most this full */
+#define COMPACT_STEP_PAGES 8                /* maxPages of every Pager_Compact by the background thread */
+#define INDEX_IO_ENTRIES 4096                /* index entries read or written at once */
+#define HASH_BATCH_PAGES 16                  /* pages pinned by a transaction of Pager_InsertBatch in Pager_HashAccess */
+#define FRAME_EVICTING (INT32_MIN / 2)       /* Frame.pinCount while the frame is being evicted */
+
+PRIVATE void PagerGrowFences(Pager *pager, int32_t size);
+PRIVATE void PagerWriteMeta(Pager *pager, bool clean);
+PRIVATE void PagerSetPage(Pager *pager, int32_t pageNum, Page *page);
+PRIVATE Page *PagerAllocPage(Pager *pager, int32_t *pageNum);
+PRIVATE void PagerGrowDirtyPages(Pager *pager, int32_t pageCount);
+#ifndef DEBUG_TEST
+PRIVATE void PagerWritePages(Pager *pager, int32_t pageNum, void *buffer, int32_t count);
+#endif
+
 #ifndef DEBUG_TEST
 PRIVATE
 #endif
@@ -25,33 +47,6 @@ Row *New_Row() {
     return row;
 }
 
-#ifndef DEBUG_TEST
-PRIVATE
-#endif
-Page *New_Page() {
-    Page *page = (Page *)calloc(1, sizeof(Page));
-    assert(page != NULL);
-    page->rowCount        = 0;
-    page->lastModifiedRow = -1;
-    page->lastReadRow     = -1;
-    page->lastModifyTime  = -1;
-    page->lastReadTime    = -1;
-    page->firstFree       = -1;
-    page->firstUse        = -1;
-    int32_t i;
-    for (i = 0; i < MAX_ROWS_PER_PAGE; i++) {
-        page->rows[i] = New_Row();
-    }
-
-    // 初始化静态链表
-    page->firstUse = 0;
-    for (i = 0; i < MAX_ROWS_PER_PAGE; i++) {
-        page->rows[i]->next = i + 1;
-    }
-    page->rows[i - 1]->next = -1;
-    return page;
-}
-
 #ifndef DEBUG_TEST
 PRIVATE
 #endif
@@ -60,16 +55,9 @@ void CreateFileIfNotExists(const char *file) {
         EXIT_ERROR("file is not exists.\n");
     }
     if (access(file, F_OK) == 0) {
-        printf("%s is already exists.\n", file);
-        if (access(file, R_OK) == 0) {
-            printf("%s can read,", file);
-        }
-        if (access(file, W_OK) == 0) {
-            printf("write");
-        }
-        printf(".\n");
+        LOG_DEBUG("%s is already exists.", file);
     } else {
-        printf("%s is not exists, it will be create later.\n", file);
+        LOG_DEBUG("%s is not exists, it will be create later.", file);
         // 创建一个文件，大小为一个pagesize。
         FILE *fp = fopen(file, "wb+");
         if (fp == NULL) {
@@ -91,7 +79,7 @@ int OpenFile(const char *file) {
 
     CreateFileIfNotExists(file);
     int fd = open(file, O_RDWR);
-    if (open(file, O_RDWR) == -1) {
+    if (fd == -1) {
         EXIT_ERROR("Fail to open file.\n");
     }
     return fd;
@@ -102,412 +90,4635 @@ PRIVATE
 #endif
 void CloseFile(int fd) {
     if (close(fd) == 0) {
-        printf("Success to close file.\n");
+        LOG_DEBUG("Success to close file.");
     } else {
-        perror("Failed to close file.\n");
+        LOG_ERROR("Failed to close file: %s", strerror(errno));
     }
 }
 
+/**
+ * 初始化一个空页面：没有槽位，记录区从页面末尾开始。
+ * 全0的页面(rowCount = 0)被视为空页面，直到插入第一条记录时才初始化。
+ */
 #ifndef DEBUG_TEST
 PRIVATE
 #endif
-inline int32_t PagerSearchPage(Pager *pager, KEY id) {
-    return -1;
+void Page_Init(Page *page) {
+    page->rowCount        = 0;
+    page->lastModifiedRow = -1;
+    page->lastReadRow     = -1;
+    page->firstFree       = -1;
+    page->rowsStart       = PAGE_SIZE;
+    page->garbage         = 0;
+    page->lastModifyTime  = -1;
+    page->lastReadTime    = -1;
+}
+
+/*************************************************************/
+// 有序槽位：slots[0, rowCount) 是按id升序排列的记录偏移量，记录从页面末尾向前分配，
+// 被删除的记录通过 Row.next 链接成空洞链表，firstFree 是链表头。
+// 插入和删除只移动2字节的槽位，不移动记录。
+
+inline Row *Slot_Row(Page *page, int32_t k) {
+    return PAGE_ROW(page, page->slots[k]);
+}
+
+inline int32_t Slot_MallocRow(Page *page) {
+    int32_t off = page->firstFree;
+    if (off != -1) {
+        page->firstFree = PAGE_ROW(page, off)->next;
+        return off;
+    }
+    page->rowsStart -= ROW_SIZE;
+    return page->rowsStart;
+}
+
+inline void Slot_FreeRow(Page *page, int32_t off) {
+    PAGE_ROW(page, off)->next = page->firstFree;
+    page->firstFree           = off;
+}
+
+/**
+ * 第一个 id >= key 的槽位，所有id都小于key时返回rowCount。
+ * 循环体只有一次比较，编译为条件传送，没有难以预测的分支。
+ */
+inline int32_t Slot_LowerBound(Page *page, KEY id) {
+    int32_t n = page->rowCount;
+    if (n == 0) {
+        return 0;
+    }
+    const uint16_t *base = page->slots;
+    while (n > 1) {
+        int32_t half = n / 2;
+        base         = PAGE_ROW(page, base[half])->id < id ? base + half : base;
+        n -= half;
+    }
+    return (int32_t)(base - page->slots) + (PAGE_ROW(page, *base)->id < id);
 }
 
+/* @return slot of id, -1 if id is not in this page */
 #ifndef DEBUG_TEST
 PRIVATE
 #endif
-inline int32_t PageSearchRow(Page *page, KEY id) {
-    int32_t i;
-    for (i = 0; i < page->rowCount && page->rows[i]->id != id; i++)
-        ;
-    return i == page->rowCount ? -1 : i;
+int32_t Slot_Select(Page *page, KEY id) {
+    int32_t k = Slot_LowerBound(page, id);
+    return k < page->rowCount && Slot_Row(page, k)->id == id ? k : -1;
 }
 
-inline void SerializePage(Page *page, void *buffer) {
-    memcpy(buffer, page, PAGE_HEADER_SIZE);
-    int32_t i;
-    for (i = 0; i < page->rowCount; i++) {
-        memcpy(buffer + PAGE_HEADER_SIZE + i * ROW_SIZE, page->rows[i], ROW_SIZE);
+/* @return false if the page is full, the caller checks duplicated ids */
+#ifndef DEBUG_TEST
+PRIVATE
+#endif
+bool Slot_Insert(Page *page, Row *row) {
+    if (page->rowCount == 0) {
+        Page_Init(page);
+    }
+    if (page->rowCount == MAX_ROWS_PER_PAGE) {
+        return false;
+    }
+    int32_t k   = Slot_LowerBound(page, row->id);
+    int32_t off = Slot_MallocRow(page);
+    memcpy(PAGE_ROW(page, off), row, ROW_SIZE);
+    PAGE_ROW(page, off)->next = -1;
+    memmove(&page->slots[k + 1], &page->slots[k], (page->rowCount - k) * sizeof(uint16_t));
+    page->slots[k] = (uint16_t)off;
+    page->rowCount++;
+    page->lastModifiedRow = off;
+    return true;
+}
+
+/* 追加一条记录，row的id必须大于页面中所有记录的id */
+inline void Slot_Append(Page *page, Row *row) {
+    if (page->rowCount == 0) {
+        Page_Init(page);
     }
+    int32_t off = Slot_MallocRow(page);
+    memcpy(PAGE_ROW(page, off), row, ROW_SIZE);
+    PAGE_ROW(page, off)->next       = -1;
+    page->slots[page->rowCount++] = (uint16_t)off;
+    page->lastModifiedRow           = off;
 }
 
 /**
- * 从指定位置读取一个Page大小的数据
+ * @param ret: points to the deleted row, which is valid until the next insert
+ * @return false if id is not in this page
  */
 #ifndef DEBUG_TEST
 PRIVATE
 #endif
-inline void DeserializePage(Page *page, void *buffer) {
-    memcpy(page, buffer, PAGE_HEADER_SIZE);
-    int32_t i;
-    for (i = 0; i < page->rowCount; i++) {
-        memcpy(page->rows[i], buffer + PAGE_HEADER_SIZE + i * ROW_SIZE, ROW_SIZE);
+bool Slot_Delete(Page *page, KEY id, Row **ret) {
+    int32_t k = Slot_Select(page, id);
+    if (k == -1) {
+        return false;
+    }
+    int32_t off = page->slots[k];
+    memmove(&page->slots[k], &page->slots[k + 1], (page->rowCount - k - 1) * sizeof(uint16_t));
+    page->rowCount--;
+    *ret = PAGE_ROW(page, off);
+    Slot_FreeRow(page, off);
+    return true;
+}
+
+/* 将page中较大的一半记录移动到空页面right中 */
+inline void Slot_Split(Page *page, Page *right) {
+    int32_t keep = page->rowCount / 2, k;
+    for (k = keep; k < page->rowCount; k++) {
+        Slot_Append(right, Slot_Row(page, k));
+        Slot_FreeRow(page, page->slots[k]);
+    }
+    page->rowCount = keep;
+}
+
+/* 页面中最小和最大的id */
+inline PageFence Slot_Fence(Page *page) {
+    if (page->rowCount == 0) {
+        return EMPTY_FENCE;
     }
+    PageFence fence = {Slot_Row(page, 0)->id, Slot_Row(page, page->rowCount - 1)->id};
+    return fence;
 }
 
 /*************************************************************/
-// 静态链表
-inline int32_t StlList_MallocNode(Page *page) {
-    int32_t i = page->firstUse;
-    if (page->firstUse != -1) {
-        page->firstUse = page->rows[i]->next;
+// PAX：每一列存放在各自的minipage中，ids[0, rowCount) 按升序排列。
+// 插入和删除时每一列分别移动，isOnline 位图逐位移动。
+
+inline bool Pax_Online(Page *page, int32_t k) {
+    return PAX_ONLINE(page)[k >> 3] >> (k & 7) & 1;
+}
+
+inline void Pax_SetOnline(Page *page, int32_t k, bool online) {
+    uint8_t *bits = PAX_ONLINE(page);
+    bits[k >> 3]  = (uint8_t)((bits[k >> 3] & ~(1 << (k & 7))) | ((online ? 1 : 0) << (k & 7)));
+}
+
+/* 将src中从from开始的count条记录复制到dst中从to开始的位置，src和dst可以是同一个页面 */
+inline void Pax_Copy(Page *dst, int32_t to, Page *src, int32_t from, int32_t count) {
+    int32_t i;
+    memmove(PAX_IDS(dst) + to, PAX_IDS(src) + from, count * sizeof(KEY));
+    memmove(PAX_USERNAME(dst, to), PAX_USERNAME(src, from), (size_t)count * USERNAME_SIZE);
+    memmove(PAX_EMAIL(dst, to), PAX_EMAIL(src, from), (size_t)count * EMAIL_SIZE);
+    if (dst == src && to > from) {
+        for (i = count - 1; i >= 0; i--) {
+            Pax_SetOnline(dst, to + i, Pax_Online(src, from + i));
+        }
+    } else {
+        for (i = 0; i < count; i++) {
+            Pax_SetOnline(dst, to + i, Pax_Online(src, from + i));
+        }
+    }
+}
+
+/* 第一个 id >= key 的位置，与 Slot_LowerBound 相同，只是直接比较ids数组 */
+inline int32_t Pax_LowerBound(Page *page, KEY id) {
+    int32_t n = page->rowCount;
+    if (n == 0) {
+        return 0;
+    }
+    const KEY *base = PAX_IDS(page);
+    while (n > 1) {
+        int32_t half = n / 2;
+        base         = base[half] < id ? base + half : base;
+        n -= half;
     }
-    return i;
+    return (int32_t)(base - PAX_IDS(page)) + (*base < id);
+}
+
+inline void Pax_Get(Page *page, int32_t k, Row *row) {
+    row->id       = PAX_IDS(page)[k];
+    row->isOnline = Pax_Online(page, k);
+    memcpy(row->username, PAX_USERNAME(page, k), USERNAME_SIZE);
+    memcpy(row->email, PAX_EMAIL(page, k), EMAIL_SIZE);
+    row->next = -1;
 }
 
-inline void StlList_FreeNode(Page *page, int32_t k) {
-    page->rows[k]->next = page->firstFree;
-    page->firstFree     = k;
+inline void Pax_Set(Page *page, int32_t k, Row *row) {
+    PAX_IDS(page)[k] = row->id;
+    Pax_SetOnline(page, k, row->isOnline);
+    memcpy(PAX_USERNAME(page, k), row->username, USERNAME_SIZE);
+    memcpy(PAX_EMAIL(page, k), row->email, EMAIL_SIZE);
 }
 
-inline bool StlList_Insert(Page *page, Row *row) {
-    if (page->firstFree == -1) {
+/* @return false if the page is full, the caller checks duplicated ids */
+#ifndef DEBUG_TEST
+PRIVATE
+#endif
+bool Pax_Insert(Page *page, Row *row) {
+    if (page->rowCount == PAX_MAX_ROWS) {
         return false;
     }
-    int32_t prev, ptr;
-    ptr    = page->firstUse;
-    KEY id = row->id;
-    while (ptr != -1 && page->rows[ptr]->id < id) {
-        prev = ptr;
-        ptr  = page->rows[ptr]->next;
-    }
-    int32_t i   = StlList_MallocNode(page);
-    Row *r      = page->rows[i];
-    r->id       = row->id;
-    r->isOnline = row->isOnline;
-    strcpy(r->username, row->username);
-    strcpy(r->email, row->email);
-
-    // NOTE: 要先判断“插入在头部”，再判断“末尾”，因为firstUse=-1
-    // 如果是一个空表插入新值，先判断末尾将会导致错误.
-    if (ptr == page->firstUse) {  // 插入在头部
-        page->rows[i]->next = page->firstUse;
-        page->firstUse      = i;
-    } else if (ptr == -1) {  // 插入在末尾
-        page->rows[prev]->next = i;
-        page->rows[i]->next    = -1;
-    } else {  // 插入在中间
-        page->rows[prev]->next = i;
-        page->rows[i]->next    = ptr;
-    }
+    int32_t k = Pax_LowerBound(page, row->id);
+    Pax_Copy(page, k + 1, page, k, page->rowCount - k);
+    Pax_Set(page, k, row);
+    page->rowCount++;
+    page->lastModifiedRow = k;
     return true;
 }
 
-inline bool StlList_Delete(Page *page, KEY id, Row **ret) {
-    if (page->firstUse == -1) {
+/* 删除第k条记录，ret不为NULL时复制被删除的记录 */
+#ifndef DEBUG_TEST
+PRIVATE
+#endif
+void Pax_Remove(Page *page, int32_t k, Row *ret) {
+    if (ret != NULL) {
+        Pax_Get(page, k, ret);
+    }
+    Pax_Copy(page, k, page, k + 1, page->rowCount - k - 1);
+    page->rowCount--;
+}
+
+/*************************************************************/
+// 变长记录：槽位与有序槽位相同，记录同样从页面末尾向前分配，但长度由数据决定。
+// 删除的记录不链接成空洞链表，只累计到garbage，连续空间不够时整理整个页面。
+
+inline int32_t Var_RecordSize(int32_t usernameLength, int32_t emailLength) {
+    return (VAR_RECORD_HEADER + usernameLength + emailLength + 3) & ~3;
+}
+
+inline int32_t Var_Size(const VarRow *row) {
+    return Var_RecordSize(row->usernameLength, row->emailLength);
+}
+
+/* 截断到 Row 能放下的前31个字节 */
+inline void Var_ToRow(const VarRow *var, Row *row) {
+    memset(row, 0, ROW_SIZE);
+    row->id       = var->id;
+    row->isOnline = var->isOnline;
+    row->next     = -1;
+    memcpy(row->username, var->username, var->usernameLength > USERNAME_LENGTH ? USERNAME_LENGTH : var->usernameLength);
+    memcpy(row->email, var->email, var->emailLength > EMAIL_LENGTH ? EMAIL_LENGTH : var->emailLength);
+}
+
+/* Row 的字段最长31字节 */
+inline void Var_FromRow(Row *row, VarRow *var) {
+    var->id             = row->id;
+    var->isOnline       = row->isOnline;
+    var->usernameLength = (uint8_t)strnlen(row->username, USERNAME_LENGTH);
+    var->emailLength    = (uint8_t)strnlen(row->email, EMAIL_LENGTH);
+    memcpy(var->username, row->username, var->usernameLength);
+    memcpy(var->email, row->email, var->emailLength);
+    var->username[var->usernameLength] = '\0';
+    var->email[var->emailLength]       = '\0';
+}
+
+/**
+ * 用 Row 更新完整的记录cur：row只有前31个字节，与cur的前31个字节相同的字段保留cur中完整的内容，
+ * 所以只修改isOnline的 Pager_Update 不会截断超过31字节的username和email。
+ */
+inline void Var_Merge(const VarRow *cur, Row *row, VarRow *next) {
+    VarRow given;
+    Row old;
+    Var_FromRow(row, &given);
+    Var_ToRow(cur, &old);
+    memcpy(next, cur, sizeof(VarRow));
+    next->isOnline = row->isOnline;
+    if (strncmp(old.username, row->username, USERNAME_LENGTH) != 0) {
+        next->usernameLength = given.usernameLength;
+        memcpy(next->username, given.username, given.usernameLength + 1);
+    }
+    if (strncmp(old.email, row->email, EMAIL_LENGTH) != 0) {
+        next->emailLength = given.emailLength;
+        memcpy(next->email, given.email, given.emailLength + 1);
+    }
+}
+
+inline VarRecord *Var_Record(Page *page, int32_t k) {
+    return VAR_RECORD(page, page->slots[k]);
+}
+
+inline int32_t Var_RecordSizeAt(Page *page, int32_t k) {
+    VarRecord *record = Var_Record(page, k);
+    return Var_RecordSize(record->usernameLength, record->emailLength);
+}
+
+/* 槽位数组和记录之间连续的空闲空间 */
+inline int32_t Var_ContiguousSpace(Page *page) {
+    return page->rowsStart - (int32_t)PAGE_HEADER_SIZE - page->rowCount * (int32_t)SLOT_SIZE;
+}
+
+/* 整理之后可用的空闲空间 */
+inline int32_t Var_FreeSpace(Page *page) {
+    if (page->rowCount == 0) {
+        return PAGE_SIZE - PAGE_HEADER_SIZE;
+    }
+    return Var_ContiguousSpace(page) + page->garbage;
+}
+
+/* 页面还能否放下size字节的记录和它的槽位 */
+inline bool Var_HasRoom(Page *page, int32_t size) {
+    return Var_FreeSpace(page) >= size + (int32_t)SLOT_SIZE;
+}
+
+/* 按槽位顺序把所有记录重新紧凑地排列在页面末尾，回收garbage */
+inline void Var_Compact(Page *page) {
+    char buffer[PAGE_SIZE];
+    int32_t k, top = PAGE_SIZE;
+    for (k = 0; k < page->rowCount; k++) {
+        int32_t size = Var_RecordSizeAt(page, k);
+        top -= size;
+        memcpy(buffer + top, Var_Record(page, k), size);
+        page->slots[k] = (uint16_t)top;
+    }
+    memcpy((char *)page + top, buffer + top, PAGE_SIZE - top);
+    page->rowsStart = top;
+    page->garbage   = 0;
+}
+
+/* 分配size字节的记录，同时为一个新槽位留出空间，调用者已经检查过空闲空间 */
+inline int32_t Var_Alloc(Page *page, int32_t size) {
+    if (Var_ContiguousSpace(page) < size + (int32_t)SLOT_SIZE) {
+        Var_Compact(page);
+    }
+    page->rowsStart -= size;
+    return page->rowsStart;
+}
+
+inline void Var_Write(Page *page, int32_t off, const VarRow *row) {
+    VarRecord *record      = VAR_RECORD(page, off);
+    record->id             = row->id;
+    record->isOnline       = row->isOnline;
+    record->usernameLength = row->usernameLength;
+    record->emailLength    = row->emailLength;
+    memcpy(record->data, row->username, row->usernameLength);
+    memcpy(record->data + row->usernameLength, row->email, row->emailLength);
+}
+
+/* 读取完整的第k条记录 */
+#ifndef DEBUG_TEST
+PRIVATE
+#endif
+void Var_Read(Page *page, int32_t k, VarRow *row) {
+    VarRecord *record   = Var_Record(page, k);
+    row->id             = record->id;
+    row->isOnline       = record->isOnline;
+    row->usernameLength = record->usernameLength;
+    row->emailLength    = record->emailLength;
+    memcpy(row->username, record->data, record->usernameLength);
+    memcpy(row->email, record->data + record->usernameLength, record->emailLength);
+    row->username[record->usernameLength] = '\0';
+    row->email[record->emailLength]       = '\0';
+}
+
+/* 读取第k条记录，username和email只保留 Row 能放下的前31个字节 */
+#ifndef DEBUG_TEST
+PRIVATE
+#endif
+void Var_Get(Page *page, int32_t k, Row *row) {
+    VarRecord *record       = Var_Record(page, k);
+    int32_t usernameLength  = record->usernameLength > USERNAME_LENGTH ? USERNAME_LENGTH : record->usernameLength;
+    int32_t emailLength     = record->emailLength > EMAIL_LENGTH ? EMAIL_LENGTH : record->emailLength;
+    memset(row, 0, ROW_SIZE);
+    row->id       = record->id;
+    row->isOnline = record->isOnline;
+    row->next     = -1;
+    memcpy(row->username, record->data, usernameLength);
+    memcpy(row->email, record->data + record->usernameLength, emailLength);
+}
+
+/* @return false if the page has no room for row, the caller checks duplicated ids */
+#ifndef DEBUG_TEST
+PRIVATE
+#endif
+bool Var_InsertVar(Page *page, const VarRow *row) {
+    if (page->rowCount == 0) {
+        Page_Init(page);
+    }
+    int32_t size = Var_Size(row);
+    if (!Var_HasRoom(page, size)) {
         return false;
     }
-    int32_t prev, ptr;
-    ptr = page->firstUse;
-    while (ptr != -1 && page->rows[ptr]->id != id) {
-        prev = ptr;
-        ptr  = page->rows[ptr]->next;
+    // VarRecord 与 Row 一样以id开头，Slot_LowerBound 同样适用
+    int32_t k   = Slot_LowerBound(page, row->id);
+    int32_t off = Var_Alloc(page, size);
+    Var_Write(page, off, row);
+    memmove(&page->slots[k + 1], &page->slots[k], (page->rowCount - k) * sizeof(uint16_t));
+    page->slots[k] = (uint16_t)off;
+    page->rowCount++;
+    page->lastModifiedRow = off;
+    return true;
+}
+
+#ifndef DEBUG_TEST
+PRIVATE
+#endif
+bool Var_Insert(Page *page, Row *row) {
+    VarRow var;
+    Var_FromRow(row, &var);
+    return Var_InsertVar(page, &var);
+}
+
+/* 删除第k条记录，ret不为NULL时复制被删除的记录 */
+#ifndef DEBUG_TEST
+PRIVATE
+#endif
+void Var_Remove(Page *page, int32_t k, Row *ret) {
+    if (ret != NULL) {
+        Var_Get(page, k, ret);
     }
-    if (ptr == -1) {
+    page->garbage += Var_RecordSizeAt(page, k);
+    memmove(&page->slots[k], &page->slots[k + 1], (page->rowCount - k - 1) * sizeof(uint16_t));
+    page->rowCount--;
+}
+
+/**
+ * 覆盖第k条记录，row的id必须与原来的相同。新记录不比原来长时原地覆盖，否则删除后重新插入。
+ * @return false if the page has no room for the longer row, nothing is changed
+ */
+#ifndef DEBUG_TEST
+PRIVATE
+#endif
+bool Var_SetVar(Page *page, int32_t k, const VarRow *row) {
+    int32_t size = Var_Size(row), old = Var_RecordSizeAt(page, k);
+    if (size <= old) {
+        Var_Write(page, page->slots[k], row);
+        page->garbage += old - size;
         return true;
-    } else if (ptr == page->firstUse) {
-        page->firstUse = page->rows[ptr]->next;
-    } else {
-        page->rows[prev]->next = page->rows[ptr]->next;
     }
-    *ret = page->rows[ptr];
-    StlList_FreeNode(page, ptr);
+    if (Var_FreeSpace(page) + old < size) {
+        return false;
+    }
+    Var_Remove(page, k, NULL);
+    Var_InsertVar(page, row);
     return true;
 }
 
-inline int32_t StlList_Select(Page *page, KEY id) {
-    int32_t ptr = page->firstUse;
-    while (ptr != -1 && page->rows[ptr]->id != id) {
-        ptr = page->rows[ptr]->next;
+#ifndef DEBUG_TEST
+PRIVATE
+#endif
+bool Var_Set(Page *page, int32_t k, Row *row) {
+    VarRow var;
+    Var_FromRow(row, &var);
+    return Var_SetVar(page, k, &var);
+}
+
+/* 把page中较大的记录移动到空页面right中，直到移走的字节数达到一半 */
+inline void Var_Split(Page *page, Page *right) {
+    int32_t used = PAGE_SIZE - PAGE_HEADER_SIZE - Var_FreeSpace(page), moved = 0, keep, k;
+    for (keep = page->rowCount; keep > 1 && moved < used / 2; keep--) {
+        moved += Var_RecordSizeAt(page, keep - 1) + SLOT_SIZE;
     }
-    return ptr;
+    Page_Init(right);
+    VarRow row;
+    for (k = keep; k < page->rowCount; k++) {
+        Var_Read(page, k, &row);
+        Var_InsertVar(right, &row);
+        page->garbage += Var_RecordSizeAt(page, k);
+    }
+    page->rowCount = keep;
 }
 
 /*************************************************************/
+// 页面格式：以下函数按记录在页面中的位置k（按id升序）访问记录，
+// 根据format分派给有序槽位或PAX的实现，其他代码不需要关心页面格式。
 
-/**
- * @param file: storage data
- */
-TINYDB_API Pager *New_Pager(const char *file) {
-    int fd       = OpenFile(file);
-    Pager *pager = (Pager *)calloc(1, sizeof(Pager) + sizeof(char) * (strlen(file) + 1));
-    assert(pager != NULL);
+/* 一个页面最多能存放的记录数，Pager_VarFormat 下实际的记录数由数据决定 */
+inline int32_t Page_MaxRows(PageFormat format) {
+    switch (format) {
+        case Pager_PaxFormat:
+            return PAX_MAX_ROWS;
+        case Pager_VarFormat:
+            return VAR_MAX_ROWS;
+        default:
+            return MAX_ROWS_PER_PAGE;
+    }
+}
 
-    strcpy(pager->file, file);
-    pager->fd         = fd;
-    off_t ret         = lseek(fd, 0L, SEEK_END);  // fseek doesn't return its position
-    pager->fileLength = ret;
-    pager->pageCount  = ret / PAGE_SIZE;
+/* 页面还能否放下row */
+inline bool Page_HasRoom(PageFormat format, Page *page, Row *row) {
+    if (format != Pager_VarFormat) {
+        return page->rowCount < Page_MaxRows(format);
+    }
+    return Var_HasRoom(page, Var_RecordSize(strnlen(row->username, USERNAME_LENGTH), strnlen(row->email, EMAIL_LENGTH)));
+}
 
-    return pager;
+inline KEY Page_Id(PageFormat format, Page *page, int32_t k) {
+    return format == Pager_PaxFormat ? PAX_IDS(page)[k] : Slot_Row(page, k)->id;
 }
 
-TINYDB_API void Destroy_Pager(Pager *pager) {
-    assert(pager != NULL);
+/* @return position of id, -1 if id is not in this page */
+inline int32_t Page_Find(PageFormat format, Page *page, KEY id) {
+    if (format != Pager_PaxFormat) {
+        return Slot_Select(page, id);
+    }
+    int32_t k = Pax_LowerBound(page, id);
+    return k < page->rowCount && PAX_IDS(page)[k] == id ? k : -1;
+}
 
-    CloseFile(pager->fd);
-    free(pager);
-    pager = NULL;
+inline void Page_Get(PageFormat format, Page *page, int32_t k, Row *row) {
+    switch (format) {
+        case Pager_PaxFormat:
+            Pax_Get(page, k, row);
+            break;
+        case Pager_VarFormat:
+            Var_Get(page, k, row);
+            break;
+        default:
+            memcpy(row, Slot_Row(page, k), ROW_SIZE);
+    }
 }
 
 /**
- * Only append.
- * 
- * Size of the file is always times of 4096.
- * TODO: 对于溢出的记录，通常结合“借用后继结点的空间”和“设置溢出块”两种方式。现在均不采用。
- * FIXME: TEST
+ * 覆盖第k条记录，row的id必须与原来的相同。
+ * @return false if a Pager_VarFormat page has no room for the longer row
  */
-TINYDB_API PagerExecuteResult Pager_Insert(Pager *pager, Row *row) {
-    int fd       = pager->fd;
-    void *buffer = alloca(sizeof(char) * PAGE_SIZE);
-    Page *page   = New_Page();
-    // seek to last page.
-    lseek(fd, 0L, SEEK_SET);
-    ssize_t readRet = read(fd, buffer, PAGE_SIZE);
-    printf("readRet = %ld\n", readRet);
-    while (readRet == PAGE_SIZE) {
-        DeserializePage(page, buffer);
-        if (page->rowCount < MAX_ROWS_PER_PAGE) {
-            // 判断是否应该插入当前页面：如果id > 当前页面最大记录的id，且也大于下一页某一记录的id，
-            // 这样插入后将导致页面记录乱序。因此需要判断。
-            uint64_t end = page->rowCount == 0 ? 0 : page->rowCount - 1;
-            // if (page->rowCount == 0 || page->rows[end]->id >= row->id) {
-            if (page->rows[end]->id == row->id) {
-                printf("id = %d is already exists.\n", row->id);
-                free(page);
-                return Pager_ExecuteFailed;
-            }
-            // 1. 先将row拷贝到末尾
-            Row *r      = page->rows[page->rowCount];
-            r->id       = row->id;
-            r->isOnline = row->isOnline;
-            // r->del      = row->del;
-            memcpy(r->username, row->username, sizeof(char) * USERNAME_SIZE);
-            memcpy(r->email, row->email, sizeof(char) * EMAIL_SIZE);
-            // 2. 再修改next,prev指针
-            int64_t ptr = page->firstUse, prev;
-            Row *cur;
-            while (ptr >= 0 && ptr < MAX_ROWS_PER_PAGE) {
-                cur = page->rows[ptr];
-                if (cur->id > row->id) {
-                    break;
-                }
-                prev = ptr;
-                ptr  = cur->next;
-            }
-            if (ptr < 0) {  // 说明链表为空，或者达到末尾
-                if (page->rowCount == 0) {
-                    page->firstUse = 0;
-                    r->next        = -1;
-                } else {
-                    r->next                = page->rows[prev]->next;
-                    page->rows[prev]->next = page->rowCount;
-                }
-            } else {
-                // 在中间插入
-                r->next                = ptr;
-                page->rows[prev]->next = page->rowCount;
-            }
-            page->rowCount++;
-            SerializePage(page, buffer);
-            lseek(fd, -PAGE_SIZE, SEEK_CUR);
-            write(fd, buffer, PAGE_SIZE);
-            printf("Insert row successfully, id = %d\n", row->id);
-            free(page);
-            return Pager_ExecuteSuccess;
-            // }
-        }
-        readRet = read(fd, buffer, PAGE_SIZE);
-    }
-    // 执行到这里时，需要在文件末尾开辟新的页，再添加page。
-    page->rowCount = 0;
-    Row *r         = page->rows[page->rowCount];
-    r->id          = row->id;
-    r->isOnline    = row->isOnline;
-    // r->del         = row->del;
-    memcpy(r->username, row->username, sizeof(char) * USERNAME_SIZE);
-    memcpy(r->email, row->email, sizeof(char) * EMAIL_SIZE);
-    page->lastModifiedRow = 0;
-    page->rowCount++;
-    page->lastModifyTime = time(NULL);
-    SerializePage(page, buffer);
-    lseek(fd, 0L, SEEK_END);
-    write(fd, buffer, PAGE_SIZE);
-    printf("Append new row at the end of file, id = %d\n", row->id);
-    free(page);
-    return Pager_ExecuteSuccess;
+inline bool Page_Set(PageFormat format, Page *page, int32_t k, Row *row) {
+    switch (format) {
+        case Pager_PaxFormat:
+            Pax_Set(page, k, row);
+            return true;
+        case Pager_VarFormat:
+            return Var_Set(page, k, row);
+        default:
+            memcpy(Slot_Row(page, k), row, ROW_SIZE);
+            Slot_Row(page, k)->next = -1;
+            return true;
+    }
 }
 
-TINYDB_API PagerExecuteResult Pager_Insert2(Pager *pager, Row *row) {
-    KEY id       = row->id;
-    int fd       = pager->fd;
-    void *buffer = alloca(sizeof(char) * PAGE_SIZE);
-    Page *page   = New_Page();
-    lseek(fd, 0L, SEEK_SET);
-    ssize_t readRet = read(fd, buffer, PAGE_SIZE);
-    printf("readRet = %ld\n", readRet);
-    bool flag = false;
-    while (readRet == PAGE_SIZE) {
-        DeserializePage(page, buffer);
-        // 判断是否应该插入到当前页面
-        // 如果不是，则后移
-        if (page->rowCount < MAX_ROWS_PER_PAGE) {
-            if (page->rowCount == 0 || page->rows[page->rowCount - 1]->id > id) {
-                StlList_Insert(page, row);
-                flag = true;
-                break;
-            }
-        }
-        readRet = read(fd, buffer, PAGE_SIZE);
+inline bool Page_Insert(PageFormat format, Page *page, Row *row) {
+    switch (format) {
+        case Pager_PaxFormat:
+            return Pax_Insert(page, row);
+        case Pager_VarFormat:
+            return Var_Insert(page, row);
+        default:
+            return Slot_Insert(page, row);
     }
-    if (flag) {
-        // 将页面写入到文件中
-        page->lastModifiedRow = page->rowCount - 1;
-        page->lastModifyTime  = time(NULL);
-        page->rowCount++;
-        SerializePage(page, buffer);
-        if (lseek(fd, -PAGE_SIZE, SEEK_CUR) == -1) {
-            perror("Failed to seek back : -PAGE_SIZE\n");
-        }
-        if (write(fd, buffer, PAGE_SIZE) != PAGE_SIZE) {
-            perror("Failed to write a page.\n");
-        }
-        printf("Insert row successfully, id = %d\n", id);
-    } else {
-        // 如果执行到这里，说明记录应该插入到一个新page
-        page->rowCount = 0;
-        Row *r         = page->rows[page->rowCount];
-        r->id          = row->id;
-        r->isOnline    = row->isOnline;
-        strcpy(r->username, row->username);
-        strcpy(r->email, row->email);
-        page->lastModifiedRow = 0;
-        page->rowCount++;
-        page->lastModifyTime = time(NULL);
-        SerializePage(page, buffer);
-        lseek(fd, 0L, SEEK_END);
-        if (write(fd, buffer, PAGE_SIZE) != PAGE_SIZE) {
-            perror("Failed to write a page.\n");
-        }
-        printf("Append new row at the end of file, id = %d\n", row->id);
+}
+
+/* 追加一条记录，row的id必须大于页面中所有记录的id */
+inline void Page_Append(PageFormat format, Page *page, Row *row) {
+    if (format == Pager_RowFormat) {
+        Slot_Append(page, row);
+        return;
     }
-    free(page);
-    return Pager_ExecuteSuccess;
+    if (format == Pager_VarFormat) {
+        Var_Insert(page, row);
+        return;
+    }
+    if (page->rowCount == 0) {
+        Page_Init(page);
+    }
+    Pax_Set(page, page->rowCount++, row);
 }
 
-TINYDB_API PagerExecuteResult Pager_Select(Pager *pager, KEY id, Row **ret) {
-    int fd       = pager->fd;
-    void *buffer = alloca(sizeof(char) * PAGE_SIZE);
-    Page *page   = New_Page();
-    lseek(fd, 0L, SEEK_SET);
-    ssize_t readRet = read(fd, buffer, PAGE_SIZE);
-    printf("readRet = %ld\n", readRet);
-    while (readRet == PAGE_SIZE) {
-        DeserializePage(page, buffer);
-        int32_t ptr = page->firstUse, i;
-        if (ptr >= 0 && ptr < MAX_ROWS_PER_PAGE) {
-            i = StlList_Select(page, id);
-            if (i != -1) {
-                if (*ret == NULL) {
-                    *ret = New_Row();
-                }
-                memcpy(*ret, page->rows[i], ROW_SIZE);
-                page->lastReadTime = time(NULL);
-                page->lastReadRow  = i;
-                printf("Success to select row = %d\n", id);
-                free(page);
-                return Pager_ExecuteSuccess;
-            }
-        }
-        readRet = read(fd, buffer, sizeof(char) * PAGE_SIZE);
+/* 删除第k条记录，ret不为NULL时复制被删除的记录 */
+inline void Page_Remove(PageFormat format, Page *page, int32_t k, Row *ret) {
+    if (format == Pager_PaxFormat) {
+        Pax_Remove(page, k, ret);
+        return;
+    }
+    if (format == Pager_VarFormat) {
+        Var_Remove(page, k, ret);
+        return;
+    }
+    int32_t off = page->slots[k];
+    if (ret != NULL) {
+        memcpy(ret, PAGE_ROW(page, off), ROW_SIZE);
     }
-    free(page);
-    return Pager_ExecuteFailed;
+    memmove(&page->slots[k], &page->slots[k + 1], (page->rowCount - k - 1) * sizeof(uint16_t));
+    page->rowCount--;
+    Slot_FreeRow(page, off);
+}
+
+/* 将page中较大的一半记录移动到空页面right中 */
+inline void Page_Split(PageFormat format, Page *page, Page *right) {
+    if (format == Pager_RowFormat) {
+        Slot_Split(page, right);
+        return;
+    }
+    if (format == Pager_VarFormat) {
+        Var_Split(page, right);
+        return;
+    }
+    int32_t keep = page->rowCount / 2;
+    Page_Init(right);
+    Pax_Copy(right, 0, page, keep, page->rowCount - keep);
+    right->rowCount = page->rowCount - keep;
+    page->rowCount  = keep;
 }
 
 /**
+ * 把src的第k条记录复制到dst，不从src中删除。append为true时记录的id大于dst中所有的id。
+ * Pager_VarFormat 复制完整的记录，超过31字节的username和email不会被 Row 截断。
+ * @return false if dst has no room for the row, nothing is changed
  */
-TINYDB_API PagerExecuteResult Pager_Update(Pager *pager, KEY id, Row *row, Row **ret) {
-    int fd       = pager->fd;
-    void *buffer = alloca(sizeof(char) * PAGE_SIZE);
-    Page *page   = New_Page();
-    lseek(fd, 0L, SEEK_SET);
-    ssize_t readRet = read(fd, buffer, PAGE_SIZE);
-    bool flag       = false;
-    int32_t i;
-    while (readRet == PAGE_SIZE) {
-        DeserializePage(page, buffer);
-        i = StlList_Select(page, id);
-        if (i != -1) {
-            if (*ret == NULL) {
-                *ret = New_Row();
-            }
-            memcpy(*ret, page->rows[i], ROW_SIZE);
-            Row *r      = page->rows[i];
-            r->isOnline = row->isOnline;
-            if (!strcmp(r->email, row->email)) {
-                strcpy(r->email, row->email);
-            }
-            if (!strcmp(r->username, row->username)) {
-                strcpy(r->username, row->username);
-            }
-            flag = true;
-            break;
-        }
-        readRet = read(fd, buffer, PAGE_SIZE);
+inline bool Page_CopyRow(PageFormat format, Page *src, int32_t k, Page *dst, bool append) {
+    if (format == Pager_VarFormat) {
+        VarRow var;
+        Var_Read(src, k, &var);
+        return Var_InsertVar(dst, &var);
     }
-    if (i == -1) {
-        printf("row is not exists, id = %d\n", id);
-        free(page);
-        return Pager_ExecuteFailed;
+    Row row;
+    Page_Get(format, src, k, &row);
+    if (!Page_HasRoom(format, dst, &row)) {
+        return false;
     }
-    if (flag) {
-        page->lastModifiedRow = i;
-        page->lastModifyTime  = time(NULL);
-        SerializePage(page, buffer);
-        lseek(fd, -PAGE_SIZE, SEEK_CUR);
-        if (write(fd, buffer, PAGE_SIZE) != PAGE_SIZE) {
-            perror("Failed to write a page.\n");
-        }
-        printf("Success to update row = %d\n", id);
-        free(page);
-        return Pager_ExecuteSuccess;
+    if (append) {
+        Page_Append(format, dst, &row);
     } else {
-        printf("row is not exists, id = %d\n", id);
-        return Pager_ExecuteFailed;
+        Page_Insert(format, dst, &row);
     }
+    return true;
 }
 
-TINYDB_API PagerExecuteResult Pager_Delete(Pager *pager, KEY id, Row **ret) {
-    int fd       = pager->fd;
-    void *buffer = alloca(sizeof(char) * PAGE_SIZE);
-    Page *page   = New_Page();
-    lseek(fd, 0L, SEEK_SET);
-    ssize_t readRet = read(fd, buffer, PAGE_SIZE);
-    while (readRet == PAGE_SIZE) {
-        DeserializePage(page, buffer);
-        Row *row = NULL;
-        if (StlList_Delete(page, id, &row)) {
-            if (*ret == NULL) {
-                *ret = New_Row();
-            }
-            if (row != NULL) {
-                memcpy(ret, row, ROW_SIZE);
-            }
-            page->rowCount--;
+/* Page_HasRoom，var不为NULL时是 Pager_VarFormat 的完整记录，row是它截断后的副本 */
+inline bool Page_HasRoomFor(PageFormat format, Page *page, Row *row, const VarRow *var) {
+    return var != NULL ? Var_HasRoom(page, Var_Size(var)) : Page_HasRoom(format, page, row);
+}
+
+/* Page_Insert，var不为NULL时插入完整的记录 */
+inline void Page_InsertFor(PageFormat format, Page *page, Row *row, const VarRow *var) {
+    if (var != NULL) {
+        Var_InsertVar(page, var);
+    } else {
+        Page_Insert(format, page, row);
+    }
+}
+
+/* 读取第k条记录，只有 Pager_VarFormat 的字段可能超过31字节 */
+inline void Page_GetVar(PageFormat format, Page *page, int32_t k, VarRow *var) {
+    if (format == Pager_VarFormat) {
+        Var_Read(page, k, var);
+        return;
+    }
+    Row row;
+    Page_Get(format, page, k, &row);
+    Var_FromRow(&row, var);
+}
+
+/* 页面中最小和最大的id */
+inline PageFence Page_Fence(PageFormat format, Page *page) {
+    if (page->rowCount == 0) {
+        return EMPTY_FENCE;
+    }
+    PageFence fence = {Page_Id(format, page, 0), Page_Id(format, page, page->rowCount - 1)};
+    return fence;
+}
+
+/**
+ * 页面的填充度，写入空闲空间表。Pager_VarFormat 按字节计算，
+ * 放不下最长的记录时才算满，所以 PagerHasRoom 之后仍要用 Page_HasRoom 确认。
+ */
+inline uint8_t Page_Fill(PageFormat format, Page *page) {
+    if (format != Pager_VarFormat) {
+        return (uint8_t)((int64_t)page->rowCount * FSM_FULL / Page_MaxRows(format));
+    }
+    int32_t space = PAGE_SIZE - PAGE_HEADER_SIZE, free = Var_FreeSpace(page);
+    if (free < VAR_MAX_RECORD + (int32_t)SLOT_SIZE) {
+        return FSM_FULL;
+    }
+    return (uint8_t)((int64_t)(space - free) * (FSM_FULL - 1) / space);
+}
+
+/*************************************************************/
+// 页面压缩：id先做差分编码，再用LZ77压缩，压缩后的页面存放在长度可变的extent中。
+
+#define PAGE_DICTIONARY_SIZE 128
+#define EXTENT_SCAN_SIZE (1 << 20) /* bytes read at once when scanning a compressed data file */
+
+/* 预置字典：常见的邮箱域名，页面中第一次出现的域名也能编码为对字典的引用 */
+PRIVATE const char PAGE_DICTIONARY[PAGE_DICTIONARY_SIZE] =
+    "@gmail.com@yahoo.com@hotmail.com@outlook.com@icloud.com@example.com"
+    "@qq.com@163.com@126.com@foxmail.com@sina.com.org.net.edu.cn";
+
+/* 第k条记录的id，记录的位置超出页面时返回NULL */
+inline KEY *PagerIdAt(PageFormat format, Page *page, int32_t k) {
+    if (format == Pager_PaxFormat) {
+        return &PAX_IDS(page)[k];
+    }
+    uint16_t off = page->slots[k];
+    return off < PAGE_HEADER_SIZE || off > PAGE_SIZE - ID_SIZE ? NULL : &PAGE_ROW(page, off)->id;
+}
+
+/**
+ * 把页面中按升序排列的id替换为与前一个id的差，连续的id变成一串相同的小整数。
+ * 只处理id严格递增的页面，否则返回false，页面不变。
+ */
+PRIVATE bool PagerDeltaEncode(PageFormat format, Page *page) {
+    int32_t k, n = page->rowCount;
+    if (n < 0 || n > Page_MaxRows(format)) {
+        return false;
+    }
+    for (k = 0; k < n; k++) {
+        KEY *id = PagerIdAt(format, page, k);
+        if (id == NULL || (k > 0 && *id <= *PagerIdAt(format, page, k - 1))) {
+            return false;
+        }
+    }
+    uint32_t prev = 0;
+    for (k = 0; k < n; k++) {
+        KEY *id      = PagerIdAt(format, page, k);
+        uint32_t cur = (uint32_t)*id;
+        *id          = (KEY)(cur - prev);
+        prev         = cur;
+    }
+    return true;
+}
+
+PRIVATE void PagerDeltaDecode(PageFormat format, Page *page) {
+    int32_t k, n = page->rowCount;
+    uint32_t prev = 0;
+    for (k = 0; k >= 0 && k < n && n <= Page_MaxRows(format); k++) {
+        KEY *id = PagerIdAt(format, page, k);
+        if (id == NULL) {
+            return;
+        }
+        prev = prev + (uint32_t)*id;
+        *id  = (KEY)prev;
+    }
+}
+
+PRIVATE uint32_t PagerExtentChecksum(const ExtentHeader *header, const char *payload) {
+    uint32_t hash = 2166136261u;
+    const unsigned char *p = (const unsigned char *)header;
+    size_t i;
+    for (i = 0; i < OFFSET_OF_ATTRIBUTE(ExtentHeader, checksum); i++) {
+        hash = (hash ^ p[i]) * 16777619u;
+    }
+    p = (const unsigned char *)payload;
+    for (i = 0; i < header->size; i++) {
+        hash = (hash ^ p[i]) * 16777619u;
+    }
+    return hash;
+}
+
+PRIVATE void PagerPushFreeExtent(Pager *pager, int64_t offset, int32_t sectors) {
+    ExtentFreeList *list = &pager->freeExtents[sectors];
+    if (list->count == list->capacity) {
+        list->capacity = list->capacity == 0 ? 16 : list->capacity * 2;
+        list->offsets  = (int64_t *)realloc(list->offsets, list->capacity * sizeof(int64_t));
+        assert(list->offsets != NULL);
+    }
+    list->offsets[list->count++] = offset;
+}
+
+/* 分配sectors个扇区：优先使用大小最接近的空闲extent，多出的扇区放回空闲表，没有时在文件末尾分配 */
+PRIVATE int64_t PagerAllocExtent(Pager *pager, int32_t sectors) {
+    int32_t i;
+    for (i = sectors; i <= EXTENT_MAX_SECTORS; i++) {
+        ExtentFreeList *list = &pager->freeExtents[i];
+        if (list->count > 0) {
+            int64_t offset = list->offsets[--list->count];
+            if (i > sectors) {
+                PagerPushFreeExtent(pager, offset + (int64_t)sectors * EXTENT_SECTOR, i - sectors);
+            }
+            return offset;
+        }
+    }
+    int64_t offset = pager->extentEnd;
+    pager->extentEnd += (int64_t)sectors * EXTENT_SECTOR;
+    return offset;
+}
+
+/* 抹掉extent的magic，扫描数据文件时不会再找到它 */
+PRIVATE void PagerEraseExtent(Pager *pager, int64_t offset) {
+    uint32_t magic = 0;
+    if (pwrite(pager->fd, &magic, sizeof(uint32_t), offset) != sizeof(uint32_t)) {
+        LOG_ERROR("Failed to erase an extent: %s", strerror(errno));
+    }
+}
+
+PRIVATE void PagerFreeExtent(Pager *pager, PageExtent *extent) {
+    PagerEraseExtent(pager, extent->offset);
+    PagerPushFreeExtent(pager, extent->offset, extent->sectors);
+    *extent = EMPTY_EXTENT;
+}
+
+/**
+ * 压缩第pageNum页，在extent中填好 ExtentHeader 和压缩后的数据，并决定写入的位置：
+ * 原来的extent放得下时原地覆盖，否则换到一个新的extent。调用者持有poolLatch。
+ * 换到新的extent时旧的extent仍然保存着这一页，写入完成之前不能回收，否则崩溃后这一页就丢了，
+ * 同一批写入中的其他页面也可能分到它。写入之后由 PagerRetireExtent 处理旧的extent。
+ *
+ * @param extent: EXTENT_MAX_SIZE bytes
+ * @param offset: where to write the extent
+ * @param retired: the extent replaced by a new one, EMPTY_EXTENT if written in place
+ * @return bytes to write
+ */
+PRIVATE int32_t PagerPackPage(Pager *pager, int32_t pageNum, const void *page, char *extent, int64_t *offset,
+                              PageExtent *retired) {
+    char buffer[PAGE_DICTIONARY_SIZE + PAGE_SIZE] __attribute__((aligned(8)));
+    memcpy(buffer, PAGE_DICTIONARY, PAGE_DICTIONARY_SIZE);
+    memcpy(buffer + PAGE_DICTIONARY_SIZE, page, PAGE_SIZE);
+    ExtentHeader *header = (ExtentHeader *)extent;
+    char *payload        = extent + sizeof(ExtentHeader);
+    memset(header, 0, sizeof(ExtentHeader));
+    header->magic   = EXTENT_MAGIC;
+    header->pageNum = pageNum;
+    header->flags   = PagerDeltaEncode(pager->config.format, (Page *)(buffer + PAGE_DICTIONARY_SIZE)) ? EXTENT_DELTA : 0;
+    int32_t size    = Lz_Compress(buffer, PAGE_DICTIONARY_SIZE, PAGE_DICTIONARY_SIZE + PAGE_SIZE, payload, PAGE_SIZE - 1);
+    if (size == -1) {
+        // 压缩之后没有变小的页面原样存放
+        memcpy(payload, page, PAGE_SIZE);
+        size          = PAGE_SIZE;
+        header->flags = 0;
+    } else {
+        header->flags |= EXTENT_LZ;
+    }
+    header->size    = (uint16_t)size;
+    int32_t bytes   = sizeof(ExtentHeader) + size;
+    int32_t sectors = (bytes + EXTENT_SECTOR - 1) / EXTENT_SECTOR;
+
+    PageExtent *e = &pager->extents[pageNum];
+    *retired      = EMPTY_EXTENT;
+    if (e->offset == -1 || e->sectors < sectors) {
+        *retired   = *e;
+        e->offset  = PagerAllocExtent(pager, sectors);
+        e->sectors = sectors;
+        __atomic_store_n(&pager->metaDirty, true, __ATOMIC_RELAXED);
+    }
+    header->sectors  = (uint16_t)e->sectors;
+    header->seq      = ++pager->extentSeq;
+    header->checksum = PagerExtentChecksum(header, payload);
+    *offset          = e->offset;
+    return bytes;
+}
+
+/**
+ * 第pageNum页写入新的extent之后回收旧的extent。写入失败时新的extent可能只写了一半，
+ * 抹掉并回收它，这一页回到仍然完好的旧extent。
+ * @param written: whether the new extent was written
+ */
+PRIVATE void PagerRetireExtent(Pager *pager, int32_t pageNum, PageExtent *retired, bool written) {
+    if (retired->offset == -1) {
+        return;
+    }
+    if (written) {
+        PagerFreeExtent(pager, retired);
+        return;
+    }
+    PagerFreeExtent(pager, &pager->extents[pageNum]);
+    pager->extents[pageNum] = *retired;
+    *retired                = EMPTY_EXTENT;
+}
+
+/**
+ * 检查extent并解压出第pageNum页，extent损坏时页面为全0。
+ * @param size: bytes of extent read from the data file
+ * @return false if the extent is corrupted
+ */
+PRIVATE bool PagerUnpackPage(Pager *pager, int32_t pageNum, const char *extent, ssize_t size, void *page) {
+    const ExtentHeader *header = (const ExtentHeader *)extent;
+    const char *payload        = extent + sizeof(ExtentHeader);
+    bool valid = size >= (ssize_t)sizeof(ExtentHeader) && header->magic == EXTENT_MAGIC && header->pageNum == pageNum &&
+                 header->size <= PAGE_SIZE && (ssize_t)sizeof(ExtentHeader) + header->size <= size &&
+                 header->checksum == PagerExtentChecksum(header, payload);
+    if (valid && !(header->flags & EXTENT_LZ)) {
+        if (header->size == PAGE_SIZE) {
+            memcpy(page, payload, PAGE_SIZE);
+            return true;
+        }
+        valid = false;
+    }
+    if (valid) {
+        char buffer[PAGE_DICTIONARY_SIZE + PAGE_SIZE];
+        memcpy(buffer, PAGE_DICTIONARY, PAGE_DICTIONARY_SIZE);
+        valid = Lz_Decompress(payload, header->size, buffer, PAGE_DICTIONARY_SIZE, PAGE_DICTIONARY_SIZE + PAGE_SIZE) ==
+                PAGE_DICTIONARY_SIZE + PAGE_SIZE;
+        memcpy(page, buffer + PAGE_DICTIONARY_SIZE, PAGE_SIZE);
+    }
+    if (!valid) {
+        LOG_ERROR("Extent of page %d is corrupted.", pageNum);
+        memset(page, 0, PAGE_SIZE);
+        return false;
+    }
+    if (header->flags & EXTENT_DELTA) {
+        PagerDeltaDecode(pager->config.format, (Page *)page);
+    }
+    return true;
+}
+
+/* 读取并解压第pageNum页，从没写入过的页面为全0 */
+PRIVATE void PagerReadExtent(Pager *pager, int32_t pageNum, void *page) {
+    PageExtent *e = &pager->extents[pageNum];
+    if (e->offset == -1) {
+        memset(page, 0, PAGE_SIZE);
+        return;
+    }
+    char extent[EXTENT_MAX_SIZE] __attribute__((aligned(8)));
+    ssize_t size = pread(pager->fd, extent, (size_t)e->sectors * EXTENT_SECTOR, e->offset);
+    if (size == -1) {
+        LOG_ERROR("Failed to read a page: %s", strerror(errno));
+    } else {
+        Metrics_Add(Metrics_BytesRead, size);
+    }
+    PagerUnpackPage(pager, pageNum, extent, size, page);
+}
+
+PRIVATE void PagerWriteExtent(Pager *pager, int32_t pageNum, const void *page) {
+    char extent[EXTENT_MAX_SIZE] __attribute__((aligned(8)));
+    int64_t offset;
+    PageExtent retired;
+    int32_t size = PagerPackPage(pager, pageNum, page, extent, &offset, &retired);
+    if (pwrite(pager->fd, extent, size, offset) != size) {
+        LOG_ERROR("Failed to write a page: %s", strerror(errno));
+        PagerRetireExtent(pager, pageNum, &retired, false);
+        return;
+    }
+    PagerRetireExtent(pager, pageNum, &retired, true);
+    Metrics_Add(Metrics_BytesWritten, size);
+    if (offset + size > pager->fileLength) {
+        pager->fileLength = offset + size;
+    }
+}
+
+/* 页面数减少到pageCount，回收多出的页面的extent */
+PRIVATE void PagerDropExtents(Pager *pager, int32_t pageCount) {
+    int32_t i;
+    for (i = pageCount; i < pager->pageCount; i++) {
+        if (pager->extents[i].offset != -1) {
+            PagerFreeExtent(pager, &pager->extents[i]);
+        }
+    }
+    pager->metaDirty = true;
+}
+
+/* 把[start, end)中的扇区放入空闲表，每个空闲extent最多 EXTENT_MAX_SECTORS 个扇区 */
+PRIVATE void PagerFreeGap(Pager *pager, int64_t start, int64_t end) {
+    while (start < end) {
+        int64_t sectors = (end - start) / EXTENT_SECTOR;
+        sectors         = sectors > EXTENT_MAX_SECTORS ? EXTENT_MAX_SECTORS : sectors;
+        PagerPushFreeExtent(pager, start, (int32_t)sectors);
+        start += sectors * EXTENT_SECTOR;
+    }
+}
+
+PRIVATE int CompareExtentOffset(const void *a, const void *b) {
+    int64_t x = ((const PageExtent *)a)->offset, y = ((const PageExtent *)b)->offset;
+    return x < y ? -1 : (x > y ? 1 : 0);
+}
+
+/* 没有被页面使用的扇区都是空闲的：按位置排序所有extent，它们之间的空隙放入空闲表 */
+PRIVATE void PagerBuildFreeExtents(Pager *pager) {
+    PageExtent *used = (PageExtent *)malloc((pager->pageCount + 1) * sizeof(PageExtent));
+    assert(used != NULL);
+    int32_t i, n = 0;
+    for (i = 0; i < pager->pageCount; i++) {
+        if (pager->extents[i].offset != -1) {
+            used[n++] = pager->extents[i];
+        }
+    }
+    qsort(used, n, sizeof(PageExtent), CompareExtentOffset);
+    int64_t end = EXTENT_SECTOR;
+    for (i = 0; i < n; i++) {
+        PagerFreeGap(pager, end, used[i].offset);
+        if (used[i].offset + (int64_t)used[i].sectors * EXTENT_SECTOR > end) {
+            end = used[i].offset + (int64_t)used[i].sectors * EXTENT_SECTOR;
+        }
+    }
+    pager->extentEnd = end;
+    free(used);
+}
+
+/**
+ * 顺序读取整个数据文件，每个页面取seq最大的extent，被取代的extent被抹掉。
+ * 页面数是出现过的最大页号加1。
+ */
+PRIVATE void PagerScanExtents(Pager *pager) {
+    int32_t i;
+    for (i = 0; i < pager->fenceSize; i++) {
+        pager->extents[i] = EMPTY_EXTENT;
+    }
+    pager->pageCount = 0;
+    pager->extentSeq = 0;
+    uint64_t *seqs   = (uint64_t *)calloc(pager->fenceSize, sizeof(uint64_t));
+    char *buffer     = (char *)malloc(EXTENT_SCAN_SIZE + EXTENT_MAX_SIZE);
+    assert(seqs != NULL && buffer != NULL);
+    int64_t offset = EXTENT_SECTOR;
+    while (offset < pager->fileLength) {
+        ssize_t n = pread(pager->fd, buffer, EXTENT_SCAN_SIZE + EXTENT_MAX_SIZE, offset);
+        if (n < (ssize_t)sizeof(ExtentHeader)) {
+            break;
+        }
+        // 从这一段中开始的extent都完整地在buffer中
+        int64_t pos = 0;
+        while (pos < EXTENT_SCAN_SIZE && pos + (ssize_t)sizeof(ExtentHeader) <= n) {
+            ExtentHeader *header = (ExtentHeader *)(buffer + pos);
+            if (header->magic != EXTENT_MAGIC || header->pageNum < 0 || header->size > PAGE_SIZE ||
+                header->sectors == 0 || header->sectors > EXTENT_MAX_SECTORS ||
+                pos + (ssize_t)sizeof(ExtentHeader) + header->size > n ||
+                header->checksum != PagerExtentChecksum(header, buffer + pos + sizeof(ExtentHeader))) {
+                pos += EXTENT_SECTOR;
+                continue;
+            }
+            int32_t pageNum = header->pageNum;
+            if (pageNum >= pager->pageCount) {
+                int32_t fenceSize = pager->fenceSize;
+                PagerGrowFences(pager, pageNum + 1);
+                seqs = (uint64_t *)realloc(seqs, pager->fenceSize * sizeof(uint64_t));
+                assert(seqs != NULL);
+                memset(seqs + fenceSize, 0, (pager->fenceSize - fenceSize) * sizeof(uint64_t));
+                pager->pageCount = pageNum + 1;
+            }
+            PageExtent *e = &pager->extents[pageNum];
+            if (e->offset != -1 && header->seq < seqs[pageNum]) {
+                PagerEraseExtent(pager, offset + pos);
+            } else {
+                if (e->offset != -1) {
+                    PagerEraseExtent(pager, e->offset);
+                }
+                e->offset      = offset + pos;
+                e->sectors     = header->sectors;
+                seqs[pageNum]  = header->seq;
+            }
+            if (header->seq > pager->extentSeq) {
+                pager->extentSeq = header->seq;
+            }
+            pos += (int64_t)header->sectors * EXTENT_SECTOR;
+        }
+        offset += pos;
+    }
+    free(buffer);
+    free(seqs);
+    pager->metaDirty = true;
+}
+
+/**
+ * 确定压缩的数据文件的页面数和每个页面的extent：元数据文件是正常关闭时写下的，直接读取，
+ * 否则扫描整个数据文件。新建的数据文件清空之后只写入第一个扇区的magic。
+ */
+PRIVATE void PagerLoadExtents(Pager *pager) {
+    uint32_t magic = 0;
+    if (pread(pager->fd, &magic, sizeof(uint32_t), 0) != sizeof(uint32_t) || magic != EXTENT_MAGIC) {
+        magic = EXTENT_MAGIC;
+        if (ftruncate(pager->fd, 0) == -1 || pwrite(pager->fd, &magic, sizeof(uint32_t), 0) != sizeof(uint32_t)) {
+            LOG_ERROR("Failed to write data file: %s", strerror(errno));
+        }
+        pager->fileLength = sizeof(uint32_t);
+        pager->pageCount  = 0;
+        pager->extentEnd  = EXTENT_SECTOR;
+        return;
+    }
+    MetaHeader header;
+    bool valid = pread(pager->metaFd, &header, sizeof(MetaHeader), 0) == sizeof(MetaHeader) &&
+                 header.magic == META_MAGIC && header.version == META_VERSION && header.clean == 1;
+    if (valid) {
+        pager->pageCount = header.pageCount;
+        pager->extentSeq = header.extentSeq;
+        PagerGrowFences(pager, pager->pageCount);
+        size_t size = pager->pageCount * sizeof(PageExtent);
+        off_t at    = PAGE_SIZE + (off_t)pager->pageCount * (sizeof(PageFence) + sizeof(uint8_t));
+        valid       = pread(pager->metaFd, pager->extents, size, at) == (ssize_t)size;
+    }
+    if (!valid) {
+        LOG_INFO("Rebuild extents of %s.", pager->file);
+        PagerScanExtents(pager);
+    }
+    PagerBuildFreeExtents(pager);
+}
+
+PRIVATE void PagerDestroyExtents(Pager *pager) {
+    int32_t i;
+    for (i = 0; i <= EXTENT_MAX_SECTORS; i++) {
+        free(pager->freeExtents[i].offsets);
+    }
+    free(pager->extents);
+    free(pager->extentBuffer);
+}
+
+/*************************************************************/
+// 页面读写
+
+/**
+ * 从文件中读取第pageNum页，文件末尾之外的部分视为全0。
+ */
+#ifndef DEBUG_TEST
+PRIVATE
+#endif
+void PagerReadPage(Pager *pager, int32_t pageNum, void *buffer) {
+    Metrics_Add(Metrics_PagesRead, 1);
+    if (pager->config.compress) {
+        PagerReadExtent(pager, pageNum, buffer);
+        return;
+    }
+    ssize_t readRet = pread(pager->fd, buffer, PAGE_SIZE, (off_t)pageNum * PAGE_SIZE);
+    if (readRet == -1) {
+        LOG_ERROR("Failed to read a page: %s", strerror(errno));
+        readRet = 0;
+    }
+    Metrics_Add(Metrics_BytesRead, readRet);
+    if (readRet < PAGE_SIZE) {
+        memset((char *)buffer + readRet, 0, PAGE_SIZE - readRet);
+    }
+}
+
+#ifndef DEBUG_TEST
+PRIVATE
+#endif
+void PagerWritePage(Pager *pager, int32_t pageNum, void *buffer) {
+    PagerWritePages(pager, pageNum, buffer, 1);
+}
+
+/* 将从pageNum开始的count个连续页面一次写入文件，压缩时逐个写入各自的extent */
+#ifndef DEBUG_TEST
+PRIVATE
+#endif
+void PagerWritePages(Pager *pager, int32_t pageNum, void *buffer, int32_t count) {
+    Metrics_Add(Metrics_PagesWritten, count);
+    if (pager->config.compress) {
+        int32_t i;
+        for (i = 0; i < count; i++) {
+            PagerWriteExtent(pager, pageNum + i, (char *)buffer + (size_t)i * PAGE_SIZE);
+        }
+        return;
+    }
+    off_t offset = (off_t)pageNum * PAGE_SIZE;
+    size_t size  = (size_t)count * PAGE_SIZE;
+    if (pwrite(pager->fd, buffer, size, offset) != (ssize_t)size) {
+        LOG_ERROR("Failed to write pages: %s", strerror(errno));
+        return;
+    }
+    Metrics_Add(Metrics_BytesWritten, size);
+    if (offset + (off_t)size > pager->fileLength) {
+        pager->fileLength = offset + size;
+    }
+}
+
+/*************************************************************/
+// 内存映射
+
+/**
+ * 预留mmapReserve字节的地址空间，再将数据文件映射到预留区域的开头。
+ * 文件增长时在预留区域内追加映射，映射的起始地址始终不变，
+ * 因此已经pin住的页面指针不会因为文件增长而失效。
+ */
+PRIVATE void PagerMapFile(Pager *pager) {
+    size_t reserve = pager->config.mmapReserve;
+    pager->mapSize = (size_t)pager->pageCount * PAGE_SIZE;
+    if (pager->mapSize > reserve) {
+        EXIT_ERROR("Data file is larger than mmapReserve.\n");
+    }
+    void *addr = mmap(NULL, reserve, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (addr == MAP_FAILED) {
+        EXIT_ERROR("Fail to reserve address space.\n");
+    }
+    pager->map = (char *)addr;
+    if (pager->mapSize > 0 &&
+        mmap(pager->map, pager->mapSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, pager->fd, 0) == MAP_FAILED) {
+        EXIT_ERROR("Fail to map data file.\n");
+    }
+    PagerGrowDirtyPages(pager, pager->pageCount);
+}
+
+/**
+ * 保证映射区域至少包含size字节。映射按倍数增长，新增的部分先用ftruncate扩展文件，
+ * 再映射到预留区域中紧接着已映射部分的位置。
+ */
+PRIVATE bool PagerGrowMapping(Pager *pager, size_t size) {
+    if (size <= pager->mapSize) {
+        return true;
+    }
+    size_t newSize = pager->mapSize < TABLE_MAX_PAGES * PAGE_SIZE ? TABLE_MAX_PAGES * PAGE_SIZE : pager->mapSize;
+    while (newSize < size) {
+        newSize *= 2;
+    }
+    if (newSize > pager->config.mmapReserve) {
+        newSize = size;
+    }
+    if (newSize > pager->config.mmapReserve) {
+        LOG_WARN("Data file reaches mmapReserve = %ld", pager->config.mmapReserve);
+        return false;
+    }
+    if ((off_t)newSize > pager->fileLength) {
+        if (ftruncate(pager->fd, newSize) == -1) {
+            LOG_ERROR("Failed to extend data file: %s", strerror(errno));
+            return false;
+        }
+        pager->fileLength = newSize;
+    }
+    if (mmap(pager->map + pager->mapSize, newSize - pager->mapSize, PROT_READ | PROT_WRITE,
+             MAP_SHARED | MAP_FIXED, pager->fd, pager->mapSize) == MAP_FAILED) {
+        LOG_ERROR("Failed to grow mapping: %s", strerror(errno));
+        return false;
+    }
+    pager->mapSize = newSize;
+    return true;
+}
+
+/* 保证dirtyPages至少能记录pageCount个页面，页面数只在独占dirLatch时增长 */
+PRIVATE void PagerGrowDirtyPages(Pager *pager, int32_t pageCount) {
+    int32_t words = (pageCount + 63) / 64;
+    if (words <= pager->dirtyWords) {
+        return;
+    }
+    int32_t size = pager->dirtyWords == 0 ? 16 : pager->dirtyWords * 2;
+    while (size < words) {
+        size *= 2;
+    }
+    pager->dirtyPages = (uint64_t *)realloc(pager->dirtyPages, size * sizeof(uint64_t));
+    assert(pager->dirtyPages != NULL);
+    memset(pager->dirtyPages + pager->dirtyWords, 0, (size - pager->dirtyWords) * sizeof(uint64_t));
+    pager->dirtyWords = size;
+}
+
+/* 多个线程可能同时标记同一个字中的不同页面 */
+PRIVATE void PagerMarkDirty(Pager *pager, int32_t pageNum) {
+    assert(pageNum / 64 < pager->dirtyWords);
+    __atomic_fetch_or(&pager->dirtyPages[pageNum / 64], 1UL << (pageNum % 64), __ATOMIC_RELAXED);
+}
+
+/* 将连续的脏页合并为一次msync */
+PRIVATE void PagerSyncMapping(Pager *pager) {
+    int32_t pageNum = 0, start;
+    while (pageNum < pager->dirtyWords * 64) {
+        if (!(pager->dirtyPages[pageNum / 64] >> (pageNum % 64) & 1)) {
+            pageNum++;
+            continue;
+        }
+        start = pageNum;
+        while (pageNum < pager->dirtyWords * 64 && (pager->dirtyPages[pageNum / 64] >> (pageNum % 64) & 1)) {
+            pageNum++;
+        }
+        if (msync(pager->map + (size_t)start * PAGE_SIZE, (size_t)(pageNum - start) * PAGE_SIZE, MS_SYNC) == -1) {
+            LOG_ERROR("Failed to sync pages: %s", strerror(errno));
+        }
+        Metrics_Add(Metrics_PagesWritten, pageNum - start);
+        Metrics_Add(Metrics_BytesWritten, (uint64_t)(pageNum - start) * PAGE_SIZE);
+    }
+    memset(pager->dirtyPages, 0, pager->dirtyWords * sizeof(uint64_t));
+}
+
+PRIVATE void PagerUnmapFile(Pager *pager) {
+    PagerSyncMapping(pager);
+    munmap(pager->map, pager->config.mmapReserve);
+    // 去掉映射增长时预先扩展的部分
+    if (pager->fileLength > (off_t)pager->pageCount * PAGE_SIZE) {
+        if (ftruncate(pager->fd, (off_t)pager->pageCount * PAGE_SIZE) == -1) {
+            LOG_ERROR("Failed to truncate data file: %s", strerror(errno));
+        }
+        pager->fileLength = (off_t)pager->pageCount * PAGE_SIZE;
+    }
+}
+
+/*************************************************************/
+// 缓冲池
+
+/**
+ * 保证pageTable至少能记录pageCount个页面。页面数只在独占dirLatch时增长，
+ * 不持有poolLatch查找pageTable的线程持有dirLatch共享锁，不会读到被释放的pageTable。
+ */
+PRIVATE void PagerGrowPageTable(Pager *pager, int32_t pageCount) {
+    if (pageCount <= pager->pageTableSize) {
+        return;
+    }
+    int32_t size = pager->pageTableSize * 2, k;
+    while (size < pageCount) {
+        size *= 2;
+    }
+    pager->pageTable = (int32_t *)realloc(pager->pageTable, size * sizeof(int32_t));
+    assert(pager->pageTable != NULL);
+    for (k = pager->pageTableSize; k < size; k++) {
+        pager->pageTable[k] = -1;
+    }
+    pager->pageTableSize = size;
+}
+
+/* 记录pageNum缓存在第i个页框中，i为-1时不再缓存 */
+PRIVATE void PagerMapPage(Pager *pager, int32_t pageNum, int32_t i) {
+    assert(pageNum < pager->pageTableSize);
+    __atomic_store_n(&pager->pageTable[pageNum], i, __ATOMIC_RELEASE);
+}
+
+PRIVATE int32_t PagerLookupFrame(Pager *pager, int32_t pageNum) {
+    return pageNum < pager->pageTableSize ? __atomic_load_n(&pager->pageTable[pageNum], __ATOMIC_ACQUIRE) : -1;
+}
+
+/**
+ * 不持有poolLatch时pin住第i个页框：先增加pinCount，再确认页框没有在被淘汰、
+ * 仍然缓存着pageNum并且已经读完。淘汰页框之前先把pinCount从0换成 FRAME_EVICTING，
+ * 所以pin住之后页框不会再变。
+ * @return false if the frame cannot be pinned this way, pinCount is unchanged
+ */
+PRIVATE bool PagerTryPinFrame(Pager *pager, int32_t i, int32_t pageNum) {
+    Frame *frame = &pager->frames[i];
+    if (__atomic_fetch_add(&frame->pinCount, 1, __ATOMIC_SEQ_CST) >= 0 &&
+        __atomic_load_n(&frame->pageNum, __ATOMIC_ACQUIRE) == pageNum &&
+        !__atomic_load_n(&frame->io, __ATOMIC_ACQUIRE)) {
+        __atomic_store_n(&frame->referenced, true, __ATOMIC_RELAXED);
+        return true;
+    }
+    __atomic_fetch_sub(&frame->pinCount, 1, __ATOMIC_RELEASE);
+    return false;
+}
+
+/* 独占一个没有被pin住的页框，准备淘汰它 */
+PRIVATE bool PagerClaimFrame(Frame *frame) {
+    int32_t expected = 0;
+    return __atomic_compare_exchange_n(&frame->pinCount, &expected, FRAME_EVICTING, false, __ATOMIC_SEQ_CST,
+                                       __ATOMIC_RELAXED);
+}
+
+/**
+ * 结束对页框的独占。不能直接赋值pinCount，PagerTryPinFrame 可能正在加减它。
+ * @param pins: pins of the caller
+ */
+PRIVATE void PagerReleaseFrame(Frame *frame, int32_t pins) {
+    __atomic_fetch_add(&frame->pinCount, pins - FRAME_EVICTING, __ATOMIC_SEQ_CST);
+}
+
+/* 页框的读写完成，唤醒等待它的线程。调用者持有poolLatch */
+PRIVATE void PagerFrameIoDone(Pager *pager, Frame *frame) {
+    __atomic_store_n(&frame->io, false, __ATOMIC_RELEASE);
+    pthread_cond_broadcast(&pager->ioDone);
+}
+
+/**
+ * 为一个脏页生成写请求。页框有磁盘副本时逐个扇区比较，只写被修改的扇区，相邻的扇区合并成一个请求。
+ * 修改的扇区超过 PAGE_PARTIAL_MAX_UNITS、页面还没有完整地写入过文件或者没有副本时写整个页面，
+ * 压缩时写入它的extent。
+ *
+ * @param extent: EXTENT_MAX_SIZE bytes to pack the page into if config.compress
+ * @param retired: extent to recycle by PagerRetireExtent after the requests complete
+ * @param requests: room for PAGE_PARTIAL_MAX_UNITS requests
+ * @return number of requests, 0 if the page is the same as on disk
+ */
+PRIVATE int32_t PagerFrameRequests(Pager *pager, Frame *frame, char *extent, PageExtent *retired,
+                                   AioRequest *requests) {
+    AioRequest request = {pager->fd, true, frame->data, PAGE_SIZE, (off_t)frame->pageNum * PAGE_SIZE, 0};
+    *retired           = EMPTY_EXTENT;
+    if (pager->config.compress) {
+        int64_t offset;
+        request.size   = PagerPackPage(pager, frame->pageNum, frame->data, extent, &offset, retired);
+        request.buffer = extent;
+        request.offset = offset;
+    }
+    if (frame->disk == NULL || !frame->diskValid || request.offset + PAGE_SIZE > pager->fileLength) {
+        requests[0] = request;
+        return 1;
+    }
+    int32_t unit, units = 0, n = 0;
+    for (unit = 0; unit < PAGE_WRITE_UNITS; unit++) {
+        size_t off = (size_t)unit * PAGE_WRITE_UNIT;
+        if (memcmp(frame->data + off, frame->disk + off, PAGE_WRITE_UNIT) == 0) {
+            continue;
+        }
+        if (++units > PAGE_PARTIAL_MAX_UNITS) {
+            requests[0] = request;
+            return 1;
+        }
+        if (n > 0 && requests[n - 1].offset + (off_t)requests[n - 1].size == request.offset + (off_t)off) {
+            requests[n - 1].size += PAGE_WRITE_UNIT;
+            continue;
+        }
+        requests[n]        = request;
+        requests[n].buffer = frame->data + off;
+        requests[n].size   = PAGE_WRITE_UNIT;
+        requests[n].offset = request.offset + off;
+        n++;
+    }
+    return n;
+}
+
+/**
+ * 写请求完成之后更新文件长度和磁盘副本
+ * @return false if some request failed, the page must be written again
+ */
+PRIVATE bool PagerFrameWritten(Pager *pager, Frame *frame, AioRequest *requests, int32_t n) {
+    int32_t i;
+    for (i = 0; i < n; i++) {
+        if (requests[i].result < 0 || (size_t)requests[i].result != requests[i].size) {
+            return false;
+        }
+    }
+    for (i = 0; i < n; i++) {
+        if (requests[i].offset + (off_t)requests[i].size > pager->fileLength) {
+            pager->fileLength = requests[i].offset + requests[i].size;
+        }
+        Metrics_Add(Metrics_BytesWritten, requests[i].size);
+    }
+    if (n > 0) {
+        Metrics_Add(Metrics_PagesWritten, 1);
+    }
+    if (frame->disk != NULL) {
+        if (n > 1 || (n == 1 && requests[0].size < PAGE_SIZE)) {
+            Metrics_Add(Metrics_PartialPageWrites, 1);
+        }
+        memcpy(frame->disk, frame->data, PAGE_SIZE);
+        frame->diskValid = true;
+    }
+    return true;
+}
+
+/**
+ * 写回一个被淘汰的脏页，页框已经被调用者独占。写入时释放poolLatch，页框标记为io，
+ * 要用这一页的线程等待写完，其他线程照常使用缓冲池。
+ * 页面最后一次修改的日志可能还没有写入磁盘（见 PagerTxnRelease），先等待它写入。
+ */
+PRIVATE void PagerWriteFrame(Pager *pager, Frame *frame) {
+    AioRequest requests[PAGE_PARTIAL_MAX_UNITS];
+    char extent[EXTENT_MAX_SIZE] __attribute__((aligned(8)));
+    PageExtent retired;
+    uint64_t pageLsn = ((Page *)frame->data)->pageLsn;
+    int32_t n        = PagerFrameRequests(pager, frame, extent, &retired, requests);
+    __atomic_store_n(&frame->io, true, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&pager->poolLatch);
+    // 一个事务的日志是一次追加的，pageLsn处的记录写入磁盘时整个事务都已经写入
+    if (pager->wal != NULL) {
+        Wal_Sync(pager->wal, pageLsn + 1);
+    }
+    // aio不能被多个线程同时使用，一个页面的请求直接同步执行
+    Aio_Execute(NULL, requests, n);
+    pthread_mutex_lock(&pager->poolLatch);
+    bool written = PagerFrameWritten(pager, frame, requests, n);
+    PagerRetireExtent(pager, frame->pageNum, &retired, written);
+    if (!written) {
+        LOG_ERROR("Failed to write a page: %s", strerror(errno));
+    }
+    PagerFrameIoDone(pager, frame);
+}
+
+/* 页框刚从文件读入，记下磁盘上的内容 */
+PRIVATE void PagerFrameLoaded(Frame *frame) {
+    if (frame->disk != NULL) {
+        memcpy(frame->disk, frame->data, PAGE_SIZE);
+        frame->diskValid = true;
+    }
+}
+
+/**
+ * CLOCK: 从clockHand开始扫描页框，跳过被pin住的页框，清除引用位，
+ * 直到找到一个空页框或引用位为0的页框。被淘汰的脏页先写回文件，写回时释放poolLatch。
+ * 返回的页框是空的，被调用者独占，用完之后调用 PagerReleaseFrame。
+ * 两圈之内仍找不到时，说明所有页框都被pin住，返回-1。
+ */
+PRIVATE int32_t PagerEvictFrame(Pager *pager) {
+    int32_t i;
+    for (i = 0; i < 2 * TABLE_MAX_PAGES; i++) {
+        int32_t victim   = pager->clockHand;
+        Frame *frame     = &pager->frames[victim];
+        pager->clockHand = (victim + 1) % TABLE_MAX_PAGES;
+        if (__atomic_load_n(&frame->pinCount, __ATOMIC_RELAXED) != 0) {
+            continue;
+        }
+        if (frame->pageNum != -1 && __atomic_load_n(&frame->referenced, __ATOMIC_RELAXED)) {
+            __atomic_store_n(&frame->referenced, false, __ATOMIC_RELAXED);
+            continue;
+        }
+        if (!PagerClaimFrame(frame)) {
+            continue;
+        }
+        if (frame->pageNum == -1) {
+            return victim;
+        }
+        // 写回时这一页仍然在pageTable中，要用它的线程等写完之后重新读入
+        if (__atomic_load_n(&frame->dirty, __ATOMIC_RELAXED)) {
+            PagerWriteFrame(pager, frame);
+            frame->dirty = false;
+        }
+        PagerMapPage(pager, frame->pageNum, -1);
+        __atomic_store_n(&frame->pageNum, -1, __ATOMIC_RELEASE);
+        return victim;
+    }
+    return -1;
+}
+
+/**
+ * 把第pageNum页读入被独占的第i个页框并pin住。读的时候释放poolLatch，页框标记为io，
+ * 要用这一页的线程等待读完，其他线程照常使用缓冲池。
+ */
+PRIVATE void PagerLoadFrame(Pager *pager, int32_t i, int32_t pageNum) {
+    Frame *frame = &pager->frames[i];
+    __atomic_store_n(&frame->io, true, __ATOMIC_RELAXED);
+    __atomic_store_n(&frame->referenced, true, __ATOMIC_RELAXED);
+    __atomic_store_n(&frame->pageNum, pageNum, __ATOMIC_RELEASE);
+    PagerMapPage(pager, pageNum, i);
+    PagerReleaseFrame(frame, 1);
+    pthread_mutex_unlock(&pager->poolLatch);
+    PagerReadPage(pager, pageNum, frame->data);
+    PagerFrameLoaded(frame);
+    pthread_mutex_lock(&pager->poolLatch);
+    PagerFrameIoDone(pager, frame);
+}
+
+/**
+ * 持有poolLatch时pin住第pageNum页，不在缓冲池中时淘汰一个页框读入它。
+ * 这一页正在被读入或者写回时，释放poolLatch等待它完成。
+ * @return frame index, -1 if all frames are pinned
+ */
+PRIVATE int32_t PagerPinFrame(Pager *pager, int32_t pageNum) {
+    for (;;) {
+        int32_t i = PagerLookupFrame(pager, pageNum);
+        if (i != -1) {
+            Frame *frame = &pager->frames[i];
+            // 缓存着这一页的页框正在被淘汰，写回之后重新读入
+            if (__atomic_load_n(&frame->pinCount, __ATOMIC_RELAXED) < 0) {
+                pthread_cond_wait(&pager->ioDone, &pager->poolLatch);
+                continue;
+            }
+            __atomic_fetch_add(&frame->pinCount, 1, __ATOMIC_SEQ_CST);
+            __atomic_store_n(&frame->referenced, true, __ATOMIC_RELAXED);
+            while (__atomic_load_n(&frame->io, __ATOMIC_ACQUIRE)) {
+                pthread_cond_wait(&pager->ioDone, &pager->poolLatch);
+            }
+            Metrics_Add(Metrics_CacheHits, 1);
+            return i;
+        }
+        i = PagerEvictFrame(pager);
+        if (i == -1) {
+            return -1;
+        }
+        // 写回被淘汰的页面时释放过poolLatch，其他线程可能已经开始读入这一页
+        if (PagerLookupFrame(pager, pageNum) != -1) {
+            PagerReleaseFrame(&pager->frames[i], 0);
+            continue;
+        }
+        Metrics_Add(Metrics_CacheMisses, 1);
+        PagerLoadFrame(pager, i, pageNum);
+        return i;
+    }
+}
+
+/**
+ * 将第pageNum页读入缓冲池并pin住，返回页面数据。
+ * 使用完毕后必须调用 Pager_UnpinPage。
+ * 
+ * @return NULL if pageNum is out of range or all frames are pinned
+ */
+TINYDB_API void *Pager_PinPage(Pager *pager, int32_t pageNum) {
+    if (pageNum < 0 || pageNum >= pager->pageCount) {
+        return NULL;
+    }
+    if (pager->config.storage == Pager_Mmap) {
+        return pager->map + (size_t)pageNum * PAGE_SIZE;
+    }
+    // 缓存的页面不需要poolLatch
+    int32_t i = PagerLookupFrame(pager, pageNum);
+    if (i != -1 && PagerTryPinFrame(pager, i, pageNum)) {
+        Metrics_Add(Metrics_CacheHits, 1);
+        return pager->frames[i].data;
+    }
+    pthread_mutex_lock(&pager->poolLatch);
+    i = PagerPinFrame(pager, pageNum);
+    pthread_mutex_unlock(&pager->poolLatch);
+    if (i == -1) {
+        LOG_WARN("All frames are pinned, page = %d", pageNum);
+        return NULL;
+    }
+    return pager->frames[i].data;
+}
+
+/* 页面数加1，新页面的fence需要写入元数据文件 */
+PRIVATE int32_t PagerAppendPage(Pager *pager) {
+    int32_t pageNum = pager->pageCount++;
+    PagerGrowFences(pager, pager->pageCount);
+    if (pager->config.storage == Pager_Mmap) {
+        PagerGrowDirtyPages(pager, pager->pageCount);
+    } else {
+        PagerGrowPageTable(pager, pager->pageCount);
+    }
+    pager->metaDirty = true;
+    return pageNum;
+}
+
+/**
+ * 在文件末尾追加一个全0的新页面，返回被pin住的页面数据。
+ * 新页面被标记为脏页，在写回之前不会占用磁盘空间。
+ * 页面数改变，多线程使用时调用者需要独占dirLatch。
+ */
+TINYDB_API void *Pager_NewPage(Pager *pager, int32_t *pageNum) {
+    if (pager->config.storage == Pager_Mmap) {
+        if (!PagerGrowMapping(pager, (size_t)(pager->pageCount + 1) * PAGE_SIZE)) {
+            return NULL;
+        }
+        *pageNum   = PagerAppendPage(pager);
+        char *data = pager->map + (size_t)*pageNum * PAGE_SIZE;
+        memset(data, 0, PAGE_SIZE);
+        PagerMarkDirty(pager, *pageNum);
+        return data;
+    }
+    pthread_mutex_lock(&pager->poolLatch);
+    int32_t i = PagerEvictFrame(pager);
+    if (i == -1) {
+        pthread_mutex_unlock(&pager->poolLatch);
+        LOG_WARN("All frames are pinned, cannot allocate a new page.");
+        return NULL;
+    }
+    Frame *frame = &pager->frames[i];
+    *pageNum     = PagerAppendPage(pager);
+    memset(frame->data, 0, PAGE_SIZE);
+    frame->dirty      = true;
+    frame->referenced = true;
+    frame->diskValid  = false;
+    __atomic_store_n(&frame->pageNum, *pageNum, __ATOMIC_RELEASE);
+    PagerMapPage(pager, *pageNum, i);
+    PagerReleaseFrame(frame, 1);
+    pthread_mutex_unlock(&pager->poolLatch);
+    return frame->data;
+}
+
+/**
+ * @param dirty: true if the caller modified the page
+ */
+TINYDB_API void Pager_UnpinPage(Pager *pager, int32_t pageNum, bool dirty) {
+    if (pager->config.storage == Pager_Mmap) {
+        if (dirty) {
+            PagerMarkDirty(pager, pageNum);
+        }
+        return;
+    }
+    // 页框被pin住时不会被淘汰，不需要poolLatch
+    int32_t i = PagerLookupFrame(pager, pageNum);
+    assert(i != -1 && __atomic_load_n(&pager->frames[i].pinCount, __ATOMIC_RELAXED) > 0);
+    Frame *frame = &pager->frames[i];
+    if (dirty) {
+        __atomic_store_n(&frame->dirty, true, __ATOMIC_RELAXED);
+    }
+    __atomic_fetch_sub(&frame->pinCount, 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * 将所有脏页写回文件，Pager_Mmap 模式下对脏页所在的范围调用msync。
+ * 所有脏页作为一批请求交给aio，它们可以同时在设备的队列中。
+ * 调用者独占dirLatch，没有线程在修改页面，但是其他事务可能已经追加了日志还没有写入磁盘（见 PagerTxnAppend），
+ * 先把日志写完，页面不会早于它的日志写回。
+ */
+PRIVATE void PagerFlush(Pager *pager) {
+    if (pager->config.storage == Pager_Mmap) {
+        PagerSyncMapping(pager);
+        return;
+    }
+    if (pager->wal != NULL) {
+        Wal_Flush(pager->wal);
+    }
+    pthread_mutex_lock(&pager->poolLatch);
+    AioRequest requests[TABLE_MAX_PAGES * PAGE_PARTIAL_MAX_UNITS];
+    PageExtent retired[TABLE_MAX_PAGES];
+    int32_t frames[TABLE_MAX_PAGES], firsts[TABLE_MAX_PAGES + 1];
+    int32_t i, n = 0, count = 0;
+    for (i = 0; i < TABLE_MAX_PAGES; i++) {
+        Frame *frame = &pager->frames[i];
+        // 等待日志的事务释放页面时会并发地设置dirty
+        if (frame->pageNum == -1 || !__atomic_load_n(&frame->dirty, __ATOMIC_RELAXED)) {
+            continue;
+        }
+        char *extent = pager->config.compress ? pager->extentBuffer + (size_t)n * EXTENT_MAX_SIZE : NULL;
+        firsts[n]    = count;
+        frames[n]    = i;
+        count += PagerFrameRequests(pager, frame, extent, &retired[n], requests + count);
+        n++;
+    }
+    firsts[n] = count;
+    if (Aio_Execute(pager->aio, requests, count) > 0) {
+        LOG_ERROR("Failed to write pages: %s", strerror(errno));
+    }
+    // 旧的extent等整批写完才回收，批中的页面不会分到别的页面还没被替换掉的extent
+    for (i = 0; i < n; i++) {
+        Frame *frame = &pager->frames[frames[i]];
+        bool written = PagerFrameWritten(pager, frame, requests + firsts[i], firsts[i + 1] - firsts[i]);
+        PagerRetireExtent(pager, frame->pageNum, &retired[i], written);
+        if (written) {
+            __atomic_store_n(&frame->dirty, false, __ATOMIC_RELAXED);
+        }
+    }
+    pthread_mutex_unlock(&pager->poolLatch);
+}
+
+TINYDB_API void Pager_Flush(Pager *pager) {
+    uint64_t start = Metrics_Now();
+    pthread_rwlock_wrlock(&pager->dirLatch);
+    PagerFlush(pager);
+    pthread_rwlock_unlock(&pager->dirLatch);
+    Metrics_Record(Metrics_PagerFlush, Metrics_Now() - start);
+}
+
+/**
+ * 预读：把pageNums中不在缓冲池里的页面一次性读入缓冲池，不pin住它们。
+ * 开启aio时这些读请求同时提交，适合扫描或者一次查找多个id之前调用。
+ * 预读的页面数不超过缓冲池的一半，多出的部分被忽略。
+ * 读的时候不持有poolLatch，这些页框标记为io，只有要用这些页面的线程需要等待。
+ */
+PRIVATE void PagerPrefetch(Pager *pager, const int32_t *pageNums, int32_t n) {
+    int32_t i, count = 0;
+    if (pager->config.storage == Pager_Mmap) {
+        for (i = 0; i < n; i++) {
+            if (pageNums[i] >= 0 && pageNums[i] < pager->pageCount) {
+                madvise(pager->map + (size_t)pageNums[i] * PAGE_SIZE, PAGE_SIZE, MADV_WILLNEED);
+            }
+        }
+        return;
+    }
+    AioRequest requests[TABLE_MAX_PAGES / 2];
+    int32_t frames[TABLE_MAX_PAGES / 2];
+    pthread_mutex_lock(&pager->prefetchLatch);
+    pthread_mutex_lock(&pager->poolLatch);
+    for (i = 0; i < n && count < TABLE_MAX_PAGES / 2; i++) {
+        int32_t pageNum = pageNums[i];
+        if (pageNum < 0 || pageNum >= pager->pageCount || PagerLookupFrame(pager, pageNum) != -1) {
+            continue;
+        }
+        int32_t k = PagerEvictFrame(pager);
+        if (k == -1) {
+            break;
+        }
+        Frame *frame = &pager->frames[k];
+        if (PagerLookupFrame(pager, pageNum) != -1) {
+            PagerReleaseFrame(frame, 0);
+            continue;
+        }
+        // 读完之前先pin住，防止被这一批中后面的页面淘汰
+        __atomic_store_n(&frame->io, true, __ATOMIC_RELAXED);
+        __atomic_store_n(&frame->referenced, true, __ATOMIC_RELAXED);
+        __atomic_store_n(&frame->pageNum, pageNum, __ATOMIC_RELEASE);
+        PagerMapPage(pager, pageNum, k);
+        PagerReleaseFrame(frame, 1);
+        AioRequest request = {pager->fd, false, frame->data, PAGE_SIZE, (off_t)pageNum * PAGE_SIZE, 0};
+        if (pager->config.compress) {
+            // 压缩的页面读入extentBuffer，读完之后再解压到页框中
+            PageExtent *e = &pager->extents[pageNum];
+            if (e->offset == -1) {
+                memset(frame->data, 0, PAGE_SIZE);
+                PagerFrameIoDone(pager, frame);
+                __atomic_fetch_sub(&frame->pinCount, 1, __ATOMIC_RELEASE);
+                continue;
+            }
+            request.buffer = pager->extentBuffer + (size_t)count * EXTENT_MAX_SIZE;
+            request.size   = (size_t)e->sectors * EXTENT_SECTOR;
+            request.offset = e->offset;
+        }
+        requests[count] = request;
+        frames[count++] = k;
+    }
+    pthread_mutex_unlock(&pager->poolLatch);
+    Aio_Execute(pager->aio, requests, count);
+    for (i = 0; i < count; i++) {
+        Frame *frame   = &pager->frames[frames[i]];
+        ssize_t result = requests[i].result < 0 ? 0 : requests[i].result;
+        if (requests[i].result < 0) {
+            LOG_WARN("Failed to prefetch page %d", frame->pageNum);
+        }
+        Metrics_Add(Metrics_PagesRead, 1);
+        Metrics_Add(Metrics_BytesRead, result);
+        if (pager->config.compress) {
+            PagerUnpackPage(pager, frame->pageNum, (char *)requests[i].buffer, result, frame->data);
+        } else {
+            // 文件末尾之外的部分视为全0
+            memset(frame->data + result, 0, PAGE_SIZE - result);
+            PagerFrameLoaded(frame);
+        }
+    }
+    pthread_mutex_lock(&pager->poolLatch);
+    for (i = 0; i < count; i++) {
+        Frame *frame = &pager->frames[frames[i]];
+        PagerFrameIoDone(pager, frame);
+        __atomic_fetch_sub(&frame->pinCount, 1, __ATOMIC_RELEASE);
+    }
+    pthread_mutex_unlock(&pager->poolLatch);
+    pthread_mutex_unlock(&pager->prefetchLatch);
+}
+
+TINYDB_API void Pager_Prefetch(Pager *pager, const int32_t *pageNums, int32_t n) {
+    pthread_rwlock_rdlock(&pager->dirLatch);
+    PagerPrefetch(pager, pageNums, n);
+    pthread_rwlock_unlock(&pager->dirLatch);
+}
+
+/*************************************************************/
+// 预写日志
+
+/**
+ * 一次操作修改的页面。开启日志时，页面在提交之前一直被pin住，提交之后才释放，
+ * 所以缓冲池不会把没有提交的修改写回文件（Pager_InsertBatch 的staging页面除外）。
+ * pageNums: -1 if the page is not pinned
+ * offsets: offset of the last record of the page in batch
+ */
+typedef struct PagerTxn {
+    WalBatch batch;
+    int32_t count;
+    int32_t pageNums[TXN_MAX_PAGES];
+    Page *pages[TXN_MAX_PAGES];
+    uint32_t offsets[TXN_MAX_PAGES];
+} PagerTxn;
+
+/**
+ * 记录对一个页面的修改，page已经被修改过。没有开启日志时直接释放页面。
+ * checkpoint之后第一次修改一个页面时，记录整个页面的镜像而不是type，
+ * 这样即使页面写入文件时只写了一部分，也可以从镜像恢复。
+ *
+ * @param pageNum: -1 if page is not pinned
+ */
+PRIVATE void PagerLogRecord(Pager *pager, PagerTxn *txn, int32_t pageNum, Page *page, int32_t diskPage,
+                            uint32_t type, const void *payload, uint32_t size) {
+    if (pager->wal == NULL) {
+        if (pageNum != -1) {
+            Pager_UnpinPage(pager, pageNum, true);
+        }
+        return;
+    }
+    if (page->pageLsn <= pager->wal->checkpointLsn) {
+        type    = Wal_ImageRecord;
+        payload = page;
+        size    = PAGE_SIZE;
+    }
+    uint32_t offset = Wal_BatchAppend(&txn->batch, type, diskPage, payload, size);
+    int32_t i;
+    for (i = 0; i < txn->count && txn->pages[i] != page; i++) {
+    }
+    if (i == txn->count) {
+        assert(txn->count < TXN_MAX_PAGES);
+        txn->pages[i]    = page;
+        txn->pageNums[i] = pageNum;
+        txn->count++;
+    } else if (pageNum != -1) {
+        // 页面已经被这个事务pin住，只需要释放一次
+        Pager_UnpinPage(pager, pageNum, true);
+    }
+    txn->offsets[i] = offset;
+}
+
+/* 记录整个页面 */
+PRIVATE void PagerLogPage(Pager *pager, PagerTxn *txn, int32_t pageNum, Page *page, int32_t diskPage) {
+    PagerLogRecord(pager, txn, pageNum, page, diskPage, Wal_ImageRecord, page, PAGE_SIZE);
+}
+
+/* 记录插入的行，var不为NULL时记录完整的 Pager_VarFormat 记录 */
+PRIVATE void PagerLogInsert(Pager *pager, PagerTxn *txn, int32_t pageNum, Page *page, Row *row, const VarRow *var) {
+    if (var != NULL) {
+        PagerLogRecord(pager, txn, pageNum, page, pageNum, Wal_VarInsertRecord, var, sizeof(VarRow));
+    } else {
+        PagerLogRecord(pager, txn, pageNum, page, pageNum, Wal_InsertRecord, row, ROW_SIZE);
+    }
+}
+
+/* 标记一个被pin住的页面为脏页，不释放它 */
+PRIVATE void PagerDirtyPinned(Pager *pager, int32_t pageNum) {
+    if (pager->config.storage == Pager_Mmap) {
+        PagerMarkDirty(pager, pageNum);
+        return;
+    }
+    int32_t i = PagerLookupFrame(pager, pageNum);
+    assert(i != -1);
+    __atomic_store_n(&pager->frames[i].dirty, true, __ATOMIC_RELAXED);
+}
+
+/**
+ * 提交事务的前一半：日志追加到日志缓冲区，事务的顺序就此确定，更新页面的pageLsn。
+ * 页面仍然被pin住，直到 PagerTxnSync 或 PagerTxnRelease。
+ * 调用者仍持有dirLatch，这时就把页面标记为脏页：释放dirLatch之后、PagerTxnSync 之前的checkpoint
+ * 会写回这些页面，不会越过它们的日志而漏掉修改。
+ * @return lsn to wait for in PagerTxnSync
+ */
+PRIVATE uint64_t PagerTxnAppend(Pager *pager, PagerTxn *txn) {
+    uint64_t end = 0;
+    if (pager->wal != NULL && txn->count > 0) {
+        uint64_t lsn = Wal_Append(pager->wal, &txn->batch, pager->pageCount, &end);
+        int32_t i;
+        for (i = 0; i < txn->count; i++) {
+            txn->pages[i]->pageLsn = lsn + txn->offsets[i];
+            if (txn->pageNums[i] != -1) {
+                PagerDirtyPinned(pager, txn->pageNums[i]);
+            }
+        }
+    }
+    return end;
+}
+
+/**
+ * 不等待日志写入磁盘，直接释放已经追加过日志的页面。页面在日志写入磁盘之前就可能被淘汰，
+ * PagerWriteFrame 写回之前会等待页面的日志写入，日志先于页面写入磁盘的顺序仍然成立。
+ * 批量插入用它避免pin住所有修改过的页面，最后只等待一次日志写入磁盘。
+ */
+PRIVATE void PagerTxnRelease(Pager *pager, PagerTxn *txn) {
+    if (pager->wal != NULL) {
+        int32_t i;
+        for (i = 0; i < txn->count; i++) {
+            if (txn->pageNums[i] != -1) {
+                Pager_UnpinPage(pager, txn->pageNums[i], true);
+            }
+        }
+    }
+    txn->count = 0;
+}
+
+/* 提交事务的后一半：等待日志写入磁盘，然后释放页面 */
+PRIVATE void PagerTxnSync(Pager *pager, PagerTxn *txn, uint64_t end) {
+    if (pager->wal != NULL && txn->count > 0) {
+        Wal_Sync(pager->wal, end);
+    }
+    PagerTxnRelease(pager, txn);
+    Wal_BatchFree(&txn->batch);
+}
+
+/* 不再跟踪没有被pin住的页面，它们已经被写入文件 */
+PRIVATE void PagerTxnForgetUnpinned(PagerTxn *txn) {
+    int32_t i, n = 0;
+    for (i = 0; i < txn->count; i++) {
+        if (txn->pageNums[i] != -1) {
+            txn->pages[n]    = txn->pages[i];
+            txn->pageNums[n] = txn->pageNums[i];
+            txn->offsets[n]  = txn->offsets[i];
+            n++;
+        }
+    }
+    txn->count = n;
+}
+
+/* 重做一条日志记录，页面镜像总是被重做，其他记录只重做在pageLsn之后的 */
+PRIVATE void PagerRedo(void *arg, uint64_t lsn, WalRecord *record, const void *payload) {
+    Pager *pager = (Pager *)arg;
+    while (record->pageNum >= pager->pageCount) {
+        PagerAppendPage(pager);
+    }
+    Page *page = (Page *)Pager_PinPage(pager, record->pageNum);
+    if (page == NULL) {
+        EXIT_ERROR("Failed to redo wal.\n");
+    }
+    if (record->type != Wal_ImageRecord && page->pageLsn >= lsn) {
+        Pager_UnpinPage(pager, record->pageNum, false);
+        return;
+    }
+    PageFormat format = pager->config.format;
+    int32_t k;
+    switch (record->type) {
+        case Wal_ImageRecord:
+            memcpy(page, payload, PAGE_SIZE);
+            break;
+        case Wal_InsertRecord:
+            Page_Insert(format, page, (Row *)payload);
+            break;
+        case Wal_VarInsertRecord:
+            Var_InsertVar(page, (const VarRow *)payload);
+            break;
+        case Wal_UpdateRecord:
+            k = Page_Find(format, page, ((Row *)payload)->id);
+            if (k != -1) {
+                Page_Set(format, page, k, (Row *)payload);
+            }
+            break;
+        case Wal_VarUpdateRecord:
+            k = Page_Find(format, page, ((const VarRow *)payload)->id);
+            if (k != -1) {
+                Var_SetVar(page, k, (const VarRow *)payload);
+            }
+            break;
+        case Wal_DeleteRecord:
+            k = Page_Find(format, page, *(KEY *)payload);
+            if (k != -1) {
+                Page_Remove(format, page, k, NULL);
+            }
+            break;
+    }
+    page->pageLsn = lsn;
+    Pager_UnpinPage(pager, record->pageNum, true);
+}
+
+/**
+ * 页面数减少到pageCount：丢弃缓存的多出的页面，截断数据文件，压缩的数据文件则回收它们的extent。
+ * 调用者独占dirLatch，多出的页面都没有被pin住。
+ */
+PRIVATE void PagerTruncate(Pager *pager, int32_t pageCount) {
+    int32_t i;
+    if (pager->config.storage == Pager_Mmap) {
+        for (i = pageCount; i < pager->pageCount; i++) {
+            pager->dirtyPages[i / 64] &= ~(1UL << (i % 64));
+        }
+    } else {
+        for (i = 0; i < TABLE_MAX_PAGES; i++) {
+            Frame *frame = &pager->frames[i];
+            if (frame->pageNum >= pageCount) {
+                assert(__atomic_load_n(&frame->pinCount, __ATOMIC_RELAXED) == 0);
+                PagerMapPage(pager, frame->pageNum, -1);
+                frame->pageNum = -1;
+                frame->dirty   = false;
+            }
+        }
+    }
+    for (i = pageCount; i < pager->pageCount && i < pager->fenceSize; i++) {
+        pager->fences[i] = EMPTY_FENCE;
+        pager->fsm[i]    = 0;
+        if (pager->localDepths != NULL) {
+            pager->localDepths[i] = -1;
+        }
+    }
+    if (pager->emptyHint > pageCount) {
+        pager->emptyHint = pageCount;
+    }
+    pager->metaDirty = true;
+    if (pager->config.compress) {
+        PagerDropExtents(pager, pageCount);
+        pager->pageCount = pageCount;
+        return;
+    }
+    pager->pageCount  = pageCount;
+    pager->fileLength = (off_t)pageCount * PAGE_SIZE;
+    if (ftruncate(pager->fd, pager->fileLength) == -1) {
+        LOG_ERROR("Failed to truncate data file: %s", strerror(errno));
+    }
+    // 映射中被截掉的部分在文件再次增长时由 PagerGrowMapping 重新映射
+    if (pager->config.storage == Pager_Mmap && pager->mapSize > (size_t)pager->fileLength) {
+        pager->mapSize = pager->fileLength;
+    }
+}
+
+/**
+ * 打开日志并重做已经提交的事务。没有提交的 Pager_InsertBatch 可能已经把页面追加到了文件末尾，
+ * 这些页面在最后一个事务提交时还不存在，直接截掉，压缩的数据文件则回收它们的extent。
+ * @return true if the data file was changed
+ */
+PRIVATE bool PagerRecover(Pager *pager) {
+    char *walFile = (char *)alloca(strlen(pager->file) + sizeof(WAL_FILE_SUFFIX));
+    sprintf(walFile, "%s%s", pager->file, WAL_FILE_SUFFIX);
+    pager->wal = New_Wal(walFile, pager->config.groupCommitUs);
+
+    int32_t pageCount;
+    int32_t txns   = Wal_Replay(pager->wal, PagerRedo, pager, &pageCount);
+    bool truncated = pageCount >= 0 && pager->pageCount > pageCount;
+    if (truncated) {
+        PagerTruncate(pager, pageCount);
+    }
+    if (txns > 0) {
+        LOG_INFO("Redo %d transactions from %s.", txns, walFile);
+    }
+    return txns > 0 || truncated;
+}
+
+/**
+ * 将所有脏页和页面目录写入文件，然后清空日志。
+ * 调用者独占dirLatch，没有正在修改页面的事务；已经追加了日志、还在等待写入磁盘的事务的页面
+ * 在追加时就已标记为脏页，和它们的日志一起被写入。
+ */
+PRIVATE void PagerCheckpoint(Pager *pager) {
+    PagerFlush(pager);
+    fdatasync(pager->fd);
+    PagerWriteMeta(pager, false);
+    if (pager->wal != NULL) {
+        Wal_Truncate(pager->wal, pager->pageCount);
+    }
+}
+
+/* 日志超过walCheckpointSize时做一次checkpoint，调用者不持有dirLatch */
+PRIVATE void PagerMaybeCheckpoint(Pager *pager) {
+    if (pager->wal != NULL && Wal_Size(pager->wal) > pager->config.walCheckpointSize) {
+        pthread_rwlock_wrlock(&pager->dirLatch);
+        // 等待的时候其他线程可能已经做过checkpoint
+        if (Wal_Size(pager->wal) > pager->config.walCheckpointSize) {
+            PagerCheckpoint(pager);
+        }
+        pthread_rwlock_unlock(&pager->dirLatch);
+    }
+}
+
+TINYDB_API void Pager_Checkpoint(Pager *pager) {
+    uint64_t start = Metrics_Now();
+    pthread_rwlock_wrlock(&pager->dirLatch);
+    PagerCheckpoint(pager);
+    pthread_rwlock_unlock(&pager->dirLatch);
+    Metrics_Record(Metrics_PagerCheckpoint, Metrics_Now() - start);
+}
+
+/*************************************************************/
+// 可扩展散列
+// Pager_HashAccess：每个非空页面是一个桶，存放散列值前localDepth位相同的记录，页面内的记录仍按id排序。
+// id的散列值的前globalDepth位是buckets的下标，一个桶占据 2^(globalDepth - localDepth) 个连续的目录项。
+// 页面满了只分裂它所在的桶，按散列值的下一位把记录分到两个页面，只有localDepth == globalDepth时目录才加倍，
+// 加倍只复制目录项，不移动任何记录。没有记录的页面不是桶，对应的目录项为-1，插入时再分配页面，
+// 所以空页面总是可以被复用或截掉，和 Pager_RangeAccess 一样。
+
+/* murmur3的32位finalizer，是一一映射，不同的id散列值一定不同 */
+#ifndef DEBUG_TEST
+PRIVATE
+#endif
+uint32_t PagerHash(KEY id) {
+    uint32_t h = (uint32_t)id;
+    h ^= h >> 16;
+    h *= 0x85EBCA6B;
+    h ^= h >> 13;
+    h *= 0xC2B2AE35;
+    h ^= h >> 16;
+    return h;
+}
+
+/* 散列值h对应的目录项 */
+inline int32_t PagerHashSlot(Pager *pager, uint32_t h) {
+    return pager->globalDepth == 0 ? 0 : (int32_t)(h >> (32 - pager->globalDepth));
+}
+
+/* 包含第slot项、局部深度为depth的桶占据的第一个目录项 */
+inline int32_t PagerBucketFirst(Pager *pager, int32_t slot, int32_t depth) {
+    int32_t shift = pager->globalDepth - depth;
+    return slot >> shift << shift;
+}
+
+/* 存放id的页面，还没有页面时返回-1 */
+PRIVATE int32_t PagerHashPage(Pager *pager, KEY id) {
+    return pager->buckets[PagerHashSlot(pager, PagerHash(id))];
+}
+
+PRIVATE void PagerSetBuckets(Pager *pager, int32_t first, int32_t count, int32_t pageNum) {
+    int32_t i;
+    for (i = 0; i < count; i++) {
+        pager->buckets[first + i] = pageNum;
+    }
+    pager->metaDirty = true;
+}
+
+/* 目录加倍：每一项复制成相邻的两项，每个桶的页面不变 */
+PRIVATE void PagerDoubleBuckets(Pager *pager) {
+    int32_t size = 1 << pager->globalDepth, i;
+    assert(pager->globalDepth < 30);
+    pager->buckets = (int32_t *)realloc(pager->buckets, 2 * (size_t)size * sizeof(int32_t));
+    assert(pager->buckets != NULL);
+    for (i = size - 1; i >= 0; i--) {
+        pager->buckets[2 * i] = pager->buckets[2 * i + 1] = pager->buckets[i];
+    }
+    pager->globalDepth++;
+    pager->metaDirty = true;
+}
+
+/**
+ * 分裂第pageNum页的桶：散列值第localDepth + 1位为1的记录移到一个空页面。
+ * 记录都在同一边时不需要新页面，没有记录的那一半目录项置为-1。
+ * page仍然被调用者pin住，修改过的页面记录在txn中。调用者独占dirLatch。
+ * @return false if no page can be allocated
+ */
+PRIVATE bool PagerSplitBucket(Pager *pager, PagerTxn *txn, int32_t pageNum, Page *page) {
+    PageFormat format = pager->config.format;
+    if (pager->localDepths[pageNum] == pager->globalDepth) {
+        PagerDoubleBuckets(pager);
+    }
+    int32_t depth = pager->localDepths[pageNum], moved = 0, k;
+    uint32_t bit  = 1u << (31 - depth);
+    for (k = 0; k < page->rowCount; k++) {
+        moved += (PagerHash(Page_Id(format, page, k)) & bit) != 0;
+    }
+    int32_t half  = 1 << (pager->globalDepth - depth - 1);
+    int32_t first = PagerBucketFirst(pager, PagerHashSlot(pager, PagerHash(Page_Id(format, page, 0))), depth);
+    if (moved == 0 || moved == page->rowCount) {
+        pager->localDepths[pageNum] = depth + 1;
+        PagerSetBuckets(pager, moved == 0 ? first + half : first, half, -1);
+        return true;
+    }
+    int32_t rightNum;
+    Page *right = PagerAllocPage(pager, &rightNum);
+    if (right == NULL) {
+        return false;
+    }
+    for (k = 0; k < page->rowCount;) {
+        if (PagerHash(Page_Id(format, page, k)) & bit) {
+            Page_CopyRow(format, page, k, right, true);
+            Page_Remove(format, page, k, NULL);
+        } else {
+            k++;
+        }
+    }
+    pager->localDepths[pageNum] = pager->localDepths[rightNum] = depth + 1;
+    PagerSetBuckets(pager, first + half, half, rightNum);
+    right->lastModifyTime = page->lastModifyTime = time(NULL);
+    PagerSetPage(pager, pageNum, page);
+    PagerSetPage(pager, rightNum, right);
+    PagerLogPage(pager, txn, rightNum, right, rightNum);
+    Pager_PinPage(pager, pageNum);
+    PagerLogPage(pager, txn, pageNum, page, pageNum);
+    Metrics_Add(Metrics_PageSplits, 1);
+    LOG_DEBUG("Split bucket, new page = %d, local depth = %d", rightNum, depth + 1);
+    return true;
+}
+
+/**
+ * 第slot项为-1时，分配一个空页面作为新的桶。桶尽可能大：
+ * 占据包含第slot项、并且全都为-1的最大的一段对齐的目录项。
+ */
+PRIVATE Page *PagerNewBucket(Pager *pager, int32_t slot, int32_t *pageNum) {
+    int32_t depth = pager->globalDepth, i;
+    while (depth > 0) {
+        int32_t first = PagerBucketFirst(pager, slot, depth - 1), size = 1 << (pager->globalDepth - depth + 1);
+        for (i = 0; i < size && pager->buckets[first + i] == -1; i++) {
+        }
+        if (i < size) {
+            break;
+        }
+        depth--;
+    }
+    Page *page = PagerAllocPage(pager, pageNum);
+    if (page != NULL) {
+        pager->localDepths[*pageNum] = depth;
+        PagerSetBuckets(pager, PagerBucketFirst(pager, slot, depth), 1 << (pager->globalDepth - depth), *pageNum);
+    }
+    return page;
+}
+
+/* 桶的最后一条记录id被删除，页面不再是桶，之后可以被复用或截掉。调用者独占dirLatch */
+PRIVATE void PagerReleaseBucket(Pager *pager, int32_t pageNum, KEY id) {
+    int32_t depth = pager->localDepths[pageNum];
+    int32_t first = PagerBucketFirst(pager, PagerHashSlot(pager, PagerHash(id)), depth);
+    PagerSetBuckets(pager, first, 1 << (pager->globalDepth - depth), -1);
+    pager->localDepths[pageNum] = -1;
+}
+
+/* 桶从第from页整个复制到了第to页，page是第to页 */
+PRIVATE void PagerMoveBucket(Pager *pager, int32_t from, int32_t to, Page *page) {
+    int32_t depth = pager->localDepths[from];
+    KEY id        = Page_Id(pager->config.format, page, 0);
+    int32_t first = PagerBucketFirst(pager, PagerHashSlot(pager, PagerHash(id)), depth);
+    PagerSetBuckets(pager, first, 1 << (pager->globalDepth - depth), to);
+    pager->localDepths[to]   = depth;
+    pager->localDepths[from] = -1;
+}
+
+/**
+ * Pager_HashAccess 下独占dirLatch时插入：id所在的桶满了就分裂，直到它有空间。
+ * 分裂只涉及这一个桶，目录加倍也只复制目录项。
+ * @param var: the whole Pager_VarFormat row if not NULL, row is truncated from it
+ */
+PRIVATE PagerExecuteResult PagerHashInsertRow(Pager *pager, PagerTxn *txn, Row *row, const VarRow *var) {
+    PageFormat format = pager->config.format;
+    uint32_t h        = PagerHash(row->id);
+    while (true) {
+        int32_t slot = PagerHashSlot(pager, h), pageNum = pager->buckets[slot];
+        Page *page   = (Page *)(pageNum == -1 ? PagerNewBucket(pager, slot, &pageNum) : Pager_PinPage(pager, pageNum));
+        if (page == NULL) {
+            return Pager_ExecuteFailed;
+        }
+        if (Page_Find(format, page, row->id) != -1) {
+            LOG_DEBUG("id = %d is already exists.", row->id);
+            Pager_UnpinPage(pager, pageNum, false);
+            return Pager_RowAleardyExists;
+        }
+        if (Page_HasRoomFor(format, page, row, var)) {
+            Page_InsertFor(format, page, row, var);
             page->lastModifyTime = time(NULL);
-            SerializePage(page, buffer);
-            lseek(fd, -PAGE_SIZE, SEEK_CUR);
-            if (write(fd, buffer, PAGE_SIZE) != PAGE_SIZE) {
-                perror("Failed to write a page.\n");
+            PagerSetPage(pager, pageNum, page);
+            PagerLogInsert(pager, txn, pageNum, page, row, var);
+            return Pager_ExecuteSuccess;
+        }
+        bool split = PagerSplitBucket(pager, txn, pageNum, page);
+        Pager_UnpinPage(pager, pageNum, false);
+        if (!split) {
+            return Pager_ExecuteFailed;
+        }
+    }
+}
+
+/* 两个散列值从最高位开始相同的位数 */
+inline int32_t PagerCommonBits(uint32_t a, uint32_t b) {
+    return a == b ? 32 : __builtin_clz(a ^ b);
+}
+
+typedef struct BucketRange {
+    uint32_t minHash;
+    uint32_t maxHash;
+    int32_t pageNum;
+} BucketRange;
+
+PRIVATE int CompareBucketRange(const void *a, const void *b) {
+    uint32_t x = ((const BucketRange *)a)->minHash, y = ((const BucketRange *)b)->minHash;
+    return x < y ? -1 : (x > y ? 1 : 0);
+}
+
+/**
+ * 扫描所有页面重建散列目录。桶原来的局部深度无从得知，取包含页面中所有散列值、
+ * 又不包含相邻页面的散列值的最大的桶：它包含原来的桶，所以不会与其他页面的桶重叠，
+ * 局部深度和全局深度都不会比原来的大。原来的空桶对应的目录项为-1。
+ */
+PRIVATE void PagerRebuildBuckets(Pager *pager) {
+    BucketRange *ranges = (BucketRange *)malloc((pager->pageCount + 1) * sizeof(BucketRange));
+    assert(ranges != NULL);
+    int32_t pageNum, window[PREFETCH_PAGES], i, k, n = 0, globalDepth = 0;
+    for (pageNum = 0; pageNum < pager->pageCount; pageNum++) {
+        if (pageNum % PREFETCH_PAGES == 0) {
+            for (i = 0; i < PREFETCH_PAGES; i++) {
+                window[i] = pageNum + i;
+            }
+            PagerPrefetch(pager, window, PREFETCH_PAGES);
+        }
+        pager->localDepths[pageNum] = -1;
+        Page *page = (Page *)Pager_PinPage(pager, pageNum);
+        if (page == NULL) {
+            continue;
+        }
+        if (page->rowCount > 0) {
+            BucketRange *range = &ranges[n++];
+            range->minHash     = UINT32_MAX;
+            range->maxHash     = 0;
+            range->pageNum     = pageNum;
+            for (k = 0; k < page->rowCount; k++) {
+                uint32_t h     = PagerHash(Page_Id(pager->config.format, page, k));
+                range->minHash = h < range->minHash ? h : range->minHash;
+                range->maxHash = h > range->maxHash ? h : range->maxHash;
+            }
+        }
+        Pager_UnpinPage(pager, pageNum, false);
+    }
+    qsort(ranges, n, sizeof(BucketRange), CompareBucketRange);
+    for (i = 0; i < n; i++) {
+        int32_t left  = i > 0 ? PagerCommonBits(ranges[i - 1].maxHash, ranges[i].minHash) + 1 : 0;
+        int32_t right = i + 1 < n ? PagerCommonBits(ranges[i].maxHash, ranges[i + 1].minHash) + 1 : 0;
+        int32_t depth = left > right ? left : right;
+        pager->localDepths[ranges[i].pageNum] = depth;
+        globalDepth                           = depth > globalDepth ? depth : globalDepth;
+    }
+    pager->globalDepth = globalDepth;
+    pager->buckets     = (int32_t *)realloc(pager->buckets, ((size_t)1 << globalDepth) * sizeof(int32_t));
+    assert(pager->buckets != NULL);
+    PagerSetBuckets(pager, 0, 1 << globalDepth, -1);
+    for (i = 0; i < n; i++) {
+        int32_t depth = pager->localDepths[ranges[i].pageNum];
+        int32_t first = PagerBucketFirst(pager, PagerHashSlot(pager, ranges[i].minHash), depth);
+        PagerSetBuckets(pager, first, 1 << (globalDepth - depth), ranges[i].pageNum);
+    }
+    free(ranges);
+}
+
+/**
+ * 读取元数据文件中的散列目录
+ * @param offset: where the hash directory starts in the meta file
+ * @return false if it is unreadable or inconsistent with the data file
+ */
+PRIVATE bool PagerLoadBuckets(Pager *pager, off_t offset) {
+    int32_t globalDepth, i;
+    if (pread(pager->metaFd, &globalDepth, sizeof(int32_t), offset) != sizeof(int32_t) || globalDepth < 0 ||
+        globalDepth > 30) {
+        return false;
+    }
+    size_t size    = ((size_t)1 << globalDepth) * sizeof(int32_t);
+    pager->buckets = (int32_t *)realloc(pager->buckets, size);
+    assert(pager->buckets != NULL);
+    pager->globalDepth = globalDepth;
+    offset += sizeof(int32_t);
+    if (pread(pager->metaFd, pager->localDepths, pager->pageCount, offset) != pager->pageCount ||
+        pread(pager->metaFd, pager->buckets, size, offset + pager->pageCount) != (ssize_t)size) {
+        return false;
+    }
+    for (i = 0; i < 1 << globalDepth; i++) {
+        if (pager->buckets[i] < -1 || pager->buckets[i] >= pager->pageCount) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/* 写回散列目录，@param offset: where the hash directory starts in the meta file */
+PRIVATE bool PagerWriteBuckets(Pager *pager, off_t offset) {
+    size_t size = ((size_t)1 << pager->globalDepth) * sizeof(int32_t);
+    return pwrite(pager->metaFd, &pager->globalDepth, sizeof(int32_t), offset) == sizeof(int32_t) &&
+           pwrite(pager->metaFd, pager->localDepths, pager->pageCount, offset + sizeof(int32_t)) ==
+               pager->pageCount &&
+           pwrite(pager->metaFd, pager->buckets, size, offset + sizeof(int32_t) + pager->pageCount) == (ssize_t)size;
+}
+
+/*************************************************************/
+// 页面目录
+
+/* 保证fences、directory、extents和localDepths至少能容纳size个页面 */
+PRIVATE void PagerGrowFences(Pager *pager, int32_t size) {
+    if (size <= pager->fenceSize) {
+        return;
+    }
+    int32_t cap = pager->fenceSize == 0 ? TABLE_MAX_PAGES : pager->fenceSize, i;
+    while (cap < size) {
+        cap *= 2;
+    }
+    pager->fences    = (PageFence *)realloc(pager->fences, cap * sizeof(PageFence));
+    pager->directory = (int32_t *)realloc(pager->directory, cap * sizeof(int32_t));
+    pager->fsm       = (uint8_t *)realloc(pager->fsm, cap * sizeof(uint8_t));
+    assert(pager->fences != NULL && pager->directory != NULL && pager->fsm != NULL);
+    for (i = pager->fenceSize; i < cap; i++) {
+        pager->fences[i] = EMPTY_FENCE;
+        pager->fsm[i]    = 0;
+    }
+    if (pager->config.compress) {
+        pager->extents = (PageExtent *)realloc(pager->extents, cap * sizeof(PageExtent));
+        assert(pager->extents != NULL);
+        for (i = pager->fenceSize; i < cap; i++) {
+            pager->extents[i] = EMPTY_EXTENT;
+        }
+    }
+    if (pager->config.access == Pager_HashAccess) {
+        pager->localDepths = (int8_t *)realloc(pager->localDepths, cap * sizeof(int8_t));
+        assert(pager->localDepths != NULL);
+        memset(pager->localDepths + pager->fenceSize, -1, cap - pager->fenceSize);
+    }
+    pager->fenceSize = cap;
+}
+
+/* directory中第一个minId > id的位置 */
+PRIVATE int32_t PagerDirectoryUpperBound(Pager *pager, KEY id) {
+    int32_t l = 0, r = pager->dirCount;
+    while (l < r) {
+        int32_t mid = l + ((r - l) >> 1);
+        if (pager->fences[pager->directory[mid]].minId <= id) {
+            l = mid + 1;
+        } else {
+            r = mid;
+        }
+    }
+    return l;
+}
+
+/**
+ * 查找负责id的页面：directory中minId <= id的最后一个页面。
+ * id小于所有页面的minId时返回第一个页面，目录为空时返回-1。
+ */
+#ifndef DEBUG_TEST
+PRIVATE
+#endif
+inline int32_t PagerSearchPage(Pager *pager, KEY id) {
+    if (pager->dirCount == 0) {
+        return -1;
+    }
+    int32_t i = PagerDirectoryUpperBound(pager, id);
+    return pager->directory[i == 0 ? 0 : i - 1];
+}
+
+/**
+ * 更新第pageNum页的fence。页面由空变为非空（或相反）、或者minId改变时，调整它在directory中的位置，
+ * 这需要独占dirLatch。只有maxId改变时，持有dirLatch共享锁和页面的latch就可以更新，
+ * 其他线程查找directory时只读minId。
+ */
+PRIVATE void PagerSetFence(Pager *pager, int32_t pageNum, PageFence fence) {
+    PagerGrowFences(pager, pageNum + 1);
+    PageFence old = pager->fences[pageNum];
+    bool wasEmpty = old.minId > old.maxId, isEmpty = fence.minId > fence.maxId;
+    int32_t i;
+    __atomic_store_n(&pager->metaDirty, true, __ATOMIC_RELAXED);
+    if (pager->config.access == Pager_HashAccess) {
+        // 桶的id区间互相重叠，不在directory中，持有页面的latch就可以更新
+        pager->fences[pageNum] = fence;
+        if (isEmpty && pageNum < pager->emptyHint) {
+            pager->emptyHint = pageNum;
+        }
+        return;
+    }
+    if (!wasEmpty && !isEmpty && old.minId == fence.minId) {
+        __atomic_store_n(&pager->fences[pageNum].maxId, fence.maxId, __ATOMIC_RELAXED);
+        return;
+    }
+    if (!wasEmpty) {
+        i = PagerDirectoryUpperBound(pager, old.minId) - 1;
+        assert(i >= 0 && pager->directory[i] == pageNum);
+        memmove(pager->directory + i, pager->directory + i + 1, (pager->dirCount - i - 1) * sizeof(int32_t));
+        pager->dirCount--;
+    }
+    pager->fences[pageNum] = fence;
+    if (isEmpty && pageNum < pager->emptyHint) {
+        pager->emptyHint = pageNum;
+    }
+    if (!isEmpty) {
+        i = PagerDirectoryUpperBound(pager, fence.minId);
+        memmove(pager->directory + i + 1, pager->directory + i, (pager->dirCount - i) * sizeof(int32_t));
+        pager->directory[i] = pageNum;
+        pager->dirCount++;
+    }
+}
+
+/* 页面被修改之后，更新它的fence和空闲空间 */
+PRIVATE void PagerSetPage(Pager *pager, int32_t pageNum, Page *page) {
+    PagerSetFence(pager, pageNum, Page_Fence(pager->config.format, page));
+    uint8_t fill = Page_Fill(pager->config.format, page);
+    if (pager->fsm[pageNum] != fill) {
+        __atomic_store_n(&pager->fsm[pageNum], fill, __ATOMIC_RELAXED);
+    }
+}
+
+/* 第pageNum页还能否插入一条记录 */
+PRIVATE bool PagerHasRoom(Pager *pager, int32_t pageNum) {
+    return pager->fsm[pageNum] < FSM_FULL;
+}
+
+typedef struct DirectoryEntry {
+    KEY minId;
+    int32_t pageNum;
+} DirectoryEntry;
+
+PRIVATE int CompareDirectoryEntry(const void *a, const void *b) {
+    KEY x = ((const DirectoryEntry *)a)->minId, y = ((const DirectoryEntry *)b)->minId;
+    return x < y ? -1 : (x > y ? 1 : 0);
+}
+
+/* 根据fences重新构造directory */
+PRIVATE void PagerBuildDirectory(Pager *pager) {
+    DirectoryEntry *entries = (DirectoryEntry *)malloc((pager->pageCount + 1) * sizeof(DirectoryEntry));
+    assert(entries != NULL);
+    int32_t i, n = 0;
+    for (i = 0; i < pager->pageCount; i++) {
+        if (pager->fences[i].minId <= pager->fences[i].maxId) {
+            entries[n].minId   = pager->fences[i].minId;
+            entries[n].pageNum = i;
+            n++;
+        }
+    }
+    qsort(entries, n, sizeof(DirectoryEntry), CompareDirectoryEntry);
+    for (i = 0; i < n; i++) {
+        pager->directory[i] = entries[i].pageNum;
+    }
+    pager->dirCount = n;
+    free(entries);
+}
+
+/* 扫描所有数据页面，重新计算每个页面的fence */
+PRIVATE void PagerRebuildFences(Pager *pager) {
+    int32_t pageNum, window[PREFETCH_PAGES], i;
+    for (pageNum = 0; pageNum < pager->pageCount; pageNum++) {
+        if (pageNum % PREFETCH_PAGES == 0) {
+            for (i = 0; i < PREFETCH_PAGES; i++) {
+                window[i] = pageNum + i;
+            }
+            PagerPrefetch(pager, window, PREFETCH_PAGES);
+        }
+        Page *page             = (Page *)Pager_PinPage(pager, pageNum);
+        pager->fences[pageNum] = Page_Fence(pager->config.format, page);
+        pager->fsm[pageNum]    = Page_Fill(pager->config.format, page);
+        Pager_UnpinPage(pager, pageNum, false);
+    }
+    pager->metaDirty = true;
+}
+
+/**
+ * 写回元数据文件。fences之后紧接着存放空闲空间表，压缩时之后是每个页面的extent，
+ * Pager_HashAccess 时最后是散列目录。
+ * @param clean: mark the meta file as consistent with the data file
+ */
+PRIVATE void PagerWriteMeta(Pager *pager, bool clean) {
+    MetaHeader header = {META_MAGIC,           META_VERSION,         pager->pageCount, clean ? 1 : 0,
+                         pager->config.format, pager->config.access, pager->extentSeq};
+    if (pager->metaDirty) {
+        size_t size    = pager->pageCount * sizeof(PageFence);
+        size_t extents = pager->config.compress ? pager->pageCount * sizeof(PageExtent) : 0;
+        off_t buckets  = PAGE_SIZE + size + pager->pageCount + extents;
+        if (pwrite(pager->metaFd, pager->fences, size, PAGE_SIZE) != (ssize_t)size ||
+            pwrite(pager->metaFd, pager->fsm, pager->pageCount, PAGE_SIZE + size) != pager->pageCount ||
+            pwrite(pager->metaFd, pager->extents, extents, PAGE_SIZE + size + pager->pageCount) != (ssize_t)extents ||
+            (pager->config.access == Pager_HashAccess && !PagerWriteBuckets(pager, buckets))) {
+            LOG_ERROR("Failed to write page directory: %s", strerror(errno));
+            return;
+        }
+        pager->metaDirty = false;
+    }
+    if (pwrite(pager->metaFd, &header, sizeof(MetaHeader), 0) != sizeof(MetaHeader)) {
+        LOG_ERROR("Failed to write meta header: %s", strerror(errno));
+    }
+    fdatasync(pager->metaFd);
+}
+
+/**
+ * 打开元数据文件，确定页面格式、组织方式和是否压缩。已有数据的文件沿用元数据文件中记录的格式和组织方式，
+ * 数据文件开头有 EXTENT_MAGIC 时是压缩的，只有新建的数据文件才使用config。
+ * 新建的数据文件只有 CreateFileIfNotExists 写入的一个页面，还没有元数据。
+ * redo之前就要知道页面格式。
+ */
+PRIVATE void PagerOpenMeta(Pager *pager) {
+    char *metaFile = (char *)alloca(strlen(pager->file) + sizeof(META_FILE_SUFFIX));
+    sprintf(metaFile, "%s%s", pager->file, META_FILE_SUFFIX);
+    pager->metaFd = open(metaFile, O_RDWR | O_CREAT, 0644);
+    if (pager->metaFd == -1) {
+        EXIT_ERROR("Fail to open meta file.\n");
+    }
+    MetaHeader header;
+    bool valid = pread(pager->metaFd, &header, sizeof(MetaHeader), 0) == sizeof(MetaHeader) &&
+                 header.magic == META_MAGIC && header.version == META_VERSION;
+    bool fresh = pager->fileLength == 0 || (pager->fileLength == PAGE_SIZE && !valid);
+    if (pager->pageCount > 0 && valid && header.format != pager->config.format) {
+        LOG_WARN("%s was created with page format %d, config.format is ignored.", pager->file, header.format);
+        pager->config.format = (PageFormat)header.format;
+    }
+    if (pager->pageCount > 0 && valid && header.access != pager->config.access) {
+        LOG_WARN("%s was created with access method %d, config.access is ignored.", pager->file, header.access);
+        pager->config.access = (PagerAccess)header.access;
+    }
+    uint32_t magic  = 0;
+    bool compressed = pread(pager->fd, &magic, sizeof(uint32_t), 0) == sizeof(uint32_t) && magic == EXTENT_MAGIC;
+    if (!fresh || compressed) {
+        if (compressed != pager->config.compress) {
+            LOG_WARN("%s was created %s compression, config.compress is ignored.", pager->file,
+                   compressed ? "with" : "without");
+            pager->config.compress = compressed;
+        }
+    }
+    if (pager->config.compress && pager->config.storage == Pager_Mmap) {
+        // 压缩的页面只能经过缓冲池读写
+        if (!compressed) {
+            LOG_WARN("Compression is not supported in Pager_Mmap mode, it is disabled.");
+            pager->config.compress = false;
+        } else {
+            LOG_WARN("%s is compressed, it is opened in Pager_ReadWrite mode.", pager->file);
+            pager->config.storage = Pager_ReadWrite;
+        }
+    }
+}
+
+/**
+ * 加载页面目录，Pager_HashAccess 时还有散列目录。如果元数据文件不存在、版本不符，
+ * 或者上一个Pager没有正常关闭，则扫描数据文件重建目录。
+ * @param rebuild: the data file was changed by redo, always rebuild
+ */
+PRIVATE void PagerLoadMeta(Pager *pager, bool rebuild) {
+    PagerGrowFences(pager, pager->pageCount);
+
+    MetaHeader header;
+    size_t size    = pager->pageCount * sizeof(PageFence);
+    size_t extents = pager->config.compress ? pager->pageCount * sizeof(PageExtent) : 0;
+    bool valid     = !rebuild && pread(pager->metaFd, &header, sizeof(MetaHeader), 0) == sizeof(MetaHeader) &&
+                 header.magic == META_MAGIC && header.version == META_VERSION &&
+                 header.clean == 1 && header.pageCount == pager->pageCount;
+    valid = valid && pread(pager->metaFd, pager->fences, size, PAGE_SIZE) == (ssize_t)size &&
+            pread(pager->metaFd, pager->fsm, pager->pageCount, PAGE_SIZE + size) == pager->pageCount;
+    if (valid) {
+        pager->metaDirty = false;
+    } else {
+        LOG_INFO("Rebuild page directory of %s.", pager->file);
+        PagerRebuildFences(pager);
+    }
+    if (pager->config.access == Pager_HashAccess) {
+        if (!valid || !PagerLoadBuckets(pager, PAGE_SIZE + size + pager->pageCount + extents)) {
+            LOG_INFO("Rebuild hash directory of %s.", pager->file);
+            PagerRebuildBuckets(pager);
+        }
+    } else {
+        PagerBuildDirectory(pager);
+    }
+    // 在关闭之前，元数据文件都被视为与数据文件不一致
+    PagerWriteMeta(pager, false);
+}
+
+/**
+ * 第一个没有记录的页面，没有空页面时返回-1。
+ * emptyHint之前的页面都不为空，所以每个页面只会被跳过一次，直到它再次变为空页面。
+ */
+PRIVATE int32_t PagerEmptyPage(Pager *pager) {
+    int32_t i;
+    for (i = pager->emptyHint; i < pager->pageCount; i++) {
+        if (pager->fences[i].minId > pager->fences[i].maxId) {
+            pager->emptyHint = i;
+            return i;
+        }
+    }
+    pager->emptyHint = pager->pageCount;
+    return -1;
+}
+
+/* 拿到一个全空的页面用于分裂：优先复用空页面，否则在文件末尾追加 */
+PRIVATE Page *PagerAllocPage(Pager *pager, int32_t *pageNum) {
+    *pageNum = PagerEmptyPage(pager);
+    if (*pageNum == -1) {
+        return (Page *)Pager_NewPage(pager, pageNum);
+    }
+    // 空页面可能残留着被删除的记录，清空后作为新页面使用
+    Page *page = (Page *)Pager_PinPage(pager, *pageNum);
+    if (page != NULL) {
+        Page_Init(page);
+    }
+    return page;
+}
+
+/**
+ * page已满时，尝试把一条记录挪到directory中相邻的、还有空间的页面，而不分裂page。
+ * 挪走的是page中最大（或最小）的记录，所以各页面的id区间仍然互不重叠。
+ * @param k: position of page in directory
+ * @return page that row should be inserted into, -1 if both neighbors are full
+ */
+PRIVATE int32_t PagerShiftToNeighbor(Pager *pager, PagerTxn *txn, int32_t k, Page *page, KEY id) {
+    int32_t pageNum   = pager->directory[k], n, moved;
+    PageFormat format = pager->config.format;
+    Page *neighbor;
+    if (k + 1 < pager->dirCount && PagerHasRoom(pager, pager->directory[k + 1])) {
+        n = pager->directory[k + 1];
+        if (id > pager->fences[pageNum].maxId) {
+            // 新记录本身就是最大的，直接插入右边的页面
+            return n;
+        }
+        moved = page->rowCount - 1;
+    } else if (k > 0 && id > pager->fences[pageNum].minId && PagerHasRoom(pager, pager->directory[k - 1])) {
+        n     = pager->directory[k - 1];
+        moved = 0;
+    } else {
+        return -1;
+    }
+    neighbor = (Page *)Pager_PinPage(pager, n);
+    if (neighbor == NULL) {
+        return -1;
+    }
+    // 变长记录的空闲空间表只是估计，确认邻居能放下挪过去的记录
+    if (!Page_CopyRow(format, page, moved, neighbor, false)) {
+        Pager_UnpinPage(pager, n, false);
+        return -1;
+    }
+    Page_Remove(format, page, moved, NULL);
+    neighbor->lastModifyTime = time(NULL);
+    PagerSetPage(pager, n, neighbor);
+    PagerLogPage(pager, txn, n, neighbor, n);
+    // page仍然被调用者pin住
+    Pager_PinPage(pager, pageNum);
+    PagerLogPage(pager, txn, pageNum, page, pageNum);
+    return pageNum;
+}
+
+/**
+ * 包含id的页面，id不在任何页面的[minId, maxId]内时返回-1。
+ * Pager_HashAccess 下是id所在的桶，不需要查找。
+ */
+PRIVATE int32_t PagerLocateRow(Pager *pager, KEY id) {
+    if (pager->config.access == Pager_HashAccess) {
+        return PagerHashPage(pager, id);
+    }
+    int32_t pageNum = PagerSearchPage(pager, id);
+    if (pageNum == -1 || id < pager->fences[pageNum].minId ||
+        id > __atomic_load_n(&pager->fences[pageNum].maxId, __ATOMIC_RELAXED)) {
+        return -1;
+    }
+    return pageNum;
+}
+
+/*************************************************************/
+// 页面latch
+
+PRIVATE PageLatch *PagerLatchOf(Pager *pager, int32_t pageNum) {
+    return &pager->latches[pageNum % PAGE_LATCH_STRIPES];
+}
+
+/* 写者在持有latch期间version为奇数，乐观的读者据此发现并发的修改 */
+PRIVATE void PagerLatchPage(Pager *pager, int32_t pageNum, bool exclusive) {
+    PageLatch *latch = PagerLatchOf(pager, pageNum);
+    if (!exclusive) {
+        pthread_rwlock_rdlock(&latch->lock);
+        return;
+    }
+    pthread_rwlock_wrlock(&latch->lock);
+    __atomic_store_n(&latch->version, latch->version + 1, __ATOMIC_RELAXED);
+    // 页面的修改不能早于version变为奇数被看到
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+PRIVATE void PagerUnlatchPage(Pager *pager, int32_t pageNum, bool exclusive) {
+    PageLatch *latch = PagerLatchOf(pager, pageNum);
+    if (exclusive) {
+        __atomic_store_n(&latch->version, latch->version + 1, __ATOMIC_RELEASE);
+    }
+    pthread_rwlock_unlock(&latch->lock);
+}
+
+/**
+ * 不加latch读取一条记录：记下version，读完之后version没有变化，说明读的过程中没有写者修改过页面。
+ * 读到的页面可能正被修改，所以每个槽位都先检查边界再使用。
+ * @return false if a writer was active, the caller reads again under the shared latch
+ */
+PRIVATE bool PagerOptimisticSelect(Pager *pager, int32_t pageNum, Page *page, KEY id, Row *row, bool *found) {
+    PageLatch *latch = PagerLatchOf(pager, pageNum);
+    uint64_t version = __atomic_load_n(&latch->version, __ATOMIC_ACQUIRE);
+    if (version & 1) {
+        return false;
+    }
+    PageFormat format = pager->config.format;
+    int32_t l = 0, r = page->rowCount;
+    if (r < 0 || r > Page_MaxRows(format)) {
+        r = 0;
+    }
+    *found = false;
+    while (l < r) {
+        int32_t mid  = l + ((r - l) >> 1);
+        uint16_t off = 0;
+        KEY key;
+        if (format == Pager_PaxFormat) {
+            key = PAX_IDS(page)[mid];
+        } else {
+            off = page->slots[mid];
+            if (off < PAGE_HEADER_SIZE || off > PAGE_SIZE - (format == Pager_VarFormat ? VAR_MIN_RECORD : ROW_SIZE)) {
+                break;
+            }
+            key = PAGE_ROW(page, off)->id;
+        }
+        if (key == id) {
+            if (format == Pager_PaxFormat) {
+                Pax_Get(page, mid, row);
+            } else if (format == Pager_VarFormat) {
+                VarRecord *record = VAR_RECORD(page, off);
+                if (off + Var_RecordSize(record->usernameLength, record->emailLength) > PAGE_SIZE) {
+                    break;
+                }
+                Var_Get(page, mid, row);
+            } else {
+                memcpy(row, PAGE_ROW(page, off), ROW_SIZE);
+            }
+            *found = true;
+            break;
+        }
+        if (key < id) {
+            l = mid + 1;
+        } else {
+            r = mid;
+        }
+    }
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return __atomic_load_n(&latch->version, __ATOMIC_RELAXED) == version;
+}
+
+/*************************************************************/
+// 页面整理
+
+/**
+ * 把directory中第k+1个页面的记录移到第k个页面：右边页面的id都更大，直接追加在左边页面的末尾。
+ * 左边页面放不下时只移走一部分，右边页面的minId随之变大，两个页面在directory中的顺序不变。
+ * @return number of rows moved, the right page is empty if all of its rows are moved
+ */
+PRIVATE int32_t PagerMergePages(Pager *pager, PagerTxn *txn, int32_t k) {
+    int32_t leftNum = pager->directory[k], rightNum = pager->directory[k + 1], moved;
+    PageFormat format = pager->config.format;
+    Page *left        = (Page *)Pager_PinPage(pager, leftNum);
+    Page *right       = left == NULL ? NULL : (Page *)Pager_PinPage(pager, rightNum);
+    if (right == NULL) {
+        if (left != NULL) {
+            Pager_UnpinPage(pager, leftNum, false);
+        }
+        return 0;
+    }
+    for (moved = 0; moved < right->rowCount; moved++) {
+        if (!Page_CopyRow(format, right, moved, left, true)) {
+            break;
+        }
+    }
+    if (moved == 0) {
+        Pager_UnpinPage(pager, leftNum, false);
+        Pager_UnpinPage(pager, rightNum, false);
+        return 0;
+    }
+    if (moved == right->rowCount) {
+        Page_Init(right);
+    } else {
+        int32_t i;
+        for (i = 0; i < moved; i++) {
+            Page_Remove(format, right, 0, NULL);
+        }
+    }
+    left->lastModifyTime = right->lastModifyTime = time(NULL);
+    PagerSetPage(pager, rightNum, right);
+    PagerSetPage(pager, leftNum, left);
+    PagerLogPage(pager, txn, leftNum, left, leftNum);
+    PagerLogPage(pager, txn, rightNum, right, rightNum);
+    return moved;
+}
+
+/* 持有dirLatch共享锁时maxId可能正在被 PagerSetFence 修改 */
+PRIVATE bool PagerIsEmpty(Pager *pager, int32_t pageNum) {
+    return pager->fences[pageNum].minId > __atomic_load_n(&pager->fences[pageNum].maxId, __ATOMIC_RELAXED);
+}
+
+/**
+ * 找到最后一个有记录的页面和它前面的第一个空页面，不修改emptyHint，持有dirLatch共享锁时也可以调用。
+ * @param pageNums: the last non-empty page and the empty page
+ * @return false if there is no empty page before the last non-empty page
+ */
+PRIVATE bool PagerFindRelocation(Pager *pager, int32_t pageNums[2]) {
+    int32_t lastNum = pager->pageCount - 1, pageNum;
+    while (lastNum >= 0 && PagerIsEmpty(pager, lastNum)) {
+        lastNum--;
+    }
+    for (pageNum = pager->emptyHint; pageNum < lastNum; pageNum++) {
+        if (PagerIsEmpty(pager, pageNum)) {
+            pageNums[0] = lastNum;
+            pageNums[1] = pageNum;
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * 把最后一个有记录的页面lastNum整个复制到它前面的空页面pageNum，原来的页面变为空页面，之后可以截掉。
+ * 两个页面在同一个事务中记录，重做之后不会有两个页面存放相同的记录。
+ * @return false if a page cannot be pinned
+ */
+PRIVATE bool PagerRelocateLast(Pager *pager, PagerTxn *txn, int32_t lastNum, int32_t pageNum) {
+    Page *last = (Page *)Pager_PinPage(pager, lastNum);
+    Page *page = last == NULL ? NULL : (Page *)Pager_PinPage(pager, pageNum);
+    if (page == NULL) {
+        if (last != NULL) {
+            Pager_UnpinPage(pager, lastNum, false);
+        }
+        return false;
+    }
+    memcpy(page, last, PAGE_SIZE);
+    if (pager->config.access == Pager_HashAccess) {
+        PagerMoveBucket(pager, lastNum, pageNum, page);
+    }
+    Page_Init(last);
+    last->lastModifyTime = time(NULL);
+    // 两个页面的minId相同，先把last移出directory
+    PagerSetPage(pager, lastNum, last);
+    PagerSetPage(pager, pageNum, page);
+    PagerLogPage(pager, txn, pageNum, page, pageNum);
+    PagerLogPage(pager, txn, lastNum, last, lastNum);
+    return true;
+}
+
+/* 文件末尾的空页面从哪一页开始，至少保留一个页面 */
+PRIVATE int32_t PagerTrailingEmpty(Pager *pager) {
+    int32_t pageCount = pager->pageCount;
+    while (pageCount > 1 && PagerIsEmpty(pager, pageCount - 1)) {
+        pageCount--;
+    }
+    return pageCount;
+}
+
+/**
+ * 持有dirLatch共享锁时把脏页写回文件。其他线程仍然在修改页面，所以逐个pin住脏页，
+ * 持有它的共享latch写入：写入的是完整的修改，清除dirty也不会丢掉写入之后的修改。
+ */
+PRIVATE void PagerWriteBackShared(Pager *pager) {
+    int32_t i;
+    for (i = 0; i < TABLE_MAX_PAGES; i++) {
+        Frame *frame    = &pager->frames[i];
+        int32_t pageNum = __atomic_load_n(&frame->pageNum, __ATOMIC_ACQUIRE);
+        if (pageNum == -1 || !__atomic_load_n(&frame->dirty, __ATOMIC_RELAXED) ||
+            !PagerTryPinFrame(pager, i, pageNum)) {
+            continue;
+        }
+        PagerLatchPage(pager, pageNum, false);
+        pthread_mutex_lock(&pager->poolLatch);
+        // 另一个线程可能正在写回它
+        if (frame->dirty && !frame->io) {
+            PagerWriteFrame(pager, frame);
+            frame->dirty = false;
+        }
+        pthread_mutex_unlock(&pager->poolLatch);
+        PagerUnlatchPage(pager, pageNum, false);
+        Pager_UnpinPage(pager, pageNum, false);
+    }
+}
+
+/**
+ * 截掉文件末尾的空页面，至少保留一个页面。
+ *
+ * 没有开启日志时，被合并或者移动的记录可能还只在缓冲池中，要先写回文件并fdatasync再截断。
+ * 写回只持有dirLatch共享锁，之后独占dirLatch时重新检查：只截掉写回之前就已经为空、现在仍然为空的页面，
+ * 其中的记录在写回之前就已经移走了。
+ * 开启日志时追加一个空事务记下新的页面数，释放dirLatch之后再等待它写入磁盘，
+ * 重做时追加出来的空页面会被再次截掉。Pager_Compact 等待日志时仍然pin住的页面不截掉。
+ * @return number of pages truncated
+ */
+PRIVATE int32_t PagerTruncateEmpty(Pager *pager) {
+    int32_t pageCount = 0, i;
+    if (pager->wal == NULL) {
+        pthread_rwlock_rdlock(&pager->dirLatch);
+        pageCount  = PagerTrailingEmpty(pager);
+        bool empty = pageCount < pager->pageCount;
+        if (empty) {
+            PagerWriteBackShared(pager);
+        }
+        pthread_rwlock_unlock(&pager->dirLatch);
+        if (!empty) {
+            return 0;
+        }
+        fdatasync(pager->fd);
+    }
+
+    pthread_rwlock_wrlock(&pager->dirLatch);
+    int32_t now = PagerTrailingEmpty(pager);
+    pageCount   = pageCount > now ? pageCount : now;
+    for (i = 0; i < TABLE_MAX_PAGES; i++) {
+        Frame *frame = &pager->frames[i];
+        if (frame->pageNum >= pageCount && __atomic_load_n(&frame->pinCount, __ATOMIC_RELAXED) > 0) {
+            pageCount = frame->pageNum + 1;
+        }
+    }
+    if (pageCount >= pager->pageCount) {
+        pthread_rwlock_unlock(&pager->dirLatch);
+        return 0;
+    }
+    uint64_t end = 0;
+    WalBatch batch;
+    memset(&batch, 0, sizeof(WalBatch));
+    if (pager->wal != NULL) {
+        Wal_Append(pager->wal, &batch, pageCount, &end);
+    }
+    int32_t n = pager->pageCount - pageCount;
+    PagerTruncate(pager, pageCount);
+    pthread_rwlock_unlock(&pager->dirLatch);
+    if (pager->wal != NULL) {
+        Wal_Sync(pager->wal, end);
+    }
+    Wal_BatchFree(&batch);
+    return n;
+}
+
+/* pin住整理的两个页面，有一个失败时两个都不pin */
+PRIVATE bool PagerPinPair(Pager *pager, const int32_t pageNums[2]) {
+    if (Pager_PinPage(pager, pageNums[0]) == NULL) {
+        return false;
+    }
+    if (Pager_PinPage(pager, pageNums[1]) == NULL) {
+        Pager_UnpinPage(pager, pageNums[0], false);
+        return false;
+    }
+    return true;
+}
+
+/**
+ * 持有dirLatch共享锁，从compactCursor开始沿directory查找合并之后不超过 COMPACT_MAX_FILL 的相邻页面。
+ * 找到时pin住这两个页面，之后独占dirLatch合并它们时不需要读文件。
+ * @param scanned: pairs examined by this Pager_Compact
+ * @param pageNums: the left and the right page
+ * @return false if no pair is found after all pairs are examined
+ */
+PRIVATE bool PagerFindMerge(Pager *pager, int32_t *scanned, int32_t pageNums[2]) {
+    bool found = false;
+    pthread_rwlock_rdlock(&pager->dirLatch);
+    int32_t k = __atomic_load_n(&pager->compactCursor, __ATOMIC_RELAXED);
+    while (!found && *scanned < pager->dirCount - 1) {
+        if (k + 1 >= pager->dirCount) {
+            k = 0;
+        }
+        (*scanned)++;
+        int32_t leftNum = pager->directory[k], rightNum = pager->directory[k + 1];
+        if (__atomic_load_n(&pager->fsm[leftNum], __ATOMIC_RELAXED) +
+                __atomic_load_n(&pager->fsm[rightNum], __ATOMIC_RELAXED) <=
+            COMPACT_MAX_FILL) {
+            pageNums[0] = leftNum;
+            pageNums[1] = rightNum;
+            found       = PagerPinPair(pager, pageNums);
+        }
+        k++;
+    }
+    __atomic_store_n(&pager->compactCursor, k, __ATOMIC_RELAXED);
+    pthread_rwlock_unlock(&pager->dirLatch);
+    return found;
+}
+
+/**
+ * 独占dirLatch合并PagerFindMerge找到的两个页面。释放共享锁之后directory可能已经变了，
+ * 两个页面仍然相邻并且放得下时才合并。
+ * @return number of rows moved
+ */
+PRIVATE int32_t PagerCompactMerge(Pager *pager, PagerTxn *txn, int32_t pageNums[2]) {
+    int32_t leftNum = pageNums[0], rightNum = pageNums[1];
+    if (pager->fences[leftNum].minId > pager->fences[leftNum].maxId ||
+        pager->fsm[leftNum] + pager->fsm[rightNum] > COMPACT_MAX_FILL) {
+        return 0;
+    }
+    int32_t k = PagerDirectoryUpperBound(pager, pager->fences[leftNum].minId) - 1;
+    if (k < 0 || k + 1 >= pager->dirCount || pager->directory[k] != leftNum || pager->directory[k + 1] != rightNum) {
+        return 0;
+    }
+    int32_t moved = PagerMergePages(pager, txn, k);
+    if (moved > 0 && pager->fences[rightNum].minId > pager->fences[rightNum].maxId) {
+        // 右边的页面已经移出directory，左边的页面继续与新的邻居比较
+        Metrics_Add(Metrics_PageMerges, 1);
+        __atomic_store_n(&pager->compactCursor, k, __ATOMIC_RELAXED);
+    }
+    return moved;
+}
+
+/**
+ * 整理一步。删除只是从页面中去掉记录，页面不会因此合并，频繁插入删除之后文件中会有很多半空的页面。
+ * 从上次停下的位置开始沿directory查找相邻的两个页面，合并之后不超过 COMPACT_MAX_FILL 时，
+ * 把右边页面的记录移到左边；然后把文件末尾的页面移到前面的空页面，截掉文件末尾的空页面。
+ * 
+ * 查找页面和读入页面只持有dirLatch共享锁。每合并或移动一次，只在修改页面、fence和directory时独占dirLatch，
+ * 这时页面已经在缓冲池中，日志也只是追加到日志缓冲区；释放dirLatch之后再等待日志写入磁盘，
+ * 页面在此之前一直被pin住。所以其他操作最多等待一次内存中的合并，不会等待I/O。
+ * 扫描在两个页面之间不持有latch，下一个页面总是通过nextId重新查找，所以不受合并和移动的影响。
+ * Pager_HashAccess 下不合并桶，只把文件末尾的桶移到前面的空页面，然后截断。
+ * 
+ * @param maxPages: max pages merged or moved in this step
+ * @return number of pages merged, moved or truncated, 0 if there is nothing to compact
+ */
+TINYDB_API int32_t Pager_Compact(Pager *pager, int32_t maxPages) {
+    uint64_t start = Metrics_Now();
+    int32_t work = 0, scanned = 0, pageNums[2];
+    PagerTxn txn;
+    memset(&txn, 0, sizeof(PagerTxn));
+    while (work < maxPages && PagerFindMerge(pager, &scanned, pageNums)) {
+        pthread_rwlock_wrlock(&pager->dirLatch);
+        int32_t moved = PagerCompactMerge(pager, &txn, pageNums);
+        uint64_t end  = PagerTxnAppend(pager, &txn);
+        pthread_rwlock_unlock(&pager->dirLatch);
+        PagerTxnSync(pager, &txn, end);
+        Pager_UnpinPage(pager, pageNums[0], false);
+        Pager_UnpinPage(pager, pageNums[1], false);
+        work += moved > 0;
+    }
+    while (work < maxPages) {
+        pthread_rwlock_rdlock(&pager->dirLatch);
+        bool found = PagerFindRelocation(pager, pageNums) && PagerPinPair(pager, pageNums);
+        pthread_rwlock_unlock(&pager->dirLatch);
+        if (!found) {
+            break;
+        }
+        pthread_rwlock_wrlock(&pager->dirLatch);
+        int32_t current[2];
+        bool moved = PagerFindRelocation(pager, current) && current[0] == pageNums[0] && current[1] == pageNums[1] &&
+                     PagerRelocateLast(pager, &txn, pageNums[0], pageNums[1]);
+        uint64_t end = PagerTxnAppend(pager, &txn);
+        pthread_rwlock_unlock(&pager->dirLatch);
+        PagerTxnSync(pager, &txn, end);
+        Pager_UnpinPage(pager, pageNums[0], false);
+        Pager_UnpinPage(pager, pageNums[1], false);
+        if (!moved) {
+            break;
+        }
+        work++;
+    }
+    work += PagerTruncateEmpty(pager);
+    PagerMaybeCheckpoint(pager);
+    if (work > 0) {
+        LOG_DEBUG("Compact %d pages, %d pages left.", work, pager->pageCount);
+    }
+    Metrics_Record(Metrics_PagerCompact, Metrics_Now() - start);
+    return work;
+}
+
+/* 后台整理线程：每隔compactIntervalUs整理一步，直到 Destroy_Pager 设置compactStop */
+PRIVATE void *PagerCompactor(void *arg) {
+    Pager *pager = (Pager *)arg;
+    pthread_mutex_lock(&pager->compactMutex);
+    while (!pager->compactStop) {
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_nsec += (long)pager->config.compactIntervalUs * 1000;
+        deadline.tv_sec += deadline.tv_nsec / 1000000000;
+        deadline.tv_nsec %= 1000000000;
+        pthread_cond_timedwait(&pager->compactCond, &pager->compactMutex, &deadline);
+        if (pager->compactStop) {
+            break;
+        }
+        pthread_mutex_unlock(&pager->compactMutex);
+        Pager_Compact(pager, COMPACT_STEP_PAGES);
+        pthread_mutex_lock(&pager->compactMutex);
+    }
+    pthread_mutex_unlock(&pager->compactMutex);
+    return NULL;
+}
+
+PRIVATE void PagerStartCompactor(Pager *pager) {
+    if (pager->config.compactIntervalUs > 0 &&
+        pthread_create(&pager->compactor, NULL, PagerCompactor, pager) != 0) {
+        EXIT_ERROR("Failed to create compactor thread.\n");
+    }
+}
+
+/* 通知后台整理线程退出并等待它结束，正在进行的一步会先完成 */
+PRIVATE void PagerStopCompactor(Pager *pager) {
+    if (pager->config.compactIntervalUs <= 0) {
+        return;
+    }
+    pthread_mutex_lock(&pager->compactMutex);
+    pager->compactStop = true;
+    pthread_cond_signal(&pager->compactCond);
+    pthread_mutex_unlock(&pager->compactMutex);
+    pthread_join(pager->compactor, NULL);
+}
+
+/*************************************************************/
+// 二级索引
+
+/* row中field列的值 */
+PRIVATE const char *PagerFieldOf(Row *row, int32_t field) {
+    return field == Pager_UsernameField ? row->username : row->email;
+}
+
+/* 新插入的记录row的索引项，没有开启索引时什么都不做 */
+PRIVATE void PagerIndexInsert(Pager *pager, Row *row) {
+    if (pager->indexFd == -1) {
+        return;
+    }
+    int32_t field;
+    pthread_rwlock_wrlock(&pager->indexLatch);
+    for (field = 0; field < PAGER_INDEXED_FIELDS; field++) {
+        SkipList_Insert(pager->indexes[field], PagerFieldOf(row, field), row->id);
+    }
+    pthread_rwlock_unlock(&pager->indexLatch);
+}
+
+/* 删除被删除的记录row的索引项 */
+PRIVATE void PagerIndexDelete(Pager *pager, Row *row) {
+    if (pager->indexFd == -1) {
+        return;
+    }
+    int32_t field;
+    pthread_rwlock_wrlock(&pager->indexLatch);
+    for (field = 0; field < PAGER_INDEXED_FIELDS; field++) {
+        SkipList_Delete(pager->indexes[field], PagerFieldOf(row, field), row->id);
+    }
+    pthread_rwlock_unlock(&pager->indexLatch);
+}
+
+/* 记录从old更新为row，只修改值改变了的列的索引项 */
+PRIVATE void PagerIndexUpdate(Pager *pager, Row *old, Row *row) {
+    if (pager->indexFd == -1) {
+        return;
+    }
+    int32_t field;
+    pthread_rwlock_wrlock(&pager->indexLatch);
+    for (field = 0; field < PAGER_INDEXED_FIELDS; field++) {
+        if (strcmp(PagerFieldOf(old, field), PagerFieldOf(row, field)) != 0) {
+            SkipList_Delete(pager->indexes[field], PagerFieldOf(old, field), old->id);
+            SkipList_Insert(pager->indexes[field], PagerFieldOf(row, field), row->id);
+        }
+    }
+    pthread_rwlock_unlock(&pager->indexLatch);
+}
+
+/* 按页号顺序扫描所有页面重建索引，打开Pager时调用 */
+PRIVATE void PagerRebuildIndexes(Pager *pager) {
+    int32_t window[PREFETCH_PAGES], pageNum, i, field;
+    Row row;
+    for (pageNum = 0; pageNum < pager->pageCount; pageNum++) {
+        if (pageNum % PREFETCH_PAGES == 0) {
+            for (i = 0; i < PREFETCH_PAGES; i++) {
+                window[i] = pageNum + i;
+            }
+            PagerPrefetch(pager, window, PREFETCH_PAGES);
+        }
+        Page *page = (Page *)Pager_PinPage(pager, pageNum);
+        for (i = 0; page != NULL && i < page->rowCount; i++) {
+            Page_Get(pager->config.format, page, i, &row);
+            for (field = 0; field < PAGER_INDEXED_FIELDS; field++) {
+                SkipList_Insert(pager->indexes[field], PagerFieldOf(&row, field), row.id);
+            }
+        }
+        if (page != NULL) {
+            Pager_UnpinPage(pager, pageNum, false);
+        }
+    }
+}
+
+/**
+ * 读取正常关闭时写下的索引项。索引项按顺序存放，插入跳表时总是落在末尾。
+ * @return false if the index file is missing, inconsistent or unreadable
+ */
+PRIVATE bool PagerLoadIndexes(Pager *pager) {
+    IndexHeader header;
+    if (pread(pager->indexFd, &header, sizeof(IndexHeader), 0) != sizeof(IndexHeader) ||
+        header.magic != INDEX_MAGIC || header.version != INDEX_VERSION || header.clean != 1) {
+        return false;
+    }
+    IndexEntry *entries = (IndexEntry *)malloc(INDEX_IO_ENTRIES * sizeof(IndexEntry));
+    assert(entries != NULL);
+    off_t offset = sizeof(IndexHeader);
+    int64_t i, k;
+    int32_t field;
+    bool valid = true;
+    for (field = 0; field < PAGER_INDEXED_FIELDS && valid; field++) {
+        for (i = 0; i < header.counts[field] && valid; i += INDEX_IO_ENTRIES) {
+            int64_t n   = header.counts[field] - i < INDEX_IO_ENTRIES ? header.counts[field] - i : INDEX_IO_ENTRIES;
+            size_t size = n * sizeof(IndexEntry);
+            valid       = pread(pager->indexFd, entries, size, offset) == (ssize_t)size;
+            for (k = 0; valid && k < n; k++) {
+                entries[k].value[SKIPLIST_VALUE_SIZE - 1] = '\0';
+                SkipList_Insert(pager->indexes[field], entries[k].value, entries[k].id);
+            }
+            offset += size;
+        }
+    }
+    free(entries);
+    return valid;
+}
+
+/**
+ * 写回索引文件。
+ * @param clean: write all entries and mark the file as consistent with the data file,
+ *               otherwise only the header is written to mark it inconsistent
+ */
+PRIVATE void PagerWriteIndexes(Pager *pager, bool clean) {
+    IndexHeader header;
+    memset(&header, 0, sizeof(IndexHeader));
+    header.magic   = INDEX_MAGIC;
+    header.version = INDEX_VERSION;
+    if (clean) {
+        IndexEntry *entries = (IndexEntry *)calloc(INDEX_IO_ENTRIES, sizeof(IndexEntry));
+        assert(entries != NULL);
+        off_t offset = sizeof(IndexHeader);
+        int32_t field, n = 0;
+        bool valid = true;
+        for (field = 0; field < PAGER_INDEXED_FIELDS; field++) {
+            SkipNode *node;
+            header.counts[field] = pager->indexes[field]->count;
+            for (node = SkipList_First(pager->indexes[field]); node != NULL; node = node->next[0]) {
+                entries[n].id = node->id;
+                memcpy(entries[n].value, node->value, SKIPLIST_VALUE_SIZE);
+                if (++n == INDEX_IO_ENTRIES || node->next[0] == NULL) {
+                    valid = valid && pwrite(pager->indexFd, entries, n * sizeof(IndexEntry), offset) ==
+                                         (ssize_t)(n * sizeof(IndexEntry));
+                    offset += n * sizeof(IndexEntry);
+                    n = 0;
+                }
+            }
+        }
+        free(entries);
+        if (!valid || ftruncate(pager->indexFd, offset) == -1) {
+            LOG_ERROR("Failed to write indexes: %s", strerror(errno));
+            return;
+        }
+        // 索引项写入磁盘之后才能标记为一致
+        fdatasync(pager->indexFd);
+        header.clean = 1;
+    }
+    if (pwrite(pager->indexFd, &header, sizeof(IndexHeader), 0) != sizeof(IndexHeader)) {
+        LOG_ERROR("Failed to write index header: %s", strerror(errno));
+    }
+    fdatasync(pager->indexFd);
+}
+
+/**
+ * 打开索引文件，加载或者重建索引。没有开启索引时不维护索引，
+ * 已有的索引文件被标记为不一致，下次开启索引打开时重建。
+ * @param rebuild: the data file was changed by redo, always rebuild
+ */
+PRIVATE void PagerOpenIndexes(Pager *pager, bool rebuild) {
+    char *indexFile = (char *)alloca(strlen(pager->file) + sizeof(INDEX_FILE_SUFFIX));
+    sprintf(indexFile, "%s%s", pager->file, INDEX_FILE_SUFFIX);
+    pager->indexFd = -1;
+    if (!pager->config.indexes) {
+        int fd = open(indexFile, O_RDWR);
+        if (fd != -1) {
+            int32_t clean = 0;
+            if (pwrite(fd, &clean, sizeof(int32_t), OFFSET_OF_ATTRIBUTE(IndexHeader, clean)) != sizeof(int32_t)) {
+                LOG_ERROR("Failed to write index header: %s", strerror(errno));
+            }
+            close(fd);
+        }
+        return;
+    }
+    pager->indexFd = open(indexFile, O_RDWR | O_CREAT, 0644);
+    if (pager->indexFd == -1) {
+        EXIT_ERROR("Fail to open index file.\n");
+    }
+    int32_t field;
+    for (field = 0; field < PAGER_INDEXED_FIELDS; field++) {
+        pager->indexes[field] = New_SkipList(0x9E3779B97F4A7C15ULL + field);
+    }
+    if (rebuild || !PagerLoadIndexes(pager)) {
+        LOG_INFO("Rebuild indexes of %s.", pager->file);
+        for (field = 0; field < PAGER_INDEXED_FIELDS; field++) {
+            Destroy_SkipList(pager->indexes[field]);
+            pager->indexes[field] = New_SkipList(0x9E3779B97F4A7C15ULL + field);
+        }
+        PagerRebuildIndexes(pager);
+    }
+    // 在关闭之前，索引文件都被视为与数据文件不一致
+    PagerWriteIndexes(pager, false);
+}
+
+/**
+ * 关闭索引文件并释放索引
+ * @param write: write back all entries, false when simulating a crash
+ */
+PRIVATE void PagerCloseIndexes(Pager *pager, bool write) {
+    if (pager->indexFd == -1) {
+        return;
+    }
+    if (write) {
+        PagerWriteIndexes(pager, true);
+    }
+    close(pager->indexFd);
+    int32_t field;
+    for (field = 0; field < PAGER_INDEXED_FIELDS; field++) {
+        Destroy_SkipList(pager->indexes[field]);
+    }
+}
+
+/*************************************************************/
+
+TINYDB_API void Init_PagerConfig(PagerConfig *config) {
+    config->storage           = Pager_ReadWrite;
+    config->mmapReserve       = DEFAULT_MMAP_RESERVE;
+    config->wal               = false;
+    config->groupCommitUs     = 0;
+    config->walCheckpointSize = DEFAULT_WAL_CHECKPOINT_SIZE;
+    config->ioDepth           = 0;
+    config->format            = Pager_RowFormat;
+    config->compress          = false;
+    config->compactIntervalUs = 0;
+    config->indexes           = false;
+    config->access            = Pager_RangeAccess;
+}
+
+/**
+ * 如果传入的config为NULL，将会使用默认设定
+ * 
+ * @param file: storage data
+ */
+TINYDB_API Pager *New_Pager(const char *file, PagerConfig *config) {
+    int fd       = OpenFile(file);
+    Pager *pager = (Pager *)calloc(1, sizeof(Pager) + sizeof(char) * (strlen(file) + 1));
+    assert(pager != NULL);
+
+    strcpy(pager->file, file);
+    struct stat st;
+    if (fstat(fd, &st) == -1) {
+        EXIT_ERROR("Fail to stat file.\n");
+    }
+    pager->fd         = fd;
+    pager->fileLength = st.st_size;
+    pager->pageCount  = st.st_size / PAGE_SIZE;
+    int32_t i;
+    // 读者很多时，等待独占dirLatch的分裂不能被饿死
+    pthread_rwlockattr_t attr;
+    pthread_rwlockattr_init(&attr);
+    pthread_rwlockattr_setkind_np(&attr, PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+    pthread_rwlock_init(&pager->dirLatch, &attr);
+    pthread_rwlockattr_destroy(&attr);
+    pthread_mutex_init(&pager->poolLatch, NULL);
+    pthread_cond_init(&pager->ioDone, NULL);
+    pthread_mutex_init(&pager->prefetchLatch, NULL);
+    for (i = 0; i < PAGE_LATCH_STRIPES; i++) {
+        pthread_rwlock_init(&pager->latches[i].lock, NULL);
+    }
+    pthread_mutex_init(&pager->compactMutex, NULL);
+    pthread_cond_init(&pager->compactCond, NULL);
+    pthread_rwlock_init(&pager->indexLatch, NULL);
+    if (config == NULL) {
+        Init_PagerConfig(&pager->config);
+    } else {
+        pager->config = *config;
+    }
+    PagerOpenMeta(pager);
+    if (pager->config.storage == Pager_Mmap) {
+        if (pager->config.wal) {
+            // 映射的页面随时可能被内核写回，无法保证日志先于页面写入
+            LOG_WARN("WAL is not supported in Pager_Mmap mode, it is disabled.");
+            pager->config.wal = false;
+        }
+        PagerMapFile(pager);
+        PagerLoadMeta(pager, false);
+        PagerOpenIndexes(pager, false);
+        PagerStartCompactor(pager);
+        return pager;
+    }
+
+    if (pager->config.compress) {
+        PagerLoadExtents(pager);
+        pager->extentBuffer = (char *)malloc((size_t)TABLE_MAX_PAGES * EXTENT_MAX_SIZE);
+        assert(pager->extentBuffer != NULL);
+    }
+    pager->pool = (char *)calloc(TABLE_MAX_PAGES, PAGE_SIZE);
+    assert(pager->pool != NULL);
+    // 压缩的页面总是整个写入extent，不需要磁盘副本
+    if (pager->config.wal && !pager->config.compress) {
+        pager->diskPool = (char *)malloc((size_t)TABLE_MAX_PAGES * PAGE_SIZE);
+        assert(pager->diskPool != NULL);
+    }
+    for (i = 0; i < TABLE_MAX_PAGES; i++) {
+        pager->frames[i].pageNum = -1;
+        pager->frames[i].data    = pager->pool + (size_t)i * PAGE_SIZE;
+        pager->frames[i].disk    = pager->diskPool == NULL ? NULL : pager->diskPool + (size_t)i * PAGE_SIZE;
+    }
+    pager->clockHand     = 0;
+    pager->aio           = pager->config.ioDepth > 0 ? New_Aio(pager->config.ioDepth) : NULL;
+    pager->pageTableSize = pager->pageCount > TABLE_MAX_PAGES ? pager->pageCount : TABLE_MAX_PAGES;
+    pager->pageTable     = (int32_t *)malloc(pager->pageTableSize * sizeof(int32_t));
+    assert(pager->pageTable != NULL);
+    for (i = 0; i < pager->pageTableSize; i++) {
+        pager->pageTable[i] = -1;
+    }
+
+    bool recovered = pager->config.wal && PagerRecover(pager);
+    PagerLoadMeta(pager, recovered);
+    if (pager->wal != NULL) {
+        PagerCheckpoint(pager);
+    }
+    PagerOpenIndexes(pager, recovered);
+    PagerStartCompactor(pager);
+    return pager;
+}
+
+/* 释放latch，调用者保证没有其他线程还在使用pager */
+PRIVATE void PagerDestroyLatches(Pager *pager) {
+    int32_t i;
+    pthread_rwlock_destroy(&pager->dirLatch);
+    pthread_mutex_destroy(&pager->poolLatch);
+    pthread_cond_destroy(&pager->ioDone);
+    pthread_mutex_destroy(&pager->prefetchLatch);
+    for (i = 0; i < PAGE_LATCH_STRIPES; i++) {
+        pthread_rwlock_destroy(&pager->latches[i].lock);
+    }
+    pthread_mutex_destroy(&pager->compactMutex);
+    pthread_cond_destroy(&pager->compactCond);
+    pthread_rwlock_destroy(&pager->indexLatch);
+}
+
+TINYDB_API void Destroy_Pager(Pager *pager) {
+    assert(pager != NULL);
+    PagerStopCompactor(pager);
+
+    if (pager->config.storage == Pager_Mmap) {
+        PagerUnmapFile(pager);
+    } else {
+        PagerFlush(pager);
+    }
+    fdatasync(pager->fd);
+    PagerWriteMeta(pager, true);
+    PagerCloseIndexes(pager, true);
+    if (pager->wal != NULL) {
+        Wal_Truncate(pager->wal, pager->pageCount);
+        Destroy_Wal(pager->wal);
+    }
+    CloseFile(pager->metaFd);
+    CloseFile(pager->fd);
+    free(pager->fences);
+    free(pager->directory);
+    free(pager->fsm);
+    free(pager->buckets);
+    free(pager->localDepths);
+    free(pager->pageTable);
+    free(pager->pool);
+    free(pager->diskPool);
+    free(pager->dirtyPages);
+    PagerDestroyExtents(pager);
+    Destroy_Aio(pager->aio);
+    PagerDestroyLatches(pager);
+    free(pager);
+    pager = NULL;
+}
+
+/**
+ * 模拟进程崩溃：不写回任何脏页和元数据，直接关闭文件并释放内存。
+ */
+#ifndef DEBUG_TEST
+PRIVATE
+#endif
+void PagerSimulateCrash(Pager *pager) {
+    PagerStopCompactor(pager);
+    if (pager->config.storage == Pager_Mmap) {
+        munmap(pager->map, pager->config.mmapReserve);
+    }
+    if (pager->wal != NULL) {
+        Destroy_Wal(pager->wal);
+    }
+    PagerCloseIndexes(pager, false);
+    close(pager->metaFd);
+    close(pager->fd);
+    free(pager->fences);
+    free(pager->directory);
+    free(pager->fsm);
+    free(pager->buckets);
+    free(pager->localDepths);
+    free(pager->pageTable);
+    free(pager->pool);
+    free(pager->diskPool);
+    free(pager->dirtyPages);
+    PagerDestroyExtents(pager);
+    Destroy_Aio(pager->aio);
+    PagerDestroyLatches(pager);
+    free(pager);
+}
+
+/**
+ * 持有dirLatch共享锁时插入：只处理不需要改变directory的情况，即负责id的页面还有空间，
+ * 并且id大于页面的minId。Pager_HashAccess 下只要求id所在的桶已经有页面并且还有空间。
+ * 日志只追加到txn，调用者释放dirLatch之后再等待它写入磁盘。
+ * @param var: the whole Pager_VarFormat row if not NULL, row is truncated from it
+ * @param end: lsn to wait for in PagerTxnSync
+ * @return false if the insert needs dirLatch exclusive, nothing is changed
+ */
+PRIVATE bool PagerInsertInPlace(Pager *pager, PagerTxn *txn, Row *row, const VarRow *var, uint64_t *end,
+                                PagerExecuteResult *result) {
+    KEY id = row->id;
+    int32_t pageNum;
+    if (pager->config.access == Pager_HashAccess) {
+        pageNum = PagerHashPage(pager, id);
+        if (pageNum == -1) {
+            return false;
+        }
+    } else {
+        int32_t k = PagerDirectoryUpperBound(pager, id);
+        if (k == 0) {
+            return false;
+        }
+        pageNum = pager->directory[k - 1];
+    }
+    Page *page = (Page *)Pager_PinPage(pager, pageNum);
+    if (page == NULL) {
+        *result = Pager_ExecuteFailed;
+        return true;
+    }
+    PagerLatchPage(pager, pageNum, true);
+    if (Page_Find(pager->config.format, page, id) != -1) {
+        PagerUnlatchPage(pager, pageNum, true);
+        Pager_UnpinPage(pager, pageNum, false);
+        LOG_DEBUG("id = %d is already exists.", id);
+        *result = Pager_RowAleardyExists;
+        return true;
+    }
+    if (!Page_HasRoomFor(pager->config.format, page, row, var)) {
+        PagerUnlatchPage(pager, pageNum, true);
+        Pager_UnpinPage(pager, pageNum, false);
+        return false;
+    }
+    Page_InsertFor(pager->config.format, page, row, var);
+    page->lastModifyTime = time(NULL);
+    PagerSetPage(pager, pageNum, page);
+    PagerLogInsert(pager, txn, pageNum, page, row, var);
+    *end = PagerTxnAppend(pager, txn);
+    PagerIndexInsert(pager, row);
+    PagerUnlatchPage(pager, pageNum, true);
+    *result = Pager_ExecuteSuccess;
+    return true;
+}
+
+/**
+ * 独占dirLatch时插入，可以挪动记录、分裂页面。修改记录在txn中，由调用者提交，
+ * 这样 Pager_Update 可以把删除和重新插入放在同一个事务中。
+ * @param var: the whole Pager_VarFormat row if not NULL, row is truncated from it
+ */
+PRIVATE PagerExecuteResult PagerInsertRow(Pager *pager, PagerTxn *txn, Row *row, const VarRow *var) {
+    if (pager->config.access == Pager_HashAccess) {
+        return PagerHashInsertRow(pager, txn, row, var);
+    }
+    PageFormat format = pager->config.format;
+    KEY id            = row->id;
+    int32_t k       = PagerDirectoryUpperBound(pager, id);
+    int32_t pageNum = pager->dirCount == 0 ? PagerEmptyPage(pager) : pager->directory[k == 0 ? 0 : k - 1];
+    Page *page      = (Page *)(pageNum == -1 ? Pager_NewPage(pager, &pageNum) : Pager_PinPage(pager, pageNum));
+    if (page == NULL) {
+        return Pager_ExecuteFailed;
+    }
+    if (Page_Find(format, page, id) != -1) {
+        LOG_DEBUG("id = %d is already exists.", id);
+        Pager_UnpinPage(pager, pageNum, false);
+        return Pager_RowAleardyExists;
+    }
+
+    if (!Page_HasRoomFor(format, page, row, var) && pager->dirCount > 0) {
+        int32_t target = PagerShiftToNeighbor(pager, txn, k == 0 ? 0 : k - 1, page, id);
+        if (target != -1 && target != pageNum) {
+            Pager_UnpinPage(pager, pageNum, false);
+            page    = (Page *)Pager_PinPage(pager, target);
+            pageNum = target;
+            if (page == NULL) {
+                return Pager_ExecuteFailed;
+            }
+        }
+    }
+
+    if (!Page_HasRoomFor(format, page, row, var)) {
+        int32_t rightNum;
+        Page *right = PagerAllocPage(pager, &rightNum);
+        if (right == NULL) {
+            Pager_UnpinPage(pager, pageNum, false);
+            return Pager_ExecuteFailed;
+        }
+        Page_Split(format, page, right);
+        right->lastModifyTime = page->lastModifyTime = time(NULL);
+        PagerSetPage(pager, pageNum, page);
+        PagerSetPage(pager, rightNum, right);
+        // 释放不需要插入新记录的那一半
+        if (id >= pager->fences[rightNum].minId) {
+            PagerLogPage(pager, txn, pageNum, page, pageNum);
+            Pager_PinPage(pager, rightNum);
+            PagerLogPage(pager, txn, rightNum, right, rightNum);
+            page    = right;
+            pageNum = rightNum;
+        } else {
+            PagerLogPage(pager, txn, rightNum, right, rightNum);
+            Pager_PinPage(pager, pageNum);
+            PagerLogPage(pager, txn, pageNum, page, pageNum);
+        }
+        Metrics_Add(Metrics_PageSplits, 1);
+        LOG_DEBUG("Split page, new page = %d", rightNum);
+    }
+
+    Page_InsertFor(format, page, row, var);
+    page->lastModifyTime = time(NULL);
+    PagerSetPage(pager, pageNum, page);
+    PagerLogInsert(pager, txn, pageNum, page, row, var);
+    return Pager_ExecuteSuccess;
+}
+
+/**
+ * 每个页面存放一段连续且互不重叠的id，记录插入到directory中负责该id的页面。
+ * 页面已满时，先根据空闲空间表尝试把一条记录挪到相邻的页面；
+ * 相邻页面也满了，才将其中较大的一半记录移动到一个空页面，没有空页面时追加在文件末尾。
+ * 大多数插入只修改一个页面，在dirLatch共享锁下完成，不同页面的插入可以并发；
+ * 需要改变directory时，释放共享锁，再独占dirLatch重新插入。
+ * Pager_HashAccess 下记录插入到id所在的桶，桶满了就分裂，见 PagerHashInsertRow。
+ * 
+ * Size of the file is always times of 4096.
+ * @param var: the whole Pager_VarFormat row if not NULL, row is truncated from it
+ */
+PRIVATE PagerExecuteResult PagerInsert(Pager *pager, Row *row, const VarRow *var) {
+    uint64_t start = Metrics_Now(), end = 0;
+    PagerExecuteResult result;
+    PagerTxn txn;
+    memset(&txn, 0, sizeof(PagerTxn));
+    pthread_rwlock_rdlock(&pager->dirLatch);
+    bool done = PagerInsertInPlace(pager, &txn, row, var, &end, &result);
+    pthread_rwlock_unlock(&pager->dirLatch);
+    if (!done) {
+        pthread_rwlock_wrlock(&pager->dirLatch);
+        result = PagerInsertRow(pager, &txn, row, var);
+        end    = PagerTxnAppend(pager, &txn);
+        if (result == Pager_ExecuteSuccess) {
+            PagerIndexInsert(pager, row);
+        }
+        pthread_rwlock_unlock(&pager->dirLatch);
+    }
+    // 修改过的页面在写入磁盘之前一直被pin住，不会被提前写回，等待日志时不需要持有任何latch
+    PagerTxnSync(pager, &txn, end);
+    PagerMaybeCheckpoint(pager);
+    if (result == Pager_ExecuteSuccess) {
+        LOG_DEBUG("Insert row successfully, id = %d", row->id);
+    }
+    Metrics_Record(Metrics_PagerInsert, Metrics_Now() - start);
+    return result;
+}
+
+TINYDB_API PagerExecuteResult Pager_Insert(Pager *pager, Row *row) {
+    return PagerInsert(pager, row, NULL);
+}
+
+/**
+ * 插入一条username或email可能超过31字节的记录，只用于 Pager_VarFormat。
+ * 二级索引只索引前31个字节，与通过 Row 读到的内容一致。
+ */
+TINYDB_API PagerExecuteResult Pager_InsertVar(Pager *pager, VarRow *row) {
+    if (pager->config.format != Pager_VarFormat) {
+        LOG_ERROR("Pager_InsertVar needs Pager_VarFormat.");
+        return Pager_ExecuteFailed;
+    }
+    Row truncated;
+    Var_ToRow(row, &truncated);
+    return PagerInsert(pager, &truncated, row);
+}
+
+/**
+ * Pager_InsertBatch 的输出：将有序的记录依次写满页面。第一个页面是被合并的原有页面，
+ * 之后的页面追加在文件末尾。缓冲池模式下，追加的页面先放在staging中，
+ * 攒够 BATCH_WRITE_PAGES 个之后一次写入文件，不经过缓冲池。
+ */
+typedef struct BatchWriter {
+    Pager *pager;
+    Page *page;       /* current output page */
+    int32_t pageNum;  /* page number of page */
+    bool pinned;      /* page is pinned in the buffer pool or the mapping */
+    char *staging;    /* BATCH_WRITE_PAGES pages */
+    int32_t stagedFirst;
+    int32_t stagedCount;
+    PagerTxn txn;     /* pages of the current target page and its overflow */
+} BatchWriter;
+
+/**
+ * staging写满时，其中的页面可能还没有提交。这些页面都在文件末尾，
+ * 如果事务最终没有提交，PagerRecover 会截掉它们。
+ */
+PRIVATE void BatchWriterFlushStaging(BatchWriter *w) {
+    if (w->stagedCount > 0) {
+        // 压缩时写入页面会分配extent，与缓冲池的写回互斥
+        pthread_mutex_lock(&w->pager->poolLatch);
+        PagerWritePages(w->pager, w->stagedFirst, w->staging, w->stagedCount);
+        pthread_mutex_unlock(&w->pager->poolLatch);
+        PagerTxnForgetUnpinned(&w->txn);
+        w->stagedCount = 0;
+    }
+}
+
+/* 结束当前页面：更新fence，释放pin住的页面 */
+PRIVATE void BatchWriterFinishPage(BatchWriter *w) {
+    if (w->page == NULL) {
+        return;
+    }
+    w->page->lastModifyTime = time(NULL);
+    PagerSetPage(w->pager, w->pageNum, w->page);
+    PagerLogPage(w->pager, &w->txn, w->pinned ? w->pageNum : -1, w->page, w->pageNum);
+    w->page = NULL;
+}
+
+/* 从pageNum开始输出，pageNum为-1时直接从新页面开始 */
+PRIVATE void BatchWriterStart(BatchWriter *w, Page *page, int32_t pageNum) {
+    w->page    = page;
+    w->pageNum = pageNum;
+    w->pinned  = page != NULL;
+    if (page != NULL) {
+        Page_Init(page);
+    }
+}
+
+/* 当前页面写满了，换到追加在文件末尾的新页面 */
+PRIVATE bool BatchWriterNextPage(BatchWriter *w) {
+    BatchWriterFinishPage(w);
+    Pager *pager = w->pager;
+    if (pager->config.storage == Pager_Mmap) {
+        w->page   = (Page *)Pager_NewPage(pager, &w->pageNum);
+        w->pinned = true;
+        return w->page != NULL;
+    }
+    if (w->stagedCount == BATCH_WRITE_PAGES) {
+        BatchWriterFlushStaging(w);
+    }
+    w->pageNum = PagerAppendPage(pager);
+    if (w->stagedCount == 0) {
+        w->stagedFirst = w->pageNum;
+    }
+    w->page   = (Page *)(w->staging + (size_t)w->stagedCount++ * PAGE_SIZE);
+    w->pinned = false;
+    memset(w->page, 0, PAGE_SIZE);
+    return true;
+}
+
+PRIVATE bool BatchWriterPut(BatchWriter *w, Row *row) {
+    if ((w->page == NULL || !Page_HasRoom(w->pager->config.format, w->page, row)) && !BatchWriterNextPage(w)) {
+        return false;
+    }
+    Page_Append(w->pager->config.format, w->page, row);
+    return true;
+}
+
+/* 写入原有页面的第k条记录，Pager_VarFormat 的记录整条复制，不经过 Row 截断 */
+PRIVATE bool BatchWriterCopy(BatchWriter *w, Page *src, int32_t k) {
+    PageFormat format = w->pager->config.format;
+    if (w->page != NULL && Page_CopyRow(format, src, k, w->page, true)) {
+        return true;
+    }
+    if (!BatchWriterNextPage(w)) {
+        return false;
+    }
+    Page_CopyRow(format, src, k, w->page, true);
+    return true;
+}
+
+/* 按id排序，id相同时按在输入中的位置，即数组中的地址 */
+PRIVATE int CompareRowId(const void *a, const void *b) {
+    const Row *x = *(const Row *const *)a, *y = *(const Row *const *)b;
+    if (x->id != y->id) {
+        return x->id < y->id ? -1 : 1;
+    }
+    return x < y ? -1 : (x > y ? 1 : 0);
+}
+
+/* 稳定地按id排序rows，id相同的记录保持输入中的顺序 */
+PRIVATE void PagerSortRows(Row *rows, size_t n) {
+    const Row **order = (const Row **)malloc(n * sizeof(Row *));
+    Row *sorted       = (Row *)malloc(n * sizeof(Row));
+    assert(order != NULL && sorted != NULL);
+    size_t i;
+    for (i = 0; i < n; i++) {
+        order[i] = &rows[i];
+    }
+    qsort(order, n, sizeof(Row *), CompareRowId);
+    for (i = 0; i < n; i++) {
+        memcpy(&sorted[i], order[i], sizeof(Row));
+    }
+    memcpy(rows, sorted, n * sizeof(Row));
+    free(sorted);
+    free(order);
+}
+
+/**
+ * Pager_HashAccess 下的批量插入：记录散落在各个桶中，没有可以顺序写满的页面，
+ * 逐条插入到所在的桶，每个事务最多pin住 HASH_BATCH_PAGES 个页面。调用者独占dirLatch。
+ * 事务的日志只追加不等待，调用者释放dirLatch之后等待end之前的日志写入磁盘。
+ * @param rows: sorted by id, only the first row of a duplicated id is inserted, an existing row is kept
+ * @param end: lsn to wait for in Wal_Sync, 0 if nothing is logged
+ */
+PRIVATE PagerExecuteResult PagerHashInsertBatch(Pager *pager, Row *rows, size_t n, uint64_t *end) {
+    PagerExecuteResult result = Pager_ExecuteSuccess, r;
+    PagerTxn txn;
+    memset(&txn, 0, sizeof(PagerTxn));
+    *end = 0;
+    size_t i;
+    for (i = 0; i < n && result != Pager_ExecuteFailed; i++) {
+        if (i > 0 && rows[i].id == rows[i - 1].id) {
+            result = Pager_RowAleardyExists;
+            continue;
+        }
+        r = PagerHashInsertRow(pager, &txn, &rows[i], NULL);
+        if (r == Pager_RowAleardyExists) {
+            // 与 Pager_Insert 一致，保留原有的记录
+            result = Pager_RowAleardyExists;
+        } else if (r == Pager_ExecuteSuccess) {
+            PagerIndexInsert(pager, &rows[i]);
+        } else {
+            result = Pager_ExecuteFailed;
+        }
+        if (txn.count >= HASH_BATCH_PAGES) {
+            *end = PagerTxnAppend(pager, &txn);
+            PagerTxnRelease(pager, &txn);
+        }
+    }
+    if (txn.count > 0) {
+        *end = PagerTxnAppend(pager, &txn);
+        PagerTxnRelease(pager, &txn);
+    }
+    Wal_BatchFree(&txn.batch);
+    return result;
+}
+
+/**
+ * 批量插入。先将rows按id排序，然后按id顺序依次处理directory中的每个页面：
+ * 将页面原有的记录与属于该页面id区间的新记录归并，写满原页面后，
+ * 剩余的记录写入追加在文件末尾的新页面，新页面除最后一个外都是满的。
+ * 比最后一个页面的maxId还大的记录同样归并到最后一个页面之后，顺序追加。
+ * Pager_HashAccess 下逐条插入，见 PagerHashInsertBatch。
+ * 每个原有页面的修改作为一个事务追加到日志，不等待写入磁盘就释放页面，
+ * 释放dirLatch之后只等待一次日志写入磁盘。
+ * 
+ * @param rows: sorted by id in place, rows with the same id keep their order
+ * @return Pager_RowAleardyExists if some ids already exist or are duplicated in rows,
+ *         these rows are skipped (the existing row, or the first of the duplicated rows, is kept)
+ *         and all other rows are inserted
+ */
+TINYDB_API PagerExecuteResult Pager_InsertBatch(Pager *pager, Row *rows, size_t n) {
+    if (n == 0) {
+        return Pager_ExecuteSuccess;
+    }
+    uint64_t start = Metrics_Now();
+    PagerSortRows(rows, n);
+    uint64_t end = 0;
+    pthread_rwlock_wrlock(&pager->dirLatch);
+    if (pager->config.access == Pager_HashAccess) {
+        PagerExecuteResult result = PagerHashInsertBatch(pager, rows, n, &end);
+        pthread_rwlock_unlock(&pager->dirLatch);
+        if (end != 0) {
+            Wal_Sync(pager->wal, end);
+        }
+        PagerMaybeCheckpoint(pager);
+        LOG_DEBUG("Insert %zu rows in batch.", n);
+        Metrics_Record(Metrics_PagerInsertBatch, Metrics_Now() - start);
+        return result;
+    }
+
+    BatchWriter w;
+    memset(&w, 0, sizeof(BatchWriter));
+    w.pager   = pager;
+    w.staging = pager->config.storage == Pager_Mmap ? NULL : (char *)malloc((size_t)BATCH_WRITE_PAGES * PAGE_SIZE);
+    assert(pager->config.storage == Pager_Mmap || w.staging != NULL);
+    // 原页面在写入时被覆盖，先复制一份，从中读取原有的记录
+    Page *existing = (Page *)malloc(PAGE_SIZE);
+    assert(existing != NULL);
+
+    PagerExecuteResult result = Pager_ExecuteSuccess;
+    size_t i                  = 0;
+    while (i < n && result != Pager_ExecuteFailed) {
+        // 找到rows[i]所属的页面，以及下一个页面的minId（即该页面id区间的上界）
+        int32_t k = PagerDirectoryUpperBound(pager, rows[i].id), pageNum = -1, count = 0, p = 0;
+        k            = k == 0 ? 0 : k - 1;
+        bool bounded = k + 1 < pager->dirCount;
+        KEY limit    = bounded ? pager->fences[pager->directory[k + 1]].minId : 0;
+        Page *page   = NULL;
+        if (pager->dirCount > 0) {
+            pageNum = pager->directory[k];
+        } else {
+            pageNum = PagerEmptyPage(pager);
+        }
+        if (pageNum != -1) {
+            page = (Page *)Pager_PinPage(pager, pageNum);
+            if (page == NULL) {
+                result = Pager_ExecuteFailed;
+                break;
+            }
+            memcpy(existing, page, PAGE_SIZE);
+            count = page->rowCount;
+        }
+
+        BatchWriterStart(&w, page, pageNum);
+        KEY last = 0;
+        bool any = false;
+        while (p < count || (i < n && (!bounded || rows[i].id < limit))) {
+            // id相同时原有的记录在前，之后的新记录被跳过
+            KEY id     = p < count ? Page_Id(pager->config.format, existing, p) : 0;
+            bool fresh = i < n && (!bounded || rows[i].id < limit) && (p == count || rows[i].id < id);
+            Row *row   = fresh ? &rows[i++] : NULL;
+            if (fresh) {
+                id = row->id;
+            } else {
+                p++;
+            }
+            if (any && id == last) {
+                result = Pager_RowAleardyExists;
+                continue;
+            }
+            if (!(fresh ? BatchWriterPut(&w, row) : BatchWriterCopy(&w, existing, p - 1))) {
+                result = Pager_ExecuteFailed;
+                break;
+            }
+            if (fresh) {
+                PagerIndexInsert(pager, row);
+            }
+            last = id;
+            any  = true;
+        }
+        BatchWriterFinishPage(&w);
+        if (w.txn.count > 0) {
+            end = PagerTxnAppend(pager, &w.txn);
+            PagerTxnRelease(pager, &w.txn);
+        }
+    }
+    BatchWriterFlushStaging(&w);
+    pthread_rwlock_unlock(&pager->dirLatch);
+    Wal_BatchFree(&w.txn.batch);
+    if (end != 0) {
+        Wal_Sync(pager->wal, end);
+    }
+    PagerMaybeCheckpoint(pager);
+    free(existing);
+    free(w.staging);
+    LOG_DEBUG("Insert %zu rows in batch.", n);
+    Metrics_Record(Metrics_PagerInsertBatch, Metrics_Now() - start);
+    return result;
+}
+
+/**
+ * 先不加latch读取记录，读的过程中页面被修改时，再在页面的共享latch下读一次。
+ */
+TINYDB_API PagerExecuteResult Pager_Select(Pager *pager, KEY id, Row **ret) {
+    uint64_t start = Metrics_Now();
+    pthread_rwlock_rdlock(&pager->dirLatch);
+    int32_t pageNum = PagerLocateRow(pager, id);
+    Page *page      = (Page *)(pageNum == -1 ? NULL : Pager_PinPage(pager, pageNum));
+    if (page == NULL) {
+        pthread_rwlock_unlock(&pager->dirLatch);
+        Metrics_Record(Metrics_PagerSelect, Metrics_Now() - start);
+        return Pager_RowNotFound;
+    }
+    Row row;
+    bool found;
+    if (!PagerOptimisticSelect(pager, pageNum, page, id, &row, &found)) {
+        PagerLatchPage(pager, pageNum, false);
+        int32_t i = Page_Find(pager->config.format, page, id);
+        found     = i != -1;
+        if (found) {
+            Page_Get(pager->config.format, page, i, &row);
+        }
+        PagerUnlatchPage(pager, pageNum, false);
+    }
+    Pager_UnpinPage(pager, pageNum, false);
+    pthread_rwlock_unlock(&pager->dirLatch);
+    if (found) {
+        if (*ret == NULL) {
+            *ret = New_Row();
+        }
+        memcpy(*ret, &row, ROW_SIZE);
+        LOG_DEBUG("Success to select row = %d", id);
+    }
+    Metrics_Record(Metrics_PagerSelect, Metrics_Now() - start);
+    return found ? Pager_ExecuteSuccess : Pager_RowNotFound;
+}
+
+/**
+ * 读取完整的记录，Pager_VarFormat 下username和email可能超过31字节。
+ * 记录比 Row 大得多，不做乐观读取，直接在页面的共享latch下复制。
+ */
+TINYDB_API PagerExecuteResult Pager_SelectVar(Pager *pager, KEY id, VarRow *ret) {
+    uint64_t start = Metrics_Now();
+    pthread_rwlock_rdlock(&pager->dirLatch);
+    int32_t pageNum = PagerLocateRow(pager, id);
+    Page *page      = (Page *)(pageNum == -1 ? NULL : Pager_PinPage(pager, pageNum));
+    if (page == NULL) {
+        pthread_rwlock_unlock(&pager->dirLatch);
+        Metrics_Record(Metrics_PagerSelect, Metrics_Now() - start);
+        return Pager_RowNotFound;
+    }
+    PagerLatchPage(pager, pageNum, false);
+    int32_t i = Page_Find(pager->config.format, page, id);
+    if (i != -1) {
+        Page_GetVar(pager->config.format, page, i, ret);
+    }
+    PagerUnlatchPage(pager, pageNum, false);
+    Pager_UnpinPage(pager, pageNum, false);
+    pthread_rwlock_unlock(&pager->dirLatch);
+    Metrics_Record(Metrics_PagerSelect, Metrics_Now() - start);
+    return i != -1 ? Pager_ExecuteSuccess : Pager_RowNotFound;
+}
+
+/**
+ * Pager_VarFormat 下写入完整的记录：var不为NULL时就是var，否则由原记录和row合并，见 Var_Merge。
+ * @param var: the whole new Pager_VarFormat row if not NULL, row is truncated from it
+ * @param ret: the old row truncated to Row, NULL if not needed
+ * @param retVar: the whole old Pager_VarFormat row, NULL if not needed
+ * @param exclusive: dirLatch is held exclusive, otherwise shared
+ * @param end: lsn to wait for in PagerTxnSync, the log is only appended to txn
+ * @return false if the updated row no longer fits in its page, which needs dirLatch exclusive,
+ *         nothing is changed
+ */
+PRIVATE bool PagerUpdateRow(Pager *pager, PagerTxn *txn, KEY id, Row *row, const VarRow *var, Row **ret,
+                            VarRow *retVar, bool exclusive, uint64_t *end, PagerExecuteResult *result) {
+    int32_t pageNum = PagerLocateRow(pager, id);
+    Page *page      = (Page *)(pageNum == -1 ? NULL : Pager_PinPage(pager, pageNum));
+    if (page == NULL) {
+        LOG_DEBUG("row is not exists, id = %d", id);
+        *result = Pager_RowNotFound;
+        return true;
+    }
+    PageFormat format = pager->config.format;
+    PagerLatchPage(pager, pageNum, true);
+    int32_t i = Page_Find(format, page, id);
+    if (i == -1) {
+        PagerUnlatchPage(pager, pageNum, true);
+        Pager_UnpinPage(pager, pageNum, false);
+        LOG_DEBUG("row is not exists, id = %d", id);
+        *result = Pager_RowNotFound;
+        return true;
+    }
+    Row old, r;
+    VarRow cur, next;
+    bool isVar = format == Pager_VarFormat;
+    Page_Get(format, page, i, &old);
+    if (isVar) {
+        Var_Read(page, i, &cur);
+        if (var != NULL) {
+            memcpy(&next, var, sizeof(VarRow));
+            next.id = id;
+        } else {
+            Var_Merge(&cur, row, &next);
+        }
+        Var_ToRow(&next, &r);
+    } else {
+        memcpy(&r, &old, ROW_SIZE);
+        r.isOnline = row->isOnline;
+        strcpy(r.email, row->email);
+        strcpy(r.username, row->username);
+    }
+    if (isVar ? Var_SetVar(page, i, &next) : Page_Set(format, page, i, &r)) {
+        page->lastModifiedRow = format == Pager_PaxFormat ? i : page->slots[i];
+        page->lastModifyTime  = time(NULL);
+        if (isVar) {
+            PagerLogRecord(pager, txn, pageNum, page, pageNum, Wal_VarUpdateRecord, &next, sizeof(VarRow));
+        } else {
+            PagerLogRecord(pager, txn, pageNum, page, pageNum, Wal_UpdateRecord, &r, ROW_SIZE);
+        }
+        *result = Pager_ExecuteSuccess;
+    } else if (!exclusive) {
+        PagerUnlatchPage(pager, pageNum, true);
+        Pager_UnpinPage(pager, pageNum, false);
+        return false;
+    } else {
+        // 变长的记录变长之后页面放不下，删除之后重新插入，可能分裂页面。
+        // 多pin一次，重新插入失败时页面仍在原处，可以把原记录放回去
+        Pager_PinPage(pager, pageNum);
+        Page_Remove(format, page, i, NULL);
+        page->lastModifyTime = time(NULL);
+        PagerSetPage(pager, pageNum, page);
+        PagerLogRecord(pager, txn, pageNum, page, pageNum, Wal_DeleteRecord, &id, sizeof(KEY));
+        *result = PagerInsertRow(pager, txn, &r, isVar ? &next : NULL);
+        if (*result == Pager_ExecuteSuccess) {
+            Pager_UnpinPage(pager, pageNum, true);
+        } else {
+            // 原记录刚从这个页面删除，一定放得下。页面镜像在日志中排在删除之后，重做时同样恢复原记录
+            Page_InsertFor(format, page, &old, isVar ? &cur : NULL);
+            PagerSetPage(pager, pageNum, page);
+            PagerLogPage(pager, txn, pageNum, page, pageNum);
+            *result = Pager_ExecuteFailed;
+        }
+    }
+    *end = PagerTxnAppend(pager, txn);
+    if (*result == Pager_ExecuteSuccess) {
+        PagerIndexUpdate(pager, &old, &r);
+    }
+    PagerUnlatchPage(pager, pageNum, true);
+    if (ret != NULL) {
+        if (*ret == NULL) {
+            *ret = New_Row();
+        }
+        memcpy(*ret, &old, ROW_SIZE);
+    }
+    if (retVar != NULL) {
+        memcpy(retVar, &cur, sizeof(VarRow));
+    }
+    return true;
+}
+
+/**
+ * 更新不改变id，通常在dirLatch共享锁和页面的独占latch下原地完成。
+ * Pager_VarFormat 下新的记录更长、页面放不下时，独占dirLatch，删除记录后重新插入。
+ */
+PRIVATE PagerExecuteResult PagerUpdate(Pager *pager, KEY id, Row *row, const VarRow *var, Row **ret, VarRow *retVar) {
+    uint64_t start = Metrics_Now(), end = 0;
+    PagerExecuteResult result;
+    PagerTxn txn;
+    memset(&txn, 0, sizeof(PagerTxn));
+    pthread_rwlock_rdlock(&pager->dirLatch);
+    bool done = PagerUpdateRow(pager, &txn, id, row, var, ret, retVar, false, &end, &result);
+    pthread_rwlock_unlock(&pager->dirLatch);
+    if (!done) {
+        pthread_rwlock_wrlock(&pager->dirLatch);
+        PagerUpdateRow(pager, &txn, id, row, var, ret, retVar, true, &end, &result);
+        pthread_rwlock_unlock(&pager->dirLatch);
+    }
+    PagerTxnSync(pager, &txn, end);
+    PagerMaybeCheckpoint(pager);
+    if (result == Pager_ExecuteSuccess) {
+        LOG_DEBUG("Success to update row = %d", id);
+    }
+    Metrics_Record(Metrics_PagerUpdate, Metrics_Now() - start);
+    return result;
+}
+
+/**
+ * Pager_VarFormat 下只替换row中与原记录前31字节不同的username或email，
+ * 超过31字节的字段不会因为只修改了isOnline而被截断。
+ */
+TINYDB_API PagerExecuteResult Pager_Update(Pager *pager, KEY id, Row *row, Row **ret) {
+    return PagerUpdate(pager, id, row, NULL, ret, NULL);
+}
+
+/**
+ * 用完整的记录覆盖id的记录，只用于 Pager_VarFormat。
+ * @param ret: the whole old row if not NULL
+ */
+TINYDB_API PagerExecuteResult Pager_UpdateVar(Pager *pager, KEY id, VarRow *row, VarRow *ret) {
+    if (pager->config.format != Pager_VarFormat) {
+        LOG_ERROR("Pager_UpdateVar needs Pager_VarFormat.");
+        return Pager_ExecuteFailed;
+    }
+    Row truncated;
+    Var_ToRow(row, &truncated);
+    truncated.id = id;
+    return PagerUpdate(pager, id, &truncated, row, NULL, ret);
+}
+
+/**
+ * @param exclusive: dirLatch is held exclusive, otherwise shared
+ * @return false if the delete changes the minId of the page or empties it,
+ *         which needs dirLatch exclusive, nothing is changed;
+ *         in Pager_HashAccess only emptying a page, which releases its bucket, needs it
+ * @param end: lsn to wait for in PagerTxnSync, the log is only appended to txn
+ */
+PRIVATE bool PagerDeleteRow(Pager *pager, PagerTxn *txn, KEY id, Row **ret, bool exclusive, uint64_t *end,
+                            PagerExecuteResult *result) {
+    int32_t pageNum = PagerLocateRow(pager, id);
+    Page *page      = (Page *)(pageNum == -1 ? NULL : Pager_PinPage(pager, pageNum));
+    if (page == NULL) {
+        *result = Pager_RowNotFound;
+        return true;
+    }
+    PagerLatchPage(pager, pageNum, true);
+    int32_t k = Page_Find(pager->config.format, page, id);
+    bool moves = page->rowCount == 1 || (k == 0 && pager->config.access == Pager_RangeAccess);
+    if (k == -1 || (!exclusive && moves)) {
+        PagerUnlatchPage(pager, pageNum, true);
+        Pager_UnpinPage(pager, pageNum, false);
+        *result = Pager_RowNotFound;
+        return k == -1;
+    }
+    if (*ret == NULL) {
+        *ret = New_Row();
+    }
+    Page_Remove(pager->config.format, page, k, *ret);
+    page->lastModifyTime = time(NULL);
+    PagerSetPage(pager, pageNum, page);
+    if (page->rowCount == 0 && pager->config.access == Pager_HashAccess) {
+        PagerReleaseBucket(pager, pageNum, id);
+    }
+    PagerLogRecord(pager, txn, pageNum, page, pageNum, Wal_DeleteRecord, &id, sizeof(KEY));
+    *end = PagerTxnAppend(pager, txn);
+    PagerIndexDelete(pager, *ret);
+    PagerUnlatchPage(pager, pageNum, true);
+    *result = Pager_ExecuteSuccess;
+    return true;
+}
+
+TINYDB_API PagerExecuteResult Pager_Delete(Pager *pager, KEY id, Row **ret) {
+    uint64_t start = Metrics_Now(), end = 0;
+    PagerExecuteResult result;
+    PagerTxn txn;
+    memset(&txn, 0, sizeof(PagerTxn));
+    pthread_rwlock_rdlock(&pager->dirLatch);
+    bool done = PagerDeleteRow(pager, &txn, id, ret, false, &end, &result);
+    pthread_rwlock_unlock(&pager->dirLatch);
+    if (!done) {
+        pthread_rwlock_wrlock(&pager->dirLatch);
+        PagerDeleteRow(pager, &txn, id, ret, true, &end, &result);
+        pthread_rwlock_unlock(&pager->dirLatch);
+    }
+    PagerTxnSync(pager, &txn, end);
+    PagerMaybeCheckpoint(pager);
+    Metrics_Record(Metrics_PagerDelete, Metrics_Now() - start);
+    return result;
+}
+
+/* 统计一个页面中isOnline == online的记录，PAX格式下只读取id和isOnline两列 */
+PRIVATE int64_t PagerCountPage(PageFormat format, Page *page, bool online, int64_t *idSum) {
+    int64_t count = 0, sum = 0;
+    int32_t k, n = page->rowCount;
+    if (format == Pager_PaxFormat) {
+        const KEY *ids = PAX_IDS(page);
+        for (k = 0; k < n; k++) {
+            int64_t match = -(int64_t)(Pax_Online(page, k) == online);
+            count -= match;
+            sum += ids[k] & match;
+        }
+    } else if (format == Pager_VarFormat) {
+        for (k = 0; k < n; k++) {
+            VarRecord *record = Var_Record(page, k);
+            if (record->isOnline == online) {
+                count++;
+                sum += record->id;
+            }
+        }
+    } else {
+        for (k = 0; k < n; k++) {
+            Row *row = Slot_Row(page, k);
+            if (row->isOnline == online) {
+                count++;
+                sum += row->id;
+            }
+        }
+    }
+    *idSum += sum;
+    return count;
+}
+
+/**
+ * 统计isOnline == online的记录数，idSum不为NULL时同时求出它们的id之和。
+ * 按页号顺序扫描所有页面，每次预读 PREFETCH_PAGES 个页面。
+ */
+TINYDB_API int64_t Pager_CountOnline(Pager *pager, bool online, int64_t *idSum) {
+    int64_t count = 0, sum = 0;
+    int32_t pageNum, window[PREFETCH_PAGES], i;
+    pthread_rwlock_rdlock(&pager->dirLatch);
+    for (pageNum = 0; pageNum < pager->pageCount; pageNum++) {
+        if (pageNum % PREFETCH_PAGES == 0) {
+            for (i = 0; i < PREFETCH_PAGES; i++) {
+                window[i] = pageNum + i;
+            }
+            PagerPrefetch(pager, window, PREFETCH_PAGES);
+        }
+        Page *page = (Page *)Pager_PinPage(pager, pageNum);
+        if (page == NULL) {
+            continue;
+        }
+        PagerLatchPage(pager, pageNum, false);
+        count += PagerCountPage(pager->config.format, page, online, &sum);
+        PagerUnlatchPage(pager, pageNum, false);
+        Pager_UnpinPage(pager, pageNum, false);
+    }
+    pthread_rwlock_unlock(&pager->dirLatch);
+    if (idSum != NULL) {
+        *idSum = sum;
+    }
+    return count;
+}
+
+/*************************************************************/
+// 扫描
+
+/* 不过滤任何记录的条件 */
+TINYDB_API void Init_PagerPredicate(PagerPredicate *predicate) {
+    predicate->minId          = INT32_MIN;
+    predicate->maxId          = INT32_MAX;
+    predicate->online         = -1;
+    predicate->usernamePrefix = NULL;
+    predicate->emailPrefix    = NULL;
+}
+
+/**
+ * @param predicate: NULL to return all rows
+ */
+TINYDB_API PagerScan *Pager_ScanOpen(Pager *pager, const PagerPredicate *predicate) {
+    PagerScan *scan = (PagerScan *)calloc(1, sizeof(PagerScan));
+    assert(scan != NULL);
+    scan->pager = pager;
+    scan->start = Metrics_Now();
+    if (predicate == NULL) {
+        Init_PagerPredicate(&scan->predicate);
+    } else {
+        scan->predicate = *predicate;
+    }
+    PagerPredicate *p    = &scan->predicate;
+    scan->usernameLength = p->usernamePrefix == NULL ? 0 : strlen(p->usernamePrefix);
+    scan->emailLength    = p->emailPrefix == NULL ? 0 : strlen(p->emailPrefix);
+    scan->nextId         = p->minId;
+    scan->done           = p->minId > p->maxId;
+    scan->rows           = (Row *)malloc(Page_MaxRows(pager->config.format) * sizeof(Row));
+    assert(scan->rows != NULL);
+    return scan;
+}
+
+/**
+ * 除id以外的条件，username和email直接与页面中的字节比较。
+ * @param usernameLength: max bytes of username, which is not null-terminated in Pager_VarFormat
+ */
+inline bool PagerScanMatch(PagerScan *scan, bool online, const char *username, int32_t usernameLength,
+                           const char *email, int32_t emailLength) {
+    PagerPredicate *p = &scan->predicate;
+    return (p->online == -1 || (p->online != 0) == online) &&
+           (scan->usernameLength == 0 || ((int32_t)scan->usernameLength <= usernameLength &&
+                                          strncmp(username, p->usernamePrefix, scan->usernameLength) == 0)) &&
+           (scan->emailLength == 0 ||
+            ((int32_t)scan->emailLength <= emailLength && strncmp(email, p->emailPrefix, scan->emailLength) == 0));
+}
+
+/* 把page中id在[nextId, maxId]内、满足条件的记录复制到rows */
+PRIVATE void PagerScanPage(PagerScan *scan, Page *page) {
+    PageFormat format = scan->pager->config.format;
+    KEY maxId         = scan->predicate.maxId;
+    int32_t k;
+    scan->count = 0;
+    if (format == Pager_PaxFormat) {
+        for (k = Pax_LowerBound(page, scan->nextId); k < page->rowCount && PAX_IDS(page)[k] <= maxId; k++) {
+            if (PagerScanMatch(scan, Pax_Online(page, k), PAX_USERNAME(page, k), USERNAME_SIZE, PAX_EMAIL(page, k),
+                               EMAIL_SIZE)) {
+                Pax_Get(page, k, &scan->rows[scan->count++]);
+            }
+        }
+        return;
+    }
+    if (format == Pager_VarFormat) {
+        for (k = Slot_LowerBound(page, scan->nextId); k < page->rowCount; k++) {
+            VarRecord *record = Var_Record(page, k);
+            if (record->id > maxId) {
+                break;
+            }
+            if (PagerScanMatch(scan, record->isOnline, record->data, record->usernameLength,
+                               record->data + record->usernameLength, record->emailLength)) {
+                Var_Get(page, k, &scan->rows[scan->count++]);
+            }
+        }
+        return;
+    }
+    for (k = Slot_LowerBound(page, scan->nextId); k < page->rowCount; k++) {
+        Row *row = Slot_Row(page, k);
+        if (row->id > maxId) {
+            break;
+        }
+        if (PagerScanMatch(scan, row->isOnline, row->username, USERNAME_SIZE, row->email, EMAIL_SIZE)) {
+            memcpy(&scan->rows[scan->count++], row, ROW_SIZE);
+        }
+    }
+}
+
+/**
+ * Pager_HashAccess 下扫描下一个桶：在buckets中找到nextHash所在的桶，取出其中满足条件的记录，
+ * 然后nextHash移动到这个桶之后。桶的散列区间只会被分裂成两半，不会与扫描过的区间重叠，
+ * 所以扫描开始时已经存在的记录只返回一次。页面中的记录按id排序，nextId始终是minId。
+ * @return false if there are no more buckets
+ */
+PRIVATE bool PagerScanNextBucket(PagerScan *scan) {
+    Pager *pager = scan->pager;
+    pthread_rwlock_rdlock(&pager->dirLatch);
+    int32_t size = 1 << pager->globalDepth, slot = 0, pageNum = -1, shift = 32 - pager->globalDepth;
+    while (pageNum == -1 && scan->nextHash <= UINT32_MAX) {
+        slot    = PagerHashSlot(pager, (uint32_t)scan->nextHash);
+        pageNum = pager->buckets[slot];
+        if (pageNum == -1) {
+            scan->nextHash = (uint64_t)(slot + 1) << shift;
+        }
+    }
+    if (pageNum == -1) {
+        pthread_rwlock_unlock(&pager->dirLatch);
+        return false;
+    }
+    if (scan->scanned % PREFETCH_PAGES == 0) {
+        int32_t window[PREFETCH_PAGES], n = 0, i;
+        for (i = slot; i < size && n < PREFETCH_PAGES; i++) {
+            if (pager->buckets[i] != -1 && (n == 0 || window[n - 1] != pager->buckets[i])) {
+                window[n++] = pager->buckets[i];
+            }
+        }
+        PagerPrefetch(pager, window, n);
+    }
+    scan->scanned++;
+    Page *page = (Page *)Pager_PinPage(pager, pageNum);
+    if (page == NULL) {
+        pthread_rwlock_unlock(&pager->dirLatch);
+        return false;
+    }
+    PagerLatchPage(pager, pageNum, false);
+    PagerScanPage(scan, page);
+    PagerUnlatchPage(pager, pageNum, false);
+    Pager_UnpinPage(pager, pageNum, false);
+    int32_t depth  = pager->localDepths[pageNum];
+    scan->nextHash = (uint64_t)(PagerBucketFirst(pager, slot, depth) + (1 << (pager->globalDepth - depth))) << shift;
+    pthread_rwlock_unlock(&pager->dirLatch);
+
+    scan->pos  = 0;
+    scan->done = scan->nextHash > UINT32_MAX;
+    return true;
+}
+
+/**
+ * 扫描下一个页面：在directory中找到负责nextId的页面，取出其中满足条件的记录，
+ * 然后nextId移动到这个页面的maxId之后。
+ * @return false if there are no more pages
+ */
+PRIVATE bool PagerScanNextPage(PagerScan *scan) {
+    Pager *pager = scan->pager;
+    if (pager->config.access == Pager_HashAccess) {
+        return PagerScanNextBucket(scan);
+    }
+    pthread_rwlock_rdlock(&pager->dirLatch);
+    int32_t k = PagerDirectoryUpperBound(pager, scan->nextId);
+    k         = k == 0 ? 0 : k - 1;
+    // nextId之前的页面已经扫描过，跳到maxId >= nextId的页面
+    while (k < pager->dirCount &&
+           __atomic_load_n(&pager->fences[pager->directory[k]].maxId, __ATOMIC_RELAXED) < scan->nextId) {
+        k++;
+    }
+    if (k == pager->dirCount || pager->fences[pager->directory[k]].minId > scan->predicate.maxId) {
+        pthread_rwlock_unlock(&pager->dirLatch);
+        return false;
+    }
+    if (scan->scanned % PREFETCH_PAGES == 0) {
+        int32_t n = pager->dirCount - k < PREFETCH_PAGES ? pager->dirCount - k : PREFETCH_PAGES;
+        PagerPrefetch(pager, pager->directory + k, n);
+    }
+    scan->scanned++;
+    int32_t pageNum = pager->directory[k];
+    Page *page      = (Page *)Pager_PinPage(pager, pageNum);
+    if (page == NULL) {
+        pthread_rwlock_unlock(&pager->dirLatch);
+        return false;
+    }
+    PagerLatchPage(pager, pageNum, false);
+    PagerScanPage(scan, page);
+    KEY maxId = page->rowCount == 0 ? scan->nextId : Page_Id(pager->config.format, page, page->rowCount - 1);
+    PagerUnlatchPage(pager, pageNum, false);
+    Pager_UnpinPage(pager, pageNum, false);
+    pthread_rwlock_unlock(&pager->dirLatch);
+
+    scan->pos = 0;
+    if (maxId >= scan->predicate.maxId || maxId == INT32_MAX) {
+        scan->done = true;
+    } else if (maxId >= scan->nextId) {
+        scan->nextId = maxId + 1;
+    }
+    return true;
+}
+
+/**
+ * @return next row matching the predicate in id order (bucket by bucket in Pager_HashAccess),
+ *         NULL at the end of the scan, the row is valid until the next call
+ */
+TINYDB_API Row *Pager_ScanNext(PagerScan *scan) {
+    while (scan->pos == scan->count) {
+        if (scan->done || !PagerScanNextPage(scan)) {
+            scan->done = true;
+            return NULL;
+        }
+    }
+    return &scan->rows[scan->pos++];
+}
+
+TINYDB_API void Pager_ScanClose(PagerScan *scan) {
+    if (scan == NULL) {
+        return;
+    }
+    Metrics_Record(Metrics_PagerScan, Metrics_Now() - scan->start);
+    free(scan->rows);
+    free(scan);
+}
+
+/* 列的值等于value，或者以长度为length的value开头 */
+inline bool PagerFieldMatch(const char *field, const char *value, size_t length, bool prefix) {
+    return prefix ? strncmp(field, value, length) == 0 : strcmp(field, value) == 0;
+}
+
+/* 把row追加到可以增长的数组rows中 */
+PRIVATE void PagerAppendRow(Row **rows, int32_t *count, int32_t *capacity, Row *row) {
+    if (*count == *capacity) {
+        *capacity = *capacity == 0 ? 16 : *capacity * 2;
+        *rows     = (Row *)realloc(*rows, *capacity * sizeof(Row));
+        assert(*rows != NULL);
+    }
+    memcpy(&(*rows)[(*count)++], row, ROW_SIZE);
+}
+
+/**
+ * 按username或email查找记录。开启索引时在跳表中定位第一个匹配的索引项，顺序取出所有匹配的id，
+ * 再逐个按id读取记录，复杂度为O(log n + 匹配的记录数)；没有开启索引时扫描整个表。
+ * 索引与页面不在同一个latch下读取，按id读到的记录会再比较一次，刚被修改的记录不会被误返回。
+ *
+ * @param prefix: match rows whose field starts with value, otherwise the field must equal value
+ * @param rows: set to a malloc'ed array of the matched rows, ordered by the field and id with indexes,
+ *              in scan order without them, NULL if no row matches, the caller frees it
+ * @param count: number of rows in *rows
+ * @return Pager_RowNotFound if no row matches
+ */
+TINYDB_API PagerExecuteResult Pager_SelectBy(Pager *pager, PagerField field, const char *value, bool prefix,
+                                             Row **rows, int32_t *count) {
+    uint64_t start = Metrics_Now();
+    size_t length  = strlen(value);
+    int32_t capacity = 0, n = 0, i;
+    *rows  = NULL;
+    *count = 0;
+    if (pager->indexFd != -1) {
+        KEY *ids = NULL;
+        pthread_rwlock_rdlock(&pager->indexLatch);
+        SkipNode *node;
+        for (node = SkipList_LowerBound(pager->indexes[field], value, INT32_MIN);
+             node != NULL && PagerFieldMatch(node->value, value, length, prefix); node = node->next[0]) {
+            if (n == capacity) {
+                capacity = capacity == 0 ? 16 : capacity * 2;
+                ids      = (KEY *)realloc(ids, capacity * sizeof(KEY));
+                assert(ids != NULL);
+            }
+            ids[n++] = node->id;
+        }
+        pthread_rwlock_unlock(&pager->indexLatch);
+        Row *row = NULL;
+        capacity = 0;
+        for (i = 0; i < n; i++) {
+            if (Pager_Select(pager, ids[i], &row) == Pager_ExecuteSuccess &&
+                PagerFieldMatch(PagerFieldOf(row, field), value, length, prefix)) {
+                PagerAppendRow(rows, count, &capacity, row);
+            }
+        }
+        free(row);
+        free(ids);
+    } else {
+        PagerPredicate predicate;
+        Init_PagerPredicate(&predicate);
+        if (field == Pager_UsernameField) {
+            predicate.usernamePrefix = value;
+        } else {
+            predicate.emailPrefix = value;
+        }
+        PagerScan *scan = Pager_ScanOpen(pager, &predicate);
+        Row *row;
+        while ((row = Pager_ScanNext(scan)) != NULL) {
+            if (prefix || strcmp(PagerFieldOf(row, field), value) == 0) {
+                PagerAppendRow(rows, count, &capacity, row);
             }
-            free(page);
-            return Pager_ExecuteSuccess;
         }
-        readRet = read(fd, buffer, PAGE_SIZE);
+        Pager_ScanClose(scan);
     }
-    free(page);
-    return Pager_ExecuteFailed;
+    Metrics_Record(Metrics_PagerSelectBy, Metrics_Now() - start);
+    return *count > 0 ? Pager_ExecuteSuccess : Pager_RowNotFound;
 }
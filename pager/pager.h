@@ -1,6 +1,7 @@
 #ifndef PAGE_PAGER_H
 #define PAGE_PAGER_H
 
+#include <pthread.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
@@ -8,7 +9,11 @@
 #include <sys/stat.h>
 #include <time.h>
 
+#include "../includes/aio.h"
 #include "../includes/global.h"
+#include "../includes/lz.h"
+#include "./skiplist.h"
+#include "./wal.h"
 
 /* use g++ compiler */
 #define USE_GPLUSPLUS_COMPILE
@@ -18,10 +23,17 @@
 
 #define USERNAME_LENGTH 31
 #define EMAIL_LENGTH 31
+#define VAR_FIELD_LENGTH 255 /* max bytes of username or email in Pager_VarFormat */
 #define MAX_DB_FILE_LENGTH 255
 
 #define TABLE_MAX_PAGES 100
 #define PAGE_SIZE 4096
+#define DEFAULT_MMAP_RESERVE (1L << 34) /* 16 GB of address space */
+#define DEFAULT_WAL_CHECKPOINT_SIZE (16L << 20)
+#define PAGE_LATCH_STRIPES 128
+#define PAGE_WRITE_UNIT 512 /* granularity of partial page writes, one sector */
+#define PAGE_WRITE_UNITS (PAGE_SIZE / PAGE_WRITE_UNIT)
+#define PAGE_PARTIAL_MAX_UNITS (PAGE_WRITE_UNITS / 2) /* more modified units are written as a whole page */
 
 #define KEY int32_t
 
@@ -69,18 +81,26 @@ const int32_t ID_OFFSET         = OFFSET_OF_ATTRIBUTE(Row, id);
 const int32_t ONLINE_OFFSET     = OFFSET_OF_ATTRIBUTE(Row, isOnline);
 const int32_t USERNAME_OFFSET   = OFFSET_OF_ATTRIBUTE(Row, username);
 const int32_t EMAIL_OFFSET      = OFFSET_OF_ATTRIBUTE(Row, email);
-const int32_t ROW_SIZE          = ID_SIZE + ONLINE_SIZE + USERNAME_SIZE + EMAIL_SIZE + NEXT_SIZE;
-const int32_t MAX_ROWS_PER_PAGE = PAGE_SIZE / ROW_SIZE;
+const int32_t ROW_SIZE          = sizeof(Row);
 
 /**
  * 
- * Page 在磁盘上的结构:
- * +----------+------------------+-----------------+------+------+------+
- * | rowCount | lastModifiedTime | lastModifiedRow | row0 | row1 | rowN | 
- * +----------+------------------+-----------------+------+------+------+
- * rowCount: count of rows in this page
- * lastModifiedTime: last modified time in this page
- * lastRowOffset: byte offset of last row in this page
+ * Page 在磁盘上的结构（slotted page）:
+ * +--------+-------+-------+-------+-----------+---------------+------+------+
+ * | header | slot0 | slot1 | slotN | free space| rowK ... row0 | hole | rowJ |
+ * +--------+-------+-------+-------+-----------+---------------+------+------+
+ *                                              ^ rowsStart
+ * rowCount: count of rows (and slots) in this page
+ * slots: byte offsets of the rows in this page, sorted by id, a lookup binary searches them
+ * rowsStart: rows are allocated downwards from the end of the page, rowsStart is the lowest one
+ * firstFree: byte offset of the first deleted row, holes are linked by Row.next, -1 if none
+ * garbage: bytes of deleted records in a Pager_VarFormat page, reclaimed when the page is compacted
+ * lastModifyTime: last modified time in this page
+ * pageLsn: lsn of the last log record applied to this page, redo skips records before it
+ * 
+ * Page 与磁盘上的结构完全相同，直接作为缓冲池中页面数据的视图使用：
+ * Page *page = (Page *)Pager_PinPage(pager, pageNum);
+ * 读写 page->rowCount、PAGE_ROW(page, page->slots[k]) 不需要序列化或反序列化，也不会分配内存。
  */
 typedef struct Page {
     /* page headers */
@@ -88,60 +108,524 @@ typedef struct Page {
     int32_t lastModifiedRow;
     int32_t lastReadRow;
     int32_t firstFree;
-    int32_t firstUse;
+    int32_t rowsStart;
+    int32_t garbage;
 
     time_t lastModifyTime;
     time_t lastReadTime;
-    /* rows */
-    Row *rows[MAX_ROWS_PER_PAGE];
+    uint64_t pageLsn;
+    /* slots */
+    uint16_t slots[];
 } Page;
 
+#define PAGE_ROW(page, offset) ((Row *)((char *)(page) + (offset)))
+
+/**
+ * PAX 格式的页面：页面头之后，每一列占一个连续的minipage，
+ * 第k条记录（按id升序）的各个字段分别位于每个minipage的第k项。
+ * +--------+---------+-----------------+---------------+------------+
+ * | header | ids[]   | isOnline bitmap | usernames[][] | emails[][] |
+ * +--------+---------+-----------------+---------------+------------+
+ * 只用到一两列的扫描只读取这些列所在的minipage。记录是紧凑的，没有槽位和空洞，
+ * firstFree 和 rowsStart 不使用。
+ */
+#define PAX_IDS(page) ((KEY *)((char *)(page) + PAX_IDS_OFFSET))
+#define PAX_ONLINE(page) ((uint8_t *)(page) + PAX_ONLINE_OFFSET)
+#define PAX_USERNAME(page, k) ((char *)(page) + PAX_USERNAME_OFFSET + (size_t)(k) * USERNAME_SIZE)
+#define PAX_EMAIL(page, k) ((char *)(page) + PAX_EMAIL_OFFSET + (size_t)(k) * EMAIL_SIZE)
+
+/**
+ * Pager_VarFormat 页面中的一条记录。页面结构与有序槽位相同，只是记录的长度不固定：
+ * username和email只占实际的长度，不以'\0'结尾。记录按4字节对齐，与 Row 一样以id开头，
+ * 所以按id查找槽位的代码两种格式共用。删除或变短的记录留下的空间记在garbage中，
+ * 连续的空闲空间不够时整理页面。
+ */
+typedef struct VarRecord {
+    KEY id;
+    uint8_t isOnline;
+    uint8_t usernameLength;
+    uint8_t emailLength;
+    char data[]; /* username followed by email */
+} VarRecord;
+
+#define VAR_RECORD(page, offset) ((VarRecord *)((char *)(page) + (offset)))
+
+/**
+ * Pager_VarFormat 的完整记录，见 Pager_InsertVar、Pager_SelectVar 和 Pager_UpdateVar。
+ * username和email最长 VAR_FIELD_LENGTH 字节，长度由usernameLength和emailLength给出，
+ * 读出时以'\0'结尾。通过 Row 读取时只能得到前31个字节，二级索引也只索引这一部分。
+ */
+typedef struct VarRow {
+    KEY id;
+    bool isOnline;
+    uint8_t usernameLength;
+    uint8_t emailLength;
+    char username[VAR_FIELD_LENGTH + 1];
+    char email[VAR_FIELD_LENGTH + 1];
+} VarRow;
+
 const uint32_t ROWCOUNT_SIZE           = SIZE_OF_ATTRIBUTE(Page, rowCount);
 const uint32_t LASTMODIFIEDROW_SIZE    = SIZE_OF_ATTRIBUTE(Page, lastModifiedRow);
 const uint32_t LASTREADROW_SIZE        = SIZE_OF_ATTRIBUTE(Page, lastReadRow);
 const uint32_t LASTMODIFIEDTIME_SIZE   = SIZE_OF_ATTRIBUTE(Page, lastModifyTime);
 const uint32_t LASTREADTIME_SIZE       = SIZE_OF_ATTRIBUTE(Page, lastReadTime);
 const uint32_t FIRST_FREE_SIZE         = SIZE_OF_ATTRIBUTE(Page, firstFree);
-const uint32_t FIRST_USE_SIZE          = SIZE_OF_ATTRIBUTE(Page, firstUse);
+const uint32_t ROWS_START_SIZE         = SIZE_OF_ATTRIBUTE(Page, rowsStart);
 const uint32_t ROWCOUNT_OFFSET         = OFFSET_OF_ATTRIBUTE(Page, rowCount);
 const uint32_t LASTMODIFIEDROW_OFFSET  = OFFSET_OF_ATTRIBUTE(Page, lastModifiedRow);
 const uint32_t LASTMODIFIEDTIME_OFFSET = OFFSET_OF_ATTRIBUTE(Page, lastModifyTime);
-const uint32_t ROWS_OFFSET             = OFFSET_OF_ATTRIBUTE(Page, rows);
+const uint32_t SLOTS_OFFSET            = OFFSET_OF_ATTRIBUTE(Page, slots);
+const uint32_t SLOT_SIZE               = sizeof(uint16_t);
+
+const uint32_t PAGE_HEADER_SIZE = SLOTS_OFFSET;
+/* every row takes ROW_SIZE bytes and a slot */
+const int32_t MAX_ROWS_PER_PAGE = (PAGE_SIZE - PAGE_HEADER_SIZE) / (ROW_SIZE + SLOT_SIZE);
+/* every row takes its id, one bit of isOnline, username and email */
+const int32_t PAX_MAX_ROWS        = (PAGE_SIZE - PAGE_HEADER_SIZE - 1) * 8 / ((ID_SIZE + USERNAME_SIZE + EMAIL_SIZE) * 8 + 1);
+const uint32_t PAX_IDS_OFFSET      = PAGE_HEADER_SIZE;
+const uint32_t PAX_ONLINE_OFFSET   = PAX_IDS_OFFSET + PAX_MAX_ROWS * ID_SIZE;
+const uint32_t PAX_USERNAME_OFFSET = PAX_ONLINE_OFFSET + (PAX_MAX_ROWS + 7) / 8;
+const uint32_t PAX_EMAIL_OFFSET    = PAX_USERNAME_OFFSET + PAX_MAX_ROWS * USERNAME_SIZE;
+/* rows per page of Pager_VarFormat depend on the data, these are the bounds */
+const int32_t VAR_RECORD_HEADER = OFFSET_OF_ATTRIBUTE(VarRecord, data);
+const int32_t VAR_MIN_RECORD    = (VAR_RECORD_HEADER + 3) & ~3;
+const int32_t VAR_MAX_RECORD    = (VAR_RECORD_HEADER + VAR_FIELD_LENGTH * 2 + 3) & ~3;
+const int32_t VAR_MAX_ROWS      = (PAGE_SIZE - PAGE_HEADER_SIZE) / (VAR_MIN_RECORD + SLOT_SIZE);
+
+#define META_FILE_SUFFIX "-meta"
+#define META_MAGIC 0x4D424454 /* "TDBM" */
+#define META_VERSION 6
+#define FSM_FULL 255 /* fill level of a full page */
+
+/**
+ * 页面目录中的一项，记录一个页面内最小和最大的id。
+ * 每个页面存放一段互不重叠的id区间，空页面的minId > maxId。
+ */
+typedef struct PageFence {
+    KEY minId;
+    KEY maxId;
+} PageFence;
+
+const PageFence EMPTY_FENCE = {INT32_MAX, INT32_MIN};
+
+/**
+ * 元数据文件的文件头，占据元数据文件的第一个页面，之后依次存放每个页面的 PageFence，
+ * 然后是空闲空间表：每个页面一个字节的填充度，0 ~ FSM_FULL。
+ * 压缩的数据文件之后还有每个页面的 PageExtent。
+ * Pager_HashAccess 的数据文件最后是散列目录：globalDepth，每个页面一个字节的局部深度，
+ * 然后是 2^globalDepth 个桶的页号。
+ * pageCount: number of fences stored after the header
+ * clean: 0 while a Pager has the file open, the directory is rebuilt from data pages
+ *        if the previous Pager was not destroyed properly
+ * format: PageFormat of all data pages, fixed when the data file is created
+ * access: PagerAccess of the data file, fixed when the data file is created
+ * extentSeq: last ExtentHeader.seq written to a compressed data file
+ */
+typedef struct MetaHeader {
+    uint32_t magic;
+    uint32_t version;
+    int32_t pageCount;
+    int32_t clean;
+    int32_t format;
+    int32_t access;
+    uint64_t extentSeq;
+} MetaHeader;
+
+#define EXTENT_MAGIC 0x58454454 /* "TDEX" */
+#define EXTENT_SECTOR 512
+#define EXTENT_LZ 1    /* payload is compressed, otherwise it is the page itself */
+#define EXTENT_DELTA 2 /* ids were delta encoded before compression */
+
+/**
+ * 压缩的数据文件：第一个扇区只有 EXTENT_MAGIC，之后是按扇区对齐、长度可变的extent，
+ * 每个extent存放一个压缩后的页面。页面变大、原来的extent放不下时，换到另一个extent，
+ * 原来的extent被回收。每个extent都能独立识别，元数据文件不可用时扫描数据文件重建页面到extent的映射。
+ * sectors: capacity of the extent
+ * size: bytes of the payload after the header
+ * seq: increases on every write, the newest one wins if a page is found in several extents
+ * checksum: FNV-1a of the header (except checksum) and the payload
+ */
+typedef struct ExtentHeader {
+    uint32_t magic;
+    int32_t pageNum;
+    uint64_t seq;
+    uint16_t size;
+    uint16_t flags;
+    uint16_t sectors;
+    uint16_t padding;
+    uint32_t checksum;
+    uint32_t reserved;
+} ExtentHeader;
+
+const int32_t EXTENT_MAX_SECTORS = (sizeof(ExtentHeader) + PAGE_SIZE + EXTENT_SECTOR - 1) / EXTENT_SECTOR;
+const int32_t EXTENT_MAX_SIZE    = EXTENT_MAX_SECTORS * EXTENT_SECTOR;
+
+/**
+ * 页面所在的extent
+ * offset: byte offset in the data file, -1 if the page has never been written
+ */
+typedef struct PageExtent {
+    int64_t offset;
+    int32_t sectors;
+    int32_t padding;
+} PageExtent;
+
+const PageExtent EMPTY_EXTENT = {-1, 0, 0};
+
+/* 建有二级索引的列 */
+typedef enum {
+    Pager_UsernameField = 0,
+    Pager_EmailField    = 1
+} PagerField;
+
+#define PAGER_INDEXED_FIELDS 2
+#define INDEX_FILE_SUFFIX "-index"
+#define INDEX_MAGIC 0x58494454 /* "TDIX" */
+#define INDEX_VERSION 1
+
+/**
+ * 索引文件的文件头，之后依次存放每一列的索引项，每一列按(value, id)升序排列。
+ * clean: 0 while a Pager has the file open, or after a Pager without config.indexes opened
+ *        the data file, the indexes are rebuilt from data pages
+ * counts: number of entries of each field
+ */
+typedef struct IndexHeader {
+    uint32_t magic;
+    uint32_t version;
+    int32_t clean;
+    int32_t padding;
+    int64_t counts[PAGER_INDEXED_FIELDS];
+} IndexHeader;
+
+/* 索引文件中的一项 */
+typedef struct IndexEntry {
+    KEY id;
+    char value[SKIPLIST_VALUE_SIZE];
+} IndexEntry;
 
-const uint32_t PAGE_HEADER_SIZE = ROWCOUNT_SIZE + LASTREADROW_SIZE + LASTMODIFIEDROW_SIZE + LASTREADTIME_SIZE + LASTMODIFIEDTIME_SIZE + FIRST_FREE_SIZE + FIRST_USE_SIZE;
+/* 空闲的extent，按扇区数分组，同一组中的extent大小相同 */
+typedef struct ExtentFreeList {
+    int64_t *offsets;
+    int32_t count;
+    int32_t capacity;
+} ExtentFreeList;
 
+/**
+ * 页面的存储方式，每个Pager在创建时选择其中一种。
+ * Pager_ReadWrite: pages are cached in the buffer pool, read with pread and written back with pwrite
+ * Pager_Mmap: the data file is mapped into memory, pages are accessed directly through the mapping
+ */
+typedef enum {
+    Pager_ReadWrite = 0,
+    Pager_Mmap      = 1
+} PagerStorage;
+
+/**
+ * 页面内记录的存放格式，在创建数据文件时选择，保存在元数据文件中，之后打开时沿用。
+ * Pager_RowFormat: slotted page, every row is stored contiguously
+ * Pager_PaxFormat: rows of a page are stored column by column, see PAX_IDS
+ * Pager_VarFormat: slotted page of variable-length records, see VarRecord
+ */
+typedef enum {
+    Pager_RowFormat = 0,
+    Pager_PaxFormat = 1,
+    Pager_VarFormat = 2
+} PageFormat;
+
+/**
+ * 页面的组织方式，在创建数据文件时选择，保存在元数据文件中，之后打开时沿用。
+ * Pager_RangeAccess: every page holds a range of ids, see PageFence, rows are scanned in id order
+ * Pager_HashAccess: pages are the buckets of an extendible hash on id, the page of an id is found in
+ *                   the hash directory without any search, rows are scanned bucket by bucket
+ */
+typedef enum {
+    Pager_RangeAccess = 0,
+    Pager_HashAccess  = 1
+} PagerAccess;
+
+/**
+ * storage: how pages are accessed
+ * mmapReserve: address space reserved for the mapping in Pager_Mmap mode, the data file
+ *              can grow up to this size without moving the mapping
+ * wal: log every mutation to "<file>-wal" before it returns, only in Pager_ReadWrite mode
+ * groupCommitUs: see Wal.groupCommitUs
+ * walCheckpointSize: a checkpoint is taken when the log grows beyond this size
+ * ioDepth: queue depth of io_uring for Pager_Flush and Pager_Prefetch, 0 for synchronous I/O
+ * format: page format of a new data file, an existing file keeps the format it was created with
+ * compress: compress the pages of a new data file, only in Pager_ReadWrite mode,
+ *           an existing file stays compressed or uncompressed as it was created
+ * compactIntervalUs: a background thread calls Pager_Compact every compactIntervalUs microseconds,
+ *                    0 for no background compaction
+ * indexes: maintain secondary indexes on username and email in "<file>-index", see Pager_SelectBy
+ * access: access method of a new data file, an existing file keeps the one it was created with
+ */
+typedef struct PagerConfig {
+    PagerStorage storage;
+    size_t mmapReserve;
+    bool wal;
+    int32_t groupCommitUs;
+    size_t walCheckpointSize;
+    uint32_t ioDepth;
+    PageFormat format;
+    bool compress;
+    int32_t compactIntervalUs;
+    bool indexes;
+    PagerAccess access;
+} PagerConfig;
+
+/**
+ * 缓冲池中的一个页框，缓存数据文件中的一个页面。
+ * pageNum: page cached in this frame, -1 if the frame is empty
+ * pinCount: number of callers using this frame, a pinned frame is never evicted. Changed atomically,
+ *           pinning a cached page does not take poolLatch. Negative while the frame is being evicted
+ * dirty: page has been modified and must be written back before eviction
+ * referenced: reference bit of the CLOCK policy, set on every pin
+ * io: the page is being read into or written from the frame without poolLatch, wait for ioDone
+ * disk: copy of the page as it is in the data file, NULL if pages are always written whole
+ * diskValid: disk holds the page, false for a new page that has never been written
+ */
+typedef struct Frame {
+    int32_t pageNum;
+    int32_t pinCount;
+    bool dirty;
+    bool referenced;
+    bool io;
+    bool diskValid;
+    char *data;
+    char *disk;
+} Frame;
+
+/**
+ * 页面latch。页面按页号分成 PAGE_LATCH_STRIPES 组，同一组的页面共享一个latch，
+ * 所以latch的数量与页面数无关。
+ * lock: shared for readers of a page, exclusive for its writer
+ * version: seqlock, odd while a writer holds lock, Pager_Select reads a row without
+ *          taking lock and falls back to it if version changed during the read
+ */
+typedef struct PageLatch {
+    pthread_rwlock_t lock;
+    uint64_t version;
+} __attribute__((aligned(64))) PageLatch;
+
+/**
+ * Pager 拥有一个大小为 TABLE_MAX_PAGES 的缓冲池，所有页面的读写都经过缓冲池。
+ * 使用 CLOCK 算法淘汰页面，脏页在被淘汰或 Destroy_Pager 时写回文件。
+ * pool: memory of all frames, TABLE_MAX_PAGES * PAGE_SIZE bytes
+ * clockHand: next frame to be examined by CLOCK
+ * pageTable: page number -> frame index, -1 if the page is not cached
+ * pageTableSize: number of entries in pageTable
+ * diskPool: memory of Frame.disk of all frames, NULL without partial writes
+ * 
+ * 开启日志时脏页只写回被修改的扇区：checkpoint之后第一次修改页面时日志中记录了整个页面的镜像，
+ * 部分写入中途崩溃留下的半新半旧的页面在重做时被镜像覆盖，所以不需要整页写入来保证原子性。
+ * 
+ * 页面目录常驻内存，保存在元数据文件中：
+ * metaFd: file descriptor of the meta file, "<file>-meta"
+ * fences: page number -> PageFence
+ * directory: non-empty pages sorted by minId, a point lookup binary searches it
+ * dirCount: number of pages in directory
+ * fenceSize: capacity of fences and directory
+ * fsm: free-space map, page number -> fill level, FSM_FULL if the page has no room for a row
+ * emptyHint: pages before it are not empty
+ * metaDirty: fences, fsm, extents or buckets have been modified since the meta file was written
+ * 
+ * Pager_HashAccess 时每个非空页面是可扩展散列的一个桶，directory为空，散列目录常驻内存，
+ * 同样保存在元数据文件中：
+ * buckets: 2^globalDepth entries, the page of an id is buckets[top globalDepth bits of its hash],
+ *          -1 if no page holds the ids of that entry
+ * globalDepth: number of hash bits that select an entry of buckets
+ * localDepths: page number -> local depth of its bucket, all ids in the page share the top localDepth
+ *              bits of their hashes, -1 if the page is empty and not a bucket, capacity is fenceSize
+ * 
+ * config.compress 时页面压缩后存放在extent中，页面读写只在缓冲池中进行，分配和回收extent时持有poolLatch：
+ * extents: page number -> PageExtent, capacity is fenceSize
+ * freeExtents: free extents of i sectors in freeExtents[i]
+ * extentEnd: end of the last extent, new extents are allocated here if no free one fits
+ * extentSeq: ExtentHeader.seq of the last extent written
+ * extentBuffer: EXTENT_MAX_SIZE bytes for each of TABLE_MAX_PAGES pages, used by
+ *               Pager_Flush and Pager_Prefetch (holding prefetchLatch)
+ * 
+ * Pager_Mmap 模式下不使用缓冲池：
+ * map: start of the mapping, mmapReserve bytes of address space
+ * mapSize: bytes of the data file mapped at map
+ * dirtyPages: bitmap of pages modified since the last Pager_Flush
+ * dirtyWords: number of uint64_t words in dirtyPages
+ * 
+ * wal: write-ahead log, NULL if config.wal is false
+ * aio: io_uring used to read and write many pages at once, NULL if config.ioDepth is 0
+ * 
+ * 多个线程可以同时使用一个Pager，所有读写都使用pread/pwrite，不依赖文件偏移量：
+ * dirLatch: shared by operations that modify at most one page without moving it in directory,
+ *           exclusive for splits, shifts, batches and checkpoints, which may touch any page
+ * poolLatch: protects frames, pageTable and clockHand, held only inside the buffer pool functions.
+ *            Released while a frame is read or written, the frame is marked io meanwhile
+ * ioDone: signaled with poolLatch when the io of a frame finishes
+ * prefetchLatch: serializes Pager_Prefetch, which shares aio and extentBuffer, taken before poolLatch
+ * latches: page latches, taken while holding dirLatch shared, at most one at a time
+ * 
+ * 页面整理，见 Pager_Compact：
+ * compactCursor: position in directory where the next Pager_Compact starts looking for pages to merge
+ * compactor: background thread started if config.compactIntervalUs > 0
+ * compactStop: set by Destroy_Pager to stop compactor, protected by compactMutex
+ * 
+ * 二级索引常驻内存，保存在索引文件中，config.indexes 为false时都是NULL：
+ * indexFd: file descriptor of the index file, "<file>-index", -1 without indexes
+ * indexes: (field value, id) of every row for each PagerField
+ * indexLatch: shared by Pager_SelectBy, exclusive while an index is modified,
+ *             taken after the page latch or dirLatch of the modified row
+ */
 typedef struct Pager {
     int fd; /* file descriptor */
     off_t fileLength;
     int32_t pageCount;
+    PagerConfig config;
+    Frame frames[TABLE_MAX_PAGES];
+    char *pool;
+    char *diskPool;
+    int32_t clockHand;
+    int32_t *pageTable;
+    int32_t pageTableSize;
+    int metaFd;
+    PageFence *fences;
+    int32_t *directory;
+    int32_t dirCount;
+    int32_t fenceSize;
+    uint8_t *fsm;
+    int32_t emptyHint;
+    bool metaDirty;
+    int32_t *buckets;
+    int32_t globalDepth;
+    int8_t *localDepths;
+    char *map;
+    size_t mapSize;
+    uint64_t *dirtyPages;
+    int32_t dirtyWords;
+    PageExtent *extents;
+    ExtentFreeList freeExtents[EXTENT_MAX_SECTORS + 1];
+    int64_t extentEnd;
+    uint64_t extentSeq;
+    char *extentBuffer;
+    Wal *wal;
+    Aio *aio;
+    pthread_rwlock_t dirLatch;
+    pthread_mutex_t poolLatch;
+    pthread_cond_t ioDone;
+    pthread_mutex_t prefetchLatch;
+    PageLatch latches[PAGE_LATCH_STRIPES];
+    int32_t compactCursor;
+    pthread_t compactor;
+    bool compactStop;
+    pthread_mutex_t compactMutex;
+    pthread_cond_t compactCond;
+    int indexFd;
+    SkipList *indexes[PAGER_INDEXED_FIELDS];
+    pthread_rwlock_t indexLatch;
     char file[];
 } Pager;
 
+/**
+ * 扫描的过滤条件，直接在页面数据上求值，只有满足条件的记录才会被复制出来。
+ * minId, maxId: range of id, both inclusive
+ * online: -1 for any, otherwise isOnline must equal it
+ * usernamePrefix, emailPrefix: NULL for any
+ */
+typedef struct PagerPredicate {
+    KEY minId;
+    KEY maxId;
+    int32_t online;
+    const char *usernamePrefix;
+    const char *emailPrefix;
+} PagerPredicate;
+
+/**
+ * 按id顺序逐页扫描的游标。每次取出一个页面中所有满足条件的记录放在rows中，
+ * 两次取页面之间不持有任何latch，页面被分裂或合并也不影响扫描：
+ * 下一个页面总是通过nextId重新在directory中查找。
+ * Pager_HashAccess 下按散列值的顺序逐个扫描桶，下一个桶通过nextHash重新在buckets中查找。
+ * nextId: rows with smaller ids have been returned
+ * nextHash: buckets of smaller hashes have been scanned in Pager_HashAccess, 1 << 32 after the last one
+ * rows: matched rows of the current page, count of them, pos is the next one to return
+ * scanned: number of pages scanned, the following PREFETCH_PAGES pages are read ahead
+ *          every PREFETCH_PAGES pages
+ * start: Metrics_Now() when the scan is opened, the whole scan is recorded as one Metrics_PagerScan
+ */
+typedef struct PagerScan {
+    Pager *pager;
+    PagerPredicate predicate;
+    size_t usernameLength;
+    size_t emailLength;
+    KEY nextId;
+    uint64_t nextHash;
+    bool done;
+    Row *rows;
+    int32_t count;
+    int32_t pos;
+    int32_t scanned;
+    uint64_t start;
+} PagerScan;
+
 typedef struct Table {
     int32_t rowCount;
     Pager *pager;
 } Table;
 
-TINYDB_API Pager *New_Pager(const char *file);
+TINYDB_API void Init_PagerConfig(PagerConfig *config);
+TINYDB_API Pager *New_Pager(const char *file, PagerConfig *config);
 TINYDB_API void Destroy_Pager(Pager *pager);
 
 TINYDB_API PagerExecuteResult Pager_Insert(Pager *pager, Row *row);
+TINYDB_API PagerExecuteResult Pager_InsertBatch(Pager *pager, Row *rows, size_t n);
 TINYDB_API PagerExecuteResult Pager_Select(Pager *pager, KEY id, Row **ret);
+TINYDB_API PagerExecuteResult Pager_InsertVar(Pager *pager, VarRow *row);
+TINYDB_API PagerExecuteResult Pager_SelectVar(Pager *pager, KEY id, VarRow *ret);
+TINYDB_API PagerExecuteResult Pager_UpdateVar(Pager *pager, KEY id, VarRow *row, VarRow *ret);
 TINYDB_API PagerExecuteResult Pager_Update(Pager *pager, KEY id, Row *row, Row **ret);
 TINYDB_API PagerExecuteResult Pager_Delete(Pager *pager, KEY id, Row **ret);
+TINYDB_API int64_t Pager_CountOnline(Pager *pager, bool online, int64_t *idSum);
+TINYDB_API PagerExecuteResult Pager_SelectBy(Pager *pager, PagerField field, const char *value, bool prefix,
+                                             Row **rows, int32_t *count);
+
+/* table scan */
+TINYDB_API void Init_PagerPredicate(PagerPredicate *predicate);
+TINYDB_API PagerScan *Pager_ScanOpen(Pager *pager, const PagerPredicate *predicate);
+TINYDB_API Row *Pager_ScanNext(PagerScan *scan);
+TINYDB_API void Pager_ScanClose(PagerScan *scan);
+
+/* buffer pool */
+TINYDB_API void *Pager_PinPage(Pager *pager, int32_t pageNum);
+TINYDB_API void *Pager_NewPage(Pager *pager, int32_t *pageNum);
+TINYDB_API void Pager_UnpinPage(Pager *pager, int32_t pageNum, bool dirty);
+TINYDB_API void Pager_Flush(Pager *pager);
+TINYDB_API void Pager_Prefetch(Pager *pager, const int32_t *pageNums, int32_t n);
+TINYDB_API void Pager_Checkpoint(Pager *pager);
+TINYDB_API int32_t Pager_Compact(Pager *pager, int32_t maxPages);
 
 /* private functions */
 #ifdef DEBUG_TEST
 Row *New_Row();
-Page *New_Page();
+void Page_Init(Page *page);
+int32_t Slot_Select(Page *page, KEY id);
+bool Slot_Insert(Page *page, Row *row);
+bool Slot_Delete(Page *page, KEY id, Row **ret);
+bool Pax_Insert(Page *page, Row *row);
+void Pax_Remove(Page *page, int32_t k, Row *ret);
+bool Var_Insert(Page *page, Row *row);
+bool Var_Set(Page *page, int32_t k, Row *row);
+void Var_Remove(Page *page, int32_t k, Row *ret);
+void Var_Get(Page *page, int32_t k, Row *row);
+bool Var_InsertVar(Page *page, const VarRow *row);
+bool Var_SetVar(Page *page, int32_t k, const VarRow *row);
+void Var_Read(Page *page, int32_t k, VarRow *row);
 void CreateFileIfNotExists(const char *file);
 int OpenFile(const char *file);
 void CloseFile(int fd);
 // inline Row *PagerSearchCache(Pager *pager, KEY id);
 inline int32_t PagerSearchPage(Pager *pager, KEY id);
-inline int32_t PageSearchRow(Page *page, KEY id);
-inline void SerializePage(Page *page, void *buffer);
-inline void DeserializePage(Page *page, void *buffer);
+void PagerReadPage(Pager *pager, int32_t pageNum, void *buffer);
+void PagerWritePage(Pager *pager, int32_t pageNum, void *buffer);
+void PagerWritePages(Pager *pager, int32_t pageNum, void *buffer, int32_t count);
+void PagerSimulateCrash(Pager *pager);
+uint32_t PagerHash(KEY id);
 #endif
 
 #endif
\ No newline at end of file
@@ -0,0 +1,140 @@
+#include "skiplist.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* (value, id)的顺序，value按字节比较 */
+PRIVATE int SkipListCompare(SkipNode *node, const char *value, int32_t id) {
+    int c = strncmp(node->value, value, SKIPLIST_VALUE_SIZE);
+    if (c != 0) {
+        return c;
+    }
+    return node->id < id ? -1 : (node->id > id ? 1 : 0);
+}
+
+PRIVATE SkipNode *SkipListNewNode(int32_t level) {
+    SkipNode *node = (SkipNode *)calloc(1, sizeof(SkipNode) + level * sizeof(SkipNode *));
+    assert(node != NULL);
+    node->level = level;
+    return node;
+}
+
+/* 新节点的层数，第i层的节点以 1 / SKIPLIST_BRANCH 的概率出现在第i + 1层 */
+PRIVATE int32_t SkipListRandomLevel(SkipList *list) {
+    int32_t level = 1;
+    while (level < SKIPLIST_MAX_LEVEL) {
+        list->seed ^= list->seed << 13;
+        list->seed ^= list->seed >> 7;
+        list->seed ^= list->seed << 17;
+        if (list->seed % SKIPLIST_BRANCH != 0) {
+            break;
+        }
+        level++;
+    }
+    return level;
+}
+
+/**
+ * 从最高层向下查找，update[i]是第i层最后一个小于(value, id)的节点。
+ * @return first node not less than (value, id), NULL if there is none
+ */
+PRIVATE SkipNode *SkipListSearch(SkipList *list, const char *value, int32_t id, SkipNode **update) {
+    SkipNode *node = list->head;
+    int32_t i;
+    for (i = list->level - 1; i >= 0; i--) {
+        while (node->next[i] != NULL && SkipListCompare(node->next[i], value, id) < 0) {
+            node = node->next[i];
+        }
+        if (update != NULL) {
+            update[i] = node;
+        }
+    }
+    return node->next[0];
+}
+
+/**
+ * @param seed: seed of node levels, must not be 0
+ */
+TINYDB_API SkipList *New_SkipList(uint64_t seed) {
+    SkipList *list = (SkipList *)calloc(1, sizeof(SkipList));
+    assert(list != NULL && seed != 0);
+    list->head  = SkipListNewNode(SKIPLIST_MAX_LEVEL);
+    list->level = 1;
+    list->seed  = seed;
+    return list;
+}
+
+TINYDB_API void Destroy_SkipList(SkipList *list) {
+    if (list == NULL) {
+        return;
+    }
+    SkipNode *node = list->head, *next;
+    while (node != NULL) {
+        next = node->next[0];
+        free(node);
+        node = next;
+    }
+    free(list);
+}
+
+/**
+ * @param value: at most SKIPLIST_VALUE_SIZE - 1 bytes are kept
+ * @return false if (value, id) is already in the list
+ */
+TINYDB_API bool SkipList_Insert(SkipList *list, const char *value, int32_t id) {
+    SkipNode *update[SKIPLIST_MAX_LEVEL];
+    SkipNode *found = SkipListSearch(list, value, id, update);
+    if (found != NULL && SkipListCompare(found, value, id) == 0) {
+        return false;
+    }
+    int32_t level = SkipListRandomLevel(list), i;
+    for (i = list->level; i < level; i++) {
+        update[i] = list->head;
+    }
+    if (level > list->level) {
+        list->level = level;
+    }
+    SkipNode *node = SkipListNewNode(level);
+    node->id       = id;
+    strncpy(node->value, value, SKIPLIST_VALUE_SIZE - 1);
+    for (i = 0; i < level; i++) {
+        node->next[i]      = update[i]->next[i];
+        update[i]->next[i] = node;
+    }
+    list->count++;
+    return true;
+}
+
+/* @return false if (value, id) is not in the list */
+TINYDB_API bool SkipList_Delete(SkipList *list, const char *value, int32_t id) {
+    SkipNode *update[SKIPLIST_MAX_LEVEL];
+    SkipNode *node = SkipListSearch(list, value, id, update);
+    if (node == NULL || SkipListCompare(node, value, id) != 0) {
+        return false;
+    }
+    int32_t i;
+    for (i = 0; i < node->level; i++) {
+        update[i]->next[i] = node->next[i];
+    }
+    while (list->level > 1 && list->head->next[list->level - 1] == NULL) {
+        list->level--;
+    }
+    free(node);
+    list->count--;
+    return true;
+}
+
+/**
+ * 第一个不小于(value, id)的节点，之后的节点沿next[0]按顺序遍历。
+ * 查找value的所有id时id取INT32_MIN，前缀查找时value就是前缀。
+ * @return NULL if all nodes are smaller
+ */
+TINYDB_API SkipNode *SkipList_LowerBound(SkipList *list, const char *value, int32_t id) {
+    return SkipListSearch(list, value, id, NULL);
+}
+
+/* 最小的节点，跳表为空时返回NULL */
+TINYDB_API SkipNode *SkipList_First(SkipList *list) {
+    return list->head->next[0];
+}
@@ -0,0 +1,48 @@
+#ifndef PAGE_SKIPLIST_H
+#define PAGE_SKIPLIST_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "../includes/global.h"
+
+#define SKIPLIST_MAX_LEVEL 16
+#define SKIPLIST_BRANCH 4      /* a node on level i is also on level i + 1 with probability 1 / SKIPLIST_BRANCH */
+#define SKIPLIST_VALUE_SIZE 32 /* values are strings of at most SKIPLIST_VALUE_SIZE - 1 bytes */
+
+/**
+ * 跳表中的一项。节点按(value, id)升序排列，同一个value可以对应多个id。
+ * level: node is on levels [0, level), next[i] is the next node on level i
+ */
+typedef struct SkipNode {
+    int32_t id;
+    int32_t level;
+    char value[SKIPLIST_VALUE_SIZE];
+    struct SkipNode *next[];
+} SkipNode;
+
+/**
+ * 内存中的有序表，用作二级索引：查找、插入和删除都是期望O(log n)，
+ * 找到第一个不小于给定值的节点之后沿next[0]顺序遍历，前缀查找只需要一次定位。
+ * 跳表本身不加锁，由调用者保证同一时刻只有一个写者，并且写者和读者不同时访问。
+ * head: sentinel on all levels, smaller than every node
+ * level: number of levels in use
+ * count: number of nodes
+ * seed: state of the xorshift generator of node levels
+ */
+typedef struct SkipList {
+    SkipNode *head;
+    int32_t level;
+    int64_t count;
+    uint64_t seed;
+} SkipList;
+
+TINYDB_API SkipList *New_SkipList(uint64_t seed);
+TINYDB_API void Destroy_SkipList(SkipList *list);
+
+TINYDB_API bool SkipList_Insert(SkipList *list, const char *value, int32_t id);
+TINYDB_API bool SkipList_Delete(SkipList *list, const char *value, int32_t id);
+TINYDB_API SkipNode *SkipList_LowerBound(SkipList *list, const char *value, int32_t id);
+TINYDB_API SkipNode *SkipList_First(SkipList *list);
+
+#endif
@@ -1,9 +1,15 @@
+#include <assert.h>
+#include <pthread.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
+#include "../includes/log.h"
+#include "../includes/metrics.h"
 #include "./pager.h"
 
 const char *file = "dbfile";
@@ -14,6 +20,27 @@ void test_Open_And_Write();
 void test_Open_And_Write2();
 void test_Open_And_Read();
 void test_Open_And_Update();
+void test_BufferPool();
+void test_PageDirectory();
+void test_MmapStorage();
+void test_InsertBatch();
+void test_SlottedPage();
+void test_FreeSpaceMap();
+void test_WalRecovery();
+void test_GroupCommit();
+void test_AsyncIO();
+void test_ConcurrentAccess();
+void test_PaxFormat();
+void test_Scan();
+void test_VarFormat();
+void test_VarLongFields();
+void test_Compression();
+void test_Log();
+void test_Metrics();
+void test_PartialWrite();
+void test_Compaction();
+void test_SecondaryIndex();
+void test_HashAccess();
 /**
  * 
  * 
@@ -21,6 +48,27 @@ void test_Open_And_Update();
 
 int main(int argc, char const *argv[]) {
     // CreateFileIfNotExists(file);
+    test_SlottedPage();
+    test_BufferPool();
+    test_PageDirectory();
+    test_MmapStorage();
+    test_InsertBatch();
+    test_FreeSpaceMap();
+    test_WalRecovery();
+    test_GroupCommit();
+    test_AsyncIO();
+    test_ConcurrentAccess();
+    test_PaxFormat();
+    test_Scan();
+    test_VarFormat();
+    test_VarLongFields();
+    test_Compression();
+    test_Log();
+    test_Metrics();
+    test_PartialWrite();
+    test_Compaction();
+    test_SecondaryIndex();
+    test_HashAccess();
     // test_Open_And_Write();
     test_Open_And_Read();
     // test_Open_And_Update();
@@ -43,7 +91,7 @@ int main(int argc, char const *argv[]) {
 void test_Open_And_Write() {
     const char *username = "xiejiachuang";
     const char *email    = "222211@gmail.com";
-    Pager *pager         = New_Pager(file);
+    Pager *pager         = New_Pager(file, NULL);
     int i;
     for (i = 0; i < 10; i++) {
         Row *row      = New_Row();
@@ -58,7 +106,7 @@ void test_Open_And_Write() {
 }
 
 void test_Open_And_Read() {
-    Pager *pager = New_Pager(file);
+    Pager *pager = New_Pager(file, NULL);
     int i;
     for (i = 0; i < 10; i++) {
         Row *row = New_Row();
@@ -79,7 +127,7 @@ void test_Open_And_Read() {
 }
 
 void test_Open_And_Update() {
-    Pager *pager = New_Pager(file);
+    Pager *pager = New_Pager(file, NULL);
     Row *row     = New_Row();
     Row *nRow    = New_Row();
     Pager_Select(pager, 27, &row);
@@ -91,3 +139,2258 @@ void test_Open_And_Update() {
     printf("row->email = %s\n", row->email);
     Destroy_Pager(pager);
 }
+
+/**
+ * 缓冲池：pin住的页框不会被淘汰，脏页在Destroy_Pager时写回文件。
+ */
+void test_BufferPool() {
+    const char *poolFile = "dbfile_pool";
+    char metaFile[64];
+    sprintf(metaFile, "%s%s", poolFile, META_FILE_SUFFIX);
+    unlink(poolFile);
+    unlink(metaFile);
+    Pager *pager = New_Pager(poolFile, NULL);
+    int32_t first = pager->pageCount, pageNum, i;
+    for (i = 0; i < TABLE_MAX_PAGES; i++) {
+        char *data = (char *)Pager_NewPage(pager, &pageNum);
+        assert(data != NULL && pageNum == first + i);
+        data[PAGE_SIZE - 1] = (char)i;
+    }
+    assert(Pager_NewPage(pager, &pageNum) == NULL);  // all frames are pinned
+    for (i = 0; i < TABLE_MAX_PAGES; i++) {
+        Pager_UnpinPage(pager, first + i, true);
+    }
+    // 读取第0页时淘汰一个脏页
+    assert(Pager_PinPage(pager, 0) != NULL);
+    Pager_UnpinPage(pager, 0, false);
+    Destroy_Pager(pager);
+
+    pager = New_Pager(poolFile, NULL);
+    assert(pager->pageCount == first + TABLE_MAX_PAGES);
+    for (i = 0; i < TABLE_MAX_PAGES; i++) {
+        char *data = (char *)Pager_PinPage(pager, first + i);
+        assert(data[PAGE_SIZE - 1] == (char)i);
+        Pager_UnpinPage(pager, first + i, false);
+    }
+    Destroy_Pager(pager);
+    unlink(poolFile);
+    unlink(metaFile);
+    printf("test_BufferPool passed.\n");
+}
+
+/**
+ * 页面目录：乱序插入足够多的记录使页面分裂，每个页面保存一段互不重叠的id。
+ * 正常关闭后直接加载目录，元数据文件丢失时扫描数据文件重建目录。
+ */
+void test_PageDirectory() {
+    const char *dirFile = "dbfile_dir";
+    char metaFile[64];
+    sprintf(metaFile, "%s%s", dirFile, META_FILE_SUFFIX);
+    unlink(dirFile);
+    unlink(metaFile);
+
+    const int n  = 1000;
+    Pager *pager = New_Pager(dirFile, NULL);
+    Row *row     = New_Row();
+    int i;
+    for (i = 0; i < n; i++) {
+        row->id       = (i * 7919) % n;
+        row->isOnline = row->id % 2;
+        sprintf(row->username, "user%d", row->id);
+        sprintf(row->email, "user%d@gmail.com", row->id);
+        assert(Pager_Insert(pager, row) == Pager_ExecuteSuccess);
+    }
+    assert(Pager_Insert(pager, row) == Pager_RowAleardyExists);
+    assert(pager->dirCount > 1);
+    for (i = 1; i < pager->dirCount; i++) {
+        assert(pager->fences[pager->directory[i - 1]].maxId < pager->fences[pager->directory[i]].minId);
+    }
+    for (i = 0; i < n; i += 3) {
+        Row *ret = NULL;
+        assert(Pager_Delete(pager, i, &ret) == Pager_ExecuteSuccess && ret->id == i);
+        free(ret);
+    }
+    Destroy_Pager(pager);
+
+    int round;
+    for (round = 0; round < 2; round++) {
+        pager = New_Pager(dirFile, NULL);
+        for (i = 0; i < n; i++) {
+            Row *ret                  = NULL;
+            PagerExecuteResult result = Pager_Select(pager, i, &ret);
+            if (i % 3 == 0) {
+                assert(result == Pager_RowNotFound && ret == NULL);
+                continue;
+            }
+            sprintf(row->email, "user%d@gmail.com", i);
+            assert(result == Pager_ExecuteSuccess && ret->id == i && strcmp(ret->email, row->email) == 0);
+            free(ret);
+        }
+        Destroy_Pager(pager);
+        unlink(metaFile);
+    }
+    unlink(dirFile);
+    free(row);
+    printf("test_PageDirectory passed.\n");
+}
+
+/**
+ * 内存映射模式：映射随插入增长，关闭时去掉预先扩展的部分。
+ * 数据文件格式与缓冲池模式相同，可以用缓冲池模式重新打开。
+ */
+void test_MmapStorage() {
+    const char *mmapFile = "dbfile_mmap";
+    char metaFile[64];
+    sprintf(metaFile, "%s%s", mmapFile, META_FILE_SUFFIX);
+    unlink(mmapFile);
+    unlink(metaFile);
+
+    PagerConfig config;
+    Init_PagerConfig(&config);
+    config.storage = Pager_Mmap;
+
+    const int n  = 5000;
+    Pager *pager = New_Pager(mmapFile, &config);
+    Row *row     = New_Row();
+    int i;
+    for (i = 0; i < n; i++) {
+        row->id = (i * 7919) % n;
+        sprintf(row->username, "user%d", row->id);
+        assert(Pager_Insert(pager, row) == Pager_ExecuteSuccess);
+    }
+    int32_t pageCount = pager->pageCount;
+    assert(pageCount > TABLE_MAX_PAGES && pager->mapSize >= (size_t)pageCount * PAGE_SIZE);
+    Destroy_Pager(pager);
+
+    struct stat st;
+    assert(stat(mmapFile, &st) == 0 && st.st_size == (off_t)pageCount * PAGE_SIZE);
+
+    pager = New_Pager(mmapFile, NULL);
+    for (i = 0; i < n; i++) {
+        Row *ret = NULL;
+        sprintf(row->username, "user%d", i);
+        assert(Pager_Select(pager, i, &ret) == Pager_ExecuteSuccess && strcmp(ret->username, row->username) == 0);
+        free(ret);
+    }
+    Destroy_Pager(pager);
+    unlink(mmapFile);
+    unlink(metaFile);
+    free(row);
+    printf("test_MmapStorage passed.\n");
+}
+
+void test_InsertBatch() {
+    const char *batchFile = "dbfile_batch";
+    char metaFile[64];
+    sprintf(metaFile, "%s%s", batchFile, META_FILE_SUFFIX);
+    unlink(batchFile);
+    unlink(metaFile);
+
+    const int n  = 10000;
+    Pager *pager = New_Pager(batchFile, NULL);
+    Row *row     = New_Row();
+    int i;
+    // 先逐条插入一些稀疏的记录，再批量插入剩下的记录
+    for (i = 0; i < n; i += 10) {
+        row->id = i;
+        sprintf(row->username, "user%d", i);
+        assert(Pager_Insert(pager, row) == Pager_ExecuteSuccess);
+    }
+    // id已经存在的记录保留原有的，批量中重复的id只插入第一条
+    Row *rows = (Row *)calloc(n + 2, sizeof(Row));
+    for (i = 0; i < n; i++) {
+        rows[i].id = (i * 7919) % n;
+        sprintf(rows[i].username, rows[i].id % 10 == 0 ? "batch%d" : "user%d", rows[i].id);
+    }
+    rows[n].id = 1;
+    strcpy(rows[n].username, "duplicate");
+    rows[n + 1].id = 3;
+    strcpy(rows[n + 1].username, "duplicate");
+    assert(Pager_InsertBatch(pager, rows, n + 2) == Pager_RowAleardyExists);
+    for (i = 1; i < n + 2; i++) {
+        assert(rows[i - 1].id <= rows[i].id);
+    }
+    assert(Pager_Insert(pager, &rows[0]) == Pager_RowAleardyExists);
+    // 比所有已有记录都大的记录追加在末尾
+    for (i = 0; i < n; i++) {
+        rows[i].id = n + i;
+        sprintf(rows[i].username, "user%d", rows[i].id);
+    }
+    assert(Pager_InsertBatch(pager, rows, n) == Pager_ExecuteSuccess);
+    Destroy_Pager(pager);
+
+    pager = New_Pager(batchFile, NULL);
+    for (i = 0; i < 2 * n; i++) {
+        Row *ret = NULL;
+        sprintf(row->username, "user%d", i);
+        assert(Pager_Select(pager, i, &ret) == Pager_ExecuteSuccess && strcmp(ret->username, row->username) == 0);
+        free(ret);
+    }
+    Destroy_Pager(pager);
+    unlink(batchFile);
+    unlink(metaFile);
+    free(rows);
+    free(row);
+    printf("test_InsertBatch passed.\n");
+}
+
+void test_SlottedPage() {
+    char buffer[PAGE_SIZE];
+    memset(buffer, 0, PAGE_SIZE);
+    Page *page = (Page *)buffer;
+    Row *row   = New_Row();
+    int32_t i;
+    // 逆序插入，槽位仍然按id升序排列
+    for (i = MAX_ROWS_PER_PAGE - 1; i >= 0; i--) {
+        row->id = i * 2;
+        sprintf(row->username, "user%d", row->id);
+        assert(Slot_Insert(page, row));
+    }
+    assert(page->rowCount == MAX_ROWS_PER_PAGE && !Slot_Insert(page, row));
+    assert(page->rowsStart >= (int32_t)(PAGE_HEADER_SIZE + MAX_ROWS_PER_PAGE * SLOT_SIZE));
+    for (i = 0; i < MAX_ROWS_PER_PAGE; i++) {
+        Row *r = PAGE_ROW(page, page->slots[i]);
+        assert(r->id == i * 2 && Slot_Select(page, i * 2) == i && Slot_Select(page, i * 2 + 1) == -1);
+    }
+    // 删除的记录留下空洞，之后的插入复用空洞而不是移动记录
+    Row *ret      = NULL;
+    int32_t start = page->rowsStart;
+    assert(Slot_Delete(page, 10, &ret) && ret->id == 10 && !Slot_Delete(page, 10, &ret));
+    int32_t hole = (int32_t)((char *)ret - buffer);
+    assert(page->firstFree == hole && Slot_Select(page, 10) == -1);
+    row->id = 11;
+    assert(Slot_Insert(page, row) && page->slots[5] == hole && page->rowsStart == start);
+    for (i = 1; i < page->rowCount; i++) {
+        assert(PAGE_ROW(page, page->slots[i - 1])->id < PAGE_ROW(page, page->slots[i])->id);
+    }
+    free(row);
+    printf("test_SlottedPage passed.\n");
+}
+
+void test_FreeSpaceMap() {
+    const char *fsmFile = "dbfile_fsm";
+    char metaFile[64];
+    sprintf(metaFile, "%s%s", fsmFile, META_FILE_SUFFIX);
+    unlink(fsmFile);
+    unlink(metaFile);
+
+    const int n  = 2000;
+    Pager *pager = New_Pager(fsmFile, NULL);
+    Row *row     = New_Row();
+    Row *ret     = NULL;
+    int32_t i, empty = 0;
+    for (i = 0; i < n; i++) {
+        row->id = i * 2;
+        assert(Pager_Insert(pager, row) == Pager_ExecuteSuccess);
+    }
+    for (i = 0; i < n / 4; i++) {
+        assert(Pager_Delete(pager, i * 2, &ret) == Pager_ExecuteSuccess);
+    }
+    for (i = 0; i < pager->pageCount; i++) {
+        if (pager->fences[i].minId > pager->fences[i].maxId) {
+            assert(pager->fsm[i] == 0);
+            empty++;
+        }
+    }
+    assert(empty > 0);
+    // 分裂复用被清空的页面，文件不再增长
+    int32_t pageCount = pager->pageCount;
+    for (i = 0; i < empty * MAX_ROWS_PER_PAGE / 2; i++) {
+        row->id = n * 2 + i;
+        assert(Pager_Insert(pager, row) == Pager_ExecuteSuccess);
+    }
+    assert(pager->pageCount == pageCount);
+    uint8_t *fsm = (uint8_t *)malloc(pageCount);
+    memcpy(fsm, pager->fsm, pageCount);
+    Destroy_Pager(pager);
+
+    pager = New_Pager(fsmFile, NULL);
+    assert(memcmp(fsm, pager->fsm, pageCount) == 0);
+    for (i = n / 4; i < n; i++) {
+        assert(Pager_Select(pager, i * 2, &ret) == Pager_ExecuteSuccess && ret->id == i * 2);
+    }
+    assert(Pager_Select(pager, 0, &ret) == Pager_RowNotFound);
+    Destroy_Pager(pager);
+    unlink(fsmFile);
+    unlink(metaFile);
+    free(fsm);
+    free(ret);
+    free(row);
+    printf("test_FreeSpaceMap passed.\n");
+}
+
+void test_WalRecovery() {
+    const char *walDataFile = "dbfile_wal";
+    char metaFile[64], walFile[64];
+    sprintf(metaFile, "%s%s", walDataFile, META_FILE_SUFFIX);
+    sprintf(walFile, "%s%s", walDataFile, WAL_FILE_SUFFIX);
+    unlink(walDataFile);
+    unlink(metaFile);
+    unlink(walFile);
+
+    PagerConfig config;
+    Init_PagerConfig(&config);
+    config.wal               = true;
+    config.walCheckpointSize = 1L << 30;
+
+    const int n  = 4000;
+    Pager *pager = New_Pager(walDataFile, &config);
+    Row *row     = New_Row();
+    Row *ret     = NULL;
+    int32_t i;
+    for (i = 0; i < n; i++) {
+        row->id = (i * 7919) % n;
+        sprintf(row->username, "user%d", row->id);
+        assert(Pager_Insert(pager, row) == Pager_ExecuteSuccess);
+    }
+    Row *rows = (Row *)calloc(n, sizeof(Row));
+    for (i = 0; i < n; i++) {
+        rows[i].id = n + i;
+        sprintf(rows[i].username, "user%d", rows[i].id);
+    }
+    assert(Pager_InsertBatch(pager, rows, n) == Pager_ExecuteSuccess);
+    for (i = 0; i < n; i += 3) {
+        row->id = i;
+        sprintf(row->username, "updated%d", i);
+        assert(Pager_Update(pager, i, row, &ret) == Pager_ExecuteSuccess);
+    }
+    for (i = 1; i < n; i += 3) {
+        assert(Pager_Delete(pager, i, &ret) == Pager_ExecuteSuccess);
+    }
+    assert(pager->pageCount > TABLE_MAX_PAGES);
+    int32_t pageCount = pager->pageCount;
+    PagerSimulateCrash(pager);
+
+    // 模拟写了一半的页面，它的镜像在日志中
+    char garbage[PAGE_SIZE / 2];
+    memset(garbage, 0xFF, sizeof(garbage));
+    int fd = open(walDataFile, O_RDWR);
+    assert(pwrite(fd, garbage, sizeof(garbage), PAGE_SIZE + PAGE_SIZE / 4) == sizeof(garbage));
+    close(fd);
+
+    pager = New_Pager(walDataFile, &config);
+    assert(pager->pageCount == pageCount);
+    for (i = 0; i < 2 * n; i++) {
+        char expect[32];
+        sprintf(expect, i < n && i % 3 == 0 ? "updated%d" : "user%d", i);
+        PagerExecuteResult result = Pager_Select(pager, i, &ret);
+        if (i < n && i % 3 == 1) {
+            assert(result == Pager_RowNotFound);
+        } else {
+            assert(result == Pager_ExecuteSuccess && strcmp(ret->username, expect) == 0);
+        }
+    }
+    Destroy_Pager(pager);
+
+    struct stat st;
+    assert(stat(walFile, &st) == 0 && st.st_size == sizeof(WalHeader));
+    unlink(walDataFile);
+    unlink(metaFile);
+    unlink(walFile);
+    free(rows);
+    free(ret);
+    free(row);
+    printf("test_WalRecovery passed.\n");
+}
+
+#define COMMIT_THREADS 4
+#define COMMITS_PER_THREAD 50
+
+void *commitWorker(void *arg) {
+    Wal *wal       = (Wal *)arg;
+    WalBatch batch = {NULL, 0, 0};
+    Row row;
+    memset(&row, 0, sizeof(Row));
+    int i;
+    for (i = 0; i < COMMITS_PER_THREAD; i++) {
+        row.id = i;
+        Wal_BatchAppend(&batch, Wal_InsertRecord, 0, &row, sizeof(Row));
+        Wal_Commit(wal, &batch, 1);
+    }
+    Wal_BatchFree(&batch);
+    return NULL;
+}
+
+typedef struct GroupInsert {
+    Pager *pager;
+    KEY id;
+} GroupInsert;
+
+int32_t groupInserted = 0;
+
+void *groupInsertWorker(void *arg) {
+    GroupInsert *insert = (GroupInsert *)arg;
+    Row row;
+    memset(&row, 0, sizeof(Row));
+    row.id = insert->id;
+    sprintf(row.username, "u%d", row.id);
+    assert(Pager_Insert(insert->pager, &row) == Pager_ExecuteSuccess);
+    __atomic_add_fetch(&groupInserted, 1, __ATOMIC_RELEASE);
+    return NULL;
+}
+
+void countRedo(void *arg, uint64_t lsn, WalRecord *record, const void *payload) {
+    (*(int *)arg)++;
+}
+
+void test_GroupCommit() {
+    const char *walFile = "dbfile_group-wal";
+    unlink(walFile);
+
+    Wal *wal = New_Wal(walFile, 2000);
+    int32_t pageCount;
+    assert(Wal_Replay(wal, countRedo, NULL, &pageCount) == 0 && pageCount == -1);
+    pthread_t threads[COMMIT_THREADS];
+    int i;
+    for (i = 0; i < COMMIT_THREADS; i++) {
+        pthread_create(&threads[i], NULL, commitWorker, wal);
+    }
+    for (i = 0; i < COMMIT_THREADS; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    // 多个事务共用一次fdatasync
+    assert(wal->syncCount < COMMIT_THREADS * COMMITS_PER_THREAD);
+    Destroy_Wal(wal);
+
+    int redone = 0;
+    wal        = New_Wal(walFile, 0);
+    assert(Wal_Replay(wal, countRedo, &redone, &pageCount) == COMMIT_THREADS * COMMITS_PER_THREAD);
+    assert(redone == COMMIT_THREADS * COMMITS_PER_THREAD && pageCount == 1);
+    Destroy_Wal(wal);
+    unlink(walFile);
+
+    // 插入释放latch之后才等待日志：同一个页面上的插入共用一次fdatasync，等待期间读取这个页面不被阻塞
+    const char *dataFile = "dbfile_group";
+    char metaFile[64], pagerWalFile[64];
+    sprintf(metaFile, "%s%s", dataFile, META_FILE_SUFFIX);
+    sprintf(pagerWalFile, "%s%s", dataFile, WAL_FILE_SUFFIX);
+    unlink(dataFile);
+    unlink(metaFile);
+    unlink(pagerWalFile);
+    PagerConfig config;
+    Init_PagerConfig(&config);
+    config.wal           = true;
+    config.groupCommitUs = 200000;
+    Pager *pager         = New_Pager(dataFile, &config);
+    Row row;
+    memset(&row, 0, sizeof(Row));
+    strcpy(row.username, "first");
+    assert(Pager_Insert(pager, &row) == Pager_ExecuteSuccess);
+    uint64_t syncs = pager->wal->syncCount;
+    GroupInsert inserts[COMMIT_THREADS];
+    for (i = 0; i < COMMIT_THREADS; i++) {
+        inserts[i].pager = pager;
+        inserts[i].id    = i + 1;
+        pthread_create(&threads[i], NULL, groupInsertWorker, &inserts[i]);
+    }
+    usleep(50000);
+    Row *ret = NULL;
+    assert(Pager_Select(pager, 0, &ret) == Pager_ExecuteSuccess && strcmp(ret->username, "first") == 0);
+    assert(__atomic_load_n(&groupInserted, __ATOMIC_ACQUIRE) == 0);
+    for (i = 0; i < COMMIT_THREADS; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    assert(pager->wal->syncCount - syncs < COMMIT_THREADS);
+    for (i = 1; i <= COMMIT_THREADS; i++) {
+        assert(Pager_Select(pager, i, &ret) == Pager_ExecuteSuccess);
+    }
+
+    // 批量插入到很多个原有页面时，每个页面追加一次日志，最后只等待一次fdatasync
+    const int n = 400;
+    Row *rows   = (Row *)calloc(n, sizeof(Row));
+    for (i = 0; i < n; i++) {
+        rows[i].id = 100 + 2 * i;
+    }
+    assert(Pager_InsertBatch(pager, rows, n) == Pager_ExecuteSuccess);
+    int32_t dirCount = pager->dirCount;
+    assert(dirCount > 4 && dirCount < TABLE_MAX_PAGES / 2);
+    for (i = 0; i < n; i++) {
+        rows[i].id = 101 + 2 * i;
+    }
+    syncs = pager->wal->syncCount;
+    assert(Pager_InsertBatch(pager, rows, n) == Pager_ExecuteSuccess);
+    assert(pager->wal->syncCount - syncs == 1);
+    for (i = 100; i < 100 + 2 * n; i++) {
+        assert(Pager_Select(pager, i, &ret) == Pager_ExecuteSuccess);
+    }
+    Destroy_Pager(pager);
+    unlink(dataFile);
+    unlink(metaFile);
+    unlink(pagerWalFile);
+    free(rows);
+    free(ret);
+    printf("test_GroupCommit passed.\n");
+}
+
+void test_AsyncIO() {
+    const char *aioFile = "dbfile_aio";
+    char metaFile[64];
+    sprintf(metaFile, "%s%s", aioFile, META_FILE_SUFFIX);
+    unlink(aioFile);
+    unlink(metaFile);
+
+    // 一批写请求之后再读回来
+    const int32_t blocks = 64;
+    Aio *aio             = New_Aio(16);
+    int fd               = open(aioFile, O_RDWR | O_CREAT, 0644);
+    char *buffer         = (char *)malloc((size_t)blocks * PAGE_SIZE);
+    AioRequest requests[64];
+    int32_t i;
+    for (i = 0; i < blocks; i++) {
+        memset(buffer + (size_t)i * PAGE_SIZE, i + 1, PAGE_SIZE);
+        AioRequest request = {fd, true, buffer + (size_t)i * PAGE_SIZE, PAGE_SIZE, (off_t)i * PAGE_SIZE, 0};
+        requests[i]        = request;
+    }
+    assert(Aio_Execute(aio, requests, blocks) == 0);
+    memset(buffer, 0, (size_t)blocks * PAGE_SIZE);
+    for (i = 0; i < blocks; i++) {
+        requests[i].write = false;
+    }
+    assert(Aio_Execute(aio, requests, blocks) == 0);
+    for (i = 0; i < blocks; i++) {
+        assert(requests[i].result == PAGE_SIZE && buffer[(size_t)i * PAGE_SIZE + 100] == i + 1);
+    }
+    // 读到文件末尾之后不算失败
+    requests[0].offset = (off_t)blocks * PAGE_SIZE;
+    assert(Aio_Execute(aio, requests, 1) == 0 && requests[0].result == 0);
+    close(fd);
+    Destroy_Aio(aio);
+    free(buffer);
+    unlink(aioFile);
+
+    PagerConfig config;
+    Init_PagerConfig(&config);
+    config.ioDepth = 32;
+
+    const int n  = 5000;
+    Pager *pager = New_Pager(aioFile, &config);
+    Row *row     = New_Row();
+    Row *ret     = NULL;
+    for (i = 0; i < n; i++) {
+        row->id = (i * 7919) % n;
+        sprintf(row->username, "user%d", row->id);
+        assert(Pager_Insert(pager, row) == Pager_ExecuteSuccess);
+    }
+    Pager_Flush(pager);
+    for (i = 0; i < TABLE_MAX_PAGES; i++) {
+        assert(!pager->frames[i].dirty);
+    }
+    int32_t pageCount = pager->pageCount;
+    Destroy_Pager(pager);
+
+    pager = New_Pager(aioFile, &config);
+    int32_t pages[TABLE_MAX_PAGES / 2];
+    for (i = 0; i < TABLE_MAX_PAGES / 2; i++) {
+        pages[i] = pageCount - 1 - i;
+    }
+    Pager_Prefetch(pager, pages, TABLE_MAX_PAGES / 2);
+    for (i = 0; i < TABLE_MAX_PAGES / 2; i++) {
+        assert(pager->pageTable[pages[i]] != -1);
+    }
+    for (i = 0; i < n; i++) {
+        sprintf(row->username, "user%d", i);
+        assert(Pager_Select(pager, i, &ret) == Pager_ExecuteSuccess && strcmp(ret->username, row->username) == 0);
+    }
+    Destroy_Pager(pager);
+    unlink(aioFile);
+    unlink(metaFile);
+    free(ret);
+    free(row);
+    printf("test_AsyncIO passed.\n");
+}
+
+#define WORKER_THREADS 4
+#define ROWS_PER_WORKER 400
+
+typedef struct Worker {
+    Pager *pager;
+    int32_t t;
+} Worker;
+
+/* 第t个线程负责 id % WORKER_THREADS == t 的记录，和其他线程交错地落在同一批页面上 */
+void *accessWorker(void *arg) {
+    Worker *w = (Worker *)arg;
+    Row *row  = New_Row();
+    Row *ret  = NULL;
+    int32_t i;
+    for (i = 0; i < ROWS_PER_WORKER; i++) {
+        row->id = i * WORKER_THREADS + w->t;
+        sprintf(row->username, "user%d", row->id);
+        assert(Pager_Insert(w->pager, row) == Pager_ExecuteSuccess);
+        // 读回之前插入的记录
+        KEY id = (i / 2) * WORKER_THREADS + w->t;
+        assert(Pager_Select(w->pager, id, &ret) == Pager_ExecuteSuccess && ret->id == id);
+        if (i % 5 == 0) {
+            strcpy(row->email, "updated");
+            assert(Pager_Update(w->pager, row->id, row, &ret) == Pager_ExecuteSuccess);
+            row->email[0] = '\0';
+        }
+    }
+    for (i = 0; i < ROWS_PER_WORKER; i += 3) {
+        assert(Pager_Delete(w->pager, i * WORKER_THREADS + w->t, &ret) == Pager_ExecuteSuccess);
+    }
+    free(ret);
+    free(row);
+    return NULL;
+}
+
+void runConcurrentAccess(const char *dbFile, PagerConfig *config) {
+    char metaFile[64], walFile[64];
+    sprintf(metaFile, "%s%s", dbFile, META_FILE_SUFFIX);
+    sprintf(walFile, "%s%s", dbFile, WAL_FILE_SUFFIX);
+    unlink(dbFile);
+    unlink(metaFile);
+    unlink(walFile);
+
+    Pager *pager = New_Pager(dbFile, config);
+    pthread_t threads[WORKER_THREADS];
+    Worker workers[WORKER_THREADS];
+    int32_t i;
+    for (i = 0; i < WORKER_THREADS; i++) {
+        workers[i].pager = pager;
+        workers[i].t     = i;
+        pthread_create(&threads[i], NULL, accessWorker, &workers[i]);
+    }
+    for (i = 0; i < WORKER_THREADS; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    Destroy_Pager(pager);
+
+    pager    = New_Pager(dbFile, config);
+    Row *ret = NULL;
+    for (i = 0; i < WORKER_THREADS * ROWS_PER_WORKER; i++) {
+        int32_t k = i / WORKER_THREADS;
+        if (k % 3 == 0) {
+            assert(Pager_Select(pager, i, &ret) == Pager_RowNotFound);
+            continue;
+        }
+        char username[32];
+        sprintf(username, "user%d", i);
+        assert(Pager_Select(pager, i, &ret) == Pager_ExecuteSuccess && strcmp(ret->username, username) == 0);
+        assert(strcmp(ret->email, k % 5 == 0 ? "updated" : "") == 0);
+    }
+    Destroy_Pager(pager);
+    unlink(dbFile);
+    unlink(metaFile);
+    unlink(walFile);
+    free(ret);
+}
+
+#define POOL_TEST_PAGES (TABLE_MAX_PAGES * 3)
+#define POOL_TEST_ROUNDS 20000
+
+/**
+ * 页面比缓冲池多，各线程同时pin住随机的页面，缓存的页面不经过poolLatch，
+ * 其他页面淘汰脏页并读入。第t个线程只修改其中第 k % WORKER_THREADS == t 个页面的计数，
+ * 第0个线程同时预读。
+ */
+void *poolWorker(void *arg) {
+    Worker *w     = (Worker *)arg;
+    uint32_t seed = (uint32_t)w->t * 2654435761u + 1;
+    int32_t first = w->pager->pageCount - POOL_TEST_PAGES, i, k;
+    for (i = 0; i < POOL_TEST_ROUNDS; i++) {
+        seed            = seed * 1103515245u + 12345u;
+        int32_t pageNum = first + (int32_t)((seed >> 8) % POOL_TEST_PAGES);
+        if (w->t == 0 && i % 500 == 0) {
+            int32_t pages[8];
+            for (k = 0; k < 8; k++) {
+                pages[k] = first + (pageNum - first + k * 37) % POOL_TEST_PAGES;
+            }
+            Pager_Prefetch(w->pager, pages, 8);
+        }
+        int32_t *data = (int32_t *)Pager_PinPage(w->pager, pageNum);
+        assert(data != NULL && data[0] == pageNum);
+        bool mine = (pageNum - first) % WORKER_THREADS == w->t;
+        if (mine) {
+            data[1 + w->t]++;
+        }
+        Pager_UnpinPage(w->pager, pageNum, mine);
+    }
+    return NULL;
+}
+
+/* 数出每个页面被各自的线程修改了多少次，和重新打开后读到的计数比较 */
+void runConcurrentPool(const char *dbFile) {
+    char metaFile[64];
+    sprintf(metaFile, "%s%s", dbFile, META_FILE_SUFFIX);
+    unlink(dbFile);
+    unlink(metaFile);
+    Pager *pager  = New_Pager(dbFile, NULL);
+    int32_t first = pager->pageCount, i, t, pageNum;
+    for (i = 0; i < POOL_TEST_PAGES; i++) {
+        int32_t *data = (int32_t *)Pager_NewPage(pager, &pageNum);
+        assert(data != NULL && pageNum == first + i);
+        data[0] = pageNum;
+        Pager_UnpinPage(pager, pageNum, true);
+    }
+    pthread_t threads[WORKER_THREADS];
+    Worker workers[WORKER_THREADS];
+    for (t = 0; t < WORKER_THREADS; t++) {
+        workers[t].pager = pager;
+        workers[t].t     = t;
+        pthread_create(&threads[t], NULL, poolWorker, &workers[t]);
+    }
+    for (t = 0; t < WORKER_THREADS; t++) {
+        pthread_join(threads[t], NULL);
+    }
+    Pager_Flush(pager);
+    Destroy_Pager(pager);
+
+    int32_t counts[POOL_TEST_PAGES] = {0};
+    for (t = 0; t < WORKER_THREADS; t++) {
+        uint32_t seed = (uint32_t)t * 2654435761u + 1;
+        for (i = 0; i < POOL_TEST_ROUNDS; i++) {
+            seed    = seed * 1103515245u + 12345u;
+            pageNum = (int32_t)((seed >> 8) % POOL_TEST_PAGES);
+            if (pageNum % WORKER_THREADS == t) {
+                counts[pageNum]++;
+            }
+        }
+    }
+    pager = New_Pager(dbFile, NULL);
+    for (i = 0; i < POOL_TEST_PAGES; i++) {
+        int32_t *data = (int32_t *)Pager_PinPage(pager, first + i);
+        assert(data[0] == first + i && data[1 + i % WORKER_THREADS] == counts[i]);
+        Pager_UnpinPage(pager, first + i, false);
+    }
+    Destroy_Pager(pager);
+    unlink(dbFile);
+    unlink(metaFile);
+}
+
+void test_ConcurrentAccess() {
+    runConcurrentPool("dbfile_concurrent");
+
+    PagerConfig config;
+    Init_PagerConfig(&config);
+    runConcurrentAccess("dbfile_concurrent", &config);
+
+    config.wal           = true;
+    config.groupCommitUs = 100;
+    runConcurrentAccess("dbfile_concurrent", &config);
+
+    Init_PagerConfig(&config);
+    config.storage     = Pager_Mmap;
+    config.mmapReserve = 1L << 30;
+    runConcurrentAccess("dbfile_concurrent", &config);
+    printf("test_ConcurrentAccess passed.\n");
+}
+
+void test_PaxFormat() {
+    // 页面内的列操作
+    Page *page = (Page *)calloc(1, PAGE_SIZE);
+    Row row, got;
+    memset(&row, 0, sizeof(Row));
+    int32_t i;
+    assert(PAX_EMAIL_OFFSET + PAX_MAX_ROWS * EMAIL_SIZE <= PAGE_SIZE && PAX_MAX_ROWS > MAX_ROWS_PER_PAGE);
+    for (i = 0; i < PAX_MAX_ROWS; i++) {
+        row.id       = (i * 37) % PAX_MAX_ROWS;
+        row.isOnline = row.id % 3 == 0;
+        sprintf(row.username, "user%d", row.id);
+        assert(Pax_Insert(page, &row));
+    }
+    assert(!Pax_Insert(page, &row) && page->rowCount == PAX_MAX_ROWS);
+    for (i = 0; i < PAX_MAX_ROWS; i++) {
+        assert(PAX_IDS(page)[i] == i && (PAX_ONLINE(page)[i >> 3] >> (i & 7) & 1) == (i % 3 == 0));
+    }
+    Pax_Remove(page, 10, &got);
+    assert(got.id == 10 && strcmp(got.username, "user10") == 0 && page->rowCount == PAX_MAX_ROWS - 1);
+    assert(PAX_IDS(page)[10] == 11 && strcmp(PAX_USERNAME(page, 10), "user11") == 0);
+    assert((PAX_ONLINE(page)[1] >> 2 & 1) == 0 && (PAX_ONLINE(page)[1] >> 1 & 1) == 1);
+    free(page);
+
+    const char *paxFile = "dbfile_pax";
+    char metaFile[64], walFile[64];
+    sprintf(metaFile, "%s%s", paxFile, META_FILE_SUFFIX);
+    sprintf(walFile, "%s%s", paxFile, WAL_FILE_SUFFIX);
+    unlink(paxFile);
+    unlink(metaFile);
+    unlink(walFile);
+
+    PagerConfig config;
+    Init_PagerConfig(&config);
+    config.format            = Pager_PaxFormat;
+    config.wal               = true;
+    config.walCheckpointSize = 1L << 30;
+
+    const int n  = 3000;
+    Pager *pager = New_Pager(paxFile, &config);
+    Row *r       = New_Row();
+    Row *ret     = NULL;
+    for (i = 0; i < n; i++) {
+        r->id       = (i * 7919) % n;
+        r->isOnline = r->id % 4 == 0;
+        sprintf(r->username, "user%d", r->id);
+        assert(Pager_Insert(pager, r) == Pager_ExecuteSuccess);
+    }
+    Row *rows = (Row *)calloc(n, sizeof(Row));
+    for (i = 0; i < n; i++) {
+        rows[i].id = n + i;
+        sprintf(rows[i].username, "user%d", rows[i].id);
+    }
+    assert(Pager_InsertBatch(pager, rows, n) == Pager_ExecuteSuccess);
+    for (i = 0; i < n; i += 5) {
+        r->id       = i;
+        r->isOnline = true;
+        sprintf(r->email, "e%d", i);
+        sprintf(r->username, "user%d", i);
+        assert(Pager_Update(pager, i, r, &ret) == Pager_ExecuteSuccess);
+    }
+    for (i = 1; i < n; i += 5) {
+        assert(Pager_Delete(pager, i, &ret) == Pager_ExecuteSuccess && ret->id == i);
+    }
+    // 每个页面比行格式多存放记录
+    assert(pager->pageCount < 2 * n / MAX_ROWS_PER_PAGE);
+
+    int64_t expected = 0, expectedSum = 0, sum = 0;
+    for (i = 0; i < n; i++) {
+        if (i % 5 != 1 && (i % 5 == 0 || i % 4 == 0)) {
+            expected++;
+            expectedSum += i;
+        }
+    }
+    assert(Pager_CountOnline(pager, true, &sum) == expected && sum == expectedSum);
+    assert(Pager_CountOnline(pager, false, NULL) == 2 * n - n / 5 - expected);
+    PagerSimulateCrash(pager);
+
+    // 重做日志之后，以默认的行格式打开也会沿用创建时的PAX格式
+    Init_PagerConfig(&config);
+    config.wal = true;
+    pager      = New_Pager(paxFile, &config);
+    assert(pager->config.format == Pager_PaxFormat);
+    for (i = 0; i < 2 * n; i++) {
+        if (i < n && i % 5 == 1) {
+            assert(Pager_Select(pager, i, &ret) == Pager_RowNotFound);
+            continue;
+        }
+        char username[32];
+        sprintf(username, "user%d", i);
+        assert(Pager_Select(pager, i, &ret) == Pager_ExecuteSuccess && ret->id == i);
+        assert(strcmp(ret->username, username) == 0 && ret->isOnline == (i < n && (i % 5 == 0 || i % 4 == 0)));
+    }
+    assert(Pager_CountOnline(pager, true, &sum) == expected && sum == expectedSum);
+    Destroy_Pager(pager);
+    unlink(paxFile);
+    unlink(metaFile);
+    unlink(walFile);
+    free(rows);
+    free(ret);
+    free(r);
+    printf("test_PaxFormat passed.\n");
+}
+
+/* 按插入时生成记录的规则，计算满足predicate的记录数 */
+int32_t countMatches(int32_t n, const PagerPredicate *p) {
+    int32_t i, count = 0;
+    for (i = 0; i < n; i++) {
+        char username[32], email[32];
+        sprintf(username, "%s%d", i % 3 == 0 ? "alice" : "bob", i);
+        sprintf(email, "%d@%s", i, i % 2 == 0 ? "a.com" : "b.org");
+        if (i < p->minId || i > p->maxId || (p->online != -1 && (i % 4 == 0) != p->online) ||
+            (p->usernamePrefix != NULL && strncmp(username, p->usernamePrefix, strlen(p->usernamePrefix)) != 0) ||
+            (p->emailPrefix != NULL && strncmp(email, p->emailPrefix, strlen(p->emailPrefix)) != 0)) {
+            continue;
+        }
+        count++;
+    }
+    return count;
+}
+
+void scanAndCheck(Pager *pager, int32_t n, const PagerPredicate *p) {
+    PagerScan *scan = Pager_ScanOpen(pager, p);
+    int32_t count = 0;
+    KEY last      = INT32_MIN;
+    Row *row;
+    while ((row = Pager_ScanNext(scan)) != NULL) {
+        assert(count == 0 || row->id > last);
+        assert(row->id >= p->minId && row->id <= p->maxId);
+        assert(p->online == -1 || row->isOnline == (p->online != 0));
+        last = row->id;
+        count++;
+    }
+    assert(Pager_ScanNext(scan) == NULL);
+    Pager_ScanClose(scan);
+    assert(count == countMatches(n, p));
+}
+
+void test_Scan() {
+    const char *scanFile = "dbfile_scan";
+    char metaFile[64];
+    sprintf(metaFile, "%s%s", scanFile, META_FILE_SUFFIX);
+    PageFormat formats[3] = {Pager_RowFormat, Pager_PaxFormat, Pager_VarFormat};
+    int32_t f, i;
+    const int n = 3000;
+    for (f = 0; f < 3; f++) {
+        unlink(scanFile);
+        unlink(metaFile);
+        PagerConfig config;
+        Init_PagerConfig(&config);
+        config.format = formats[f];
+        Pager *pager  = New_Pager(scanFile, &config);
+        Row *row      = New_Row();
+        for (i = 0; i < n; i++) {
+            row->id       = (i * 7919) % n;
+            row->isOnline = row->id % 4 == 0;
+            sprintf(row->username, "%s%d", row->id % 3 == 0 ? "alice" : "bob", row->id);
+            sprintf(row->email, "%d@%s", row->id, row->id % 2 == 0 ? "a.com" : "b.org");
+            assert(Pager_Insert(pager, row) == Pager_ExecuteSuccess);
+        }
+
+        PagerPredicate p;
+        Init_PagerPredicate(&p);
+        scanAndCheck(pager, n, &p);
+        p.minId = 100;
+        p.maxId = 1999;
+        scanAndCheck(pager, n, &p);
+        p.online         = 1;
+        p.usernamePrefix = "alice";
+        scanAndCheck(pager, n, &p);
+        p.online         = 0;
+        p.usernamePrefix = "bob1";
+        p.emailPrefix    = "1";
+        scanAndCheck(pager, n, &p);
+        // 没有满足条件的记录
+        Init_PagerPredicate(&p);
+        p.minId = n;
+        scanAndCheck(pager, n, &p);
+        p.usernamePrefix = "carol";
+        p.minId          = INT32_MIN;
+        scanAndCheck(pager, n, &p);
+
+        // 扫描的同时插入记录，分裂页面之后扫描仍然按id顺序继续
+        PagerScan *scan = Pager_ScanOpen(pager, NULL);
+        int32_t count   = 0;
+        KEY last        = INT32_MIN;
+        Row *r;
+        while ((r = Pager_ScanNext(scan)) != NULL) {
+            assert(r->id > last);
+            last = r->id;
+            if (count++ == n / 2) {
+                for (i = 0; i < 500; i++) {
+                    row->id = n + i;
+                    assert(Pager_Insert(pager, row) == Pager_ExecuteSuccess);
+                }
+            }
+        }
+        Pager_ScanClose(scan);
+        assert(count == n + 500);
+        Destroy_Pager(pager);
+        free(row);
+    }
+    unlink(scanFile);
+    unlink(metaFile);
+    printf("test_Scan passed.\n");
+}
+
+void test_VarFormat() {
+    // 页面内的变长记录
+    Page *page = (Page *)calloc(1, PAGE_SIZE);
+    Row row, got;
+    memset(&row, 0, sizeof(Row));
+    int32_t i;
+    assert(PAGE_HEADER_SIZE == 48 && VAR_MIN_RECORD == VAR_RECORD_HEADER + 1);
+    for (i = 0;; i++) {
+        row.id = (i * 37) % 1000;
+        sprintf(row.username, "u%d", row.id);
+        if (!Var_Insert(page, &row)) {
+            break;
+        }
+    }
+    // 短的记录比定长的行格式多存放很多条
+    assert(page->rowCount == i && i > 2 * MAX_ROWS_PER_PAGE);
+    for (i = 1; i < page->rowCount; i++) {
+        assert(VAR_RECORD(page, page->slots[i - 1])->id < VAR_RECORD(page, page->slots[i])->id);
+    }
+    Var_Get(page, 3, &got);
+    KEY id = got.id;
+    assert(got.email[0] == '\0' && got.username[0] == 'u');
+
+    // 变长的更新需要空闲空间，删除留下的碎片在分配时整理
+    int32_t n = page->rowCount;
+    strcpy(got.email, "0123456789012345678901234567890");
+    assert(!Var_Set(page, 3, &got));
+    for (i = 0; i < 4; i++) {
+        Var_Remove(page, page->rowCount - 1, NULL);
+    }
+    assert(page->garbage > 0);
+    assert(Var_Set(page, 3, &got) && page->garbage == 0 && page->rowCount == n - 4);
+    memset(&row, 0, sizeof(Row));
+    Var_Get(page, 3, &row);
+    assert(row.id == id && strcmp(row.email, got.email) == 0 && strcmp(row.username, got.username) == 0);
+    // 变短的更新原地完成
+    strcpy(got.email, "e");
+    assert(Var_Set(page, 3, &got) && page->garbage > 0);
+    Var_Get(page, 3, &row);
+    assert(row.id == id && strcmp(row.email, "e") == 0);
+    free(page);
+
+    const char *varFile = "dbfile_var";
+    char metaFile[64], walFile[64];
+    sprintf(metaFile, "%s%s", varFile, META_FILE_SUFFIX);
+    sprintf(walFile, "%s%s", varFile, WAL_FILE_SUFFIX);
+    unlink(varFile);
+    unlink(metaFile);
+    unlink(walFile);
+
+    PagerConfig config;
+    Init_PagerConfig(&config);
+    config.format            = Pager_VarFormat;
+    config.wal               = true;
+    config.walCheckpointSize = 1L << 30;
+
+    n            = 3000;
+    Pager *pager = New_Pager(varFile, &config);
+    Row *r       = New_Row();
+    Row *ret     = NULL;
+    for (i = 0; i < n; i++) {
+        r->id       = (i * 7919) % n;
+        r->isOnline = r->id % 4 == 0;
+        sprintf(r->username, "u%d", r->id);
+        assert(Pager_Insert(pager, r) == Pager_ExecuteSuccess);
+    }
+    Row *rows = (Row *)calloc(n, sizeof(Row));
+    for (i = 0; i < n; i++) {
+        rows[i].id = n + i;
+        sprintf(rows[i].username, "u%d", rows[i].id);
+    }
+    assert(Pager_InsertBatch(pager, rows, n) == Pager_ExecuteSuccess);
+    assert(pager->pageCount < 2 * n / MAX_ROWS_PER_PAGE / 2);
+    // 把记录改长，页面放不下时记录被挪到分裂出的新页面
+    int32_t pageCount = pager->pageCount;
+    for (i = 0; i < n; i += 3) {
+        r->id       = i;
+        r->isOnline = true;
+        sprintf(r->username, "user-with-a-long-name-%d", i);
+        sprintf(r->email, "someone-%d@example.com", i);
+        assert(Pager_Update(pager, i, r, &ret) == Pager_ExecuteSuccess && ret->id == i);
+    }
+    assert(pager->pageCount > pageCount);
+    for (i = 1; i < n; i += 3) {
+        assert(Pager_Delete(pager, i, &ret) == Pager_ExecuteSuccess && ret->id == i);
+    }
+
+    int64_t expected = 0, expectedSum = 0, sum = 0;
+    for (i = 0; i < n; i++) {
+        if (i % 3 == 0 || (i % 3 == 2 && i % 4 == 0)) {
+            expected++;
+            expectedSum += i;
+        }
+    }
+    assert(Pager_CountOnline(pager, true, &sum) == expected && sum == expectedSum);
+    PagerPredicate p;
+    Init_PagerPredicate(&p);
+    p.usernamePrefix = "user-with";
+    p.emailPrefix    = "someone-1";
+    PagerScan *scan  = Pager_ScanOpen(pager, &p);
+    int32_t count    = 0;
+    Row *s;
+    while ((s = Pager_ScanNext(scan)) != NULL) {
+        assert(s->id % 3 == 0 && s->isOnline);
+        count++;
+    }
+    Pager_ScanClose(scan);
+    for (i = 0; i < n; i += 3) {
+        char email[32];
+        sprintf(email, "%d", i);
+        count -= email[0] == '1';
+    }
+    assert(count == 0);
+    PagerSimulateCrash(pager);
+
+    // 重做日志之后，以默认的行格式打开也会沿用创建时的变长格式
+    Init_PagerConfig(&config);
+    config.wal = true;
+    pager      = New_Pager(varFile, &config);
+    assert(pager->config.format == Pager_VarFormat);
+    for (i = 0; i < 2 * n; i++) {
+        if (i < n && i % 3 == 1) {
+            assert(Pager_Select(pager, i, &ret) == Pager_RowNotFound);
+            continue;
+        }
+        char username[32], email[32];
+        if (i < n && i % 3 == 0) {
+            sprintf(username, "user-with-a-long-name-%d", i);
+            sprintf(email, "someone-%d@example.com", i);
+        } else {
+            sprintf(username, "u%d", i);
+            email[0] = '\0';
+        }
+        assert(Pager_Select(pager, i, &ret) == Pager_ExecuteSuccess && ret->id == i);
+        assert(strcmp(ret->username, username) == 0 && strcmp(ret->email, email) == 0);
+    }
+    assert(Pager_CountOnline(pager, true, &sum) == expected && sum == expectedSum);
+    Destroy_Pager(pager);
+    unlink(varFile);
+    unlink(metaFile);
+    unlink(walFile);
+    free(rows);
+    free(ret);
+    free(r);
+    printf("test_VarFormat passed.\n");
+}
+
+/* 第i条记录的username和email都超过31字节，email最长255字节 */
+void varRow(VarRow *row, int32_t i) {
+    int32_t j;
+    row->id             = i;
+    row->isOnline       = i % 3 == 0;
+    row->usernameLength = (uint8_t)(32 + (i * 13) % 224);
+    row->emailLength    = (uint8_t)(32 + (i * 7) % 224);
+    sprintf(row->username, "long-%06d-", i);
+    for (j = 12; j < row->usernameLength; j++) {
+        row->username[j] = 'a' + (i + j) % 26;
+    }
+    for (j = 0; j < row->emailLength; j++) {
+        row->email[j] = 'A' + (i * j) % 26;
+    }
+    row->email[row->emailLength - 1] = 'z';
+}
+
+/* 偶数id是 Pager_InsertVar 插入的长记录，奇数id是 Pager_InsertBatch 插入的短记录 */
+void checkVarRow(Pager *pager, int32_t i) {
+    VarRow expected, got;
+    Row *ret = NULL;
+    if (i % 2 == 0) {
+        varRow(&expected, i);
+    } else {
+        memset(&expected, 0, sizeof(VarRow));
+        expected.id             = i;
+        expected.usernameLength = (uint8_t)sprintf(expected.username, "b%d", i);
+    }
+    assert(Pager_SelectVar(pager, i, &got) == Pager_ExecuteSuccess && got.id == i);
+    assert(got.isOnline == expected.isOnline && got.usernameLength == expected.usernameLength &&
+           got.emailLength == expected.emailLength);
+    assert(memcmp(got.username, expected.username, got.usernameLength) == 0 && got.username[got.usernameLength] == '\0');
+    assert(memcmp(got.email, expected.email, got.emailLength) == 0 && got.email[got.emailLength] == '\0');
+    // Row 只有前31个字节
+    assert(Pager_Select(pager, i, &ret) == Pager_ExecuteSuccess);
+    assert(strlen(ret->username) == (size_t)(got.usernameLength < USERNAME_LENGTH ? got.usernameLength : USERNAME_LENGTH));
+    assert(strncmp(ret->username, got.username, USERNAME_LENGTH) == 0 && strncmp(ret->email, got.email, EMAIL_LENGTH) == 0);
+    free(ret);
+}
+
+void test_VarLongFields() {
+    const char *varFile = "dbfile_varlong";
+    char metaFile[64], walFile[64], indexFile[64];
+    sprintf(metaFile, "%s%s", varFile, META_FILE_SUFFIX);
+    sprintf(walFile, "%s%s", varFile, WAL_FILE_SUFFIX);
+    sprintf(indexFile, "%s%s", varFile, INDEX_FILE_SUFFIX);
+    unlink(varFile);
+    unlink(metaFile);
+    unlink(walFile);
+    unlink(indexFile);
+
+    VarRow var;
+    varRow(&var, 0);
+    assert(VAR_MAX_RECORD >= VAR_RECORD_HEADER + 2 * VAR_FIELD_LENGTH);
+    PagerConfig config;
+    Init_PagerConfig(&config);
+    Pager *pager = New_Pager(varFile, &config);
+    // 定长的格式放不下长记录
+    assert(Pager_InsertVar(pager, &var) == Pager_ExecuteFailed);
+    Destroy_Pager(pager);
+    unlink(varFile);
+    unlink(metaFile);
+
+    PagerAccess accesses[2] = {Pager_RangeAccess, Pager_HashAccess};
+    int32_t a, i, n = 1200;
+    Row *rows = (Row *)calloc(n, sizeof(Row));
+    for (a = 0; a < 2; a++) {
+        Init_PagerConfig(&config);
+        config.format            = Pager_VarFormat;
+        config.access            = accesses[a];
+        config.wal               = true;
+        config.indexes           = true;
+        config.walCheckpointSize = 1L << 30;
+        pager                    = New_Pager(varFile, &config);
+        // 乱序插入，页面分裂和挪到相邻页面时整条复制长记录
+        for (i = 0; i < n; i++) {
+            varRow(&var, (i * 7919) % n * 2);
+            assert(Pager_InsertVar(pager, &var) == Pager_ExecuteSuccess);
+        }
+        assert(Pager_InsertVar(pager, &var) == Pager_RowAleardyExists);
+        // 批量插入与原有的长记录归并
+        for (i = 0; i < n; i++) {
+            memset(&rows[i], 0, sizeof(Row));
+            rows[i].id = 2 * i + 1;
+            sprintf(rows[i].username, "b%d", rows[i].id);
+        }
+        assert(Pager_InsertBatch(pager, rows, n) == Pager_ExecuteSuccess);
+        for (i = 0; i < 2 * n; i++) {
+            checkVarRow(pager, i);
+        }
+        if (accesses[a] == Pager_RangeAccess) {
+            // 缓冲池被pin满，变长的更新分配不到分裂的新页面，失败时原记录和索引都不变
+            int32_t pinned = TABLE_MAX_PAGES, failed = 0;
+            assert(pager->pageCount > pinned);
+            for (i = 0; i < pinned; i++) {
+                assert(Pager_PinPage(pager, i) != NULL);
+            }
+            for (i = 0; i < 2 * n; i += 2) {
+                VarRow longer;
+                varRow(&longer, i);
+                memset(longer.username, 'x', VAR_FIELD_LENGTH);
+                longer.usernameLength = VAR_FIELD_LENGTH;
+                PagerExecuteResult result = Pager_UpdateVar(pager, i, &longer, NULL);
+                if (result == Pager_RowNotFound) {
+                    // 记录所在的页面不在缓冲池中，pin不上
+                    continue;
+                }
+                if (result == Pager_ExecuteSuccess) {
+                    varRow(&var, i);
+                    assert(Pager_UpdateVar(pager, i, &var, NULL) == Pager_ExecuteSuccess);
+                    continue;
+                }
+                assert(result == Pager_ExecuteFailed);
+                failed++;
+                checkVarRow(pager, i);
+                char prefix[16];
+                Row *found    = NULL;
+                int32_t count = 0;
+                sprintf(prefix, "long-%06d-", i);
+                assert(Pager_SelectBy(pager, Pager_UsernameField, prefix, true, &found, &count) == Pager_ExecuteSuccess);
+                assert(count == 1 && found[0].id == i);
+                free(found);
+            }
+            assert(failed > 0);
+            for (i = 0; i < pinned; i++) {
+                Pager_UnpinPage(pager, i, false);
+            }
+        }
+        // 删除大部分记录之后合并页面
+        Row *ret = NULL;
+        for (i = 0; i < 2 * n; i++) {
+            if (i % 8 != 0) {
+                assert(Pager_Delete(pager, i, &ret) == Pager_ExecuteSuccess);
+            }
+        }
+        while (Pager_Compact(pager, 100) > 0) {
+        }
+        for (i = 0; i < 2 * n; i += 8) {
+            checkVarRow(pager, i);
+        }
+        // 只修改isOnline的 Pager_Update 保留完整的username和email
+        VarRow got, old;
+        Row *r = NULL;
+        for (i = 0; i < 2 * n; i += 8) {
+            assert(Pager_Select(pager, i, &r) == Pager_ExecuteSuccess);
+            r->isOnline = !r->isOnline;
+            assert(Pager_Update(pager, i, r, &ret) == Pager_ExecuteSuccess && ret->isOnline != r->isOnline);
+            varRow(&var, i);
+            assert(Pager_SelectVar(pager, i, &got) == Pager_ExecuteSuccess && got.isOnline != var.isOnline);
+            assert(got.usernameLength == var.usernameLength && memcmp(got.username, var.username, var.usernameLength) == 0);
+            assert(got.emailLength == var.emailLength && memcmp(got.email, var.email, var.emailLength) == 0);
+            // 改变的字段被替换，没有改变的字段仍然完整
+            sprintf(r->username, "short%d", i);
+            assert(Pager_Update(pager, i, r, &ret) == Pager_ExecuteSuccess);
+            assert(Pager_SelectVar(pager, i, &got) == Pager_ExecuteSuccess && strcmp(got.username, r->username) == 0);
+            assert(got.emailLength == var.emailLength && memcmp(got.email, var.email, var.emailLength) == 0);
+            // 变到最长，页面放不下时重新插入
+            memset(var.username + var.usernameLength, 'x', VAR_FIELD_LENGTH - var.usernameLength);
+            memset(var.email + var.emailLength, 'y', VAR_FIELD_LENGTH - var.emailLength);
+            var.usernameLength = var.emailLength = VAR_FIELD_LENGTH;
+            assert(Pager_UpdateVar(pager, i, &var, &old) == Pager_ExecuteSuccess);
+            assert(old.id == i && strcmp(old.username, r->username) == 0);
+            assert(Pager_SelectVar(pager, i, &got) == Pager_ExecuteSuccess && got.usernameLength == VAR_FIELD_LENGTH);
+            assert(got.emailLength == VAR_FIELD_LENGTH && memcmp(got.email, var.email, VAR_FIELD_LENGTH) == 0);
+        }
+        free(r);
+        free(ret);
+        // 改回原来的记录，之后重做日志时依次重做上面的更新
+        for (i = 0; i < 2 * n; i += 8) {
+            varRow(&var, i);
+            assert(Pager_UpdateVar(pager, i, &var, NULL) == Pager_ExecuteSuccess);
+            checkVarRow(pager, i);
+        }
+        assert(Pager_UpdateVar(pager, 1, &var, NULL) == Pager_RowNotFound);
+        // 二级索引只有前31个字节
+        Row *found    = NULL;
+        int32_t count = 0;
+        assert(Pager_SelectBy(pager, Pager_UsernameField, "long-000800-", true, &found, &count) == Pager_ExecuteSuccess);
+        assert(count == 1 && found[0].id == 800);
+        free(found);
+        PagerSimulateCrash(pager);
+
+        // 重做日志中的长记录
+        pager = New_Pager(varFile, &config);
+        for (i = 0; i < 2 * n; i++) {
+            VarRow got;
+            if (i % 8 == 0) {
+                checkVarRow(pager, i);
+            } else {
+                assert(Pager_SelectVar(pager, i, &got) == Pager_RowNotFound);
+            }
+        }
+        Destroy_Pager(pager);
+        unlink(varFile);
+        unlink(metaFile);
+        unlink(walFile);
+        unlink(indexFile);
+    }
+    free(rows);
+    printf("test_VarLongFields passed.\n");
+}
+
+/* 每一页的extent都保存着这一页，各页的extent互不重叠 */
+void checkExtents(Pager *pager) {
+    int32_t i, j;
+    for (i = 0; i < pager->pageCount; i++) {
+        PageExtent *e = &pager->extents[i];
+        if (e->offset == -1) {
+            continue;
+        }
+        ExtentHeader header;
+        assert(pread(pager->fd, &header, sizeof(header), e->offset) == (ssize_t)sizeof(header));
+        assert(header.magic == EXTENT_MAGIC && header.pageNum == i && header.sectors == e->sectors);
+        for (j = i + 1; j < pager->pageCount; j++) {
+            PageExtent *o = &pager->extents[j];
+            assert(o->offset == -1 || o->offset >= e->offset + (int64_t)e->sectors * EXTENT_SECTOR ||
+                   e->offset >= o->offset + (int64_t)o->sectors * EXTENT_SECTOR);
+        }
+    }
+}
+
+/**
+ * 检查 test_Compression 插入的前n条记录：id为7k+3的记录已被删除，
+ * 小于updated的偶数id的email被 Pager_Update 改成了难以压缩的字符串，其余记录保持插入时的内容。
+ */
+void checkCompressedRows(Pager *pager, int32_t n, int32_t updated) {
+    Row *ret = NULL;
+    int32_t i;
+    for (i = 0; i < n; i++) {
+        if (i % 7 == 3) {
+            assert(Pager_Select(pager, i, &ret) == Pager_RowNotFound);
+            continue;
+        }
+        char username[32], email[32];
+        sprintf(username, "user%d", i);
+        if (i < updated && i % 2 == 0) {
+            sprintf(email, "%08x.%d@a.org", (uint32_t)(i * 2654435761u), i);
+        } else {
+            sprintf(email, "user%d@%s", i, i % 3 == 0 ? "gmail.com" : "example.com");
+        }
+        assert(Pager_Select(pager, i, &ret) == Pager_ExecuteSuccess && ret->id == i);
+        assert(strcmp(ret->username, username) == 0 && strcmp(ret->email, email) == 0);
+    }
+    free(ret);
+}
+
+void test_Compression() {
+    // LZ77编解码，字典中的字节可以被引用
+    char src[64 + PAGE_SIZE], dst[2 * PAGE_SIZE], out[64 + PAGE_SIZE];
+    int32_t i, size;
+    memset(src, 0, sizeof(src));
+    strcpy(src, "@example.com");
+    for (i = 0; i < 100; i++) {
+        sprintf(src + 64 + i * 40, "user%d@example.com", i);
+    }
+    size = Lz_Compress(src, 64, sizeof(src), dst, sizeof(dst));
+    assert(size > 0 && size < PAGE_SIZE / 4);
+    memcpy(out, src, 64);
+    assert(Lz_Decompress(dst, size, out, 64, sizeof(out)) == (int32_t)sizeof(out) && memcmp(src, out, sizeof(out)) == 0);
+    assert(Lz_Compress(src, 64, sizeof(src), dst, size - 1) == -1);
+    // 随机数据压缩不了，损坏的输入被发现
+    srand(7);
+    for (i = 64; i < (int32_t)sizeof(src); i++) {
+        src[i] = (char)rand();
+    }
+    assert(Lz_Compress(src, 64, sizeof(src), dst, PAGE_SIZE) == -1);
+    size = Lz_Compress(src, 64, sizeof(src), dst, sizeof(dst));
+    assert(size > PAGE_SIZE && Lz_Decompress(dst, size, out, 64, sizeof(out)) == (int32_t)sizeof(out));
+    assert(memcmp(src, out, sizeof(out)) == 0 && Lz_Decompress(dst, size - 1, out, 64, sizeof(out)) == -1);
+
+    const char *zipFile = "dbfile_zip";
+    char metaFile[64], walFile[64];
+    sprintf(metaFile, "%s%s", zipFile, META_FILE_SUFFIX);
+    sprintf(walFile, "%s%s", zipFile, WAL_FILE_SUFFIX);
+    PageFormat formats[3] = {Pager_RowFormat, Pager_PaxFormat, Pager_VarFormat};
+    int32_t f;
+    const int n = 20000;
+    for (f = 0; f < 3; f++) {
+        unlink(zipFile);
+        unlink(metaFile);
+        unlink(walFile);
+        PagerConfig config;
+        Init_PagerConfig(&config);
+        config.format            = formats[f];
+        config.compress          = true;
+        config.wal               = true;
+        config.walCheckpointSize = 1L << 30;
+        config.ioDepth           = 8;
+
+        // 页面比缓冲池多，被淘汰的页面压缩之后写回
+        Pager *pager = New_Pager(zipFile, &config);
+        Row *rows    = (Row *)calloc(n, sizeof(Row));
+        for (i = 0; i < n; i++) {
+            rows[i].id = i;
+            sprintf(rows[i].username, "user%d", i);
+            sprintf(rows[i].email, "user%d@%s", i, i % 3 == 0 ? "gmail.com" : "example.com");
+        }
+        assert(Pager_InsertBatch(pager, rows, n / 2) == Pager_ExecuteSuccess);
+        for (i = n / 2; i < n; i++) {
+            assert(Pager_Insert(pager, &rows[i]) == Pager_ExecuteSuccess);
+        }
+        Row *ret = NULL;
+        for (i = 3; i < n; i += 7) {
+            assert(Pager_Delete(pager, i, &ret) == Pager_ExecuteSuccess);
+        }
+        Pager_Checkpoint(pager);
+        struct stat st;
+        stat(zipFile, &st);
+        // 行格式和PAX的页面压缩到1/3以下，变长记录的页面本身已经紧凑
+        assert(st.st_size * (formats[f] == Pager_VarFormat ? 2 : 3) < (off_t)pager->pageCount * PAGE_SIZE);
+        checkCompressedRows(pager, n, 0);
+        int32_t pageCount = pager->pageCount;
+        Destroy_Pager(pager);
+
+        // 已有的压缩文件总是压缩的，元数据文件正常关闭时直接读取extent
+        Init_PagerConfig(&config);
+        config.wal = true;
+        pager      = New_Pager(zipFile, &config);
+        assert(pager->config.compress && pager->config.format == formats[f] && pager->pageCount == pageCount);
+        checkCompressedRows(pager, n, 0);
+        // 难以压缩的email让页面变大，换到更大的extent
+        int32_t updated = n / 4;
+        for (i = 0; i < updated; i += 2) {
+            if (i % 7 != 3) {
+                sprintf(rows[i].email, "%08x.%d@a.org", (uint32_t)(i * 2654435761u), i);
+                assert(Pager_Update(pager, i, &rows[i], &ret) == Pager_ExecuteSuccess);
+            }
+        }
+        Pager_Flush(pager);
+        checkExtents(pager);
+        checkCompressedRows(pager, n, updated);
+        PagerSimulateCrash(pager);
+
+        // 崩溃之后扫描数据文件重建extent，再重做日志
+        pager = New_Pager(zipFile, &config);
+        assert(pager->config.compress);
+        checkExtents(pager);
+        checkCompressedRows(pager, n, updated);
+        Destroy_Pager(pager);
+        free(rows);
+        free(ret);
+    }
+
+    // 没有压缩的文件不会因为config.compress而改变
+    unlink(zipFile);
+    unlink(metaFile);
+    unlink(walFile);
+    PagerConfig config;
+    Init_PagerConfig(&config);
+    Pager *pager = New_Pager(zipFile, &config);
+    Row *row     = New_Row();
+    row->id      = 1;
+    assert(Pager_Insert(pager, row) == Pager_ExecuteSuccess);
+    Destroy_Pager(pager);
+    config.compress = true;
+    pager           = New_Pager(zipFile, &config);
+    assert(!pager->config.compress && Pager_Select(pager, 1, &row) == Pager_ExecuteSuccess);
+    Destroy_Pager(pager);
+    unlink(zipFile);
+    unlink(metaFile);
+    unlink(walFile);
+    free(row);
+    printf("test_Compression passed.\n");
+}
+
+#define LOG_THREADS 4
+#define LOGS_PER_THREAD 2000
+
+void *logWorker(void *arg) {
+    int i;
+    for (i = 0; i < LOGS_PER_THREAD; i++) {
+        LOG_WARN("worker %ld message %d", (long)arg, i);
+    }
+    return NULL;
+}
+
+/* 读出整个日志文件，调用者负责free */
+char *readLog(const char *logFile) {
+    FILE *fp = fopen(logFile, "r");
+    assert(fp != NULL);
+    fseek(fp, 0, SEEK_END);
+    long size = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+    char *text = (char *)malloc(size + 1);
+    assert(text != NULL);
+    assert(fread(text, 1, size, fp) == (size_t)size);
+    text[size] = '\0';
+    fclose(fp);
+    return text;
+}
+
+void test_Log() {
+    const char *logFile = "dbfile_log";
+    int fd = open(logFile, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    assert(fd >= 0);
+    Log_SetOutput(fd);
+
+    // 低于运行期级别的日志不输出，超长的消息被截断
+    Log_SetLevel(LOG_LEVEL_INFO);
+    LOG_DEBUG("hidden %d", 1);
+    LOG_INFO("visible %d", 2);
+    LOG_ERROR("error %s", "3");
+    char longText[LOG_ENTRY_SIZE * 2];
+    memset(longText, 'x', sizeof(longText) - 1);
+    longText[sizeof(longText) - 1] = '\0';
+    LOG_WARN("%s", longText);
+    Log_SetLevel(LOG_LEVEL_OFF);
+    LOG_ERROR("hidden %d", 4);
+    Log_Flush();
+    char *text = readLog(logFile);
+    const char *expected = "[INFO] visible 2\n[ERROR] error 3\n[WARN] xxx";
+    assert(strncmp(text, expected, strlen(expected)) == 0);
+    char *line = strstr(text, "[WARN]");
+    assert(strlen(line) == LOG_ENTRY_SIZE && line[LOG_ENTRY_SIZE - 1] == '\n');
+    free(text);
+
+    // 多个线程同时写日志：每个线程的消息保持顺序，缓冲区满时丢弃的消息都被计数
+    assert(ftruncate(fd, 0) == 0 && lseek(fd, 0, SEEK_SET) == 0);
+    Log_SetLevel(LOG_LEVEL_DEBUG);
+    uint64_t dropped = Log_Dropped();
+    pthread_t threads[LOG_THREADS];
+    long i;
+    for (i = 0; i < LOG_THREADS; i++) {
+        pthread_create(&threads[i], NULL, logWorker, (void *)i);
+    }
+    for (i = 0; i < LOG_THREADS; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    Log_Flush();
+    text = readLog(logFile);
+    int last[LOG_THREADS], lines = 0, worker, message, n;
+    for (i = 0; i < LOG_THREADS; i++) {
+        last[i] = -1;
+    }
+    char *p;
+    for (p = text; sscanf(p, "[WARN] worker %d message %d\n%n", &worker, &message, &n) == 2; p += n) {
+        assert(worker >= 0 && worker < LOG_THREADS && message > last[worker]);
+        last[worker] = message;
+        lines++;
+    }
+    assert(*p == '\0');
+    assert(lines + (Log_Dropped() - dropped) == LOG_THREADS * LOGS_PER_THREAD);
+    free(text);
+
+    Log_SetOutput(STDOUT_FILENO);
+    Log_SetLevel(LOG_LEVEL);
+    close(fd);
+    unlink(logFile);
+    printf("test_Log passed.\n");
+}
+
+#define METRICS_THREADS 4
+#define METRICS_PER_THREAD 1000
+
+/* 记录完退出，分片并入公共分片 */
+void *metricsWorker(void *arg) {
+    int i;
+    for (i = 0; i < METRICS_PER_THREAD; i++) {
+        Metrics_Add(Metrics_NodeMerges, 1);
+        Metrics_Record(Metrics_BpTreeInsert, 1000 + i);
+    }
+    return NULL;
+}
+
+void test_Metrics() {
+    // 桶随值单调不减，相对误差不超过 1 / METRICS_SUB_BUCKETS
+    uint64_t v;
+    int32_t last = -1;
+    for (v = 0; v < 100000; v += 7) {
+        int32_t bucket = Metrics_Bucket(v);
+        assert(bucket >= last && bucket < METRICS_BUCKETS);
+        last = bucket;
+    }
+    assert(Metrics_Bucket(UINT64_MAX) == METRICS_BUCKETS - 1);
+    MetricsHistogram h;
+    memset(&h, 0, sizeof(MetricsHistogram));
+    for (v = 1; v <= 1000; v++) {
+        h.buckets[Metrics_Bucket(v * 1000)]++;
+        h.count++;
+        h.sum += v * 1000;
+    }
+    h.max = 1000000;
+    assert(Metrics_Percentile(&h, 0.5) > 500000 * 3 / 4 && Metrics_Percentile(&h, 0.5) < 500000 * 5 / 4);
+    assert(Metrics_Percentile(&h, 0.99) > 990000 * 3 / 4 && Metrics_Percentile(&h, 0.99) <= 1000000);
+
+    // 多个线程的计数器和直方图在读取时汇总，退出的线程不丢失
+    MetricsSnapshot *before = (MetricsSnapshot *)malloc(sizeof(MetricsSnapshot));
+    MetricsSnapshot *after  = (MetricsSnapshot *)malloc(sizeof(MetricsSnapshot));
+    assert(before != NULL && after != NULL);
+    Metrics_Snapshot(before);
+    pthread_t threads[METRICS_THREADS];
+    int i;
+    for (i = 0; i < METRICS_THREADS; i++) {
+        pthread_create(&threads[i], NULL, metricsWorker, NULL);
+    }
+    for (i = 0; i < METRICS_THREADS; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    Metrics_Snapshot(after);
+    assert(after->counters[Metrics_NodeMerges] - before->counters[Metrics_NodeMerges] ==
+           METRICS_THREADS * METRICS_PER_THREAD);
+    MetricsHistogram *inserts = &after->histograms[Metrics_BpTreeInsert];
+    assert(inserts->count - before->histograms[Metrics_BpTreeInsert].count == METRICS_THREADS * METRICS_PER_THREAD);
+    assert(inserts->max >= 1000 + METRICS_PER_THREAD - 1);
+
+    // Pager的操作、缓冲池和页面读写
+    const char *metricsFile = "dbfile_metrics";
+    char metaFile[64], walFile[64];
+    sprintf(metaFile, "%s%s", metricsFile, META_FILE_SUFFIX);
+    sprintf(walFile, "%s%s", metricsFile, WAL_FILE_SUFFIX);
+    unlink(metricsFile);
+    unlink(metaFile);
+    unlink(walFile);
+    Metrics_Snapshot(before);
+    Pager *pager = New_Pager(metricsFile, NULL);
+    Row *row     = New_Row();
+    int n        = 1000;
+    for (i = 0; i < n; i++) {
+        row->id = i;
+        sprintf(row->username, "user%d", i);
+        assert(Pager_Insert(pager, row) == Pager_ExecuteSuccess);
+    }
+    for (i = 0; i < n; i += 10) {
+        assert(Pager_Select(pager, i, &row) == Pager_ExecuteSuccess && row->id == i);
+    }
+    assert(Pager_Select(pager, n, &row) == Pager_RowNotFound);
+    Pager_Flush(pager);
+    Metrics_Snapshot(after);
+    assert(after->histograms[Metrics_PagerInsert].count - before->histograms[Metrics_PagerInsert].count == (uint64_t)n);
+    assert(after->histograms[Metrics_PagerSelect].count - before->histograms[Metrics_PagerSelect].count ==
+           (uint64_t)n / 10 + 1);
+    assert(after->histograms[Metrics_PagerFlush].count - before->histograms[Metrics_PagerFlush].count == 1);
+    assert(after->counters[Metrics_PageSplits] > before->counters[Metrics_PageSplits]);
+    assert(after->counters[Metrics_CacheHits] > before->counters[Metrics_CacheHits]);
+    uint64_t written = after->counters[Metrics_PagesWritten] - before->counters[Metrics_PagesWritten];
+    assert(written >= (uint64_t)pager->pageCount);
+    assert(after->counters[Metrics_BytesWritten] - before->counters[Metrics_BytesWritten] == written * PAGE_SIZE);
+    assert(Metrics_Percentile(&after->histograms[Metrics_PagerInsert], 0.5) > 0);
+
+    FILE *fp = tmpfile();
+    assert(fp != NULL);
+    Metrics_Dump(after, fp);
+    char text[4096];
+    rewind(fp);
+    size_t size = fread(text, 1, sizeof(text) - 1, fp);
+    text[size]  = '\0';
+    fclose(fp);
+    assert(strstr(text, "pages_written") != NULL && strstr(text, "pager_insert") != NULL);
+    assert(strstr(text, "bplustree_insert") == NULL || after->histograms[Metrics_BPlusTreeInsert].count > 0);
+
+    Destroy_Pager(pager);
+    free(row);
+    free(before);
+    free(after);
+    unlink(metricsFile);
+    unlink(metaFile);
+    unlink(walFile);
+    printf("test_Metrics passed.\n");
+}
+
+void test_PartialWrite() {
+    const char *partialFile = "dbfile_partial";
+    char metaFile[64], walFile[64];
+    sprintf(metaFile, "%s%s", partialFile, META_FILE_SUFFIX);
+    sprintf(walFile, "%s%s", partialFile, WAL_FILE_SUFFIX);
+    unlink(partialFile);
+    unlink(metaFile);
+    unlink(walFile);
+
+    PagerConfig config;
+    Init_PagerConfig(&config);
+    config.wal               = true;
+    config.walCheckpointSize = 1L << 30;
+    Pager *pager             = New_Pager(partialFile, &config);
+    Row *row                 = New_Row();
+    const int n              = 300;
+    int i;
+    for (i = 0; i < n; i++) {
+        row->id = i;
+        sprintf(row->username, "user%d", i);
+        assert(Pager_Insert(pager, row) == Pager_ExecuteSuccess);
+    }
+    Pager_Checkpoint(pager);
+
+    // 只改变isOnline时只写回被修改的扇区
+    MetricsSnapshot *before = (MetricsSnapshot *)malloc(sizeof(MetricsSnapshot));
+    MetricsSnapshot *after  = (MetricsSnapshot *)malloc(sizeof(MetricsSnapshot));
+    assert(before != NULL && after != NULL);
+    Metrics_Snapshot(before);
+    row->id       = 100;
+    row->isOnline = true;
+    sprintf(row->username, "user%d", 100);
+    assert(Pager_Update(pager, 100, row, &row) == Pager_ExecuteSuccess);
+    Pager_Flush(pager);
+    Metrics_Snapshot(after);
+    assert(after->counters[Metrics_PartialPageWrites] - before->counters[Metrics_PartialPageWrites] == 1);
+    assert(after->counters[Metrics_PagesWritten] - before->counters[Metrics_PagesWritten] == 1);
+    assert(after->counters[Metrics_BytesWritten] - before->counters[Metrics_BytesWritten] <= 2 * PAGE_WRITE_UNIT);
+
+    Metrics_Snapshot(before);
+    assert(Pager_Delete(pager, 150, &row) == Pager_ExecuteSuccess);
+    Pager_Flush(pager);
+    Metrics_Snapshot(after);
+    assert(after->counters[Metrics_PartialPageWrites] - before->counters[Metrics_PartialPageWrites] == 1);
+    assert(after->counters[Metrics_BytesWritten] - before->counters[Metrics_BytesWritten] < PAGE_SIZE);
+
+    // 部分写入中途崩溃，页面的其余部分是旧的或者损坏的，重做时由日志中的页面镜像修复
+    row->id = 200;
+    sprintf(row->username, "torn");
+    assert(Pager_Update(pager, 200, row, &row) == Pager_ExecuteSuccess);
+    Pager_Flush(pager);
+    int32_t pageNum;
+    for (pageNum = 0; pager->fences[pageNum].minId > 200 || pager->fences[pageNum].maxId < 200; pageNum++) {
+    }
+    PagerSimulateCrash(pager);
+    int fd = open(partialFile, O_RDWR);
+    char garbage[PAGE_WRITE_UNIT];
+    memset(garbage, 0x5A, PAGE_WRITE_UNIT);
+    assert(pwrite(fd, garbage, PAGE_WRITE_UNIT, (off_t)pageNum * PAGE_SIZE) == PAGE_WRITE_UNIT);
+    close(fd);
+    pager = New_Pager(partialFile, &config);
+    for (i = 0; i < n; i++) {
+        PagerExecuteResult result = Pager_Select(pager, i, &row);
+        if (i == 150) {
+            assert(result == Pager_RowNotFound);
+            continue;
+        }
+        char username[32];
+        sprintf(username, i == 200 ? "torn" : "user%d", i);
+        assert(result == Pager_ExecuteSuccess && strcmp(row->username, username) == 0);
+        assert(row->isOnline == (i == 100));
+    }
+    Destroy_Pager(pager);
+
+    // 没有日志时总是写整个页面
+    config.wal = false;
+    pager      = New_Pager(partialFile, &config);
+    Metrics_Snapshot(before);
+    row->id       = 0;
+    row->isOnline = false;
+    sprintf(row->username, "user%d", 0);
+    assert(Pager_Update(pager, 0, row, &row) == Pager_ExecuteSuccess);
+    Pager_Flush(pager);
+    Metrics_Snapshot(after);
+    assert(after->counters[Metrics_PartialPageWrites] == before->counters[Metrics_PartialPageWrites]);
+    assert(after->counters[Metrics_BytesWritten] - before->counters[Metrics_BytesWritten] == PAGE_SIZE);
+    Destroy_Pager(pager);
+
+    free(row);
+    free(before);
+    free(after);
+    unlink(partialFile);
+    unlink(metaFile);
+    unlink(walFile);
+    printf("test_PartialWrite passed.\n");
+}
+
+#define COMPACT_ROWS 4000
+
+typedef struct CompactReader {
+    Pager *pager;
+    volatile bool stop;
+} CompactReader;
+
+/* 后台整理期间不断读取保留下来的记录（id % 4 == 0），每次都必须读到 */
+void *compactReader(void *arg) {
+    CompactReader *r = (CompactReader *)arg;
+    Row *ret         = NULL;
+    int32_t i        = 0;
+    while (!r->stop) {
+        KEY id = (i++ % (COMPACT_ROWS / 4)) * 4;
+        assert(Pager_Select(r->pager, id, &ret) == Pager_ExecuteSuccess && ret->id == id);
+    }
+    free(ret);
+    return NULL;
+}
+
+/* 保留的记录都能读到，被删除的都读不到，扫描按id顺序返回保留的记录 */
+void checkCompacted(Pager *pager) {
+    Row *ret = NULL;
+    int32_t i;
+    for (i = 0; i < COMPACT_ROWS; i++) {
+        PagerExecuteResult result = Pager_Select(pager, i, &ret);
+        if (i % 4 != 0) {
+            assert(result == Pager_RowNotFound);
+            continue;
+        }
+        char username[32];
+        sprintf(username, "user%d", i);
+        assert(result == Pager_ExecuteSuccess && strcmp(ret->username, username) == 0);
+    }
+    PagerScan *scan = Pager_ScanOpen(pager, NULL);
+    Row *row;
+    for (i = 0; (row = Pager_ScanNext(scan)) != NULL; i++) {
+        assert(row->id == i * 4);
+    }
+    assert(i == COMPACT_ROWS / 4);
+    Pager_ScanClose(scan);
+    free(ret);
+}
+
+void runCompaction(const char *dbFile, PagerConfig *config, bool crash) {
+    char metaFile[64], walFile[64];
+    sprintf(metaFile, "%s%s", dbFile, META_FILE_SUFFIX);
+    sprintf(walFile, "%s%s", dbFile, WAL_FILE_SUFFIX);
+    unlink(dbFile);
+    unlink(metaFile);
+    unlink(walFile);
+
+    Pager *pager = New_Pager(dbFile, config);
+    Row *row     = New_Row();
+    Row *ret     = NULL;
+    int32_t i;
+    for (i = 0; i < COMPACT_ROWS; i++) {
+        row->id = i;
+        sprintf(row->username, "user%d", i);
+        assert(Pager_Insert(pager, row) == Pager_ExecuteSuccess);
+    }
+    Pager_Flush(pager);
+    int32_t pageCount = pager->pageCount;
+    off_t fileLength  = pager->fileLength;
+    for (i = 0; i < COMPACT_ROWS; i++) {
+        if (i % 4 != 0) {
+            assert(Pager_Delete(pager, i, &ret) == Pager_ExecuteSuccess);
+        }
+    }
+    // 删除不会合并页面
+    assert(pager->pageCount == pageCount);
+
+    // 每一步最多合并或移动maxPages个页面
+    int32_t work, steps = 0;
+    while ((work = Pager_Compact(pager, 4)) > 0) {
+        assert(++steps < pageCount * 2);
+    }
+    assert(steps > 1);
+    assert(pager->pageCount <= pageCount / 2);
+    Pager_Flush(pager);
+    if (!pager->config.compress) {
+        struct stat st;
+        assert(stat(dbFile, &st) == 0);
+        assert(st.st_size <= fileLength / 2 && st.st_size >= (off_t)pager->pageCount * PAGE_SIZE);
+    }
+    checkCompacted(pager);
+    pageCount = pager->pageCount;
+    if (crash) {
+        PagerSimulateCrash(pager);
+    } else {
+        Destroy_Pager(pager);
+    }
+
+    pager = New_Pager(dbFile, config);
+    assert(pager->pageCount <= pageCount);
+    checkCompacted(pager);
+    Destroy_Pager(pager);
+    unlink(dbFile);
+    unlink(metaFile);
+    unlink(walFile);
+    free(ret);
+    free(row);
+}
+
+/* config.compactIntervalUs 由这里设置，删除四分之三的记录之后等待后台线程把页面数减半 */
+void runBackgroundCompaction(const char *compactFile, PagerConfig *config) {
+    char metaFile[64], walFile[64];
+    sprintf(metaFile, "%s%s", compactFile, META_FILE_SUFFIX);
+    sprintf(walFile, "%s%s", compactFile, WAL_FILE_SUFFIX);
+    unlink(compactFile);
+    unlink(metaFile);
+    unlink(walFile);
+    config->compactIntervalUs = 200;
+    Pager *pager              = New_Pager(compactFile, config);
+    Row *row                  = New_Row();
+    Row *ret                  = NULL;
+    int32_t i;
+    for (i = 0; i < COMPACT_ROWS; i++) {
+        row->id = i;
+        sprintf(row->username, "user%d", i);
+        assert(Pager_Insert(pager, row) == Pager_ExecuteSuccess);
+    }
+    int32_t pageCount = pager->pageCount;
+    CompactReader reader;
+    reader.pager = pager;
+    reader.stop  = false;
+    pthread_t thread;
+    pthread_create(&thread, NULL, compactReader, &reader);
+    for (i = 0; i < COMPACT_ROWS; i++) {
+        if (i % 4 != 0) {
+            assert(Pager_Delete(pager, i, &ret) == Pager_ExecuteSuccess);
+        }
+    }
+    for (i = 0; i < 5000 && __atomic_load_n(&pager->pageCount, __ATOMIC_RELAXED) > pageCount / 2; i++) {
+        usleep(1000);
+    }
+    reader.stop = true;
+    pthread_join(thread, NULL);
+    pthread_rwlock_rdlock(&pager->dirLatch);
+    assert(pager->pageCount <= pageCount / 2);
+    pthread_rwlock_unlock(&pager->dirLatch);
+    checkCompacted(pager);
+    Destroy_Pager(pager);
+    pager = New_Pager(compactFile, config);
+    checkCompacted(pager);
+    Destroy_Pager(pager);
+    unlink(compactFile);
+    unlink(metaFile);
+    unlink(walFile);
+    free(ret);
+    free(row);
+}
+
+void test_Compaction() {
+    PagerConfig config;
+    Init_PagerConfig(&config);
+    runCompaction("dbfile_compact", &config, false);
+
+    config.wal = true;
+    runCompaction("dbfile_compact", &config, true);
+
+    Init_PagerConfig(&config);
+    config.format = Pager_PaxFormat;
+    runCompaction("dbfile_compact", &config, false);
+
+    config.format   = Pager_VarFormat;
+    config.compress = true;
+    runCompaction("dbfile_compact", &config, false);
+
+    Init_PagerConfig(&config);
+    config.storage     = Pager_Mmap;
+    config.mmapReserve = 1L << 30;
+    runCompaction("dbfile_compact", &config, false);
+
+    // 后台线程整理的同时，读者一直能读到保留的记录；开启日志时整理的事务在释放dirLatch之后等待日志
+    Init_PagerConfig(&config);
+    runBackgroundCompaction("dbfile_compact", &config);
+    config.wal           = true;
+    config.groupCommitUs = 100;
+    runBackgroundCompaction("dbfile_compact", &config);
+    printf("test_Compaction passed.\n");
+}
+
+#define INDEX_ROWS 3000
+
+/* 第i条记录的username有INDEX_ROWS / 10种，email各不相同 */
+void indexRow(Row *row, int32_t i) {
+    row->id       = i;
+    row->isOnline = false;
+    sprintf(row->username, "name%d", i % (INDEX_ROWS / 10));
+    sprintf(row->email, "u%d@host%d.com", i, i % 7);
+}
+
+/* 分别用索引和全表扫描查找，结果必须相同 */
+void checkSelectBy(Pager *pager, PagerField field, const char *value, bool prefix, int32_t expected) {
+    Row *rows = NULL;
+    int32_t count, i;
+    PagerExecuteResult result = Pager_SelectBy(pager, field, value, prefix, &rows, &count);
+    assert(count == expected && result == (expected > 0 ? Pager_ExecuteSuccess : Pager_RowNotFound));
+    for (i = 0; i < count; i++) {
+        const char *v = field == Pager_UsernameField ? rows[i].username : rows[i].email;
+        assert(prefix ? strncmp(v, value, strlen(value)) == 0 : strcmp(v, value) == 0);
+        // 按(value, id)排序
+        if (i > 0) {
+            const char *u = field == Pager_UsernameField ? rows[i - 1].username : rows[i - 1].email;
+            assert(strcmp(u, v) < 0 || (strcmp(u, v) == 0 && rows[i - 1].id < rows[i].id));
+        }
+    }
+    free(rows);
+}
+
+void test_SecondaryIndex() {
+    // 跳表本身
+    SkipList *list = New_SkipList(42);
+    int32_t i;
+    char value[32];
+    for (i = 0; i < 1000; i++) {
+        sprintf(value, "v%03d", (i * 7) % 1000);
+        assert(SkipList_Insert(list, value, i));
+    }
+    assert(!SkipList_Insert(list, "v007", 1));
+    assert(SkipList_Delete(list, "v007", 1) && !SkipList_Delete(list, "v007", 1));
+    assert(list->count == 999);
+    SkipNode *node = SkipList_LowerBound(list, "v5", INT32_MIN);
+    assert(node != NULL && strcmp(node->value, "v500") == 0);
+    for (i = 0; node != NULL && strncmp(node->value, "v5", 2) == 0; node = node->next[0]) {
+        i++;
+    }
+    assert(i == 100);
+    Destroy_SkipList(list);
+
+    const char *indexFile = "dbfile_index";
+    char metaFile[64], walFile[64], idxFile[64];
+    sprintf(metaFile, "%s%s", indexFile, META_FILE_SUFFIX);
+    sprintf(walFile, "%s%s", indexFile, WAL_FILE_SUFFIX);
+    sprintf(idxFile, "%s%s", indexFile, INDEX_FILE_SUFFIX);
+    unlink(indexFile);
+    unlink(metaFile);
+    unlink(walFile);
+    unlink(idxFile);
+
+    PagerConfig config;
+    Init_PagerConfig(&config);
+    config.indexes = true;
+    config.wal     = true;
+    Pager *pager   = New_Pager(indexFile, &config);
+    Row *row       = New_Row();
+    Row *ret       = NULL;
+    for (i = 0; i < INDEX_ROWS / 2; i++) {
+        indexRow(row, i);
+        assert(Pager_Insert(pager, row) == Pager_ExecuteSuccess);
+    }
+    Row *rows = (Row *)calloc(INDEX_ROWS / 2, sizeof(Row));
+    for (i = 0; i < INDEX_ROWS / 2; i++) {
+        indexRow(&rows[i], INDEX_ROWS / 2 + i);
+    }
+    assert(Pager_InsertBatch(pager, rows, INDEX_ROWS / 2) == Pager_ExecuteSuccess);
+    // id已经存在的记录被跳过，索引不变
+    indexRow(&rows[0], 5);
+    strcpy(rows[0].username, "replaced");
+    assert(Pager_InsertBatch(pager, rows, 1) == Pager_RowAleardyExists);
+    checkSelectBy(pager, Pager_UsernameField, "replaced", false, 0);
+    checkSelectBy(pager, Pager_UsernameField, "name5", false, 10);
+    checkSelectBy(pager, Pager_UsernameField, "name7", false, 10);
+    checkSelectBy(pager, Pager_UsernameField, "name29", true, 110);
+    checkSelectBy(pager, Pager_EmailField, "u42@host0.com", false, 1);
+    checkSelectBy(pager, Pager_EmailField, "u12", true, 111);
+    checkSelectBy(pager, Pager_EmailField, "nobody", true, 0);
+
+    // 更新和删除同步修改索引
+    indexRow(row, 7);
+    strcpy(row->email, "changed@host.com");
+    assert(Pager_Update(pager, 7, row, &ret) == Pager_ExecuteSuccess);
+    checkSelectBy(pager, Pager_EmailField, "u7@host0.com", false, 0);
+    checkSelectBy(pager, Pager_EmailField, "changed@", true, 1);
+    for (i = 0; i < INDEX_ROWS; i += 10) {
+        assert(Pager_Delete(pager, i, &ret) == Pager_ExecuteSuccess);
+    }
+    checkSelectBy(pager, Pager_UsernameField, "name0", false, 0);
+    checkSelectBy(pager, Pager_UsernameField, "name7", false, 10);
+    Destroy_Pager(pager);
+
+    // 正常关闭之后从索引文件加载，没有开启索引时扫描全表，结果相同
+    pager = New_Pager(indexFile, &config);
+    checkSelectBy(pager, Pager_UsernameField, "name7", false, 10);
+    checkSelectBy(pager, Pager_EmailField, "u12", true, 100);
+    Destroy_Pager(pager);
+    config.indexes = false;
+    pager          = New_Pager(indexFile, &config);
+    checkSelectBy(pager, Pager_UsernameField, "name7", false, 10);
+    // 不维护索引时修改的记录，下次开启索引时重建
+    indexRow(row, 0);
+    assert(Pager_Insert(pager, row) == Pager_ExecuteSuccess);
+    Destroy_Pager(pager);
+    config.indexes = true;
+    pager          = New_Pager(indexFile, &config);
+    checkSelectBy(pager, Pager_UsernameField, "name0", false, 1);
+
+    // 崩溃之后重做日志并重建索引
+    indexRow(row, 1);
+    strcpy(row->username, "crash");
+    assert(Pager_Update(pager, 1, row, &ret) == Pager_ExecuteSuccess);
+    PagerSimulateCrash(pager);
+    pager = New_Pager(indexFile, &config);
+    checkSelectBy(pager, Pager_UsernameField, "crash", false, 1);
+    checkSelectBy(pager, Pager_UsernameField, "name1", false, 9);
+    Destroy_Pager(pager);
+
+    unlink(indexFile);
+    unlink(metaFile);
+    unlink(walFile);
+    unlink(idxFile);
+    free(rows);
+    free(ret);
+    free(row);
+    printf("test_SecondaryIndex passed.\n");
+}
+
+#define HASH_ROWS 20000
+
+/* 每条记录都在它的散列值对应的目录项指向的页面中，只有非空页面是桶 */
+void checkBuckets(Pager *pager) {
+    int32_t pageNum, k, i;
+    for (pageNum = 0; pageNum < pager->pageCount; pageNum++) {
+        Page *page = (Page *)Pager_PinPage(pager, pageNum);
+        assert((page->rowCount == 0) == (pager->localDepths[pageNum] == -1));
+        assert(pager->localDepths[pageNum] <= pager->globalDepth);
+        for (k = 0; k < page->rowCount; k++) {
+            KEY id     = pager->config.format == Pager_PaxFormat ? PAX_IDS(page)[k] : PAGE_ROW(page, page->slots[k])->id;
+            uint32_t h = PagerHash(id);
+            assert(pager->buckets[pager->globalDepth == 0 ? 0 : h >> (32 - pager->globalDepth)] == pageNum);
+        }
+        Pager_UnpinPage(pager, pageNum, false);
+    }
+    for (i = 0; i < 1 << pager->globalDepth; i++) {
+        assert(pager->buckets[i] >= -1 && pager->buckets[i] < pager->pageCount);
+    }
+}
+
+/* id为3的倍数的记录中，i % 3 != 0 的还在，第i条的username是"user<i>" */
+void checkHashRows(Pager *pager) {
+    Row *ret = NULL;
+    int32_t i;
+    for (i = 0; i < HASH_ROWS; i++) {
+        PagerExecuteResult result = Pager_Select(pager, i * 3, &ret);
+        if (i % 3 == 0) {
+            assert(result == Pager_RowNotFound);
+            continue;
+        }
+        char username[32];
+        sprintf(username, "user%d", i);
+        assert(result == Pager_ExecuteSuccess && ret->id == i * 3 && strcmp(ret->username, username) == 0);
+        assert(Pager_Select(pager, i * 3 + 2, &ret) == Pager_RowNotFound);
+    }
+    // 扫描返回每条记录恰好一次，同一个桶中按id顺序
+    bool *seen = (bool *)calloc(HASH_ROWS, sizeof(bool));
+    PagerScan *scan = Pager_ScanOpen(pager, NULL);
+    Row *row;
+    int32_t n = 0;
+    for (n = 0; (row = Pager_ScanNext(scan)) != NULL; n++) {
+        if (row->id % 3 != 0) {
+            continue;
+        }
+        assert(!seen[row->id / 3] && row->id / 3 % 3 != 0);
+        seen[row->id / 3] = true;
+    }
+    Pager_ScanClose(scan);
+    assert(n == HASH_ROWS - (HASH_ROWS + 2) / 3 + 1000);
+    // id的范围条件在每个桶中分别判断
+    PagerPredicate predicate;
+    Init_PagerPredicate(&predicate);
+    predicate.minId = 3000;
+    predicate.maxId = 5999;
+    scan            = Pager_ScanOpen(pager, &predicate);
+    for (n = 0; (row = Pager_ScanNext(scan)) != NULL; n++) {
+        assert(row->id >= 3000 && row->id <= 5999);
+    }
+    Pager_ScanClose(scan);
+    assert(n == 667);
+    free(seen);
+    free(ret);
+    checkBuckets(pager);
+}
+
+void runHashAccess(const char *dbFile, PagerConfig *config, bool crash) {
+    char metaFile[64], walFile[64];
+    sprintf(metaFile, "%s%s", dbFile, META_FILE_SUFFIX);
+    sprintf(walFile, "%s%s", dbFile, WAL_FILE_SUFFIX);
+    unlink(dbFile);
+    unlink(metaFile);
+    unlink(walFile);
+
+    config->access = Pager_HashAccess;
+    Pager *pager   = New_Pager(dbFile, config);
+    Row *row       = New_Row();
+    Row *ret       = NULL;
+    int32_t i, k;
+    for (i = 0; i < HASH_ROWS; i++) {
+        row->id = i * 3;
+        sprintf(row->username, "user%d", i);
+        assert(Pager_Insert(pager, row) == Pager_ExecuteSuccess);
+    }
+    assert(Pager_Insert(pager, row) == Pager_RowAleardyExists);
+    // 目录随着桶的分裂加倍，没有全局的重新散列
+    assert(pager->globalDepth > 0 && pager->pageCount > 1 && pager->dirCount == 0);
+    assert(pager->pageCount <= 1 << pager->globalDepth);
+    for (i = 0; i < HASH_ROWS; i += 3) {
+        assert(Pager_Delete(pager, i * 3, &ret) == Pager_ExecuteSuccess && ret->id == i * 3);
+    }
+    // 批量插入id为3k+1的记录，id已经存在的记录保留原有的，重复的id只插入第一条
+    Row *rows = (Row *)calloc(1002, sizeof(Row));
+    for (i = 0; i < 1000; i++) {
+        rows[i].id = i * 3 + 1;
+        sprintf(rows[i].username, "batch%d", i);
+    }
+    rows[1000].id = 1;
+    strcpy(rows[1000].username, "duplicate");
+    rows[1001].id = 3;
+    strcpy(rows[1001].username, "batch3");
+    assert(Pager_InsertBatch(pager, rows, 1002) == Pager_RowAleardyExists);
+    assert(Pager_Select(pager, 1, &ret) == Pager_ExecuteSuccess && strcmp(ret->username, "batch0") == 0);
+    assert(Pager_Select(pager, 2998, &ret) == Pager_ExecuteSuccess && strcmp(ret->username, "batch999") == 0);
+    checkHashRows(pager);
+
+    // 清空前两个页面，整理时把文件末尾的两个桶移过来，然后截断
+    int32_t pageCount = pager->pageCount, n = 0;
+    for (k = 0; k < 2; k++) {
+        Page *page = (Page *)Pager_PinPage(pager, k);
+        KEY ids[VAR_MAX_ROWS];
+        int32_t count = page->rowCount;
+        for (i = 0; i < count; i++) {
+            ids[i] = config->format == Pager_PaxFormat ? PAX_IDS(page)[i] : PAGE_ROW(page, page->slots[i])->id;
+        }
+        Pager_UnpinPage(pager, k, false);
+        for (i = 0; i < count; i++) {
+            assert(Pager_Delete(pager, ids[i], &ret) == Pager_ExecuteSuccess);
+            memcpy(&rows[n++], ret, ROW_SIZE);
+        }
+        assert(pager->localDepths[k] == -1);
+    }
+    assert(Pager_Compact(pager, 100) == 4 && pager->pageCount == pageCount - 2);
+    checkBuckets(pager);
+    assert(Pager_InsertBatch(pager, rows, n) == Pager_ExecuteSuccess);
+    checkHashRows(pager);
+    int32_t globalDepth = pager->globalDepth;
+    if (crash) {
+        PagerSimulateCrash(pager);
+    } else {
+        Destroy_Pager(pager);
+    }
+
+    // 重新打开：组织方式沿用数据文件创建时的，正常关闭时加载散列目录，一次读取就找到记录；
+    // 崩溃之后扫描页面重建
+    config->access = Pager_RangeAccess;
+    pager = New_Pager(dbFile, config);
+    assert(pager->config.access == Pager_HashAccess);
+    if (crash) {
+        assert(pager->globalDepth <= globalDepth);
+    } else {
+        assert(pager->globalDepth == globalDepth);
+        MetricsSnapshot before, after;
+        Metrics_Snapshot(&before);
+        assert(Pager_Select(pager, 30, &ret) == Pager_ExecuteSuccess && ret->id == 30);
+        Metrics_Snapshot(&after);
+        assert(config->storage == Pager_Mmap ||
+               after.counters[Metrics_PagesRead] - before.counters[Metrics_PagesRead] == 1);
+    }
+    checkHashRows(pager);
+    Destroy_Pager(pager);
+    unlink(dbFile);
+    unlink(metaFile);
+    unlink(walFile);
+    free(rows);
+    free(ret);
+    free(row);
+}
+
+void test_HashAccess() {
+    PagerConfig config;
+    Init_PagerConfig(&config);
+    runHashAccess("dbfile_hash", &config, false);
+
+    Init_PagerConfig(&config);
+    config.wal = true;
+    runHashAccess("dbfile_hash", &config, true);
+
+    Init_PagerConfig(&config);
+    config.format = Pager_PaxFormat;
+    runHashAccess("dbfile_hash", &config, false);
+
+    Init_PagerConfig(&config);
+    config.format   = Pager_VarFormat;
+    config.compress = true;
+    runHashAccess("dbfile_hash", &config, false);
+
+    Init_PagerConfig(&config);
+    config.storage     = Pager_Mmap;
+    config.mmapReserve = 1L << 30;
+    runHashAccess("dbfile_hash", &config, false);
+
+    Init_PagerConfig(&config);
+    config.access = Pager_HashAccess;
+    runConcurrentAccess("dbfile_hash", &config);
+    config.wal           = true;
+    config.groupCommitUs = 100;
+    runConcurrentAccess("dbfile_hash", &config);
+    printf("test_HashAccess passed.\n");
+}
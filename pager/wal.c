@@ -0,0 +1,312 @@
+#include "wal.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../includes/log.h"
+#include "../includes/metrics.h"
+
+#define WAL_BUFFER_SIZE (64 * 1024)
+
+PRIVATE uint32_t WalChecksum(WalRecord *record, const void *payload) {
+    uint32_t hash = 2166136261u;
+    const unsigned char *p = (const unsigned char *)&record->type;
+    size_t i;
+    for (i = 0; i < sizeof(WalRecord) - sizeof(record->checksum); i++) {
+        hash = (hash ^ p[i]) * 16777619u;
+    }
+    p = (const unsigned char *)payload;
+    for (i = 0; i < record->size; i++) {
+        hash = (hash ^ p[i]) * 16777619u;
+    }
+    return hash;
+}
+
+/* lsn在日志文件中的偏移量 */
+PRIVATE off_t WalOffset(Wal *wal, uint64_t lsn) {
+    return (off_t)(sizeof(WalHeader) + (lsn - wal->startLsn));
+}
+
+PRIVATE void WalWriteHeader(Wal *wal, int32_t pageCount) {
+    WalHeader header = {WAL_MAGIC, WAL_VERSION, wal->startLsn, pageCount, 0};
+    if (pwrite(wal->fd, &header, sizeof(WalHeader), 0) != sizeof(WalHeader)) {
+        LOG_ERROR("Failed to write wal header: %s", strerror(errno));
+    }
+}
+
+/**
+ * 打开日志文件，文件不存在时创建一个空的日志。
+ * 打开之后必须先调用一次 Wal_Replay，它会找到日志中最后一条完整的记录。
+ *
+ * @param groupCommitUs: see Wal.groupCommitUs
+ */
+TINYDB_API Wal *New_Wal(const char *file, int32_t groupCommitUs) {
+    Wal *wal = (Wal *)calloc(1, sizeof(Wal));
+    assert(wal != NULL);
+    wal->fd = open(file, O_RDWR | O_CREAT, 0644);
+    if (wal->fd == -1) {
+        EXIT_ERROR("Fail to open wal file.\n");
+    }
+    WalHeader header;
+    if (pread(wal->fd, &header, sizeof(WalHeader), 0) != sizeof(WalHeader) ||
+        header.magic != WAL_MAGIC || header.version != WAL_VERSION) {
+        wal->startLsn = 0;
+        WalWriteHeader(wal, -1);
+        if (ftruncate(wal->fd, sizeof(WalHeader)) == -1 || fdatasync(wal->fd) == -1) {
+            LOG_ERROR("Failed to create wal file: %s", strerror(errno));
+        }
+    } else {
+        wal->startLsn = header.startLsn;
+    }
+    wal->nextLsn          = wal->startLsn;
+    wal->flushedLsn       = wal->startLsn;
+    wal->checkpointLsn    = wal->startLsn;
+    wal->groupCommitUs    = groupCommitUs;
+    wal->activeCapacity   = WAL_BUFFER_SIZE;
+    wal->flushingCapacity = WAL_BUFFER_SIZE;
+    wal->active           = (char *)malloc(wal->activeCapacity);
+    wal->flushing         = (char *)malloc(wal->flushingCapacity);
+    assert(wal->active != NULL && wal->flushing != NULL);
+    pthread_mutex_init(&wal->mutex, NULL);
+    pthread_cond_init(&wal->cond, NULL);
+    return wal;
+}
+
+/* 关闭日志，调用者需要保证没有正在提交的事务 */
+TINYDB_API void Destroy_Wal(Wal *wal) {
+    assert(wal != NULL && !wal->syncing);
+    close(wal->fd);
+    pthread_mutex_destroy(&wal->mutex);
+    pthread_cond_destroy(&wal->cond);
+    free(wal->active);
+    free(wal->flushing);
+    free(wal);
+}
+
+/**
+ * 向batch追加一条日志记录。
+ * @return offset of the record in batch, lsn of the record is the lsn returned by Wal_Commit plus it
+ */
+TINYDB_API uint32_t Wal_BatchAppend(WalBatch *batch, uint32_t type, int32_t pageNum, const void *payload, uint32_t size) {
+    uint32_t need = batch->size + sizeof(WalRecord) + size;
+    if (need > batch->capacity) {
+        uint32_t cap = batch->capacity == 0 ? 4096 : batch->capacity;
+        while (cap < need) {
+            cap *= 2;
+        }
+        batch->data = (char *)realloc(batch->data, cap);
+        assert(batch->data != NULL);
+        batch->capacity = cap;
+    }
+    uint32_t offset   = batch->size;
+    WalRecord *record = (WalRecord *)(batch->data + offset);
+    record->type      = type;
+    record->pageNum   = pageNum;
+    record->size      = size;
+    memcpy(record + 1, payload, size);
+    record->checksum = WalChecksum(record, payload);
+    batch->size      = need;
+    return offset;
+}
+
+TINYDB_API void Wal_BatchFree(WalBatch *batch) {
+    free(batch->data);
+    batch->data     = NULL;
+    batch->size     = 0;
+    batch->capacity = 0;
+}
+
+/**
+ * 等待end之前的日志写入磁盘，调用者持有mutex。
+ *
+ * group commit: 第一个需要等待的线程成为leader，先等待groupCommitUs，让更多的事务进入active，
+ * 然后交换两个缓冲区，在不持有锁的情况下写入并fdatasync。
+ * 其他线程作为follower等待，只要leader写入的范围包含了自己的事务就可以返回，
+ * 所以一次fdatasync可以提交很多个事务。
+ */
+PRIVATE void WalSyncLocked(Wal *wal, uint64_t end) {
+    while (wal->flushedLsn < end) {
+        if (wal->syncing) {
+            pthread_cond_wait(&wal->cond, &wal->mutex);
+            continue;
+        }
+        wal->syncing = true;
+        if (wal->groupCommitUs > 0) {
+            struct timespec deadline;
+            clock_gettime(CLOCK_REALTIME, &deadline);
+            deadline.tv_nsec += (long)wal->groupCommitUs * 1000;
+            deadline.tv_sec += deadline.tv_nsec / 1000000000;
+            deadline.tv_nsec %= 1000000000;
+            while (pthread_cond_timedwait(&wal->cond, &wal->mutex, &deadline) != ETIMEDOUT) {
+            }
+        }
+        char *buffer          = wal->active;
+        size_t size           = wal->activeSize;
+        size_t capacity       = wal->activeCapacity;
+        uint64_t upto         = wal->nextLsn;
+        wal->active           = wal->flushing;
+        wal->activeCapacity   = wal->flushingCapacity;
+        wal->activeSize       = 0;
+        wal->flushing         = buffer;
+        wal->flushingCapacity = capacity;
+        off_t offset          = WalOffset(wal, upto - size);
+        pthread_mutex_unlock(&wal->mutex);
+
+        if (pwrite(wal->fd, buffer, size, offset) != (ssize_t)size || fdatasync(wal->fd) == -1) {
+            EXIT_ERROR("Failed to write wal.\n");
+        }
+        Metrics_Add(Metrics_WalBytes, size);
+        Metrics_Add(Metrics_WalSyncs, 1);
+
+        pthread_mutex_lock(&wal->mutex);
+        wal->flushedLsn = upto;
+        wal->syncing    = false;
+        wal->syncCount++;
+        pthread_cond_broadcast(&wal->cond);
+    }
+}
+
+/**
+ * 把batch连同一条commit记录追加到active，不等待写入磁盘。
+ * 追加的顺序就是事务的顺序，之后调用 Wal_Sync 等待它们写入磁盘。
+ *
+ * @param pageCount: page count of the data file after this transaction
+ * @param end: lsn after the commit record
+ * @return lsn of the first record in batch, batch is emptied
+ */
+TINYDB_API uint64_t Wal_Append(Wal *wal, WalBatch *batch, int32_t pageCount, uint64_t *end) {
+    Wal_BatchAppend(batch, Wal_CommitRecord, -1, &pageCount, sizeof(int32_t));
+
+    pthread_mutex_lock(&wal->mutex);
+    uint64_t lsn = wal->nextLsn;
+    size_t need  = wal->activeSize + batch->size;
+    if (need > wal->activeCapacity) {
+        while (wal->activeCapacity < need) {
+            wal->activeCapacity *= 2;
+        }
+        wal->active = (char *)realloc(wal->active, wal->activeCapacity);
+        assert(wal->active != NULL);
+    }
+    memcpy(wal->active + wal->activeSize, batch->data, batch->size);
+    wal->activeSize += batch->size;
+    wal->nextLsn += batch->size;
+    *end        = wal->nextLsn;
+    batch->size = 0;
+    pthread_mutex_unlock(&wal->mutex);
+    return lsn;
+}
+
+/* 等待end之前的日志写入磁盘，end超过已经追加的日志时只等待已经追加的日志 */
+TINYDB_API void Wal_Sync(Wal *wal, uint64_t end) {
+    pthread_mutex_lock(&wal->mutex);
+    WalSyncLocked(wal, end < wal->nextLsn ? end : wal->nextLsn);
+    pthread_mutex_unlock(&wal->mutex);
+}
+
+/* 把已经追加的日志全部写入磁盘，之后写回的页面不会早于它们的日志 */
+TINYDB_API void Wal_Flush(Wal *wal) {
+    pthread_mutex_lock(&wal->mutex);
+    WalSyncLocked(wal, wal->nextLsn);
+    pthread_mutex_unlock(&wal->mutex);
+}
+
+/**
+ * 把batch连同一条commit记录追加到日志，等到它们写入磁盘之后才返回。
+ *
+ * @param pageCount: page count of the data file after this transaction
+ * @return lsn of the first record in batch, batch is emptied
+ */
+TINYDB_API uint64_t Wal_Commit(Wal *wal, WalBatch *batch, int32_t pageCount) {
+    uint64_t end;
+    uint64_t lsn = Wal_Append(wal, batch, pageCount, &end);
+    Wal_Sync(wal, end);
+    return lsn;
+}
+
+/**
+ * 按顺序重做日志中所有已提交的事务。最后一个commit记录之后的记录属于没有提交的事务，
+ * 或者在写入时被截断，它们会被丢弃，之后的日志从这里继续追加。
+ *
+ * @param pageCount: page count of the data file after the last committed transaction,
+ *                   -1 if it is unknown
+ * @return number of transactions replayed
+ */
+TINYDB_API int32_t Wal_Replay(Wal *wal, WalRedo redo, void *arg, int32_t *pageCount) {
+    WalHeader header;
+    struct stat st;
+    if (pread(wal->fd, &header, sizeof(WalHeader), 0) != sizeof(WalHeader) || fstat(wal->fd, &st) == -1) {
+        EXIT_ERROR("Failed to read wal.\n");
+    }
+    *pageCount  = header.pageCount;
+    size_t size = st.st_size > (off_t)sizeof(WalHeader) ? st.st_size - sizeof(WalHeader) : 0;
+    char *log   = (char *)malloc(size + 1);
+    assert(log != NULL);
+    if (pread(wal->fd, log, size, sizeof(WalHeader)) != (ssize_t)size) {
+        EXIT_ERROR("Failed to read wal.\n");
+    }
+
+    // 先找出最后一个完整的commit记录
+    size_t pos = 0, committed = 0;
+    while (pos + sizeof(WalRecord) <= size) {
+        WalRecord *record = (WalRecord *)(log + pos);
+        if (pos + sizeof(WalRecord) + record->size > size || record->checksum != WalChecksum(record, record + 1)) {
+            break;
+        }
+        pos += sizeof(WalRecord) + record->size;
+        if (record->type == Wal_CommitRecord) {
+            committed = pos;
+        }
+    }
+    int32_t txns = 0;
+    for (pos = 0; pos < committed;) {
+        WalRecord *record = (WalRecord *)(log + pos);
+        if (record->type == Wal_CommitRecord) {
+            memcpy(pageCount, record + 1, sizeof(int32_t));
+            txns++;
+        } else {
+            redo(arg, wal->startLsn + pos, record, record + 1);
+        }
+        pos += sizeof(WalRecord) + record->size;
+    }
+    free(log);
+
+    wal->nextLsn    = wal->startLsn + committed;
+    wal->flushedLsn = wal->nextLsn;
+    if (committed < size && ftruncate(wal->fd, sizeof(WalHeader) + committed) == -1) {
+        LOG_ERROR("Failed to truncate wal: %s", strerror(errno));
+    }
+    return txns;
+}
+
+/**
+ * checkpoint: 数据文件已经包含了日志中所有的修改，清空日志。
+ * 之后第一次修改每个页面时，都会先记录整个页面的镜像，防止页面在写入时被截断。
+ */
+TINYDB_API void Wal_Truncate(Wal *wal, int32_t pageCount) {
+    pthread_mutex_lock(&wal->mutex);
+    assert(!wal->syncing && wal->activeSize == 0);
+    // 先截断再写文件头，否则崩溃之后旧的记录会被当作新startLsn之后的记录重做
+    if (ftruncate(wal->fd, sizeof(WalHeader)) == -1 || fdatasync(wal->fd) == -1) {
+        LOG_ERROR("Failed to truncate wal: %s", strerror(errno));
+    }
+    wal->startLsn      = wal->nextLsn;
+    wal->checkpointLsn = wal->nextLsn;
+    WalWriteHeader(wal, pageCount);
+    fdatasync(wal->fd);
+    pthread_mutex_unlock(&wal->mutex);
+}
+
+/* 日志中checkpoint之后的字节数 */
+TINYDB_API uint64_t Wal_Size(Wal *wal) {
+    pthread_mutex_lock(&wal->mutex);
+    uint64_t size = wal->nextLsn - wal->startLsn;
+    pthread_mutex_unlock(&wal->mutex);
+    return size;
+}
@@ -0,0 +1,106 @@
+#ifndef PAGE_WAL_H
+#define PAGE_WAL_H
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "../includes/global.h"
+
+#define WAL_FILE_SUFFIX "-wal"
+#define WAL_MAGIC 0x4C574454 /* "TDWL" */
+#define WAL_VERSION 1
+
+/* 日志记录的类型 */
+typedef enum {
+    Wal_InsertRecord    = 1, /* payload is the inserted Row */
+    Wal_UpdateRecord    = 2, /* payload is the new Row */
+    Wal_DeleteRecord    = 3, /* payload is the deleted KEY */
+    Wal_ImageRecord     = 4, /* payload is the whole page */
+    Wal_CommitRecord    = 5, /* payload is the page count after the transaction, pageNum is -1 */
+    Wal_VarInsertRecord = 6, /* payload is the inserted VarRow, Pager_VarFormat only */
+    Wal_VarUpdateRecord = 7  /* payload is the new VarRow, Pager_VarFormat only */
+} WalRecordType;
+
+/**
+ * 日志文件的文件头，之后是连续的日志记录。
+ * startLsn: lsn of the first record, a checkpoint truncates the log and moves it forward
+ * pageCount: page count of the data file when the log was truncated
+ */
+typedef struct WalHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t startLsn;
+    int32_t pageCount;
+    int32_t padding;
+} WalHeader;
+
+/**
+ * 每条日志记录的记录头，之后紧接着size字节的payload。
+ * 日志记录的lsn是它在日志中的逻辑偏移量，checkpoint之后继续递增，不会重复。
+ * checksum: FNV-1a of type, pageNum, size and the payload, a torn record at the tail fails it
+ */
+typedef struct WalRecord {
+    uint32_t checksum;
+    uint32_t type;
+    int32_t pageNum;
+    uint32_t size;
+} WalRecord;
+
+/**
+ * 一次操作产生的日志记录，先在内存中攒好，由 Wal_Commit 连同commit记录一起原子地追加到日志。
+ * 同一个事务的记录在日志中总是连续的，redo时只重做有commit记录的事务。
+ */
+typedef struct WalBatch {
+    char *data;
+    uint32_t size;
+    uint32_t capacity;
+} WalBatch;
+
+/**
+ * 日志缓冲区有两个：追加写入active，leader把flushing写入文件时，其他线程可以继续追加。
+ * nextLsn: lsn of the next record appended to active
+ * flushedLsn: records before it are on disk
+ * checkpointLsn: lsn of the last checkpoint, a page not logged since then is logged as a whole image
+ * groupCommitUs: the leader waits this long for more transactions before fdatasync
+ * syncCount: number of fdatasync calls, for statistics
+ */
+typedef struct Wal {
+    int fd;
+    uint64_t startLsn;
+    uint64_t nextLsn;
+    uint64_t flushedLsn;
+    uint64_t checkpointLsn;
+    int32_t groupCommitUs;
+    char *active;
+    size_t activeSize;
+    size_t activeCapacity;
+    char *flushing;
+    size_t flushingCapacity;
+    bool syncing;
+    uint64_t syncCount;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+} Wal;
+
+/**
+ * 重做一条日志记录，由 Wal_Replay 按日志顺序调用。
+ */
+typedef void (*WalRedo)(void *arg, uint64_t lsn, WalRecord *record, const void *payload);
+
+TINYDB_API Wal *New_Wal(const char *file, int32_t groupCommitUs);
+TINYDB_API void Destroy_Wal(Wal *wal);
+
+TINYDB_API uint32_t Wal_BatchAppend(WalBatch *batch, uint32_t type, int32_t pageNum, const void *payload, uint32_t size);
+TINYDB_API void Wal_BatchFree(WalBatch *batch);
+
+TINYDB_API uint64_t Wal_Append(Wal *wal, WalBatch *batch, int32_t pageCount, uint64_t *end);
+TINYDB_API void Wal_Sync(Wal *wal, uint64_t end);
+TINYDB_API void Wal_Flush(Wal *wal);
+TINYDB_API uint64_t Wal_Commit(Wal *wal, WalBatch *batch, int32_t pageCount);
+TINYDB_API int32_t Wal_Replay(Wal *wal, WalRedo redo, void *arg, int32_t *pageCount);
+TINYDB_API void Wal_Truncate(Wal *wal, int32_t pageCount);
+TINYDB_API uint64_t Wal_Size(Wal *wal);
+
+#endif